@@ -46,12 +46,13 @@ union TWordAndByteArray
 //-----------------------------------------------------------------------------
 // Tables necessary dor decompression
 
-static int64_t Table1503F120[] =
+// The original table contained 0xFFFFFFFF which is -1 only if "long" has 32 bits.
+static long Table1503F120[] =
 {
-    0xFFFFFFFF, 0x00000000, 0xFFFFFFFF, 0x00000004, 0xFFFFFFFF, 0x00000002, 0xFFFFFFFF, 0x00000006,
-    0xFFFFFFFF, 0x00000001, 0xFFFFFFFF, 0x00000005, 0xFFFFFFFF, 0x00000003, 0xFFFFFFFF, 0x00000007,
-    0xFFFFFFFF, 0x00000001, 0xFFFFFFFF, 0x00000005, 0xFFFFFFFF, 0x00000003, 0xFFFFFFFF, 0x00000007,
-    0xFFFFFFFF, 0x00000002, 0xFFFFFFFF, 0x00000004, 0xFFFFFFFF, 0x00000006, 0xFFFFFFFF, 0x00000008
+    -1, 0x00000000, -1, 0x00000004, -1, 0x00000002, -1, 0x00000006,
+    -1, 0x00000001, -1, 0x00000005, -1, 0x00000003, -1, 0x00000007,
+    -1, 0x00000001, -1, 0x00000005, -1, 0x00000003, -1, 0x00000007,
+    -1, 0x00000002, -1, 0x00000004, -1, 0x00000006, -1, 0x00000008
 };
 
 static long step_table[] =
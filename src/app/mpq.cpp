@@ -18,7 +18,10 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#include <algorithm>
 #include <iostream>
+#include <mutex>
+#include <set>
 
 #include "../mpq.hpp"
 #include "../utilities.hpp"
@@ -34,74 +37,202 @@ using namespace wc3lib::mpq;
 namespace
 {
 
-void extract(Archive &mpq, std::string &entry, const boost::program_options::variables_map &vm)
+/*
+ * A single file which is extracted by one of the worker threads.
+ */
+struct Extraction
 {
-	mpq::File file = mpq.findFile(entry);
+	std::string entry;
+	mpq::File file;
+	boost::filesystem::path directoryPath;
+	boost::filesystem::path filePath;
+};
 
-	if (!file.isValid())
+typedef std::vector<Extraction> Extractions;
+
+bool extractionOffsetLess(const Extraction &first, const Extraction &second)
+{
+	return first.file.block()->largeOffset() < second.file.block()->largeOffset();
+}
+
+/*
+ * Extracts all files \p entries from \p mpq using up to \p jobs threads.
+ * All output directories are created at once before the extraction.
+ * The files are extracted in the order of their offsets in the archive that the archive is read sequentially even if several threads are used.
+ */
+void extract(Archive &mpq, const std::vector<std::string> &entries, const boost::program_options::variables_map &vm, unsigned jobs)
+{
+	// output directory is archive's basename in the current working directory (name without extension)
+	const boost::filesystem::path outputDirectoryPath = boost::filesystem::current_path() / mpq.path().stem();
+	Extractions extractions;
+	extractions.reserve(entries.size());
+	std::set<boost::filesystem::path> directoryPaths;
+
+	BOOST_FOREACH(std::vector<std::string>::const_reference entry, entries)
 	{
-		std::cerr << boost::format(_("Error occured while extracting file \"%1%\": File doesn't exist.")) % entry << std::endl;
+		Extraction extraction;
+		extraction.entry = entry;
+		extraction.file = mpq.findFile(entry);
 
-		return;
-	}
+		if (!extraction.file.isValid())
+		{
+			std::cerr << boost::format(_("Error occured while extracting file \"%1%\": File doesn't exist.")) % entry << std::endl;
 
-	/*
-	 * Always use the first occurence of directory as dir path.
-	 * Otherwise all files would use different dir names which are case sensitively listed in the (listfile).
-	 */
-	string dirPath = Listfile::dirPath(entry);
+			continue;
+		}
 
-#ifdef DEBUG
-	std::string oldEntry = entry;
-#endif
+		/*
+		 * Always use the first occurence of directory as dir path.
+		 * Otherwise all files would use different dir names which are case sensitively listed in the (listfile).
+		 */
+		string dirPath = Listfile::dirPath(entry);
+		string nativeEntry = entry;
 
 #ifdef UNIX
-	// (listfile) entries usually have Windows path format
-	Listfile::toNativePath(entry);
-	Listfile::toNativePath(dirPath);
+		// (listfile) entries usually have Windows path format
+		Listfile::toNativePath(nativeEntry);
+		Listfile::toNativePath(dirPath);
 #endif
-	// output directory is archive's basename in the current working directory (name without extension)
-	boost::filesystem::path outputDirectoryPath = boost::filesystem::current_path() / mpq.path().stem();
-	boost::filesystem::path entryPath = outputDirectoryPath / boost::filesystem::path(dirPath);
+		extraction.directoryPath = outputDirectoryPath / boost::filesystem::path(dirPath);
+		/*
+		 * Now construct the whole file path with the file name from the directory path.
+		 */
+		extraction.filePath = extraction.directoryPath / boost::filesystem::path(nativeEntry).filename();
+		directoryPaths.insert(extraction.directoryPath);
+		extractions.push_back(extraction);
+	}
+
+	/*
+	 * Create all directories at once instead of checking them for every single file.
+	 * Directories which existed before are only used with --overwrite.
+	 */
+	std::set<boost::filesystem::path> invalidDirectoryPaths;
 
-	if (!vm.count("overwrite") && boost::filesystem::exists(entryPath))
+	BOOST_FOREACH(std::set<boost::filesystem::path>::const_reference directoryPath, directoryPaths)
 	{
-		std::cerr << boost::format(_("Error occured while extracting file \"%1%\": \"Directory exists %2% already (use --overwrite to create it anyway\".")) % entry % entryPath << std::endl;
+		if (boost::filesystem::exists(directoryPath))
+		{
+			if (!vm.count("overwrite"))
+			{
+				std::cerr << boost::format(_("Error occured while extracting files into directory %1%: \"Directory exists already (use --overwrite to extract files into it anyway\".")) % directoryPath << std::endl;
+				invalidDirectoryPaths.insert(directoryPath);
+			}
+			else if (!boost::filesystem::is_directory(directoryPath))
+			{
+				std::cerr << boost::format(_("Error occured while extracting files: Unable to create output directory %1%.")) % directoryPath << std::endl;
+				invalidDirectoryPaths.insert(directoryPath);
+			}
 
-		return;
-	}
+			continue;
+		}
 
-	if (!boost::filesystem::is_directory(entryPath) && !boost::filesystem::create_directories(entryPath))
-	{
-		std::cerr << boost::format(_("Error occured while extracting file \"%1%\": Unable to create output directory %2%.")) % entry %
-		entryPath << std::endl;
+		boost::system::error_code errorCode;
+		boost::filesystem::create_directories(directoryPath, errorCode);
 
-		return;
+		if (errorCode)
+		{
+			std::cerr << boost::format(_("Error occured while extracting files: Unable to create output directory %1%.")) % directoryPath << std::endl;
+			invalidDirectoryPaths.insert(directoryPath);
+		}
 	}
 
-	/*
-	 * Now construct the whole file path with the file name from the directory path.
-	 */
-	entryPath /= boost::filesystem::path(entry).filename();
+	Extractions validExtractions;
+	validExtractions.reserve(extractions.size());
 
-	if (!vm.count("overwrite") && boost::filesystem::exists(entryPath))
+	BOOST_FOREACH(Extractions::const_reference extraction, extractions)
 	{
-		std::cerr << boost::format(_("Error occured while extracting file \"%1%\": \"File exists already (use --overwrite to extract it anyway\".")) % entry << std::endl;
+		if (invalidDirectoryPaths.find(extraction.directoryPath) != invalidDirectoryPaths.end())
+		{
+			continue;
+		}
+
+		if (!vm.count("overwrite") && boost::filesystem::exists(extraction.filePath))
+		{
+			std::cerr << boost::format(_("Error occured while extracting file \"%1%\": \"File exists already (use --overwrite to extract it anyway\".")) % extraction.entry << std::endl;
 
-		return;
+			continue;
+		}
+
+		validExtractions.push_back(extraction);
 	}
 
-	ofstream out(entryPath, std::ios::out | std::ios::binary);
+	std::sort(validExtractions.begin(), validExtractions.end(), extractionOffsetLess);
+	std::mutex errorMutex;
 
-	try
+	parallelFor(validExtractions.size(), jobs, [&](std::size_t index)
 	{
-		checkStream(out);
-		file.decompress(out);
-	}
-	catch (const Exception &exception)
+		const Extraction &extraction = validExtractions[index];
+
+		try
+		{
+			ofstream out(extraction.filePath, std::ios::out | std::ios::binary);
+			checkStream(out);
+			mpq::File file = extraction.file;
+			file.decompress(out);
+		}
+		catch (const Exception &exception)
+		{
+			std::lock_guard<std::mutex> lock(errorMutex);
+			std::cerr << boost::format(_("Error occured while extracting file \"%1%\": \"%2%\".")) % extraction.entry % exception.what() << std::endl;
+		}
+	});
+}
+
+/*
+ * A file from the hard disk together with its path in the archive.
+ */
+struct ImportFile
+{
+	boost::filesystem::path filePath;
+	boost::filesystem::path entry;
+};
+
+typedef std::vector<ImportFile> ImportFiles;
+
+/*
+ * Collects all regular files of \p filePaths and of the directories among them.
+ * Files of a directory are stored relative to the directory.
+ * Other files keep their relative path unless it is absolute or leaves the current directory. Then only their file name is kept.
+ */
+ImportFiles importFiles(const std::vector<boost::filesystem::path> &filePaths)
+{
+	ImportFiles result;
+
+	BOOST_FOREACH(const boost::filesystem::path &filePath, filePaths)
 	{
-		std::cerr << boost::format(_("Error occured while extracting file \"%1%\": \"%2%\".")) % entry % exception.what() << std::endl;
+		if (boost::filesystem::is_directory(filePath))
+		{
+			for (boost::filesystem::recursive_directory_iterator iterator(filePath); iterator != boost::filesystem::recursive_directory_iterator(); ++iterator)
+			{
+				if (boost::filesystem::is_regular_file(iterator->path()))
+				{
+					ImportFile importFile;
+					importFile.filePath = iterator->path();
+					importFile.entry = iterator->path().lexically_relative(filePath);
+					result.push_back(importFile);
+				}
+			}
+		}
+		else if (boost::filesystem::is_regular_file(filePath))
+		{
+			ImportFile importFile;
+			importFile.filePath = filePath;
+			importFile.entry = filePath.lexically_normal();
+
+			if (importFile.entry.has_root_path() || *importFile.entry.begin() == "..")
+			{
+				importFile.entry = filePath.filename();
+			}
+
+			result.push_back(importFile);
+		}
+		else
+		{
+			std::cerr << boost::format(_("Error on importing file %1%.")) % filePath << std::endl;
+		}
 	}
+
+	return result;
 }
 
 }
@@ -121,14 +252,19 @@ int main(int argc, char *argv[])
 	Strings listfileStrings;
 	Strings archiveStrings;
 	Strings fileStrings;
+	Strings wordlistStrings;
+	Strings patterns;
 	Paths listfiles;
 	Paths archivePaths;
 	Paths filePaths;
 	boost::filesystem::path dir;
+	boost::filesystem::path patch;
 	uint32 hashes = 0;
 	uint32 blocks = 0;
 	uint32 sectorSize = 0;
 	uint32 startPosition = 0;
+	unsigned jobs = 0;
+	std::string compression;
 
 	const boost::program_options::command_line_style::style_t pstyle = boost::program_options::command_line_style::style_t(
 	boost::program_options::command_line_style::unix_style
@@ -142,9 +278,11 @@ int main(int argc, char *argv[])
 	// options
 	("human-readable", boost::program_options::value<bool>()->default_value(true), _("Shows output sizes in an human-readable format."))
 	("decimal,d", _("Shows decimal sizes (factor 1000 not 1024)"))
-	("format,F", boost::program_options::value<std::string>(&format)->default_value("1"), _("Selects the format of the created MPQ archive and modified files: <format:format:format>\nHere's a list of valid expressions:\n* \"1\"\n* \"2\"\n* \"listfile\"\n* \"attributes\""))
+	("format,F", boost::program_options::value<std::string>(&format)->default_value("1"), _("Selects the format of the created MPQ archive and modified files: <format:format:format>\nHere's a list of valid expressions:\n* \"1\"\n* \"2\"\n* \"3\" (with HET and BET tables)\n* \"4\" (with HET and BET tables)\n* \"listfile\"\n* \"attributes\""))
 	("list-files,L", boost::program_options::value<Strings>(&listfileStrings), _("Uses given listfiles to detect file paths of MPQ archives."))
-	("overwrite", _("Overwrites existing files and directories when creating or extracting files."))
+	("wordlist,W", boost::program_options::value<Strings>(&wordlistStrings), _("Uses the words of the given files (separated like listfile entries) to recover file paths."))
+	("pattern,P", boost::program_options::value<Strings>(&patterns), _("Uses the given patterns to recover file paths. Every '*' is replaced by every word of the wordlists. If no pattern is given the file names of Warcraft III maps and some common patterns are used."))
+	("overwrite", _("Overwrites existing files and directories when creating, adding or extracting files."))
 	("remove-files", _("Removes files/archives after adding them to the MPQ archives."))
 	("interactive", _("Asks for confirmation for every action."))
 #ifdef DEBUG
@@ -156,15 +294,21 @@ int main(int argc, char *argv[])
 	("blocks",  boost::program_options::value<uint32>(&blocks)->default_value(4096), _("Sets the number of block entries when creating an archive."))
 	("sectorsize",  boost::program_options::value<uint32>(&sectorSize)->default_value(4096), _("Sets the size of file sectors in bytes when creating an archive."))
 	("startposition",  boost::program_options::value<uint32>(&startPosition)->default_value(0), _("Sets the start offset in the the archive file when creating one."))
+	("compression,z",  boost::program_options::value<std::string>(&compression)->default_value("none"), _("Sets the compression of added files when creating an archive: <none|zlib|bzip2|pkware|huffman|lzma|sparse|auto>. \"auto\" selects the compression for every file and is only supported when adding files."))
+	("patch",  boost::program_options::value<boost::filesystem::path>(&patch), _("Writes all files which have been added or changed in the second archive into a new patch archive when finding differences between archives. The patch archive uses the format, sector size and compression of created archives."))
+	("jobs,j",  boost::program_options::value<unsigned>(&jobs)->default_value(0), _("Sets the number of threads used for compressing and extracting files. 0 uses all available cores."))
 
 	// operations
-	("add,a", _("Adds files of MPQ archives or from hard disk to another archive."))
+	("add,a", _("Adds the files specified with -f from hard disk to MPQ archives. Directories are added recursively."))
 	("create,c", _("Creates new MPQ archives."))
-	("diff,d", _("Finds differences between archives."))
+	("diff", _("Finds the files which differ between two archives. The files are compared by their sizes, the checksums of the \"(attributes)\" files and their raw data and are only decompressed if these checks are inconclusive. Added, changed and removed files are listed with A, M and D."))
 	("list,t", _("Lists all contained files of all read MPQ archives."))
-	("update,u", _("Only append files that are newer than the existing archives."))
+	("update,u", _("Only adds files which are missing in the archives or whose contents differ when adding files. Changed files are replaced in place and their previous space is reused."))
 	("extract,x", _("Extract files from MPQ archives. If no files are specified via -f all files are extracted from given MPQ archives."))
 	("delete", _("Deletes files from MPQ archives."))
+	("compact", _("Rewrites MPQ archives without the space of deleted files. Encrypted files which have to be moved are found via the archive's listfile and the listfiles specified with -L."))
+	("recover-listfile", _("Recovers the file paths of MPQ archives by hashing the patterns specified with -P with the words of the wordlists specified with -W as well as the entries of the listfiles specified with -L. The recovered listfile is written to the standard output."))
+	("verify", _("Verifies all files of MPQ archives by decompressing them and comparing their CRC32 and MD5 checksums with the ones of the archive's \"(attributes)\" file. Encrypted files are found via the archive's listfile and the listfiles specified with -L."))
 	("info,i", _("Shows some basic information about all read MPQ archives. If any files are specified via -f their information will be shown as well."))
 
 	// input
@@ -223,6 +367,14 @@ int main(int argc, char *argv[])
 		{
 			mpqFormat = wc3lib::mpq::Archive::Format::Mpq2;
 		}
+		else if (format == "3")
+		{
+			mpqFormat = wc3lib::mpq::Archive::Format::Mpq3;
+		}
+		else if (format == "4")
+		{
+			mpqFormat = wc3lib::mpq::Archive::Format::Mpq4;
+		}
 		else
 		{
 			std::cerr << boost::format(_("Unknown MPQ format: %1%.")) % format << std::endl;
@@ -231,6 +383,49 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	Sector::Compression sectorCompression = Sector::Compression::Uncompressed;
+	const bool autoCompression = compression == "auto";
+
+	if (autoCompression)
+	{
+		if (vm.count("create") || !patch.empty())
+		{
+			std::cerr << _("The compression \"auto\" is only supported when adding files.") << std::endl;
+
+			return EXIT_FAILURE;
+		}
+	}
+	else if (compression == "zlib")
+	{
+		sectorCompression = Sector::Compression::Deflated;
+	}
+	else if (compression == "bzip2")
+	{
+		sectorCompression = Sector::Compression::Bzip2Compressed;
+	}
+	else if (compression == "pkware")
+	{
+		sectorCompression = Sector::Compression::Imploded;
+	}
+	else if (compression == "huffman")
+	{
+		sectorCompression = Sector::Compression::Huffman;
+	}
+	else if (compression == "lzma")
+	{
+		sectorCompression = Sector::Compression::Lzma;
+	}
+	else if (compression == "sparse")
+	{
+		sectorCompression = Sector::Compression::Sparse;
+	}
+	else if (compression != "none")
+	{
+		std::cerr << boost::format(_("Unknown compression: %1%.")) % compression << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
 	// WORKAROUND
 	listfiles.resize(listfileStrings.size());
 	listfiles.assign(listfileStrings.begin(), listfileStrings.end());
@@ -266,9 +461,10 @@ int main(int argc, char *argv[])
 			continue;
 		}
 
-		const string::size_type size = (string::size_type)(endPosition(in)) + 1;
-		string content(size, '0');
-		in.read(&content[0], size);
+		string content((string::size_type)(endPosition(in)), '\0');
+		in.read(&content[0], content.size());
+		// text mode might read less characters than the file has bytes
+		content.resize(in.gcount());
 		Listfile::Entries entries = Listfile::entries(content);
 
 		BOOST_FOREACH(Listfile::Entries::const_reference entry, entries)
@@ -277,6 +473,27 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	Listfile::Entries words;
+
+	BOOST_FOREACH(Strings::const_reference wordlist, wordlistStrings)
+	{
+		ifstream in(wordlist, std::ios::in);
+
+		if (!in)
+		{
+			std::cerr << boost::format(_("Unable to open wordlist %1%.")) % wordlist << std::endl;
+
+			continue;
+		}
+
+		string content((string::size_type)(endPosition(in)), '\0');
+		in.read(&content[0], content.size());
+		// text mode might read less characters than the file has bytes
+		content.resize(in.gcount());
+		Listfile::Entries entries = Listfile::entries(content);
+		words.insert(words.end(), entries.begin(), entries.end());
+	}
+
 	if (archivePaths.empty())
 	{
 		std::cerr << _("Missing archive arguments.") << std::endl;
@@ -385,38 +602,131 @@ int main(int argc, char *argv[])
 				continue;
 			}
 
+			/*
+			 * All files are collected first and written at once by the builder which is much faster than adding them one by one.
+			 */
+			try
+			{
+				ArchiveBuilder builder(mpqFormat, sectorSize);
+				builder.setHashTableEntries(hashes);
+				builder.setBlockTableEntries(blocks);
+				builder.setThreads(jobs);
+
+				// import all specified files on creation
+				BOOST_FOREACH(ImportFiles::const_reference importFile, importFiles(filePaths))
+				{
+					// TODO allow setting flags for each file
+					builder.importFile(importFile.entry, importFile.filePath, sectorCompression);
+				}
+
+				builder.write(path, startPosition);
+			}
+			catch (wc3lib::Exception &exception)
+			{
+				std::cerr << boost::format(_("Error occured while creating file %1%: \"%2%\"")) % path % exception.what() << std::endl;
+
+				continue;
+			}
+		}
+	}
+
+	if (vm.count("add"))
+	{
+		/*
+		 * All files are read first and added at once that they are compressed in parallel and the tables are written only once.
+		 */
+		ImportFiles files;
+		std::vector<std::vector<byte> > contents;
+
+		BOOST_FOREACH(ImportFiles::const_reference file, importFiles(filePaths))
+		{
+			ifstream in(file.filePath, std::ios::in | std::ios::binary);
+			std::vector<byte> content(boost::filesystem::file_size(file.filePath));
+
+			// a file which could not be read completely is not added at all
+			if (!in || (!content.empty() && !in.read(content.data(), content.size())))
+			{
+				std::cerr << boost::format(_("Error on importing file %1%.")) % file.filePath << std::endl;
+
+				continue;
+			}
+
+			files.push_back(file);
+			contents.push_back(content);
+		}
+
+		BOOST_FOREACH(Paths::const_reference path, archivePaths)
+		{
+			if (!boost::filesystem::is_regular_file(path))
+			{
+				std::cerr << boost::format(_("File %1% does not seem to be a regular file and will be skipped.")) % path << std::endl;
+
+				continue;
+			}
+
 			boost::scoped_ptr<Archive> mpq(new Archive());
 
 			try
 			{
-				mpq->create(path, hashes, blocks, mpqFormat, sectorSize, startPosition);
+				mpq->open(path);
+				mpq->setThreads(jobs);
+				Archive::NewFiles newFiles;
 
-				// import all specified files on creation
-				BOOST_FOREACH(Paths::reference entry, filePaths)
+				for (std::size_t i = 0; i < files.size(); ++i)
 				{
-					ifstream in(entry);
+					string entry = files[i].entry.string();
+					Listfile::toListfileEntry(entry);
+					File existingFile = mpq->findFile(entry);
 
-					if (!in)
+					if (existingFile.isValid())
 					{
-						std::cerr << boost::format(_("Error on importing file %1%.")) % entry << std::endl;
-
-						continue;
+						if (vm.count("update"))
+						{
+							stringstream sstream;
+							existingFile.decompress(sstream);
+							const string existingContent = sstream.str();
+
+							if (existingContent.size() == contents[i].size() && std::equal(existingContent.begin(), existingContent.end(), contents[i].begin()))
+							{
+								continue;
+							}
+						}
+						else if (!vm.count("overwrite"))
+						{
+							std::cerr << boost::format(_("File %1% does already exist in archive %2%.")) % entry % path << std::endl;
+
+							continue;
+						}
+
+						// the existing file is replaced in place
 					}
 
-					const uint64 dataSize = std::streamoff(endPosition(in)) + 1;
-					boost::scoped_array<byte> data(new byte[dataSize]);
-					in.read(data.get(), dataSize);
-					in.close();
+					newFiles.push_back(Archive::NewFile(entry, contents[i].data(), contents[i].size(), sectorCompression));
+					newFiles.back().autoCompression = autoCompression;
+				}
 
-					// TODO allow setting flags for each file
-					mpq->addFile(entry, data.get(), dataSize);
+				mpq->addFiles(newFiles);
+
+				if (autoCompression)
+				{
+					BOOST_FOREACH(Archive::NewFiles::const_reference newFile, newFiles)
+					{
+						if (newFile.compressionLevel == Sector::defaultCompressionLevel)
+						{
+							std::cout << boost::format(_("%1%: %2%")) % newFile.path.string() % CompressionSelection::name(newFile.compression) << std::endl;
+						}
+						else
+						{
+							std::cout << boost::format(_("%1%: %2% (level %3%)")) % newFile.path.string() % CompressionSelection::name(newFile.compression) % newFile.compressionLevel << std::endl;
+						}
+					}
 				}
+
+				std::cout << boost::format(_("Added %1% files to archive %2%.")) % newFiles.size() % path << std::endl;
 			}
 			catch (wc3lib::Exception &exception)
 			{
-				std::cerr << boost::format(_("Error occured while creating file %1%: \"%2%\"")) % path % exception.what() << std::endl;
-
-				continue;
+				std::cerr << boost::format(_("Error occured while adding files to archive %1%: \"%2%\"")) % path % exception.what() << std::endl;
 			}
 		}
 	}
@@ -436,7 +746,8 @@ int main(int argc, char *argv[])
 
 			try
 			{
-				mpq->open(path);
+				// the files are extracted by several threads directly from the mapped archive
+				mpq->open(path, true);
 			}
 			catch (wc3lib::Exception &exception)
 			{
@@ -445,8 +756,6 @@ int main(int argc, char *argv[])
 				continue;
 			}
 
-			std::set<boost::filesystem::path> newlyCreatedDirsForExtraction;
-
 			if (filePaths.empty())
 			{
 				if (mpq->containsListfileFile())
@@ -472,21 +781,272 @@ int main(int argc, char *argv[])
 				 */
 				listfileEntries = Listfile::caseSensitiveFileEntries(Listfile::existingEntries(listfileEntries, *mpq));
 
-				BOOST_FOREACH(Listfile::Entries::reference entry, listfileEntries)
-				{
-					extract(*mpq, entry, vm);
-				}
+				extract(*mpq, listfileEntries, vm, jobs);
 			}
 			else
 			{
+				std::vector<std::string> entries;
+
 				BOOST_FOREACH(Paths::reference entry, filePaths)
 				{
-					string stringEntry = entry.string();
-					extract(*mpq, stringEntry, vm);
+					entries.push_back(entry.string());
+				}
+
+				extract(*mpq, entries, vm, jobs);
+			}
+		}
+	}
+
+	if (vm.count("compact"))
+	{
+		BOOST_FOREACH(Paths::const_reference path, archivePaths)
+		{
+			if (!boost::filesystem::is_regular_file(path))
+			{
+				std::cerr << boost::format(_("File %1% does not seem to be a regular file and will be skipped.")) % path << std::endl;
+
+				continue;
+			}
+
+			boost::scoped_ptr<Archive> mpq(new Archive());
+
+			try
+			{
+				mpq->open(path);
+				const uintmax_t oldSize = boost::filesystem::file_size(path);
+				mpq->compact(listfileEntries);
+				const uintmax_t newSize = boost::filesystem::file_size(path);
+
+				std::cout << boost::format(_("Compacted archive %1% from %2% to %3%.")) % path % sizeString(oldSize, vm.count("human-readable"), vm.count("decimal")) % sizeString(newSize, vm.count("human-readable"), vm.count("decimal")) << std::endl;
+			}
+			catch (wc3lib::Exception &exception)
+			{
+				std::cerr << boost::format(_("Error occured while compacting file %1%: \"%2%\"")) % path % exception.what() << std::endl;
+			}
+		}
+	}
+
+	if (vm.count("diff"))
+	{
+		if (archivePaths.size() != 2)
+		{
+			std::cerr << _("Finding differences requires exactly two archives.") << std::endl;
+
+			return EXIT_FAILURE;
+		}
+
+		try
+		{
+			Archive oldArchive;
+			oldArchive.open(archivePaths[0], true);
+			Archive newArchive;
+			newArchive.open(archivePaths[1], true);
+			ArchiveDiff diff;
+			diff.setThreads(jobs);
+			const ArchiveDiff::Entries entries = diff.diff(oldArchive, newArchive, listfileEntries);
+			std::size_t added = 0;
+			std::size_t changed = 0;
+			std::size_t removed = 0;
+			std::size_t decompressed = 0;
+
+			BOOST_FOREACH(ArchiveDiff::Entries::const_reference entry, entries)
+			{
+				const File &file = entry.newFile.isValid() ? entry.newFile : entry.oldFile;
+				const std::string name = entry.path.empty() ? (boost::format(_("<block %1%>")) % file.block()->index()).str() : entry.path;
+
+				if (entry.check == ArchiveDiff::Check::Content)
+				{
+					++decompressed;
+				}
+
+				switch (entry.status)
+				{
+					case ArchiveDiff::Status::Added:
+						std::cout << boost::format(_("A %1%")) % name << std::endl;
+						++added;
+
+						break;
+
+					case ArchiveDiff::Status::Removed:
+						std::cout << boost::format(_("D %1%")) % name << std::endl;
+						++removed;
+
+						break;
+
+					case ArchiveDiff::Status::Changed:
+						if (entry.error.empty())
+						{
+							std::cout << boost::format(_("M %1%")) % name << std::endl;
+						}
+						else
+						{
+							std::cout << boost::format(_("M %1% (%2%)")) % name % entry.error << std::endl;
+						}
+
+						++changed;
+
+						break;
+
+					case ArchiveDiff::Status::Unchanged:
+						break;
+				}
+			}
+
+			std::cerr << boost::format(_("Compared %1% files: %2% added, %3% changed, %4% removed, %5% decompressed.")) % entries.size() % added % changed % removed % decompressed << std::endl;
+
+			if (!patch.empty())
+			{
+				if (boost::filesystem::exists(patch) && !vm.count("overwrite"))
+				{
+					std::cerr << boost::format(_("File %1% does already exist.")) % patch << std::endl;
+
+					return EXIT_FAILURE;
 				}
+
+				ArchiveBuilder builder(mpqFormat, sectorSize);
+				builder.setThreads(jobs);
+				ArchiveDiff::Entries skippedEntries;
+				const std::size_t files = ArchiveDiff::addPatchFiles(entries, builder, skippedEntries, sectorCompression);
+				builder.write(patch, startPosition);
+
+				std::cout << boost::format(_("Wrote %1% files into patch archive %2%.")) % files % patch << std::endl;
+
+				// the patch archive is incomplete
+				if (!skippedEntries.empty())
+				{
+					BOOST_FOREACH(ArchiveDiff::Entries::const_reference entry, skippedEntries)
+					{
+						const File &file = entry.newFile.isValid() ? entry.newFile : entry.oldFile;
+
+						if (entry.path.empty())
+						{
+							std::cerr << boost::format(_("Skipped file <block %1%> since its path is unknown.")) % file.block()->index() << std::endl;
+						}
+						else
+						{
+							std::cerr << boost::format(_("Skipped file %1%: %2%")) % entry.path % entry.error << std::endl;
+						}
+					}
+
+					std::cerr << boost::format(_("Skipped %1% added or changed files which are missing in patch archive %2%.")) % skippedEntries.size() % patch << std::endl;
+
+					return EXIT_FAILURE;
+				}
+			}
+		}
+		catch (wc3lib::Exception &exception)
+		{
+			std::cerr << boost::format(_("Error occured while finding differences between archives %1% and %2%: \"%3%\"")) % archivePaths[0] % archivePaths[1] % exception.what() << std::endl;
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	bool verified = true;
+
+	if (vm.count("verify"))
+	{
+		BOOST_FOREACH(Paths::const_reference path, archivePaths)
+		{
+			if (!boost::filesystem::is_regular_file(path))
+			{
+				std::cerr << boost::format(_("File %1% does not seem to be a regular file and will be skipped.")) % path << std::endl;
+
+				continue;
+			}
+
+			boost::scoped_ptr<Archive> mpq(new Archive());
+
+			try
+			{
+				mpq->open(path, true);
+				const Archive::BlockVerifications verifications = mpq->verify(listfileEntries, jobs);
+				std::size_t corrupted = 0;
+				std::size_t unchecked = 0;
+				std::size_t skipped = 0;
+
+				BOOST_FOREACH(Archive::BlockVerifications::const_reference verification, verifications)
+				{
+					const std::string name = verification.paths.empty() ? (boost::format(_("<block %1%>")) % verification.block->index()).str() : verification.paths.front();
+
+					if (verification.skipped)
+					{
+						std::cout << boost::format(_("%1%: SKIPPED (unknown path of encrypted file)")) % name << std::endl;
+						++skipped;
+					}
+					else if (!verification.error.empty())
+					{
+						std::cout << boost::format(_("%1%: FAILED (%2%)")) % name % verification.error << std::endl;
+						++corrupted;
+					}
+					else if (!verification.isValid())
+					{
+						std::cout << boost::format(_("%1%: FAILED (%2%%3%)")) % name % (verification.crc32Checked && !verification.crc32Valid ? _("CRC32 mismatch ") : "") % (verification.md5Checked && !verification.md5Valid ? _("MD5 mismatch") : "") << std::endl;
+						++corrupted;
+					}
+					else if (!verification.crc32Checked && !verification.md5Checked)
+					{
+						std::cout << boost::format(_("%1%: UNCHECKED")) % name << std::endl;
+						++unchecked;
+					}
+					else
+					{
+						std::cout << boost::format(_("%1%: OK")) % name << std::endl;
+					}
+				}
+
+				std::cerr << boost::format(_("Verified %1% files of archive %2%: %3% corrupted, %4% without checksums, %5% skipped.")) % verifications.size() % path % corrupted % unchecked % skipped << std::endl;
+
+				if (corrupted > 0)
+				{
+					verified = false;
+				}
+			}
+			catch (wc3lib::Exception &exception)
+			{
+				std::cerr << boost::format(_("Error occured while verifying file %1%: \"%2%\"")) % path % exception.what() << std::endl;
+				verified = false;
+			}
+		}
+	}
+
+	if (vm.count("recover-listfile"))
+	{
+		ListfileRecovery recovery;
+		recovery.addWords(words);
+		recovery.addPatterns(patterns.empty() ? ListfileRecovery::defaultPatterns() : Listfile::Entries(patterns.begin(), patterns.end()));
+		recovery.addPatterns(listfileEntries);
+		recovery.setThreads(jobs);
+
+		BOOST_FOREACH(Paths::const_reference path, archivePaths)
+		{
+			if (!boost::filesystem::is_regular_file(path))
+			{
+				std::cerr << boost::format(_("File %1% does not seem to be a regular file and will be skipped.")) % path << std::endl;
+
+				continue;
+			}
+
+			boost::scoped_ptr<Archive> mpq(new Archive());
+
+			try
+			{
+				mpq->open(path);
+				const Listfile::Entries entries = recovery.recover(*mpq);
+
+				BOOST_FOREACH(Listfile::Entries::const_reference entry, entries)
+				{
+					std::cout << entry << std::endl;
+				}
+
+				std::cerr << boost::format(_("Recovered %1% file paths of archive %2% from %3% candidates.")) % entries.size() % path % recovery.candidates() << std::endl;
+			}
+			catch (wc3lib::Exception &exception)
+			{
+				std::cerr << boost::format(_("Error occured while recovering the listfile of file %1%: \"%2%\"")) % path % exception.what() << std::endl;
 			}
 		}
 	}
 
-	return EXIT_SUCCESS;
+	return verified ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -62,6 +62,16 @@ QString ArchiveInfoDialog::formatToString(mpq::Archive::Format format)
 		{
 			return tr("MPQ 2");
 		}
+
+		case mpq::Archive::Format::Mpq3:
+		{
+			return tr("MPQ 3");
+		}
+
+		case mpq::Archive::Format::Mpq4:
+		{
+			return tr("MPQ 4");
+		}
 	}
 
 	return QString();
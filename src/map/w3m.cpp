@@ -62,16 +62,12 @@ std::streamsize W3m::readFileFormat(FileFormat *format)
 
 	if (file.isValid())
 	{
-		/*
-		 * FIXME
-		boost::scoped_array<byte> buffer(new byte[file->size()]);
-		arraystream stream(buffer.get(), file->size());
-		*/
-		stringstream stream;
-
 		try
 		{
-			file.decompress(stream);
+			/*
+			 * The sectors are decompressed on demand while the format is being read.
+			 */
+			mpq::FileInputStream stream(file);
 			size += format->read(stream);
 		}
 		catch (std::exception &exception)
@@ -130,16 +126,9 @@ std::streamsize W3m::readTriggers(const TriggerData &triggerData)
 
 	if (file.isValid())
 	{
-		/*
-		 * FIXME
-		boost::scoped_array<byte> buffer(new byte[file->size()]);
-		arraystream stream(buffer.get(), file->size());
-		*/
-		stringstream stream;
-
 		try
 		{
-			file.decompress(stream);
+			mpq::FileInputStream stream(file);
 			size += m_triggers.get()->read(stream, triggerData);
 		}
 		catch (std::exception &exception)
@@ -49,13 +49,29 @@ namespace wc3lib
 
 #include "mpq/algorithm.hpp"
 #include "mpq/archive.hpp"
+#include "mpq/archivebuilder.hpp"
+#include "mpq/archivediff.hpp"
+#include "mpq/archiveset.hpp"
 #include "mpq/attributes.hpp"
+#include "mpq/bettable.hpp"
 #include "mpq/block.hpp"
+#include "mpq/compressionselection.hpp"
 #include "mpq/file.hpp"
+#include "mpq/filestreambuf.hpp"
+#include "mpq/freespace.hpp"
 #include "mpq/hash.hpp"
+#include "mpq/hashtable.hpp"
+#include "mpq/hettable.hpp"
+#include "mpq/huffmandecoder.hpp"
+#include "mpq/imaadpcm.hpp"
 #include "mpq/listfile.hpp"
+#include "mpq/listfileindex.hpp"
+#include "mpq/listfilerecovery.hpp"
+#include "mpq/parallel.hpp"
+#include "mpq/pklibdecoder.hpp"
 #include "mpq/platform.hpp"
 #include "mpq/sector.hpp"
+#include "mpq/sectorcache.hpp"
 #include "mpq/signature.hpp"
 #include "mpq/test.hpp"
 
@@ -18,13 +18,38 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/iostreams/copy.hpp>
 #include <boost/scoped_array.hpp>
+#include <boost/foreach.hpp>
+#include <boost/format.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/cast.hpp>
 
 #include "algorithm.hpp" // include before #ifdef to get proper flag
+#include "sector.hpp"
+#include "huffmandecoder.hpp"
+#include "imaadpcm.hpp"
+#include "pklibdecoder.hpp"
 #include "config.h"
 
+#include <zlib.h>
+#include <bzlib.h>
+
+#ifdef HAS_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#ifdef HAS_LZMA
+#include <lzma.h>
+#endif
+
 using namespace huffman;
 
 namespace wc3lib
@@ -54,25 +79,45 @@ void InitializeCryptTable(uint32 dwCryptTable[cryptTableSize])
 	}
 }
 
+namespace
+{
+
+inline uint32 nextCryptKey(uint32 key)
+{
+	return ((~key << 0x15) + 0x11111111) | (key >> 0x0B);
+}
+
+/**
+ * StormLib compatible upper case conversion which does not depend on the current locale.
+ */
+inline uint32 asciiToUpper(unsigned char c)
+{
+	return c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c;
+}
+
+}
+
+/*
+ * Every dword's seed depends on the previous plain dword.
+ * Therefore the cipher cannot be vectorized and the loops are kept as short as possible: the key table is addressed directly and the buffer is not required to be aligned.
+ */
 void EncryptData(const uint32 dwCryptTable[cryptTableSize], void *lpbyBuffer, uint32 dwLength, uint32 dwKey)
 {
 	assert(lpbyBuffer);
 
-	uint32 *lpdwBuffer = (uint32 *)lpbyBuffer;
+	byte *data = static_cast<byte*>(lpbyBuffer);
+	const uint32 *keyTable = dwCryptTable + 0x400;
 	uint32 seed = 0xEEEEEEEE;
-	uint32 ch;
 
-	dwLength /= sizeof(uint32);
-
-	while (dwLength-- > 0)
+	for (uint32 count = dwLength / sizeof(uint32); count > 0; --count, data += sizeof(uint32))
 	{
-		seed += dwCryptTable[0x400 + (dwKey & 0xFF)];
-		ch = *lpdwBuffer ^ (dwKey + seed);
-
-		dwKey = ((~dwKey << 0x15) + 0x11111111) | (dwKey >> 0x0B);
-		seed = *lpdwBuffer + seed + (seed << 5) + 3;
-
-		*lpdwBuffer++ = ch;
+		uint32 value;
+		memcpy(&value, data, sizeof(value));
+		seed += keyTable[dwKey & 0xFF];
+		const uint32 ch = value ^ (dwKey + seed);
+		dwKey = nextCryptKey(dwKey);
+		seed = value + seed + (seed << 5) + 3;
+		memcpy(data, &ch, sizeof(ch));
 	}
 }
 
@@ -80,21 +125,19 @@ void DecryptData(const uint32 dwCryptTable[cryptTableSize], void *lpbyBuffer, ui
 {
 	assert(lpbyBuffer);
 
-	uint32 *lpdwBuffer = (uint32 *)lpbyBuffer;
-	uint32 seed = 0xEEEEEEEEL;
-	uint32 ch;
-
-	dwLength /= sizeof(uint32);
+	byte *data = static_cast<byte*>(lpbyBuffer);
+	const uint32 *keyTable = dwCryptTable + 0x400;
+	uint32 seed = 0xEEEEEEEE;
 
-	while (dwLength-- > 0)
+	for (uint32 count = dwLength / sizeof(uint32); count > 0; --count, data += sizeof(uint32))
 	{
-		seed += dwCryptTable[0x400 + (dwKey & 0xFF)];
-		ch = *lpdwBuffer ^ (dwKey + seed);
-
-		dwKey = ((~dwKey << 0x15) + 0x11111111L) | (dwKey >> 0x0B);
+		uint32 value;
+		memcpy(&value, data, sizeof(value));
+		seed += keyTable[dwKey & 0xFF];
+		const uint32 ch = value ^ (dwKey + seed);
+		dwKey = nextCryptKey(dwKey);
 		seed = ch + seed + (seed << 5) + 3;
-
-		*lpdwBuffer++ = ch;
+		memcpy(data, &ch, sizeof(ch));
 	}
 }
 
@@ -103,22 +146,213 @@ uint32 HashString(const uint32 dwCryptTable[cryptTableSize], const char *lpszStr
 {
 	assert(lpszString);
 
-	uint32 dwHashType = uint32(hashType);
+	const uint32 *table = dwCryptTable + uint32(hashType);
 	uint32 seed1 = 0x7FED7FEDL;
 	uint32 seed2 = 0xEEEEEEEEL;
-	int ch;
 
 	while (*lpszString != 0)
 	{
-		ch = toupper(*lpszString++);
+		const uint32 ch = asciiToUpper(*lpszString++);
 
-		seed1 = dwCryptTable[dwHashType + ch] ^ (seed1 + seed2);
+		seed1 = table[ch] ^ (seed1 + seed2);
 		seed2 = ch + seed1 + seed2 + (seed2 << 5) + 3;
 	}
 
 	return seed1;
 }
 
+HashValues HashStrings(const uint32 dwCryptTable[cryptTableSize], const char *lpszString)
+{
+	assert(lpszString);
+
+	const uint32 *tableOffsetTable = dwCryptTable + uint32(HashType::TableOffset);
+	const uint32 *nameATable = dwCryptTable + uint32(HashType::NameA);
+	const uint32 *nameBTable = dwCryptTable + uint32(HashType::NameB);
+	uint32 tableOffsetSeed1 = 0x7FED7FEDL;
+	uint32 tableOffsetSeed2 = 0xEEEEEEEEL;
+	uint32 nameASeed1 = 0x7FED7FEDL;
+	uint32 nameASeed2 = 0xEEEEEEEEL;
+	uint32 nameBSeed1 = 0x7FED7FEDL;
+	uint32 nameBSeed2 = 0xEEEEEEEEL;
+
+	/*
+	 * The three hash values are independent from each other.
+	 * Calculating them in the same loop reads and converts every character only once and allows the CPU to process the three chains in parallel.
+	 */
+	while (*lpszString != 0)
+	{
+		const uint32 ch = asciiToUpper(*lpszString++);
+
+		tableOffsetSeed1 = tableOffsetTable[ch] ^ (tableOffsetSeed1 + tableOffsetSeed2);
+		tableOffsetSeed2 = ch + tableOffsetSeed1 + tableOffsetSeed2 + (tableOffsetSeed2 << 5) + 3;
+		nameASeed1 = nameATable[ch] ^ (nameASeed1 + nameASeed2);
+		nameASeed2 = ch + nameASeed1 + nameASeed2 + (nameASeed2 << 5) + 3;
+		nameBSeed1 = nameBTable[ch] ^ (nameBSeed1 + nameBSeed2);
+		nameBSeed2 = ch + nameBSeed1 + nameBSeed2 + (nameBSeed2 << 5) + 3;
+	}
+
+	HashValues result;
+	result.tableOffset = tableOffsetSeed1;
+	result.nameA = nameASeed1;
+	result.nameB = nameBSeed1;
+
+	return result;
+}
+
+void HashStrings(const uint32 dwCryptTable[cryptTableSize], const char *const *lpszStrings, std::size_t count, HashValues *values)
+{
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		values[i] = HashStrings(dwCryptTable, lpszStrings[i]);
+	}
+}
+
+namespace
+{
+
+inline uint32 rotate(uint32 value, uint32 bits)
+{
+	return (value << bits) | (value >> (32 - bits));
+}
+
+inline void mix(uint32 &a, uint32 &b, uint32 &c)
+{
+	a -= c; a ^= rotate(c, 4); c += b;
+	b -= a; b ^= rotate(a, 6); a += c;
+	c -= b; c ^= rotate(b, 8); b += a;
+	a -= c; a ^= rotate(c, 16); c += b;
+	b -= a; b ^= rotate(a, 19); a += c;
+	c -= b; c ^= rotate(b, 4); b += a;
+}
+
+inline void final(uint32 &a, uint32 &b, uint32 &c)
+{
+	c ^= b; c -= rotate(b, 14);
+	a ^= c; a -= rotate(c, 11);
+	b ^= a; b -= rotate(a, 25);
+	c ^= b; c -= rotate(b, 16);
+	a ^= c; a -= rotate(c, 4);
+	b ^= a; b -= rotate(a, 14);
+	c ^= b; c -= rotate(b, 24);
+}
+
+}
+
+void HashLittle2(const void *key, std::size_t length, uint32 &primary, uint32 &secondary)
+{
+	uint32 a = 0xDEADBEEF + static_cast<uint32>(length) + primary;
+	uint32 b = a;
+	uint32 c = a + secondary;
+	// the byte-wise variant does not depend on the alignment or the endianness
+	const unsigned char *k = reinterpret_cast<const unsigned char*>(key);
+
+	while (length > 12)
+	{
+		a += k[0] + (uint32(k[1]) << 8) + (uint32(k[2]) << 16) + (uint32(k[3]) << 24);
+		b += k[4] + (uint32(k[5]) << 8) + (uint32(k[6]) << 16) + (uint32(k[7]) << 24);
+		c += k[8] + (uint32(k[9]) << 8) + (uint32(k[10]) << 16) + (uint32(k[11]) << 24);
+		mix(a, b, c);
+		length -= 12;
+		k += 12;
+	}
+
+	switch (length)
+	{
+		case 12: c += uint32(k[11]) << 24; // fall through
+		case 11: c += uint32(k[10]) << 16; // fall through
+		case 10: c += uint32(k[9]) << 8; // fall through
+		case 9: c += k[8]; // fall through
+		case 8: b += uint32(k[7]) << 24; // fall through
+		case 7: b += uint32(k[6]) << 16; // fall through
+		case 6: b += uint32(k[5]) << 8; // fall through
+		case 5: b += k[4]; // fall through
+		case 4: a += uint32(k[3]) << 24; // fall through
+		case 3: a += uint32(k[2]) << 16; // fall through
+		case 2: a += uint32(k[1]) << 8; // fall through
+		case 1: a += k[0];
+			break;
+
+		// zero length strings require no mixing
+		case 0:
+			primary = c;
+			secondary = b;
+
+			return;
+	}
+
+	final(a, b, c);
+	primary = c;
+	secondary = b;
+}
+
+uint64 HashStringJenkins(const char *lpszString)
+{
+	string normalized(lpszString);
+
+	BOOST_FOREACH(string::reference character, normalized)
+	{
+		if (character == '/')
+		{
+			character = '\\';
+		}
+		else if (character >= 'A' && character <= 'Z')
+		{
+			character = character - 'A' + 'a';
+		}
+	}
+
+	// like the StormLib the lower part is the primary hash of lookup3 with the initial value 2 and the upper part the secondary one with the initial value 1
+	uint32 low = 2;
+	uint32 high = 1;
+	HashLittle2(normalized.data(), normalized.size(), low, high);
+
+	return (uint64(high) << 32) | low;
+}
+
+uint64 readBits(const byte *data, uint64 bitIndex, uint32 bitCount)
+{
+	uint64 result = 0;
+
+	for (uint32 i = 0; i < bitCount; )
+	{
+		const uint64 position = bitIndex + i;
+		const uint32 shift = position % 8;
+		const uint32 count = std::min<uint32>(8 - shift, bitCount - i);
+		const uint64 bits = (static_cast<unsigned char>(data[position / 8]) >> shift) & ((1u << count) - 1);
+		result |= bits << i;
+		i += count;
+	}
+
+	return result;
+}
+
+void writeBits(byte *data, uint64 bitIndex, uint32 bitCount, uint64 value)
+{
+	for (uint32 i = 0; i < bitCount; )
+	{
+		const uint64 position = bitIndex + i;
+		const uint32 shift = position % 8;
+		const uint32 count = std::min<uint32>(8 - shift, bitCount - i);
+		const unsigned char mask = static_cast<unsigned char>(((1u << count) - 1) << shift);
+		const unsigned char bits = static_cast<unsigned char>(((value >> i) << shift) & mask);
+		data[position / 8] = static_cast<byte>((static_cast<unsigned char>(data[position / 8]) & ~mask) | bits);
+		i += count;
+	}
+}
+
+uint32 bitCount(uint64 value)
+{
+	uint32 result = 0;
+
+	while (value > 0)
+	{
+		value >>= 1;
+		++result;
+	}
+
+	return result;
+}
+
 struct DataInfo
 {
 	char *inBuffer;		// Pointer to input data buffer
@@ -190,8 +424,9 @@ void compressPklib(char *outBuffer, int &outLength, char* const inBuffer, int in
 	info.inBufferEnd = inBuffer + inLength;
 	info.outBuffer = outBuffer;
 	info.outBufferEnd  = outBuffer + outLength;
-	boost::scoped_array<char> workBuffer(new char[CMP_BUFFER_SIZE]); // Pklib's work buffer
-	memset(workBuffer.get(), 0, CMP_BUFFER_SIZE);
+	// Pklib's work buffer is reused by every thread
+	static thread_local TCmpStruct workBuffer;
+	memset(&workBuffer, 0, CMP_BUFFER_SIZE);
 	unsigned int dictonarySize;                             // Dictionary size
 	unsigned int ctype = CMP_BINARY;                    // Compression type
 
@@ -211,7 +446,7 @@ void compressPklib(char *outBuffer, int &outLength, char* const inBuffer, int in
 	}
 
 	// Do the compression
-	unsigned int state = implode(readBuffer, writeBuffer, workBuffer.get(), &info, &ctype, &dictonarySize);
+	unsigned int state = implode(readBuffer, writeBuffer, reinterpret_cast<char*>(&workBuffer), &info, &ctype, &dictonarySize);
 
 	if (state != CMP_NO_ERROR)
 	{
@@ -316,7 +551,7 @@ int decompressWaveStereo(unsigned char* const inBuffer, int inBufferLength, unsi
 		throw Exception(_("Output buffer is 0."));
 	}
 
-	inBufferLength = DecompressADPCM(outBuffer, outBufferLength, inBuffer, inBufferLength, 2);
+	outBufferLength = DecompressADPCM(outBuffer, outBufferLength, inBuffer, inBufferLength, 2);
 
 	return outBufferLength;
 }
@@ -418,12 +653,794 @@ int decompressHuffman(char * pbOutBuffer, int * pcbOutBuffer, char * pbInBuffer,
 	return 1;
 }
 
+Codec::~Codec()
+{
+}
+
+namespace
+{
+
+const char* zlibError(int error)
+{
+	switch (error)
+	{
+		case Z_STREAM_ERROR:
+			return _("Stream error: Compressed data stream or parameter configuration is corrupted.");
+
+		case Z_VERSION_ERROR:
+			return _("Version error: Incompatible versions.");
+
+		case Z_DATA_ERROR:
+			return _("Data error: Compressed data stream is corrupted.");
+
+		case Z_BUF_ERROR:
+			return _("Buff error: Internal error.");
+
+		case Z_MEM_ERROR:
+			return _("Memory error: Not enough memory.");
+	}
+
+	return "";
+}
+
+const char* bzip2Error(int error)
+{
+	switch (error)
+	{
+		case BZ_DATA_ERROR:
+			return _("Data error: Compressed data stream is corrupted.");
+
+		case BZ_DATA_ERROR_MAGIC:
+			return _("Data error magic: Compressed data stream does not begin with the 'magic' sequence 'B' 'Z' 'h'.");
+
+		case BZ_CONFIG_ERROR:
+			return _("Config error: libbzip2 has been improperly configured for the current platform.");
+
+		case BZ_UNEXPECTED_EOF:
+			return _("Unexpected end of compressed data stream.");
+
+		case BZ_MEM_ERROR:
+			return _("Memory error: Not enough memory.");
+	}
+
+	return "";
+}
+
+/*
+ * Initializing a zlib stream allocates its whole state.
+ * Therefore every thread keeps one stream which is only reset for every sector.
+ */
+class ZlibStream : private boost::noncopyable
+{
+	public:
+		explicit ZlibStream(bool deflating) : m_deflating(deflating)
+		{
+			memset(&this->m_stream, 0, sizeof(this->m_stream));
+			// the same parameters as Boost's zlib compressor uses by default that the compressed data stays the same
+			const int state = deflating ? deflateInit(&this->m_stream, Z_DEFAULT_COMPRESSION) : inflateInit(&this->m_stream);
+
+			if (state != Z_OK)
+			{
+				throw Exception(zlibError(state));
+			}
+		}
+
+		~ZlibStream()
+		{
+			if (this->m_deflating)
+			{
+				deflateEnd(&this->m_stream);
+			}
+			else
+			{
+				inflateEnd(&this->m_stream);
+			}
+		}
+
+		z_stream& stream()
+		{
+			return this->m_stream;
+		}
+
+	private:
+		bool m_deflating;
+		z_stream m_stream;
+};
+
+#ifdef HAS_LIBDEFLATE
+class LibdeflateDecompressor : private boost::noncopyable
+{
+	public:
+		LibdeflateDecompressor() : m_decompressor(libdeflate_alloc_decompressor())
+		{
+			if (this->m_decompressor == 0)
+			{
+				throw Exception(_("Memory error: Not enough memory."));
+			}
+		}
+
+		~LibdeflateDecompressor()
+		{
+			libdeflate_free_decompressor(this->m_decompressor);
+		}
+
+		libdeflate_decompressor* decompressor() const
+		{
+			return this->m_decompressor;
+		}
+
+	private:
+		libdeflate_decompressor *m_decompressor;
+};
+#endif
+
+class ZlibCodec : public Codec
+{
+	public:
+		virtual const char* name() const override
+		{
+			return "Deflated";
+		}
+
+		virtual bool compress(const byte *in, uint32 inSize, byte *out, uint32 &outSize, int level) const override
+		{
+			static thread_local ZlibStream deflateStream(true);
+			// the level of the stream is only changed if it differs since deflateParams() might flush data
+			static thread_local int streamLevel = Z_DEFAULT_COMPRESSION;
+			z_stream &stream = deflateStream.stream();
+			deflateReset(&stream);
+
+			if (level < Z_NO_COMPRESSION || level > Z_BEST_COMPRESSION)
+			{
+				level = Z_DEFAULT_COMPRESSION;
+			}
+
+			if (level != streamLevel)
+			{
+				const int state = deflateParams(&stream, level, Z_DEFAULT_STRATEGY);
+
+				if (state != Z_OK)
+				{
+					throw Exception(zlibError(state));
+				}
+
+				streamLevel = level;
+			}
+
+			stream.next_in = (Bytef*)in;
+			stream.avail_in = inSize;
+			stream.next_out = (Bytef*)out;
+			stream.avail_out = outSize;
+			const int state = deflate(&stream, Z_FINISH);
+
+			if (state == Z_STREAM_END)
+			{
+				outSize = boost::numeric_cast<uint32>(stream.total_out);
+
+				return true;
+			}
+
+			// the output buffer is full
+			if (state == Z_OK || state == Z_BUF_ERROR)
+			{
+				return false;
+			}
+
+			throw Exception(zlibError(state));
+		}
+
+		virtual bool decompress(const byte *in, uint32 inSize, byte *out, uint32 &outSize) const override
+		{
+#ifdef HAS_LIBDEFLATE
+			static thread_local LibdeflateDecompressor decompressor;
+			std::size_t size = 0;
+			const libdeflate_result result = libdeflate_zlib_decompress(decompressor.decompressor(), in, inSize, out, outSize, &size);
+
+			if (result == LIBDEFLATE_SUCCESS)
+			{
+				outSize = boost::numeric_cast<uint32>(size);
+
+				return true;
+			}
+
+			if (result == LIBDEFLATE_INSUFFICIENT_SPACE)
+			{
+				return false;
+			}
+
+			throw Exception(zlibError(Z_DATA_ERROR));
+#else
+			static thread_local ZlibStream inflateStream(false);
+			z_stream &stream = inflateStream.stream();
+			inflateReset(&stream);
+			stream.next_in = (Bytef*)in;
+			stream.avail_in = inSize;
+			stream.next_out = (Bytef*)out;
+			stream.avail_out = outSize;
+			const int state = inflate(&stream, Z_FINISH);
+
+			if (state == Z_STREAM_END)
+			{
+				outSize = boost::numeric_cast<uint32>(stream.total_out);
+
+				return true;
+			}
+
+			// the output buffer is full but there is still input left
+			if ((state == Z_OK || state == Z_BUF_ERROR) && stream.avail_out == 0)
+			{
+				return false;
+			}
+
+			// the compressed data ends too early
+			throw Exception(zlibError(state == Z_OK || state == Z_BUF_ERROR ? Z_DATA_ERROR : state));
+#endif
+		}
+};
+
+/*
+ * libbzip2 provides no way to reset its streams.
+ * The buffer to buffer functions still avoid all the stream buffering of Boost.
+ */
+class Bzip2Codec : public Codec
+{
+	public:
+		virtual const char* name() const override
+		{
+			return "Bzip2";
+		}
+
+		virtual bool compress(const byte *in, uint32 inSize, byte *out, uint32 &outSize, int level) const override
+		{
+			unsigned int size = outSize;
+			// the same parameters as Boost's bzip2 compressor uses by default that the compressed data stays the same
+			const int blockSize = level >= 1 && level <= 9 ? level : 9;
+			const int state = BZ2_bzBuffToBuffCompress(out, &size, const_cast<char*>(in), inSize, blockSize, 0, 30);
+
+			if (state == BZ_OK)
+			{
+				outSize = size;
+
+				return true;
+			}
+
+			if (state == BZ_OUTBUFF_FULL)
+			{
+				return false;
+			}
+
+			throw Exception(bzip2Error(state));
+		}
+
+		virtual bool decompress(const byte *in, uint32 inSize, byte *out, uint32 &outSize) const override
+		{
+			unsigned int size = outSize;
+			const int state = BZ2_bzBuffToBuffDecompress(out, &size, const_cast<char*>(in), inSize, 0, 0);
+
+			if (state == BZ_OK)
+			{
+				outSize = size;
+
+				return true;
+			}
+
+			if (state == BZ_OUTBUFF_FULL)
+			{
+				return false;
+			}
+
+			throw Exception(bzip2Error(state));
+		}
+};
+
+class PklibCodec : public Codec
+{
+	public:
+		virtual const char* name() const override
+		{
+			return "Imploded";
+		}
+
+		virtual bool compress(const byte *in, uint32 inSize, byte *out, uint32 &outSize, int /* level */) const override
+		{
+			int outLength = boost::numeric_cast<int>(outSize);
+			compressPklib(out, outLength, const_cast<char* const>(in), boost::numeric_cast<int>(inSize), 0, 0);
+			outSize = boost::numeric_cast<uint32>(outLength);
+
+			return true;
+		}
+
+		virtual bool decompress(const byte *in, uint32 inSize, byte *out, uint32 &outSize) const override
+		{
+			static thread_local PklibDecoder decoder;
+			const unsigned int state = decoder.decompress(in, inSize, out, outSize);
+
+			// like decompressPklib() the output of corrupted data is used if there is any
+			if (outSize == 0)
+			{
+				throw Exception(boost::format(_("Explode error: \"%1%\".")) % pkglibError(state));
+			}
+
+			return true;
+		}
+};
+
+class HuffmanCodec : public Codec
+{
+	public:
+		virtual const char* name() const override
+		{
+			return "Huffman";
+		}
+
+		virtual bool compress(const byte *in, uint32 inSize, byte *out, uint32 &outSize, int /* level */) const override
+		{
+			int outLength = boost::numeric_cast<int>(outSize);
+			int type = Sector::defaultHuffmanCompressionType;
+			compressHuffman(out, &outLength, const_cast<char*>(in), boost::numeric_cast<int>(inSize), &type, 0);
+			outSize = boost::numeric_cast<uint32>(outLength);
+
+			return true;
+		}
+
+		virtual bool decompress(const byte *in, uint32 inSize, byte *out, uint32 &outSize) const override
+		{
+			// the tree is reused for all sectors of the thread
+			static thread_local HuffmanDecoder decoder;
+			const uint32 outLength = decoder.decompress(in, inSize, out, outSize);
+
+			if (outLength == 0)
+			{
+				throw Exception(_("Huffman error: The data is corrupted."));
+			}
+
+			outSize = outLength;
+
+			return true;
+		}
+};
+
+class WaveCodec : public Codec
+{
+	public:
+		explicit WaveCodec(bool stereo) : m_stereo(stereo)
+		{
+		}
+
+		virtual const char* name() const override
+		{
+			return this->m_stereo ? "Stereo" : "Mono";
+		}
+
+		virtual bool compress(const byte *in, uint32 inSize, byte *out, uint32 &outSize, int level) const override
+		{
+			if (ImaAdpcm::compress(in, inSize, out, outSize, this->channels(), level))
+			{
+				return true;
+			}
+
+			if (outSize == 0)
+			{
+				throw Exception(this->m_stereo ? _("Wave stereo compression error.") : _("Wave mono compression error."));
+			}
+
+			return false;
+		}
+
+		virtual bool decompress(const byte *in, uint32 inSize, byte *out, uint32 &outSize) const override
+		{
+			static thread_local ImaAdpcm adpcm;
+			const uint32 size = adpcm.decompress(in, inSize, out, outSize, this->channels());
+
+			if (size == 0)
+			{
+				throw Exception(this->m_stereo ? _("Wave stereo decompression error.") : _("Wave mono decompression error."));
+			}
+
+			outSize = size;
+
+			return true;
+		}
+
+	private:
+		uint32 channels() const
+		{
+			return this->m_stereo ? 2 : 1;
+		}
+
+		bool m_stereo;
+};
+
+/*
+ * Sparse compression stores the size of the data as big endian 32 bit integer followed by chunks.
+ * A chunk starting with a byte with the highest bit set contains (byte & 0x7F) + 1 bytes of data which follow.
+ * Any other chunk is a run of (byte & 0x7F) + 3 zero bytes.
+ */
+class SparseCodec : public Codec
+{
+	public:
+		virtual const char* name() const override
+		{
+			return "Sparse";
+		}
+
+		virtual bool compress(const byte *in, uint32 inSize, byte *out, uint32 &outSize, int /* level */) const override
+		{
+			const unsigned char *input = reinterpret_cast<const unsigned char*>(in);
+			unsigned char *output = reinterpret_cast<unsigned char*>(out);
+
+			if (outSize < 4)
+			{
+				return false;
+			}
+
+			output[0] = static_cast<unsigned char>(inSize >> 24);
+			output[1] = static_cast<unsigned char>(inSize >> 16);
+			output[2] = static_cast<unsigned char>(inSize >> 8);
+			output[3] = static_cast<unsigned char>(inSize);
+			uint32 position = 4;
+			uint32 i = 0;
+
+			while (i < inSize)
+			{
+				uint32 zeros = 0;
+
+				while (i + zeros < inSize && input[i + zeros] == 0 && zeros < 130)
+				{
+					++zeros;
+				}
+
+				if (zeros >= 3)
+				{
+					if (position + 1 > outSize)
+					{
+						return false;
+					}
+
+					output[position++] = static_cast<unsigned char>(zeros - 3);
+					i += zeros;
+
+					continue;
+				}
+
+				// data is copied until the next run of at least three zero bytes
+				uint32 length = 0;
+
+				while (i + length < inSize && length < 128)
+				{
+					if (i + length + 2 < inSize && input[i + length] == 0 && input[i + length + 1] == 0 && input[i + length + 2] == 0)
+					{
+						break;
+					}
+
+					++length;
+				}
+
+				if (position + 1 + length > outSize)
+				{
+					return false;
+				}
+
+				output[position++] = static_cast<unsigned char>(0x80 | (length - 1));
+				memcpy(output + position, input + i, length);
+				position += length;
+				i += length;
+			}
+
+			outSize = position;
+
+			return true;
+		}
+
+		virtual bool decompress(const byte *in, uint32 inSize, byte *out, uint32 &outSize) const override
+		{
+			const unsigned char *input = reinterpret_cast<const unsigned char*>(in);
+			const unsigned char *inputEnd = input + inSize;
+
+			if (inSize < 4)
+			{
+				throw Exception(_("Sparse data is too short."));
+			}
+
+			const uint32 size = (uint32(input[0]) << 24) | (uint32(input[1]) << 16) | (uint32(input[2]) << 8) | uint32(input[3]);
+			input += 4;
+
+			if (size > outSize)
+			{
+				return false;
+			}
+
+			uint32 position = 0;
+
+			while (input < inputEnd && position < size)
+			{
+				const unsigned char value = *input++;
+
+				if (value & 0x80)
+				{
+					const uint32 length = std::min<uint32>((value & 0x7F) + 1, size - position);
+
+					if (input + length > inputEnd)
+					{
+						throw Exception(_("Sparse data is corrupted."));
+					}
+
+					memcpy(out + position, input, length);
+					input += length;
+					position += length;
+				}
+				else
+				{
+					const uint32 length = std::min<uint32>((value & 0x7F) + 3, size - position);
+					memset(out + position, 0, length);
+					position += length;
+				}
+			}
+
+			// trailing zero bytes might be omitted
+			memset(out + position, 0, size - position);
+			outSize = size;
+
+			return true;
+		}
+};
+
+#ifdef HAS_LZMA
+const char* lzmaError(lzma_ret error)
+{
+	switch (error)
+	{
+		case LZMA_MEM_ERROR:
+			return _("Memory error: Not enough memory.");
+
+		case LZMA_OPTIONS_ERROR:
+			return _("Options error: Unsupported LZMA options.");
+
+		case LZMA_DATA_ERROR:
+		case LZMA_BUF_ERROR:
+			return _("Data error: Compressed data stream is corrupted.");
+
+		default:
+			break;
+	}
+
+	return _("Internal LZMA error.");
+}
+
+/*
+ * Initializing an LZMA coder again with the same stream reuses its memory if possible.
+ * Therefore every thread keeps one stream for compression and one for decompression.
+ */
+class LzmaStream : private boost::noncopyable
+{
+	public:
+		LzmaStream() : m_stream(LZMA_STREAM_INIT)
+		{
+		}
+
+		~LzmaStream()
+		{
+			lzma_end(&this->m_stream);
+		}
+
+		lzma_stream& stream()
+		{
+			return this->m_stream;
+		}
+
+	private:
+		lzma_stream m_stream;
+};
+
+/*
+ * LZMA compressed sectors start with a header which is compatible to StormLib:
+ * One byte which is always 0 since filters are not supported, 5 bytes of LZMA properties and the uncompressed size as little endian 64 bit integer.
+ * The raw LZMA stream follows.
+ * LZMA cannot be combined with other algorithms.
+ */
+class LzmaCodec : public Codec
+{
+	public:
+		static const uint32 propertiesSize = 5;
+		static const uint32 headerSize = 1 + propertiesSize + 8;
+
+		virtual const char* name() const override
+		{
+			return "LZMA";
+		}
+
+		virtual bool compress(const byte *in, uint32 inSize, byte *out, uint32 &outSize, int /* level */) const override
+		{
+			if (outSize < headerSize)
+			{
+				return false;
+			}
+
+			lzma_options_lzma options;
+
+			if (lzma_lzma_preset(&options, LZMA_PRESET_DEFAULT))
+			{
+				throw Exception(lzmaError(LZMA_OPTIONS_ERROR));
+			}
+
+			// the dictionary never has to be larger than the data
+			options.dict_size = std::max<uint32>(LZMA_DICT_SIZE_MIN, inSize);
+			lzma_filter filters[2];
+			filters[0].id = LZMA_FILTER_LZMA1;
+			filters[0].options = &options;
+			filters[1].id = LZMA_VLI_UNKNOWN;
+			filters[1].options = 0;
+
+			unsigned char *output = reinterpret_cast<unsigned char*>(out);
+			output[0] = 0;
+			lzma_ret state = lzma_properties_encode(&filters[0], output + 1);
+
+			if (state != LZMA_OK)
+			{
+				throw Exception(lzmaError(state));
+			}
+
+			for (uint32 i = 0; i < 8; ++i)
+			{
+				output[1 + propertiesSize + i] = static_cast<unsigned char>((uint64(inSize) >> (i * 8)) & 0xFF);
+			}
+
+			static thread_local LzmaStream encoder;
+			lzma_stream &stream = encoder.stream();
+			state = lzma_raw_encoder(&stream, filters);
+
+			if (state != LZMA_OK)
+			{
+				throw Exception(lzmaError(state));
+			}
+
+			stream.next_in = reinterpret_cast<const uint8_t*>(in);
+			stream.avail_in = inSize;
+			stream.next_out = output + headerSize;
+			stream.avail_out = outSize - headerSize;
+			state = lzma_code(&stream, LZMA_FINISH);
+
+			if (state == LZMA_STREAM_END)
+			{
+				outSize = boost::numeric_cast<uint32>(headerSize + stream.total_out);
+
+				return true;
+			}
+
+			// the output buffer is full
+			if (state == LZMA_OK || state == LZMA_BUF_ERROR)
+			{
+				return false;
+			}
+
+			throw Exception(lzmaError(state));
+		}
+
+		virtual bool decompress(const byte *in, uint32 inSize, byte *out, uint32 &outSize) const override
+		{
+			const unsigned char *input = reinterpret_cast<const unsigned char*>(in);
+
+			if (inSize < headerSize)
+			{
+				throw Exception(lzmaError(LZMA_DATA_ERROR));
+			}
+
+			if (input[0] != 0)
+			{
+				throw Exception(boost::format(_("Unsupported LZMA filter %1%.")) % static_cast<int>(input[0]));
+			}
+
+			uint64 size = 0;
+
+			for (uint32 i = 0; i < 8; ++i)
+			{
+				size |= uint64(input[1 + propertiesSize + i]) << (i * 8);
+			}
+
+			if (size > outSize)
+			{
+				return false;
+			}
+
+			if (size == 0)
+			{
+				outSize = 0;
+
+				return true;
+			}
+
+			lzma_filter filters[2];
+			filters[0].id = LZMA_FILTER_LZMA1;
+			filters[0].options = 0;
+			filters[1].id = LZMA_VLI_UNKNOWN;
+			filters[1].options = 0;
+			lzma_ret state = lzma_properties_decode(&filters[0], 0, input + 1, propertiesSize);
+
+			if (state != LZMA_OK)
+			{
+				throw Exception(lzmaError(state));
+			}
+
+			static thread_local LzmaStream decoder;
+			lzma_stream &stream = decoder.stream();
+			state = lzma_raw_decoder(&stream, filters);
+			// the decoder copies the options
+			free(filters[0].options);
+
+			if (state != LZMA_OK)
+			{
+				throw Exception(lzmaError(state));
+			}
+
+			/*
+			 * The stream does not need to have an end marker since the uncompressed size is known.
+			 * The decoder stops as soon as the output buffer has this size.
+			 */
+			stream.next_in = input + headerSize;
+			stream.avail_in = inSize - headerSize;
+			stream.next_out = reinterpret_cast<uint8_t*>(out);
+			stream.avail_out = boost::numeric_cast<std::size_t>(size);
+			state = lzma_code(&stream, LZMA_FINISH);
+
+			if ((state != LZMA_OK && state != LZMA_STREAM_END) || stream.total_out != size)
+			{
+				throw Exception(lzmaError(state == LZMA_OK ? LZMA_DATA_ERROR : state));
+			}
+
+			outSize = boost::numeric_cast<uint32>(size);
+
+			return true;
+		}
+};
+#endif
+
+/*
+ * Codecs are stored by their compression flag that finding one is a single array access.
+ */
+typedef std::array<std::unique_ptr<Codec>, 256> Codecs;
+
+Codecs& codecs()
+{
+	static Codecs codecs = []()
+	{
+		Codecs result;
+		result[static_cast<uint8>(Sector::Compression::Deflated)].reset(new ZlibCodec());
+		result[static_cast<uint8>(Sector::Compression::Bzip2Compressed)].reset(new Bzip2Codec());
+		result[static_cast<uint8>(Sector::Compression::Imploded)].reset(new PklibCodec());
+		result[static_cast<uint8>(Sector::Compression::Huffman)].reset(new HuffmanCodec());
+		result[static_cast<uint8>(Sector::Compression::ImaAdpcmMono)].reset(new WaveCodec(false));
+		result[static_cast<uint8>(Sector::Compression::ImaAdpcmStereo)].reset(new WaveCodec(true));
+		result[static_cast<uint8>(Sector::Compression::Sparse)].reset(new SparseCodec());
+#ifdef HAS_LZMA
+		result[static_cast<uint8>(Sector::Compression::Lzma)].reset(new LzmaCodec());
+#endif
+
+		return result;
+	}();
+
+	return codecs;
+}
+
+}
+
+void registerCodec(uint8 compression, std::unique_ptr<Codec> codec)
+{
+	codecs()[compression] = std::move(codec);
+}
+
+const Codec* findCodec(uint8 compression)
+{
+	return codecs()[compression].get();
+}
+
 MD5Checksum md5(const byte *buffer, std::size_t bufferSize)
 {
+	// the constructor finalizes the digest already
 	MD5 md5((unsigned char*)buffer, bufferSize);
-	md5.finalize();
 	MD5Checksum result;
-	memcpy(result.checksum, md5.raw_digest(), 16);
+	// the digest is allocated by the MD5 implementation
+	const boost::scoped_array<unsigned char> digest(md5.raw_digest());
+	memcpy(result.checksum, digest.get(), 16);
 
 	return result;
 }
@@ -21,6 +21,8 @@
 #ifndef WC3LIB_MPQ_ALGORITHM_HPP
 #define WC3LIB_MPQ_ALGORITHM_HPP
 
+#include <memory>
+
 #include <boost/iostreams/filter/bzip2.hpp>
 #include <boost/iostreams/filter/zlib.hpp>
 
@@ -87,17 +89,67 @@ void DecryptData(const uint32 dwCryptTable[cryptTableSize], void *lpbyBuffer, ui
 /// Based on code from StormLib.
 uint32 HashString(const uint32 dwCryptTable[cryptTableSize], const char *lpszString, HashType hashType);
 
+/**
+ * \brief All hash values of a file path which are required to find it in an archive's hash table.
+ */
+struct HashValues
+{
+	uint32 tableOffset; /// \ref HashType::TableOffset
+	uint32 nameA; /// \ref HashType::NameA
+	uint32 nameB; /// \ref HashType::NameB
+};
+
+/**
+ * Calculates the hash values \ref HashType::TableOffset, \ref HashType::NameA and \ref HashType::NameB of \p lpszString in one single pass.
+ * The results are equal to three calls of \ref HashString().
+ */
+HashValues HashStrings(const uint32 dwCryptTable[cryptTableSize], const char *lpszString);
+/**
+ * Calculates the hash values of \p count strings \p lpszStrings at once and stores them in \p values which must have a size of at least \p count.
+ * This can be used to resolve many file paths (for example all entries of a listfile) against an archive.
+ */
+void HashStrings(const uint32 dwCryptTable[cryptTableSize], const char *const *lpszStrings, std::size_t count, HashValues *values);
+
+/**
+ * Bob Jenkins' hash function "hashlittle2" from lookup3.c which calculates two 32 bit hash values at once.
+ * \param primary Initial value of the primary hash which is replaced by the primary result.
+ * \param secondary Initial value of the secondary hash which is replaced by the secondary result.
+ */
+void HashLittle2(const void *key, std::size_t length, uint32 &primary, uint32 &secondary);
+/**
+ * Calculates the 64 bit file name hash which is used by the HET table (\ref HetTable) of the MPQ formats 3 and 4.
+ * The path is normalized before. All characters are converted to lower case and slashes are converted to backslashes.
+ */
+uint64 HashStringJenkins(const char *lpszString);
+
+/**
+ * Reads \p bitCount bits (at most 64) starting at bit \p bitIndex of the bit array \p data.
+ * The bits are stored with the least significant bit first as in the HET and BET tables.
+ */
+uint64 readBits(const byte *data, uint64 bitIndex, uint32 bitCount);
+/**
+ * Writes the lower \p bitCount bits (at most 64) of \p value starting at bit \p bitIndex of the bit array \p data.
+ */
+void writeBits(byte *data, uint64 bitIndex, uint32 bitCount, uint64 value);
+/**
+ * \return Returns the number of bits which are required to store \p value.
+ */
+uint32 bitCount(uint64 value);
+
 /**
  * \throw Exception Throws an exception if an error occurs on compression.
  */
 void compressPklib(char *outBuffer, int &outLength, char* const inBuffer, int inLength, int * /* pCmpType */, int /* compressionLevel */) ;
 /**
+ * Decompresses imploded data using explode() of "lib/pklib".
+ * The codec of \ref Sector::Compression::Imploded uses the faster \ref PklibDecoder which produces the same output.
  * \throw Exception Throws an exception if an error occurs on decompression.
  */
 void decompressPklib(char *outBuffer, int &outLength, char* const inBuffer, int inLength);
 /**
  * \sa compressWaveMono, decompressWaveMono, compressWaveStereo, decompressWaveStereo
  * Wrapper of StormLib functions.
+ * The codecs of \ref Sector::Compression::ImaAdpcmMono and \ref Sector::Compression::ImaAdpcmStereo use \ref ImaAdpcm which produces the same output.
  * \param inBuffer Buffer which is read from.
  * \param inBufferLength Buffer length which should be set to amount of bytes which should be read from buffer.
  * \param outBuffer Buffer which is read into.
@@ -130,8 +182,63 @@ std::streamsize compressZlib(istream &istream, ostream &ostream);
 std::streamsize decompressZlib(istream &istream, ostream &ostream, int bufferSize);
 
 void compressHuffman(char *pbOutBuffer, int * pdwOutLength, char *pbInBuffer, int dwInLength, int *pCmpType, int /* nCmpLevel */);
+/**
+ * Decompresses Huffman data using "lib/huffman".
+ * The codec of \ref Sector::Compression::Huffman uses the faster \ref HuffmanDecoder which produces the same output.
+ * \return Returns 1 on success and 0 if the data is corrupted.
+ */
 int decompressHuffman(char *pbOutBuffer, int *pdwOutLength, char *pbInBuffer, int /* dwInLength */);
 
+/**
+ * \brief One compression algorithm of sectors which works directly from buffer to buffer.
+ *
+ * Every codec is registered for one compression flag (\ref Sector::Compression) using \ref registerCodec() and can be found with \ref findCodec().
+ * Sectors are compressed and decompressed by applying the codecs of all their compression flags one after another.
+ *
+ * The default codecs for zlib and bzip2 use the libraries directly instead of Boost's stream filters which have a high setup cost for small sectors.
+ * Their state is reused per thread. The stream based functions (\ref compressZlib(), \ref decompressZlib(), \ref compressBzip2(), \ref decompressBzip2()) remain for stream based usage.
+ *
+ * All member functions must be thread-safe since sectors are compressed and decompressed by several threads.
+ */
+class Codec
+{
+	public:
+		virtual ~Codec();
+
+		/**
+		 * \return Returns the name of the algorithm which is used in error messages.
+		 */
+		virtual const char* name() const = 0;
+		/**
+		 * Compresses \p inSize bytes of \p in into \p out.
+		 * Not all algorithms can detect an overflow of the output buffer. Therefore \p out should always have a size of at least two times \p inSize plus 1024 bytes.
+		 * \param outSize The size of \p out which is set to the size of the compressed data.
+		 * \param level The compression level. The IMA ADPCM codecs expect a wave compression level like \ref Sector::defaultWaveCompressionLevel. Deflated accepts 0 to 9 and Bzip2 1 to 9 (its block size). Other values like \ref Sector::defaultCompressionLevel use the default level. All other codecs ignore it.
+		 * \return Returns false if the compressed data does not fit into \p out.
+		 * \throw Exception Throws an exception if an error occurs on compression.
+		 */
+		virtual bool compress(const byte *in, uint32 inSize, byte *out, uint32 &outSize, int level) const = 0;
+		/**
+		 * Decompresses \p inSize bytes of \p in into \p out.
+		 * \param outSize The size of \p out which is set to the size of the decompressed data.
+		 * \return Returns false if the decompressed data does not fit into \p out.
+		 * \throw Exception Throws an exception if the compressed data is corrupted.
+		 */
+		virtual bool decompress(const byte *in, uint32 inSize, byte *out, uint32 &outSize) const = 0;
+};
+
+/**
+ * Registers \p codec for the compression flag \p compression and replaces the previous codec.
+ * This allows using other implementations of an algorithm. Registering 0 removes the codec.
+ * \note Codecs must not be registered while sectors are being compressed or decompressed.
+ */
+void registerCodec(uint8 compression, std::unique_ptr<Codec> codec);
+/**
+ * \return Returns the codec for the compression flag \p compression or 0 if no codec is registered.
+ * By default codecs for all algorithms of \ref Sector::Compression are registered. The codec for \ref Sector::Compression::Lzma is only available if wc3lib is built with liblzma (HAS_LZMA).
+ */
+const Codec* findCodec(uint8 compression);
+
 MD5Checksum md5(const byte *buffer, std::size_t bufferSize);
 
 }
@@ -18,11 +18,19 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <set>
+#include <mutex>
+#include <memory>
+
 #include <boost/filesystem.hpp>
 #include <boost/scoped_ptr.hpp>
 
 #include "mpq.hpp"
 #include "sector.hpp"
+#include "parallel.hpp"
 
 namespace wc3lib
 {
@@ -33,22 +41,50 @@ namespace mpq
 const byte Archive::identifier[4] = { 'M', 'P', 'Q',  0x1A };
 const int16 Archive::formatVersion1Identifier = 0x0000;
 const int16 Archive::formatVersion2Identifier = 0x0001;
+const int16 Archive::formatVersion3Identifier = 0x0002;
+const int16 Archive::formatVersion4Identifier = 0x0003;
 const uint32 Archive::maxBlockId = 0xFFFFFFFD;
 const uint32 Archive::maxHashId = 0xFFFFFFFF;
-const std::size_t Archive::headerSize = sizeof(struct Header);
 
 const uint32* Archive::cryptTable()
 {
-	static uint32 cryptTable[cryptTableSize];
-	static bool isInitialized = false;
+	/*
+	 * The table is initialized exactly once in a thread-safe way since sectors might be decrypted by several threads at the same time.
+	 */
+	struct CryptTable
+	{
+		CryptTable()
+		{
+			InitializeCryptTable(values);
+		}
+
+		uint32 values[cryptTableSize];
+	};
+
+	static const CryptTable cryptTable;
 
-	if (!isInitialized)
+	return cryptTable.values;
+}
+
+uint32 Archive::headerSize(Format format)
+{
+	switch (format)
 	{
-		InitializeCryptTable(cryptTable);
-		isInitialized = true;
+		case Archive::Format::Mpq1:
+			return sizeof(Header);
+
+		// the padded structures are smaller in the archive
+		case Archive::Format::Mpq2:
+			return sizeof(Header) + 12;
+
+		case Archive::Format::Mpq3:
+			return sizeof(Header) + 12 + sizeof(ExtendedHeader3);
+
+		case Archive::Format::Mpq4:
+			return sizeof(Header) + 12 + sizeof(ExtendedHeader3) + 140;
 	}
 
-	return const_cast<const uint32*>(cryptTable);
+	return sizeof(Header);
 }
 
 Archive::Archive()
@@ -58,11 +94,17 @@ Archive::Archive()
 , m_blockTableOffset(0)
 , m_extendedBlockTableOffset(0)
 , m_hashTableOffset(0)
+, m_hetTableOffset(0)
+, m_betTableOffset(0)
 , m_strongDigitalSignaturePosition(0)
 , m_format(Archive::Format::Mpq1)
 , m_sectorSize(0)
 , m_strongDigitalSignature(0)
 , m_isOpen(false)
+, m_usesHetTable(false)
+, m_threads(0)
+, m_compressionSelection()
+, m_freeSpace()
 {
 }
 
@@ -75,6 +117,11 @@ std::streamsize Archive::create(const boost::filesystem::path &path, uint32 hash
 {
 	this->close();
 
+	if (format == Archive::Format::Mpq3 || format == Archive::Format::Mpq4)
+	{
+		throw Exception(_("Archives of the formats 3 and 4 cannot be created directly. Use ArchiveBuilder instead."));
+	}
+
 	ofstream out(path, std::ios::out | std::ios::binary);
 
 	if (!out)
@@ -102,14 +149,19 @@ std::streamsize Archive::create(const boost::filesystem::path &path, uint32 hash
 	}
 
 	// create empty hashes
-	for (uint32 i = 0; i < blockTableEntries; ++i)
+	this->m_hashTable.resize(hashTableEntries);
+
+	for (uint32 i = 0; i < hashTableEntries; ++i)
 	{
 		HashData key;
-		this->m_hashes.insert(key, new Hash(this, i));
+		Hash *hash = new Hash(this, i);
+		this->m_hashes.insert(key, hash);
+		this->m_hashTable.set(hash);
 	}
 
 	// skip header for later writing
-	out.seekp(sizeof(Header), std::ios::cur);
+	const std::streamoff headerSize = Archive::headerSize(format);
+	out.seekp(headerSize, std::ios::cur);
 
 	this->m_blockTableOffset = std::streamoff(out.tellp()) - this->startPosition();
 
@@ -136,7 +188,7 @@ std::streamsize Archive::create(const boost::filesystem::path &path, uint32 hash
 	}
 
 	const std::streampos current = out.tellp();
-	const uint32 archiveSize = boost::numeric_cast<uint32>(streamSize) + sizeof(Header); // includes the header size
+	const uint32 archiveSize = boost::numeric_cast<uint32>(streamSize + headerSize); // includes the header size
 	this->m_size = archiveSize;
 
 	// seeks automatically
@@ -152,23 +204,43 @@ std::streamsize Archive::create(const boost::filesystem::path &path, uint32 hash
 	return streamSize;
 }
 
-std::streamsize Archive::open(const boost::filesystem::path &path)
+std::streamsize Archive::open(const boost::filesystem::path &path, bool mapped)
 {
 	this->close();
 
-	ifstream stream(boost::filesystem::system_complete(path), std::ios_base::binary | std::ios_base::in);
-
-	if (!stream)
-	{
-		throw Exception(boost::format(_("Unable to open file \"%1%\".")) % boost::filesystem::system_complete(path));
-	}
-
 	this->m_path = boost::filesystem::system_complete(path);
 	std::streamsize streamSize = 0;
 
 	try
 	{
-		streamSize = this->read(stream);
+		if (mapped)
+		{
+			try
+			{
+				this->m_mappedFile.open(this->m_path.string());
+			}
+			catch (const std::exception &exception)
+			{
+				throw Exception(boost::format(_("Unable to map file \"%1%\": %2%")) % this->m_path % exception.what());
+			}
+
+			/*
+			 * The tables are read directly from the mapped data.
+			 */
+			iarraystream stream(this->m_mappedFile.data(), this->m_mappedFile.size());
+			streamSize = this->read(stream);
+		}
+		else
+		{
+			ifstream stream(this->m_path, std::ios_base::binary | std::ios_base::in);
+
+			if (!stream)
+			{
+				throw Exception(boost::format(_("Unable to open file \"%1%\".")) % this->m_path);
+			}
+
+			streamSize = this->read(stream);
+		}
 	}
 	catch (Exception &exception)
 	{
@@ -177,6 +249,7 @@ std::streamsize Archive::open(const boost::filesystem::path &path)
 		throw;
 	}
 
+	this->updateFreeSpace();
 	this->m_isOpen = true;
 
 	return streamSize;
@@ -210,6 +283,14 @@ std::streamsize Archive::read(InputStream &stream)
 	{
 		this->m_format = Archive::Format::Mpq2;
 	}
+	else if (header.formatVersion == Archive::formatVersion3Identifier)
+	{
+		this->m_format = Archive::Format::Mpq3;
+	}
+	else if (header.formatVersion == Archive::formatVersion4Identifier)
+	{
+		this->m_format = Archive::Format::Mpq4;
+	}
 	else
 	{
 		throw Exception(boost::format(_("Unknown MPQ format \"%1%\".")) % header.formatVersion);
@@ -232,37 +313,60 @@ std::streamsize Archive::read(InputStream &stream)
 	}
 
 	// According to the StormLib this value is sometimes changed by map creators to protect their maps. As in the StormLib this value is ignored.
-	if (header.headerSize != sizeof(header))
+	if (header.headerSize != Archive::headerSize(this->format()))
 	{
-		std::cerr << boost::format(_("Warning: MPQ header size is not equal to real header size.\nContained header size: %1%.\nReal header size: %2%.")) % header.headerSize % sizeof(header) << std::endl;
+		std::cerr << boost::format(_("Warning: MPQ header size is not equal to real header size.\nContained header size: %1%.\nReal header size: %2%.")) % header.headerSize % Archive::headerSize(this->format()) << std::endl;
 	}
 
-	const uint64 expectedArchiveSize = boost::filesystem::file_size(this->path()) - this->startPosition();
-
-	if (header.archiveSize != expectedArchiveSize)
+	this->m_sectorSize = pow(2, header.sectorSizeShift) * 512;
+	ExtendedHeader extendedHeader;
+	memset(&extendedHeader, 0, sizeof(extendedHeader));
+	ExtendedHeader3 extendedHeader3;
+	memset(&extendedHeader3, 0, sizeof(extendedHeader3));
+	boost::scoped_ptr<ExtendedHeader4> extendedHeader4;
+
+	// the structures are padded so their members have to be read one by one
+	if (this->format() != Archive::Format::Mpq1)
 	{
-		std::cerr << boost::format(_("Warning: MPQ file size of MPQ file %1% is not equal to its internal header file size.\nFile size: %2%.\nInternal header file size: %3%.")) % this->path() % expectedArchiveSize
-		% header.archiveSize << std::endl;
+		wc3lib::read(stream, extendedHeader.extendedBlockTableOffset, size);
+		wc3lib::read(stream, extendedHeader.hashTableOffsetHigh, size);
+		wc3lib::read(stream, extendedHeader.blockTableOffsetHigh, size);
 	}
 
-	this->m_size = header.archiveSize;
-	this->m_sectorSize = pow(2, header.sectorSizeShift) * 512;
-	boost::scoped_ptr<ExtendedHeader> extendedHeader;
+	if (this->format() == Archive::Format::Mpq3 || this->format() == Archive::Format::Mpq4)
+	{
+		wc3lib::read(stream, extendedHeader3, size);
+	}
 
-	if (this->format() == Archive::Format::Mpq2)
+	if (this->format() == Archive::Format::Mpq4)
 	{
-		extendedHeader.reset(new ExtendedHeader);
-		wc3lib::read(stream, *extendedHeader, size);
+		extendedHeader4.reset(new ExtendedHeader4);
+		wc3lib::read(stream, extendedHeader4->hashTableSize, size);
+		wc3lib::read(stream, extendedHeader4->blockTableSize, size);
+		wc3lib::read(stream, extendedHeader4->extendedBlockTableSize, size);
+		wc3lib::read(stream, extendedHeader4->hetTableSize, size);
+		wc3lib::read(stream, extendedHeader4->betTableSize, size);
+		wc3lib::read(stream, extendedHeader4->rawChunkSize, size);
+		wc3lib::read(stream, extendedHeader4->blockTableMd5, size);
+		wc3lib::read(stream, extendedHeader4->hashTableMd5, size);
+		wc3lib::read(stream, extendedHeader4->extendedBlockTableMd5, size);
+		wc3lib::read(stream, extendedHeader4->betTableMd5, size);
+		wc3lib::read(stream, extendedHeader4->hetTableMd5, size);
+		wc3lib::read(stream, extendedHeader4->headerMd5, size);
 	}
 
-	uint64 offset = header.blockTableOffset;
+	// since format 3 the archive size has 64 bits
+	const uint64 archiveSize = extendedHeader3.archiveSize > 0 ? extendedHeader3.archiveSize : header.archiveSize;
+	const uint64 expectedArchiveSize = boost::filesystem::file_size(this->path()) - this->startPosition();
 
-	if (this->format() == Archive::Format::Mpq2 && extendedHeader->blockTableOffsetHigh > 0)
+	if (archiveSize != expectedArchiveSize)
 	{
-		offset += uint64(extendedHeader->blockTableOffsetHigh) << 32;
+		std::cerr << boost::format(_("Warning: MPQ file size of MPQ file %1% is not equal to its internal header file size.\nFile size: %2%.\nInternal header file size: %3%.")) % this->path() % expectedArchiveSize
+		% archiveSize << std::endl;
 	}
 
-	this->m_blockTableOffset = offset;
+	this->m_size = boost::numeric_cast<std::size_t>(archiveSize);
+	this->m_blockTableOffset = header.blockTableOffset + (uint64(extendedHeader.blockTableOffsetHigh) << 32);
 
 	if (!readBlockTable(stream, header.blockTableEntries, size))
 	{
@@ -272,10 +376,11 @@ std::streamsize Archive::read(InputStream &stream)
 	/*
 	 * Read extended block table
 	 * As of the Burning Crusade Friends and Family beta, this table is not encrypted.
+	 * Since the format 3 it is optional.
 	 */
-	if (this->format() == Archive::Format::Mpq2)
+	if (this->format() == Archive::Format::Mpq2 || extendedHeader.extendedBlockTableOffset > 0)
 	{
-		this->m_extendedBlockTableOffset = extendedHeader->extendedBlockTableOffset;
+		this->m_extendedBlockTableOffset = extendedHeader.extendedBlockTableOffset;
 
 		if (!readExtendedBlockTable(stream, size))
 		{
@@ -284,22 +389,19 @@ std::streamsize Archive::read(InputStream &stream)
 	}
 
 	// read encrypted hash table
-	offset = header.hashTableOffset;
-
-	if (this->format() == Archive::Format::Mpq2 && extendedHeader->hashTableOffsetHigh > 0)
-	{
-		offset += uint64(extendedHeader->hashTableOffsetHigh) << 32;
-	}
-
-	this->m_hashTableOffset = offset;
+	this->m_hashTableOffset = header.hashTableOffset + (uint64(extendedHeader.hashTableOffsetHigh) << 32);
 
 	if (!readHashTable(stream, header.hashTableEntries, size))
 	{
 		throw Exception(_("Error on reading hash table."));
 	}
 
+	this->m_hetTableOffset = extendedHeader3.hetTableOffset;
+	this->m_betTableOffset = extendedHeader3.betTableOffset;
+	this->readExtendedTables(stream, extendedHeader4.get(), size);
+
 	// The strong digital signature is stored immediately after the archive, in the containing file
-	const std::streampos position = startPosition() + boost::numeric_cast<std::streampos>(header.archiveSize);
+	const std::streampos position = startPosition() + boost::numeric_cast<std::streampos>(archiveSize);
 
 	// jumps to the end of the archive
 	if (endPosition(stream) > position && Archive::hasStrongDigitalSignature(stream))
@@ -330,6 +432,16 @@ uint32_t Archive::version() const
 		{
 			return formatVersion2Identifier;
 		}
+
+		case Format::Mpq3:
+		{
+			return formatVersion3Identifier;
+		}
+
+		case Format::Mpq4:
+		{
+			return formatVersion4Identifier;
+		}
 	}
 
 	return 0;
@@ -449,28 +561,268 @@ bool Archive::readHashTable(istream &in, uint32 entries, std::streamsize &size)
 	 */
 	arraystream sstream(encryptedBytes.get(), encryptedBytesSize);
 	Hashes hashes;
+	HashTable hashTable;
+	hashTable.resize(entries);
 
 	for (uint32 i = 0; i < entries; ++i)
 	{
 		std::unique_ptr<Hash> hash(new Hash(this, i));
 		size += hash->read(sstream);
 		const HashData hashData = hash->cHashData();
+		hashTable.set(hash.get());
 		hashes.insert(hashData, std::move(hash));
 	}
 
 	// exception safe
 	this->m_hashes.swap(hashes);
+	std::swap(this->m_hashTable, hashTable);
 
 	return true;
 }
 
+void Archive::readExtendedTables(istream &in, const ExtendedHeader4 *extendedHeader4, std::streamsize &size)
+{
+	if (this->m_hetTableOffset > 0)
+	{
+		in.seekg(this->startPosition() + boost::numeric_cast<std::streamoff>(this->m_hetTableOffset));
+		boost::scoped_ptr<HetTable> hetTable(new HetTable());
+		size += hetTable->read(in, extendedHeader4 != 0 ? extendedHeader4->hetTableSize : 0);
+		this->m_hetTable.swap(hetTable);
+	}
+
+	if (this->m_betTableOffset > 0)
+	{
+		in.seekg(this->startPosition() + boost::numeric_cast<std::streamoff>(this->m_betTableOffset));
+		boost::scoped_ptr<BetTable> betTable(new BetTable());
+		size += betTable->read(in, extendedHeader4 != 0 ? extendedHeader4->betTableSize : 0);
+		this->m_betTable.swap(betTable);
+	}
+
+	// without a classic block table the blocks are created from the BET table
+	if (this->m_blocks.empty() && this->m_betTable.get() != 0)
+	{
+		Blocks blocks;
+
+		for (uint32 i = 0; i < this->m_betTable->entryCount(); ++i)
+		{
+			const BetTable::Entry entry = this->m_betTable->entry(i);
+			std::unique_ptr<Block> block(new Block(i));
+			block->setBlockOffset(static_cast<uint32>(entry.filePosition));
+			block->setExtendedBlockOffset(boost::numeric_cast<uint16>(entry.filePosition >> 32));
+			block->setBlockSize(boost::numeric_cast<uint32>(entry.compressedSize));
+			block->setFileSize(boost::numeric_cast<uint32>(entry.fileSize));
+			block->setFlags(entry.flags);
+			blocks.push_back(std::move(block));
+		}
+
+		this->m_blocks.swap(blocks);
+	}
+
+	// without a classic hash table there is one hash for every entry of the HET table which refers to the block of its file
+	if (this->m_hashTable.empty() && this->m_hetTable.get() != 0 && this->m_betTable.get() != 0)
+	{
+		Hashes hashes;
+		HashTable hashTable;
+		hashTable.resize(this->m_hetTable->totalCount());
+
+		for (uint32 i = 0; i < this->m_hetTable->totalCount(); ++i)
+		{
+			std::unique_ptr<Hash> hash(new Hash(this, i));
+			const byte nameHash1 = this->m_hetTable->nameHash1(i);
+
+			if (nameHash1 != HetTable::entryFree)
+			{
+				const uint32 fileIndex = this->m_hetTable->fileIndex(i);
+
+				if (fileIndex < this->m_blocks.size())
+				{
+					hash->setBlock(&this->m_blocks[fileIndex]);
+				}
+				else if (nameHash1 == HetTable::entryDeleted)
+				{
+					hash->setDeleted(true);
+				}
+			}
+
+			const HashData hashData = hash->cHashData();
+			hashTable.set(hash.get());
+			hashes.insert(hashData, std::move(hash));
+		}
+
+		this->m_hashes.swap(hashes);
+		std::swap(this->m_hashTable, hashTable);
+		this->m_usesHetTable = true;
+	}
+}
+
+void Archive::checkModifiable() const
+{
+	if (this->format() == Archive::Format::Mpq3 || this->format() == Archive::Format::Mpq4)
+	{
+		throw Exception(_("Archives of the formats 3 and 4 cannot be modified since their HET and BET tables are not updated. Use ArchiveBuilder to create them."));
+	}
+}
+
+void Archive::updateFreeSpace()
+{
+	this->m_freeSpace.clear();
+
+	if (this->format() == Archive::Format::Mpq3 || this->format() == Archive::Format::Mpq4)
+	{
+		return;
+	}
+
+	/*
+	 * All used extents are sorted by their offsets. The gaps between them are free.
+	 * Extents might overlap in corrupted or protected archives.
+	 */
+	typedef std::pair<uint64, uint64> Extent;
+	std::vector<Extent> usedExtents;
+	usedExtents.push_back(Extent(0, Archive::headerSize(this->format())));
+	usedExtents.push_back(Extent(this->blockTableOffset(), uint64(this->blocks().size()) * sizeof(struct BlockTableEntry)));
+
+	if (this->format() == Archive::Format::Mpq2)
+	{
+		usedExtents.push_back(Extent(this->extendedBlockTableOffset(), uint64(this->blocks().size()) * sizeof(struct ExtendedBlockTableEntry)));
+	}
+
+	usedExtents.push_back(Extent(this->hashTableOffset(), uint64(this->m_hashTable.size()) * sizeof(struct HashTableEntry)));
+
+	BOOST_FOREACH(const Block &block, this->blocks())
+	{
+		if (!block.empty() && !block.unused())
+		{
+			usedExtents.push_back(Extent(block.largeOffset(), block.blockSize()));
+		}
+	}
+
+	std::sort(usedExtents.begin(), usedExtents.end());
+	uint64 offset = 0;
+
+	BOOST_FOREACH(std::vector<Extent>::const_reference extent, usedExtents)
+	{
+		if (extent.first > offset)
+		{
+			this->m_freeSpace.insert(offset, std::min<uint64>(extent.first, this->size()) - std::min<uint64>(offset, this->size()));
+		}
+
+		offset = std::max(offset, extent.first + extent.second);
+	}
+
+	if (offset < this->size())
+	{
+		this->m_freeSpace.insert(offset, this->size() - offset);
+	}
+}
+
+uint64 Archive::allocateBlock(uint64 size)
+{
+	uint64 offset = 0;
+
+	if (size > 0 && this->m_freeSpace.allocate(size, offset))
+	{
+		return offset;
+	}
+
+	// the archive grows, even if its size in the header is too small
+	offset = std::max<uint64>(this->size(), this->nextBlockOffset());
+	this->m_size = boost::numeric_cast<std::size_t>(offset + size);
+
+	return offset;
+}
+
+Archive::PathsByHash Archive::resolvePaths(const Listfile::Entries &entries)
+{
+	Listfile::Entries paths = entries;
+	paths.push_back("(listfile)");
+	paths.push_back("(attributes)");
+	paths.push_back("(signature)");
+
+	if (this->containsListfileFile())
+	{
+		const Listfile::Entries listfileEntries = this->listfileFile().entries();
+		paths.insert(paths.end(), listfileEntries.begin(), listfileEntries.end());
+	}
+
+	std::vector<const char*> pathStrings;
+	pathStrings.reserve(paths.size());
+
+	BOOST_FOREACH(Listfile::Entries::const_reference path, paths)
+	{
+		pathStrings.push_back(path.c_str());
+	}
+
+	std::vector<HashValues> hashValues(paths.size());
+	HashStrings(Archive::cryptTable(), pathStrings.data(), pathStrings.size(), hashValues.data());
+	PathsByHash result;
+
+	for (std::size_t i = 0; i < paths.size(); ++i)
+	{
+		// the first path wins since the entries of the caller are preferred
+		result.insert(std::make_pair(std::make_pair(static_cast<int32>(hashValues[i].nameA), static_cast<int32>(hashValues[i].nameB)), paths[i]));
+	}
+
+	return result;
+}
+
+Archive::UsedBlocks Archive::usedBlocks() const
+{
+	std::map<Block*, std::vector<Hash*> > blockHashes;
+
+	for (uint32 i = 0; i < this->m_hashTable.size(); ++i)
+	{
+		Hash *hash = this->m_hashTable.hash(i);
+
+		if (!hash->empty() && !hash->deleted() && hash->block() != 0)
+		{
+			// several hashes (for example of different locales) might refer to the same block
+			blockHashes[hash->block()].push_back(hash);
+		}
+	}
+
+	UsedBlocks result(blockHashes.begin(), blockHashes.end());
+	std::sort(result.begin(), result.end(), [](UsedBlocks::const_reference first, UsedBlocks::const_reference second) { return first.first->largeOffset() < second.first->largeOffset() || (first.first->largeOffset() == second.first->largeOffset() && first.first->index() < second.first->index()); });
+
+	return result;
+}
+
+File Archive::blockFile(const std::vector<Hash*> &hashes, const PathsByHash &pathsByHash, std::vector<string> &paths)
+{
+	Hash *fileHash = 0;
+
+	BOOST_FOREACH(Hash *hash, hashes)
+	{
+		PathsByHash::const_iterator iterator = pathsByHash.find(std::make_pair(hash->cHashData().filePathHashA(), hash->cHashData().filePathHashB()));
+
+		if (iterator != pathsByHash.end())
+		{
+			if (fileHash == 0)
+			{
+				fileHash = hash;
+			}
+
+			if (std::find(paths.begin(), paths.end(), iterator->second) == paths.end())
+			{
+				paths.push_back(iterator->second);
+			}
+		}
+	}
+
+	if (fileHash == 0)
+	{
+		fileHash = hashes.front();
+	}
+
+	return File(this, fileHash, paths.empty() ? "" : paths.front());
+}
+
 bool Archive::writeHeader(ostream &out, std::streamsize &size) const
 {
 	std::streamsize currentSize = 0;
 
 	Header header;
 	memcpy(header.magic, Archive::identifier, 4);
-	header.headerSize = sizeof(header);
+	header.headerSize = Archive::headerSize(this->format());
 	header.archiveSize = this->size();
 	header.formatVersion = static_cast<uint16>(this->format());
 	header.sectorSizeShift = this->sectorSizeShift();
@@ -483,60 +835,106 @@ bool Archive::writeHeader(ostream &out, std::streamsize &size) const
 	out.seekp(this->m_startPosition);
 	wc3lib::write(out, header, currentSize);
 
+	if (this->format() == Archive::Format::Mpq2)
+	{
+		// the structure is padded so its members have to be written one by one
+		ExtendedHeader extendedHeader;
+		extendedHeader.extendedBlockTableOffset = this->m_extendedBlockTableOffset;
+		extendedHeader.hashTableOffsetHigh = boost::numeric_cast<uint16>(this->m_hashTableOffset >> 32);
+		extendedHeader.blockTableOffsetHigh = boost::numeric_cast<uint16>(this->m_blockTableOffset >> 32);
+		wc3lib::write(out, extendedHeader.extendedBlockTableOffset, currentSize);
+		wc3lib::write(out, extendedHeader.hashTableOffsetHigh, currentSize);
+		wc3lib::write(out, extendedHeader.blockTableOffsetHigh, currentSize);
+	}
+
 	size += currentSize;
 
 	return true;
 }
 
-bool Archive::writeBlockTable(ostream &out, std::streamsize &size) const
+bool Archive::writeBlockTable(ostream &out, std::streamsize &size, uint32 firstEntry) const
 {
 	const std::size_t encryptedBytesSize = this->m_blocks.size() * sizeof(struct BlockTableEntry);
 	boost::scoped_array<byte> encryptedBytes(new byte[encryptedBytesSize]);
 
+	// blocks are stored in the order of their indices
 	BOOST_FOREACH(Blocks::const_reference ref, this->blocks())
 	{
 		const BlockTableEntry blockTableEntry = ref.toBlockTableEntry();
-		memcpy(encryptedBytes.get(), &blockTableEntry, sizeof(BlockTableEntry));
+		memcpy(encryptedBytes.get() + ref.index() * sizeof(BlockTableEntry), &blockTableEntry, sizeof(BlockTableEntry));
 	}
 
 	const uint32 hashValue = HashString(Archive::cryptTable(), "(block table)", HashType::FileKey);
 	EncryptData(Archive::cryptTable(), encryptedBytes.get(), encryptedBytesSize, hashValue);
 
-	out.seekp(this->startPosition() + boost::numeric_cast<std::streamoff>(this->blockTableOffset()));
-	wc3lib::write(out, encryptedBytes.get(), size, encryptedBytesSize);
+	const std::size_t firstByte = std::min<std::size_t>(firstEntry * sizeof(struct BlockTableEntry), encryptedBytesSize);
+	out.seekp(this->startPosition() + boost::numeric_cast<std::streamoff>(this->blockTableOffset() + firstByte));
+	wc3lib::write(out, encryptedBytes.get() + firstByte, size, encryptedBytesSize - firstByte);
 
 	return true;
 }
 
 bool Archive::writeExtendedBlockTable(ostream &out, std::streamsize &size) const
 {
-	return false;
+	out.seekp(this->startPosition() + boost::numeric_cast<std::streamoff>(this->extendedBlockTableOffset()));
+
+	// As of the Burning Crusade Friends and Family beta, this table is not encrypted.
+	BOOST_FOREACH(Blocks::const_reference ref, this->blocks())
+	{
+		ExtendedBlockTableEntry extendedBlockTableEntry;
+		extendedBlockTableEntry.extendedBlockOffset = ref.extendedBlockOffset();
+		wc3lib::write(out, extendedBlockTableEntry, size);
+	}
+
+	return true;
 }
 
-bool Archive::writeHashTable(ostream &out, std::streamsize &size) const
+bool Archive::writeHashTable(ostream &out, std::streamsize &size, uint32 firstEntry) const
 {
-	const std::size_t encryptedBytesSize = this->m_blocks.size() * sizeof(struct BlockTableEntry);
+	/*
+	 * The flat hash table already contains all entries in the order of the archive's hash table.
+	 */
+	const std::size_t encryptedBytesSize = this->m_hashTable.size() * sizeof(struct HashTableEntry);
 	boost::scoped_array<byte> encryptedBytes(new byte[encryptedBytesSize]);
 
-	BOOST_FOREACH(Hashes::const_reference ref, this->hashes())
+	if (encryptedBytesSize > 0)
 	{
-		const HashTableEntry hashEntry = ref.second->toHashTableEntry();
-		memcpy(encryptedBytes.get(), &hashEntry, sizeof(HashTableEntry));
+		memcpy(encryptedBytes.get(), &this->m_hashTable.entries()[0], encryptedBytesSize);
 	}
 
 	const uint32 hashValue = HashString(Archive::cryptTable(), "(hash table)", HashType::FileKey);
 	EncryptData(Archive::cryptTable(), encryptedBytes.get(), encryptedBytesSize, hashValue);
 
-	out.seekp(this->startPosition() + boost::numeric_cast<std::streamoff>(this->hashTableOffset()));
-	wc3lib::write(out, encryptedBytes.get(), size, encryptedBytesSize);
+	const std::size_t firstByte = std::min<std::size_t>(firstEntry * sizeof(struct HashTableEntry), encryptedBytesSize);
+	out.seekp(this->startPosition() + boost::numeric_cast<std::streamoff>(this->hashTableOffset() + firstByte));
+	wc3lib::write(out, encryptedBytes.get() + firstByte, size, encryptedBytesSize - firstByte);
 
 	return true;
 }
 
+void Archive::remap()
+{
+	if (!this->isMapped())
+	{
+		return;
+	}
+
+	this->m_mappedFile.close();
+	this->m_mappedFile.open(this->m_path.string());
+}
+
 void Archive::clear()
 {
 	this->m_strongDigitalSignature.reset();
 
+	if (this->m_mappedFile.is_open())
+	{
+		this->m_mappedFile.close();
+	}
+
+	this->m_sectorCache.clear();
+	this->m_freeSpace.clear();
+	this->m_hashTable.clear();
 	this->m_hashes.clear();
 	this->m_blocks.clear();
 
@@ -546,6 +944,11 @@ void Archive::clear()
 	this->m_blockTableOffset = 0;
 	this->m_extendedBlockTableOffset = 0;
 	this->m_hashTableOffset = 0;
+	this->m_hetTableOffset = 0;
+	this->m_betTableOffset = 0;
+	this->m_hetTable.reset();
+	this->m_betTable.reset();
+	this->m_usesHetTable = false;
 	this->m_format = Archive::Format::Mpq1;
 	this->m_sectorSize = 0;
 	this->m_strongDigitalSignaturePosition = 0;
@@ -554,227 +957,1100 @@ void Archive::clear()
 
 bool Archive::removeFile(const File &mpqFile)
 {
-	Hashes::iterator hashIterator = this->hashes().find(mpqFile.hash()->hashData());
+	this->checkModifiable();
 
 	// return false if the hash or block entry does not belong to the archive
-	if (hashIterator == this->hashes().end() || this->blocks().size() <= mpqFile.block()->index() || &this->blocks()[mpqFile.block()->index()] != mpqFile.block())
+	if (mpqFile.hash()->index() >= this->m_hashTable.size() || this->m_hashTable.hash(mpqFile.hash()->index()) != mpqFile.hash() || this->blocks().size() <= mpqFile.block()->index() || &this->blocks()[mpqFile.block()->index()] != mpqFile.block())
 	{
 		return false;
 	}
 
 	/*
 	 * Change both entries.
+	 * The data of the file is kept but its space can be reused.
 	 */
-	const uint32 compressedSize = mpqFile.block()->blockSize();
-	mpqFile.block()->remove();
-	mpqFile.hash()->remove();
+	Hash *hash = mpqFile.hash();
+	Block *block = mpqFile.block();
+	this->m_sectorCache.remove(block->index());
 
-	// synchronize the meta information with the file
-	ofstream out(this->path());
-	std::streamsize size = 0;
-
-	// rewrite header since the archive size has changed
-	this->m_size -= compressedSize;
-
-	if (!writeHeader(out, size))
+	if (!block->empty() && !block->unused())
 	{
+		this->m_freeSpace.insert(block->largeOffset(), block->blockSize());
 	}
 
-	// rewrite both tables, since they are encrypted the whole tables have to be rewritten
-	out.seekp(this->m_startPosition + this->m_blockTableOffset);
+	block->remove();
 
-	// write the whole block table since it is encrypted
-	if (!writeBlockTable(out, size))
+	/*
+	 * If the next entry is empty, mark this one as empty; otherwise, mark this as deleted.
+	 * Otherwise the search for other files of the same collision chain would stop at this entry.
+	 */
+	const uint32 nextIndex = (hash->index() + 1) % this->m_hashTable.size();
+
+	if (nextIndex == hash->index() || this->m_hashTable.hash(nextIndex)->empty())
 	{
-		return false;
+		hash->remove();
 	}
+	else
+	{
+		hash->setBlock(0);
+		hash->setDeleted(true);
+	}
+
+	this->m_hashTable.update(*hash);
 
-	// TODO dont rewrite everything look at DeleteFile() from the specification, just NULL the entry and make the previous empty different?
-	out.seekp(this->m_startPosition + this->m_hashTableOffset);
+	// synchronize the meta information with the file
+	// open the existing file without truncating it
+	ofstream out(this->path(), std::ios::in | std::ios::out | std::ios::binary);
+	std::streamsize size = 0;
 
-	if (!writeHashTable(out, size))
+	// the archive size does not change since the freed space is only reused by files which are added later
+	// since the tables are encrypted they have to be rewritten starting with the changed entries
+	if (!writeBlockTable(out, size, block->index()) || !writeHashTable(out, size, hash->index()))
 	{
 		return false;
 	}
 
-	// don't free any space, otherwise it takes longer
+	out.close();
+	this->remap();
 
 	return true;
 }
 
 File Archive::addFile(const boost::filesystem::path &filePath, const byte *data, uint64 dataSize, Sector::Compression compression, Block::Flags flags, File::Locale locale, File::Platform platform)
 {
-	/*
-	 * Get a free block for the file data and a free hash for the hash data of the file path etc.
-	 */
-	Hash *hash = firstFreeHash();
+	NewFiles files;
+	files.push_back(NewFile(filePath, data, dataSize, compression, flags, locale, platform));
 
-	/*
-	 * If there is no free hash or block then the table is too small and no further file can be added.
-	 */
-	if (hash == nullptr)
+	return this->addFiles(files).front();
+}
+
+Archive::NewFile::NewFile()
+: data(0)
+, size(0)
+, compression(Sector::Compression::Uncompressed)
+, compressionLevel(Sector::defaultCompressionLevel)
+, waveCompressionLevel(Sector::defaultWaveCompressionLevel)
+, autoCompression(false)
+, flags(Block::Flags::None)
+, locale(File::Locale::Neutral)
+, platform(File::Platform::Default)
+{
+}
+
+Archive::NewFile::NewFile(const boost::filesystem::path &path, const byte *data, uint64 size, Sector::Compression compression, Block::Flags flags, File::Locale locale, File::Platform platform)
+: path(path)
+, data(data)
+, size(size)
+, compression(compression)
+, compressionLevel(Sector::defaultCompressionLevel)
+, waveCompressionLevel(Sector::defaultWaveCompressionLevel)
+, autoCompression(false)
+, flags(flags)
+, locale(locale)
+, platform(platform)
+{
+}
+
+namespace
+{
+
+/*
+ * Returns the compression of the existing file \p file that its data can be replaced without changing it.
+ * Sectors which could not be compressed are stored without the compression byte, so the first compressed sector has to be decompressed.
+ * Deflated is assumed if no sector is compressed.
+ */
+Sector::Compression fileCompression(File &file)
+{
+	if (file.isImploded())
 	{
-		throw TooSmallHashTableException();
+		return Sector::Compression::Imploded;
 	}
 
-	Block *block = firstFreeBlock();
-
-	if (block == nullptr)
+	if (!file.isCompressed())
 	{
-		throw TooSmallBlockTableException();
+		return Sector::Compression::Uncompressed;
 	}
 
-	/*
-	 * Store the written sectors
-	 */
-	Sector::Sectors sectors;
+	ifstream in(file.archive()->path(), std::ios_base::in | std::ios_base::binary);
 
-	/*
-	 * Compress the whole input data at once with the specified flags and compression type.
-	 */
-	uint32 compressedSize = 0;
-	boost::scoped_array<byte> compressedData(Sector::compress(data, dataSize, flags, compression, compressedSize));
+	if (!in)
+	{
+		throw Exception(boost::format(_("Unable to open file %1%.")) % file.archive()->path());
+	}
 
-	/*
-	 * The filename is required to generate sector keys for encrypted files.
-	 */
-	string fileName = filePath.string();
-	Listfile::toListfileEntry(fileName);
+	Sector::Sectors sectors;
+	file.sectors(in, sectors);
 
-	// write sector table
-	if (Block::hasSectorOffsetTable(flags))
+	BOOST_FOREACH(Sector::Sectors::const_reference sector, sectors)
 	{
-		uint32 sectorIndex = 0;
-		uint32 sectorOffset = 0;
-
-		while (sectorOffset < compressedSize)
+		if (sector.compressionSucceded())
 		{
-			const uint32 remainingSize = compressedSize - sectorOffset;
-			uint32 sectorSize = std::min<uint32>(this->sectorSize(), remainingSize);
-
-			if (compression != Sector::Compression::Uncompressed)
-			{
-				++sectorSize;
-			}
-
-			// TODO how to calculate uncompressed size?
-			sectors.push_back(Sector(this, block, fileName, sectorIndex, sectorOffset, sectorSize, 0, compression));
-
-			sectorOffset += sectorSize;
-			++sectorIndex;
+			std::vector<byte> data(sector.sectorSize());
+			std::vector<byte> buffer(sector.uncompressedSize());
+			std::streamsize size = 0;
+			in.seekg(sector.position());
+			wc3lib::read(in, data[0], size, sector.sectorSize());
+			// the compression byte is read by the decompression
+			sector.decompress(data.data(), sector.sectorSize(), buffer.data(), sector.uncompressedSize());
+
+			return sector.compression();
 		}
 	}
-	// write single block data without sector table
-	else
-	{
-		// The compression byte is stored as well for compressed sectors BUT is written in writeCompressed() not here.
-		const uint32 sectorSize = compression == Sector::Compression::Uncompressed ? compressedSize : compressedSize + 1;
-		sectors.push_back(Sector(this, block, fileName, 0, 0, sectorSize, dataSize, compression));
-	}
 
-	/*
-	 * Calculate the complete offset of the used block for writing the data at the correct position into the file.
-	 * The newly calculated offset should be the end of the archive.
-	 */
-	uint32 blockOffset = 0;
-	uint16 extendedBlockOffset = 0;
-	nextBlockOffsets(blockOffset,  extendedBlockOffset);
-	// At this offset the sector table starts.
-	const uint64 completeBlockOffset = blockOffset + (((uint64)extendedBlockOffset) << 32);
+	return Sector::Compression::Deflated;
+}
 
-	// prepare the block entry
-	block->setBlockOffset(blockOffset);
-	block->setExtendedBlockOffset(extendedBlockOffset);
-	// the flags are required by Sector::writeCompressed()!
-	block->setFlags(flags);
+/*
+ * The compressed but not yet encrypted data of one added file.
+ * It can only be encrypted when its block offset is known.
+ */
+struct CompressedFile
+{
+	string path;
+	Block::Flags flags;
+	uint32 fileSize;
+	std::vector<uint32> sectorOffsets;
+	std::vector<byte> data;
+	CRC32 crc32;
+	MD5Checksum md5;
+};
+
+}
+
+Hash* Archive::usedHash(const NewFile &file)
+{
+	string path = file.path.string();
+	Listfile::toListfileEntry(path);
+	Hash *hash = this->findHash(path, file.locale, file.platform);
+
+	if (hash == 0 || hash->deleted() || hash->block() == 0)
+	{
+		return 0;
+	}
+
+	return hash;
+}
+
+void Archive::replaceBlockData(ostream &out, Block *block, const string &path, const byte *data, uint32 dataSize, Sector::Compression compression, FreeSpace::Extents &releasedSpace)
+{
+	std::vector<uint32> sectorOffsets;
+	std::vector<byte> compressedData;
+	Sector::compressSectors(data, dataSize, this->sectorSize(), block->flags(), compression, sectorOffsets, compressedData, this->threads());
+
+	// the previous data is kept until the block refers to the new data in the file
+	releasedSpace.insert(std::make_pair(block->largeOffset(), uint64(block->blockSize())));
+	const uint64 completeBlockOffset = this->allocateBlock(Sector::blockSize(sectorOffsets, compressedData, block->flags()));
+	const uint32 blockOffset = uint32(completeBlockOffset);
+	const uint16 extendedBlockOffset = boost::numeric_cast<uint16>(completeBlockOffset >> 32);
+	const uint32 fileKey = (block->flags() & Block::Flags::IsEncrypted) ? Block::fileKey(Listfile::fileName(path), block->flags(), blockOffset, dataSize) : 0;
+	out.seekp(this->startPosition() + completeBlockOffset);
+	const uint32 blockSize = boost::numeric_cast<uint32>(Sector::writeBlock(out, sectorOffsets, compressedData, block->flags(), fileKey));
+
+	this->m_sectorCache.remove(block->index());
+	block->setBlockOffset(blockOffset);
+	block->setExtendedBlockOffset(extendedBlockOffset);
+	block->setBlockSize(blockSize);
+	block->setFileSize(dataSize);
+}
+
+std::vector<File> Archive::addFiles(NewFiles &files)
+{
+	this->checkModifiable();
 
 	/*
-	 * Write data to the end of the archive.
+	 * Check if there is enough space in both tables before anything is compressed or written.
+	 * Files which exist already keep their entries.
 	 */
-	ofstream out(this->path());
-	// Start at the position of the sector table.
-	out.seekp(completeBlockOffset);
-	uint32 fileSize = 0; // uncompressed size
-	uint32 blockSize = 0; // compressed size
+	std::size_t newEntries = 0;
+
+	BOOST_FOREACH(NewFiles::const_reference file, files)
+	{
+		if (this->usedHash(file) == 0)
+		{
+			++newEntries;
+		}
+	}
+
+	std::size_t freeHashes = 0;
 
-	// Write the sector table before writing the actual file data.
-	// TODO does the block size include the size of the sector table?
-	blockSize += Sector::writeSectors(out, sectors, flags, compressedSize, dataSize, blockOffset, filePath.string().c_str());
+	BOOST_FOREACH(HashTable::Entries::const_reference entry, this->m_hashTable.entries())
+	{
+		if (entry.fileBlockIndex == Hash::blockIndexEmpty || entry.fileBlockIndex == Hash::blockIndexDeleted)
+		{
+			++freeHashes;
+		}
+	}
+
+	if (freeHashes < newEntries)
+	{
+		throw TooSmallHashTableException();
+	}
+
+	std::size_t freeBlocks = 0;
+
+	BOOST_FOREACH(const Block &block, this->blocks())
+	{
+		if (block.empty() || block.unused())
+		{
+			++freeBlocks;
+		}
+	}
+
+	if (freeBlocks < newEntries)
+	{
+		throw TooSmallBlockTableException();
+	}
 
 	/*
-	 * Write all sectors data into the archive and use all block space.
+	 * The "(listfile)" and "(attributes)" files are updated if the archive contains them.
+	 * They are read before anything is written.
 	 */
-	BOOST_FOREACH(Sector::Sectors::reference ref, sectors)
+	Hash *listfileHash = this->findHash("(listfile)");
+	Listfile::Entries listfileEntries;
+	Sector::Compression listfileCompression = Sector::Compression::Uncompressed;
+
+	if (listfileHash != 0)
 	{
-		const uint32 sectorOffset = ref.sectorOffset();
-		const uint32 sectorSize = ref.sectorSize(); // compressed size
-		// since our data is already compressed it only has to be encrypted (if the file is encrypted) and the compression type has to be stored if the file is compressed
-		ref.writeCompressed(&compressedData[sectorOffset], sectorSize, out);
+		Listfile listfile = this->listfileFile();
+		listfileEntries = listfile.entries();
+		listfileCompression = fileCompression(listfile);
+	}
+
+	Hash *attributesHash = this->findHash("(attributes)");
+	int32 attributesVersion = 0;
+	Attributes::ExtendedAttributes extendedAttributes = Attributes::ExtendedAttributes::None;
+	Attributes::Crc32s crcs;
+	Attributes::FileTimes fileTimes;
+	Attributes::Md5s md5s;
+	Sector::Compression attributesCompression = Sector::Compression::Uncompressed;
 
-		fileSize += ref.uncompressedSize();
-		blockSize += sectorSize;
+	if (attributesHash != 0)
+	{
+		try
+		{
+			Attributes attributes = this->attributesFile();
+			attributes.attributes(attributesVersion, extendedAttributes, crcs, fileTimes, md5s);
+			attributesCompression = fileCompression(attributes);
+		}
+		// corrupted attributes are not updated
+		catch (const Exception &)
+		{
+			attributesHash = 0;
+		}
+
+		// every block which might be used by the new files requires an entry
+		const std::size_t blocksCount = this->blocks().size();
+
+		if ((!crcs.empty() && crcs.size() < blocksCount) || (!fileTimes.empty() && fileTimes.size() < blocksCount) || (!md5s.empty() && md5s.size() < blocksCount))
+		{
+			throw Exception(boost::format(_("The \"(attributes)\" file of archive %1% has less entries than the block table.")) % this->path());
+		}
 	}
 
 	/*
-	 * Remove old hash entry to update its hash key.
+	 * All files are compressed concurrently.
+	 * A single file is compressed sector by sector by all threads instead.
 	 */
-	HashData oldHashData = hash->hashData();
-	Hashes::iterator iterator = this->m_hashes.find(oldHashData);
+	const unsigned threads = this->threads() == 0 ? defaultThreads() : this->threads();
+	const unsigned sectorThreads = files.size() == 1 ? threads : 1;
+	std::vector<CompressedFile> compressedFiles(files.size());
+	this->m_compressionSelection.setSectorSize(this->sectorSize());
+	CompressionSelection compressionSelection = this->compressionSelection();
+
+	// Warcraft III cannot read archives of format 3 or newer anyway
+	if (this->format() >= Format::Mpq3)
+	{
+		compressionSelection.setExtendedCompressions(true);
+	}
 
-	if (iterator == this->m_hashes.end())
+	parallelFor(files.size(), threads, [&](std::size_t i)
 	{
-		throw Exception();
+		NewFile &file = files[i];
+		CompressedFile &compressedFile = compressedFiles[i];
+		// the filename is required to generate the file key for encrypted files
+		compressedFile.path = file.path.string();
+		Listfile::toListfileEntry(compressedFile.path);
+
+		try
+		{
+			compressedFile.fileSize = boost::numeric_cast<uint32>(file.size);
+
+			if (file.autoCompression)
+			{
+				const CompressionSelection::Result selection = compressionSelection.select(compressedFile.path, file.data, compressedFile.fileSize);
+				file.compression = selection.compression;
+				file.compressionLevel = selection.compressionLevel;
+				file.waveCompressionLevel = selection.waveCompressionLevel;
+			}
+
+			compressedFile.flags = Sector::fileFlags(file.flags, file.compression);
+			Sector::compressSectors(file.data, compressedFile.fileSize, this->sectorSize(), compressedFile.flags, file.compression, compressedFile.sectorOffsets, compressedFile.data, sectorThreads, file.waveCompressionLevel, file.compressionLevel);
+
+			if (attributesHash != 0)
+			{
+				compressedFile.crc32 = Attributes::crc32(file.data, file.size);
+				compressedFile.md5 = Attributes::md5(file.data, file.size);
+			}
+		}
+		catch (std::exception &exception)
+		{
+			throw Exception(boost::format(_("Error on compressing file %1%:\n%2%")) % compressedFile.path % exception.what());
+		}
+	});
+
+	/*
+	 * The new paths are appended to the "(listfile)" file.
+	 */
+	const bool updateListfile = listfileHash != 0 && listfileHash->block() != 0;
+	string listfileContent;
+
+	if (updateListfile)
+	{
+		std::set<string> knownEntries;
+
+		BOOST_FOREACH(Listfile::Entries::const_reference entry, listfileEntries)
+		{
+			knownEntries.insert(boost::to_upper_copy(entry));
+		}
+
+		BOOST_FOREACH(std::vector<CompressedFile>::const_reference compressedFile, compressedFiles)
+		{
+			if (knownEntries.insert(boost::to_upper_copy(compressedFile.path)).second)
+			{
+				listfileEntries.push_back(compressedFile.path);
+			}
+		}
+
+		listfileContent = Listfile::content(listfileEntries);
 	}
 
-	// store old hash for reinserting it
-	// TODO dont copy but rather transfer the pointer into the autopointer!
-	std::unique_ptr<Hash> newHash(new Hash(*iterator->second));
-	this->m_hashes.erase(iterator);
+	const bool updateAttributes = attributesHash != 0 && attributesHash->block() != 0;
 
 	/*
-	 * Prepare the updated hash entry.
+	 * Format 1 cannot store offsets beyond 32 bits which has to be checked before anything is changed.
+	 * Every block is either written into the free space or appended, so the archive grows by the size of all blocks at most.
+	 * The "(listfile)" and "(attributes)" files are compressed later but their sectors are never bigger than the uncompressed data.
 	 */
-	HashData hashData(filePath, locale, platform);
-	newHash->setHashData(hashData);
-	newHash->setBlock(block);
-	newHash->setDeleted(false);
+	if (this->format() == Archive::Format::Mpq1)
+	{
+		uint64 maximumSize = std::max<uint64>(this->size(), this->nextBlockOffset());
+
+		BOOST_FOREACH(std::vector<CompressedFile>::const_reference compressedFile, compressedFiles)
+		{
+			maximumSize += Sector::blockSize(compressedFile.sectorOffsets, compressedFile.data, compressedFile.flags);
+		}
+
+		if (updateListfile)
+		{
+			maximumSize += listfileContent.size() + (listfileContent.size() / this->sectorSize() + 3) * sizeof(uint32);
+		}
+
+		if (updateAttributes)
+		{
+			const uint64 attributesSize = sizeof(ExtendedAttributesHeader) + crcs.size() * sizeof(CRC32) + fileTimes.size() * sizeof(FILETIME) + md5s.size() * sizeof(MD5Checksum);
+			maximumSize += attributesSize + (attributesSize / this->sectorSize() + 3) * sizeof(uint32);
+		}
 
-	// update the hash key in the hash table
-	this->m_hashes.insert(hashData, std::move(newHash));
+		if (maximumSize > std::numeric_limits<uint32>::max())
+		{
+			throw Exception(boost::format(_("Archive %1% is too big for MPQ format 1.")) % this->path());
+		}
+	}
 
 	/*
-	 * Prepare the updated block entry.
+	 * The blocks are written in order into the free space or at the end of the archive.
+	 * Only the table entries starting with the first changed ones are written again.
 	 */
-	block->setBlockSize(blockSize);
-	block->setFileSize(fileSize);
+	uint32 firstBlock = boost::numeric_cast<uint32>(this->blocks().size());
+	uint32 firstHash = boost::numeric_cast<uint32>(this->m_hashTable.size());
+
+	// open the existing file without truncating it
+	ofstream out(this->path(), std::ios::in | std::ios::out | std::ios::binary);
+
+	if (!out)
+	{
+		throw Exception(boost::format(_("Unable to open file \"%1%\".")) % this->path());
+	}
+
+	/*
+	 * The data of replaced files becomes free space only after the tables refer to the new data.
+	 * Otherwise the new data might overwrite the old one and the file would be lost if writing stops in between.
+	 */
+	FreeSpace::Extents releasedSpace;
+
+	for (std::size_t i = 0; i < files.size(); ++i)
+	{
+		const NewFile &file = files[i];
+		CompressedFile &compressedFile = compressedFiles[i];
+		// a file might occur twice
+		Hash *hash = this->usedHash(file);
+		const bool replace = hash != 0;
+		Block *block = 0;
+
+		if (replace)
+		{
+			block = hash->block();
+			releasedSpace.insert(std::make_pair(block->largeOffset(), uint64(block->blockSize())));
+		}
+		else
+		{
+			const HashValues values = HashStrings(Archive::cryptTable(), compressedFile.path.c_str());
+			hash = this->firstFreeHash(values.tableOffset);
+			block = this->firstFreeBlock();
+		}
+
+		firstBlock = std::min(firstBlock, block->index());
+		firstHash = std::min(firstHash, hash->index());
+
+		/*
+		 * Calculate the complete offset of the used block for writing the data at the correct position into the file.
+		 */
+		const uint64 completeBlockOffset = this->allocateBlock(Sector::blockSize(compressedFile.sectorOffsets, compressedFile.data, compressedFile.flags));
+		const uint32 blockOffset = uint32(completeBlockOffset);
+		const uint16 extendedBlockOffset = boost::numeric_cast<uint16>(completeBlockOffset >> 32);
+
+		// the block might have been used by a removed file before
+		this->m_sectorCache.remove(block->index());
+
+		const uint32 fileKey = (compressedFile.flags & Block::Flags::IsEncrypted) ? Block::fileKey(Listfile::fileName(compressedFile.path), compressedFile.flags, blockOffset, compressedFile.fileSize) : 0;
+		out.seekp(this->startPosition() + completeBlockOffset);
+		const uint32 blockSize = boost::numeric_cast<uint32>(Sector::writeBlock(out, compressedFile.sectorOffsets, compressedFile.data, compressedFile.flags, fileKey));
+		// release the data of the written file
+		std::vector<byte>().swap(compressedFile.data);
+
+		block->setBlockOffset(blockOffset);
+		block->setExtendedBlockOffset(extendedBlockOffset);
+		block->setBlockSize(blockSize);
+		block->setFileSize(compressedFile.fileSize);
+		block->setFlags(compressedFile.flags);
+
+		/*
+		 * Replaced files keep their hash entry.
+		 * Otherwise the old hash entry is removed to update its hash key.
+		 */
+		if (!replace)
+		{
+			HashData oldHashData = hash->hashData();
+			// empty hashes share the same hash data, so the exact instance has to be found
+			boost::iterator_range<Hashes::iterator> range = this->m_hashes.equal_range(oldHashData);
+			Hashes::iterator iterator = range.begin();
+
+			while (iterator != range.end() && iterator->second != hash)
+			{
+				++iterator;
+			}
+
+			if (iterator == range.end())
+			{
+				throw Exception();
+			}
+
+			// store old hash for reinserting it
+			std::unique_ptr<Hash> newHash(new Hash(*iterator->second));
+			this->m_hashes.erase(iterator);
+
+			/*
+			 * Prepare the updated hash entry.
+			 */
+			HashData hashData(compressedFile.path, file.locale, file.platform);
+			newHash->setHashData(hashData);
+			newHash->setBlock(block);
+			newHash->setDeleted(false);
+
+			// update the hash key in the hash table
+			this->m_hashTable.set(newHash.get());
+			this->m_hashes.insert(hashData, std::move(newHash));
+		}
+
+		if (!crcs.empty())
+		{
+			crcs[block->index()] = compressedFile.crc32;
+		}
+
+		if (!md5s.empty())
+		{
+			md5s[block->index()] = compressedFile.md5;
+		}
+
+		if (!fileTimes.empty())
+		{
+			fileTimes[block->index()].lowDateTime = 0;
+			fileTimes[block->index()].highDateTime = 0;
+		}
+	}
+
+	// the content of the "(listfile)" file has been prepared before anything was written
+	if (updateListfile)
+	{
+		Block *block = listfileHash->block();
+		this->replaceBlockData(out, block, "(listfile)", listfileContent.data(), boost::numeric_cast<uint32>(listfileContent.size()), listfileCompression, releasedSpace);
+		firstBlock = std::min(firstBlock, block->index());
+
+		if (!crcs.empty())
+		{
+			crcs[block->index()] = Attributes::crc32(listfileContent.data(), listfileContent.size());
+		}
+
+		if (!md5s.empty())
+		{
+			md5s[block->index()] = Attributes::md5(listfileContent.data(), listfileContent.size());
+		}
+	}
+
+	/*
+	 * The checksums of the new blocks are stored in the "(attributes)" file.
+	 */
+	if (updateAttributes)
+	{
+		ostringstream stream;
+		std::streamsize attributesSize = 0;
+		ExtendedAttributesHeader extendedAttributesHeader;
+		extendedAttributesHeader.version = attributesVersion;
+		extendedAttributesHeader.attributesPresent = static_cast<uint32>(extendedAttributes);
+		wc3lib::write(stream, extendedAttributesHeader, attributesSize);
+
+		BOOST_FOREACH(Attributes::Crc32s::const_reference crc, crcs)
+		{
+			wc3lib::write(stream, crc, attributesSize);
+		}
+
+		BOOST_FOREACH(Attributes::FileTimes::const_reference fileTime, fileTimes)
+		{
+			wc3lib::write(stream, fileTime, attributesSize);
+		}
+
+		BOOST_FOREACH(Attributes::Md5s::const_reference md5, md5s)
+		{
+			wc3lib::write(stream, md5, attributesSize);
+		}
+
+		const string content = stream.str();
+		this->replaceBlockData(out, attributesHash->block(), "(attributes)", content.data(), boost::numeric_cast<uint32>(content.size()), attributesCompression, releasedSpace);
+		firstBlock = std::min(firstBlock, attributesHash->block()->index());
+	}
 
 	// write the tables to the output file that the archive file is up to date
 	std::streamsize size = 0;
 
-	// write the whole block table since it is encrypted
 	// seeks automatically with seekp
-	if (!writeBlockTable(out, size))
+	if (!writeBlockTable(out, size, firstBlock) || (this->format() == Archive::Format::Mpq2 && !writeExtendedBlockTable(out, size)) || !writeHashTable(out, size, firstHash) || !writeHeader(out, size))
 	{
-		return File();
+		throw Exception(boost::format(_("Unable to write the tables of archive %1%.")) % this->path());
 	}
 
-	// seeks automatically with seekp
-	if (!writeHashTable(out, size))
+	out.close();
+
+	BOOST_FOREACH(FreeSpace::Extents::const_reference extent, releasedSpace)
 	{
-		return File();
+		this->m_freeSpace.insert(extent.first, extent.second);
 	}
 
-	// update the header since the whole archive size has changed
-	this->m_size += blockSize; // add the compressed size
+	this->remap();
 
-	// seeks automatically with seekp
-	if (!writeHeader(out, size))
+	// the resulting files should be available now since the hash table entries have been updated
+	std::vector<File> result;
+	result.reserve(files.size());
+
+	BOOST_FOREACH(NewFiles::const_reference file, files)
 	{
-		return File();
+		result.push_back(this->findFile(file.path, file.locale, file.platform));
 	}
 
-	// the resulting file should be available now since the hash table entry has been updated
-	return findFile(filePath, locale, platform);
+	return result;
+}
+
+namespace
+{
+
+/*
+ * Decrypts all encrypted parts of the raw block data \p data with the file key \p oldKey and encrypts them with \p newKey.
+ * The parts are the sector offset table (if there is one) and all sectors.
+ */
+void reencryptBlock(std::vector<byte> &data, const Block &block, uint32 sectorSize, uint32 oldKey, uint32 newKey)
+{
+	if (Block::hasSectorOffsetTable(block.flags()))
+	{
+		const uint32 sectorsCount = block.fileSize() / sectorSize + (block.fileSize() % sectorSize > 0 ? 1 : 0);
+		const uint32 offsetsSize = sectorsCount + 1;
+		const uint32 tableSize = offsetsSize * sizeof(uint32);
+
+		if (tableSize > data.size())
+		{
+			throw Exception(boost::format(_("Sector offset table of block %1% exceeds the block size.")) % block.index());
+		}
+
+		std::vector<uint32> offsets(offsetsSize);
+		DecryptData(Archive::cryptTable(), &data[0], tableSize, oldKey - 1);
+		memcpy(&offsets[0], &data[0], tableSize);
+		EncryptData(Archive::cryptTable(), &data[0], tableSize, newKey - 1);
+
+		for (uint32 i = 0; i < sectorsCount; ++i)
+		{
+			if (offsets[i] > offsets[i + 1] || offsets[i + 1] > data.size())
+			{
+				throw Exception(boost::format(_("Invalid offset of sector %1% of block %2%.")) % i % block.index());
+			}
+
+			DecryptData(Archive::cryptTable(), &data[offsets[i]], offsets[i + 1] - offsets[i], oldKey + i);
+			EncryptData(Archive::cryptTable(), &data[offsets[i]], offsets[i + 1] - offsets[i], newKey + i);
+		}
+	}
+	// a single unit file only has one sector and uncompressed sectors all have the archive's sector size
+	else
+	{
+		const std::size_t unitSize = (block.flags() & Block::Flags::IsSingleUnit) ? data.size() : sectorSize;
+
+		for (std::size_t offset = 0, i = 0; offset < data.size(); offset += unitSize, ++i)
+		{
+			const uint32 size = boost::numeric_cast<uint32>(std::min(unitSize, data.size() - offset));
+			DecryptData(Archive::cryptTable(), &data[offset], size, oldKey + i);
+			EncryptData(Archive::cryptTable(), &data[offset], size, newKey + i);
+		}
+	}
+}
+
+}
+
+std::streamsize Archive::compact(const Listfile::Entries &entries)
+{
+	if (!this->isOpen())
+	{
+		throw Exception(_("Archive is not open."));
+	}
+
+	this->checkModifiable();
+
+	/*
+	 * Only blocks which are referenced by used hash entries are kept.
+	 * They are written in the order of their current offsets that the archive file is read sequentially.
+	 */
+	const UsedBlocks usedBlocks = this->usedBlocks();
+	std::vector<Block*> liveBlocks;
+
+	BOOST_FOREACH(UsedBlocks::const_reference usedBlock, usedBlocks)
+	{
+		liveBlocks.push_back(usedBlock.first);
+	}
+
+	const uint64 headerSize = Archive::headerSize(this->format());
+	const uint64 blockTableOffset = headerSize;
+	const uint64 extendedBlockTableOffset = blockTableOffset + this->blocks().size() * sizeof(BlockTableEntry);
+	const uint64 hashTableOffset = extendedBlockTableOffset + (this->format() == Archive::Format::Mpq2 ? this->blocks().size() * sizeof(ExtendedBlockTableEntry) : 0);
+	uint64 offset = hashTableOffset + this->m_hashTable.size() * sizeof(HashTableEntry);
+
+	std::vector<uint64> newOffsets(liveBlocks.size());
+
+	for (std::size_t i = 0; i < liveBlocks.size(); ++i)
+	{
+		newOffsets[i] = offset;
+		offset += liveBlocks[i]->blockSize();
+	}
+
+	if (this->format() == Archive::Format::Mpq1 && offset > std::numeric_limits<uint32>::max())
+	{
+		throw Exception(boost::format(_("Archive size %1% is too big for the format 1.")) % offset);
+	}
+
+	/*
+	 * Resolve the names of all blocks which have to be encrypted again before anything is written.
+	 */
+	const PathsByHash paths = this->resolvePaths(entries);
+	std::map<const Block*, string> fileNames;
+
+	for (std::size_t i = 0; i < liveBlocks.size(); ++i)
+	{
+		const Block *block = liveBlocks[i];
+
+		if ((block->flags() & Block::Flags::IsEncrypted) && (block->flags() & Block::Flags::UsesEncryptionKey) && newOffsets[i] != block->largeOffset())
+		{
+			// the path might be known for any of the hashes which refer to the block
+			std::vector<string> blockPaths;
+			this->blockFile(usedBlocks[i].second, paths, blockPaths);
+
+			if (blockPaths.empty())
+			{
+				throw Exception(boost::format(_("Unknown name of encrypted block %1% which has to be moved. Specify its file path.")) % block->index());
+			}
+
+			fileNames[block] = Listfile::fileName(blockPaths.front());
+		}
+	}
+
+	const boost::filesystem::path path = this->path();
+	const boost::filesystem::path temporaryPath = path.string() + ".compact";
+	const bool mapped = this->isMapped();
+
+	try
+	{
+		boost::scoped_ptr<ifstream> in;
+
+		if (!this->isMapped())
+		{
+			in.reset(new ifstream(path, std::ios::in | std::ios::binary));
+
+			if (!*in)
+			{
+				throw Exception(boost::format(_("Unable to open file \"%1%\".")) % path);
+			}
+		}
+
+		ofstream out(temporaryPath, std::ios::out | std::ios::binary);
+
+		if (!out)
+		{
+			throw Exception(boost::format(_("Unable to create file \"%1%\".")) % temporaryPath);
+		}
+
+		std::vector<byte> buffer;
+
+		// reads the raw data from the current archive file at absolute position
+		auto readRaw = [&](uint64 position, std::size_t size)
+		{
+			buffer.resize(size);
+
+			if (size == 0)
+			{
+				return;
+			}
+
+			if (this->isMapped())
+			{
+				memcpy(&buffer[0], this->mappedData(position, size), size);
+			}
+			else
+			{
+				in->seekg(boost::numeric_cast<std::streamoff>(position));
+				std::streamsize bytes = 0;
+				wc3lib::read(*in, buffer[0], bytes, size);
+
+				if (bytes != boost::numeric_cast<std::streamsize>(size))
+				{
+					throw Exception(boost::format(_("Unable to read %1% bytes at position %2% from archive %3%.")) % size % position % path);
+				}
+			}
+		};
+
+		std::streamsize size = 0;
+
+		// keep any data in front of the archive such as the header of a Warcraft III map
+		if (this->startPosition() > 0)
+		{
+			readRaw(0, boost::numeric_cast<std::size_t>(this->startPosition()));
+			wc3lib::write(out, buffer[0], size, buffer.size());
+		}
+
+		// the tables are written at the end since the blocks have to be changed first
+		out.seekp(boost::numeric_cast<std::streamoff>(this->startPosition() + hashTableOffset + this->m_hashTable.size() * sizeof(HashTableEntry)));
+
+		for (std::size_t i = 0; i < liveBlocks.size(); ++i)
+		{
+			const Block *block = liveBlocks[i];
+			readRaw(this->startPosition() + block->largeOffset(), block->blockSize());
+
+			if ((block->flags() & Block::Flags::IsEncrypted) && (block->flags() & Block::Flags::UsesEncryptionKey) && newOffsets[i] != block->largeOffset())
+			{
+				const string &fileName = fileNames[block];
+				const uint32 oldKey = Block::fileKey(fileName, block->flags(), block->blockOffset(), block->fileSize());
+				const uint32 newKey = Block::fileKey(fileName, block->flags(), static_cast<uint32>(newOffsets[i]), block->fileSize());
+				reencryptBlock(buffer, *block, this->sectorSize(), oldKey, newKey);
+			}
+
+			if (!buffer.empty())
+			{
+				wc3lib::write(out, buffer[0], size, buffer.size());
+			}
+		}
+
+		if (in.get() != 0)
+		{
+			in->close();
+		}
+
+		/*
+		 * Now the blocks and the archive meta data can be changed since the data has been copied successfully.
+		 */
+		std::set<const Block*> liveBlocksSet(liveBlocks.begin(), liveBlocks.end());
+
+		BOOST_FOREACH(Blocks::reference block, this->m_blocks)
+		{
+			if (liveBlocksSet.find(&block) == liveBlocksSet.end())
+			{
+				block.remove();
+				block.setBlockOffset(0);
+				block.setExtendedBlockOffset(0);
+				block.setBlockSize(0);
+			}
+		}
+
+		for (std::size_t i = 0; i < liveBlocks.size(); ++i)
+		{
+			liveBlocks[i]->setBlockOffset(static_cast<uint32>(newOffsets[i]));
+			liveBlocks[i]->setExtendedBlockOffset(boost::numeric_cast<uint16>(newOffsets[i] >> 32));
+		}
+
+		this->m_size = boost::numeric_cast<std::size_t>(offset);
+		this->m_blockTableOffset = blockTableOffset;
+		this->m_extendedBlockTableOffset = this->format() == Archive::Format::Mpq2 ? extendedBlockTableOffset : 0;
+		this->m_hashTableOffset = hashTableOffset;
+
+		if (!this->writeHeader(out, size) || !this->writeBlockTable(out, size) || (this->format() == Archive::Format::Mpq2 && !this->writeExtendedBlockTable(out, size)) || !this->writeHashTable(out, size))
+		{
+			throw Exception(_("Error on writing tables."));
+		}
+
+		out.close();
+
+		if (!out)
+		{
+			throw Exception(boost::format(_("Error on writing file \"%1%\".")) % temporaryPath);
+		}
+
+		// the mapping has to be released before the file is replaced
+		this->close();
+		boost::filesystem::rename(temporaryPath, path);
+	}
+	catch (...)
+	{
+		boost::system::error_code error;
+		boost::filesystem::remove(temporaryPath, error);
+		// restore the unchanged state of the archive
+		this->open(path, mapped);
+
+		throw;
+	}
+
+	this->open(path, mapped);
+
+	return boost::numeric_cast<std::streamsize>(this->size());
+}
+
+std::size_t Archive::forEachBlock(const BlockFunction &function, const Listfile::Entries &entries, bool decompress)
+{
+	if (!this->isOpen())
+	{
+		throw Exception(_("Archive is not open."));
+	}
+
+	const PathsByHash paths = this->resolvePaths(entries);
+	const UsedBlocks usedBlocks = this->usedBlocks();
+	boost::scoped_ptr<ifstream> in;
+
+	if (decompress && !this->isMapped())
+	{
+		in.reset(new ifstream(this->path(), std::ios::in | std::ios::binary));
+
+		if (!*in)
+		{
+			throw Exception(boost::format(_("Unable to open file \"%1%\".")) % this->path());
+		}
+	}
+
+	// the buffer is reused for all blocks
+	std::vector<byte> buffer;
+	std::size_t count = 0;
+
+	BOOST_FOREACH(UsedBlocks::const_reference usedBlock, usedBlocks)
+	{
+		BlockContent content;
+		content.block = usedBlock.first;
+		content.data = 0;
+		content.size = 0;
+		content.file = this->blockFile(usedBlock.second, paths, content.paths);
+
+		if (!decompress)
+		{
+			content.error = _("Data has not been decompressed.");
+		}
+		else if (content.paths.empty() && (content.block->flags() & Block::Flags::IsEncrypted))
+		{
+			content.error = _("Unknown path of encrypted file.");
+		}
+		else
+		{
+			try
+			{
+				if (buffer.size() < content.file.size())
+				{
+					buffer.resize(content.file.size());
+				}
+
+				if (in.get() != nullptr)
+				{
+					content.size = content.file.decompress(*in, buffer.data(), boost::numeric_cast<uint32>(buffer.size()));
+				}
+				else
+				{
+					content.size = content.file.decompress(buffer.data(), boost::numeric_cast<uint32>(buffer.size()));
+				}
+
+				content.data = buffer.data();
+			}
+			catch (const Exception &exception)
+			{
+				content.error = exception.what();
+				content.size = 0;
+			}
+		}
+
+		++count;
+
+		if (!function(content))
+		{
+			break;
+		}
+	}
+
+	return count;
+}
+
+bool Archive::BlockVerification::isValid() const
+{
+	return this->error.empty() && (!this->crc32Checked || this->crc32Valid) && (!this->md5Checked || this->md5Valid);
+}
+
+Archive::BlockVerifications Archive::verify(const Listfile::Entries &entries, unsigned threads)
+{
+	if (!this->isOpen())
+	{
+		throw Exception(_("Archive is not open."));
+	}
+
+	int32 version = 0;
+	Attributes::ExtendedAttributes extendedAttributes = Attributes::ExtendedAttributes::None;
+	Attributes::Crc32s crcs;
+	Attributes::FileTimes fileTimes;
+	Attributes::Md5s md5s;
+
+	if (this->containsAttributesFile())
+	{
+		/*
+		 * A corrupted "(attributes)" file is reported by the verification of its own block.
+		 * All other blocks are verified without checksums in this case.
+		 */
+		try
+		{
+			this->attributesFile().attributes(version, extendedAttributes, crcs, fileTimes, md5s);
+		}
+		catch (const Exception &)
+		{
+			crcs.clear();
+			md5s.clear();
+		}
+
+		if (!(extendedAttributes & Attributes::ExtendedAttributes::FileCrc32s))
+		{
+			crcs.clear();
+		}
+
+		if (!(extendedAttributes & Attributes::ExtendedAttributes::FileMd5s))
+		{
+			md5s.clear();
+		}
+	}
+
+	const PathsByHash paths = this->resolvePaths(entries);
+	const UsedBlocks usedBlocks = this->usedBlocks();
+	BlockVerifications result(usedBlocks.size());
+	std::vector<File> files(usedBlocks.size());
+
+	for (std::size_t i = 0; i < usedBlocks.size(); ++i)
+	{
+		result[i].block = usedBlocks[i].first;
+		files[i] = this->blockFile(usedBlocks[i].second, paths, result[i].paths);
+	}
+
+	MD5Checksum emptyMd5;
+	memset(emptyMd5.checksum, 0, sizeof(emptyMd5.checksum));
+
+	/*
+	 * Every thread requires its own archive file stream if the archive is not memory mapped.
+	 * The streams are reused for all blocks which are verified by the same thread.
+	 */
+	std::mutex streamsMutex;
+	boost::ptr_vector<ifstream> streams;
+
+	parallelFor(usedBlocks.size(), threads, [&](std::size_t i)
+	{
+		BlockVerification &verification = result[i];
+		verification.size = 0;
+		verification.crc32 = 0;
+		memset(verification.md5.checksum, 0, sizeof(verification.md5.checksum));
+		verification.crc32Checked = false;
+		verification.crc32Valid = false;
+		verification.md5Checked = false;
+		verification.md5Valid = false;
+		verification.skipped = false;
+
+		// the file key cannot be calculated without the path
+		if (verification.paths.empty() && (verification.block->flags() & Block::Flags::IsEncrypted))
+		{
+			verification.skipped = true;
+
+			return;
+		}
+
+		std::unique_ptr<ifstream> stream;
+
+		if (!this->isMapped())
+		{
+			{
+				std::lock_guard<std::mutex> lock(streamsMutex);
+
+				if (!streams.empty())
+				{
+					stream.reset(streams.pop_back().release());
+				}
+			}
+
+			if (stream.get() == nullptr)
+			{
+				stream.reset(new ifstream(this->path(), std::ios::in | std::ios::binary));
+			}
+		}
+
+		try
+		{
+			if (stream.get() != nullptr && !*stream)
+			{
+				throw Exception(boost::format(_("Unable to open file \"%1%\".")) % this->path());
+			}
+
+			Attributes::Checksums checksums;
+			verification.size = files[i].decompress([&checksums](const byte *data, uint32 size)
+			{
+				checksums.process(data, size);
+			}, stream.get());
+			verification.crc32 = checksums.crc32();
+			verification.md5 = checksums.md5();
+
+			const uint32 index = verification.block->index();
+
+			if (index < crcs.size() && crcs[index] != 0)
+			{
+				verification.crc32Checked = true;
+				verification.crc32Valid = crcs[index] == verification.crc32;
+			}
+
+			if (index < md5s.size() && !(md5s[index] == emptyMd5))
+			{
+				verification.md5Checked = true;
+				verification.md5Valid = md5s[index] == verification.md5;
+			}
+		}
+		catch (const std::exception &exception)
+		{
+			verification.error = exception.what();
+		}
+
+		// a failed stream is not reused
+		if (stream.get() != nullptr && *stream)
+		{
+			std::lock_guard<std::mutex> lock(streamsMutex);
+			streams.push_back(stream.release());
+		}
+	});
+
+	return result;
 }
 
 Hash* Archive::findHash(const HashData &hashData)
@@ -804,22 +2080,28 @@ const Hash* Archive::findHash(const HashData &hashData) const
 
 Hash* Archive::findHash(const boost::filesystem::path &path, File::Locale locale, File::Platform platform)
 {
-	if (this->hashes().empty())
-	{
-		return 0;
-	}
-
-	return findHash(HashData(path, locale, platform));
+	return const_cast<Hash*>(const_cast<const Archive*>(this)->findHash(path, locale, platform));
 }
 
 const Hash* Archive::findHash(const boost::filesystem::path &path, File::Locale locale, File::Platform platform) const
 {
-	if (this->hashes().empty())
+	if (this->m_hashTable.empty())
 	{
 		return 0;
 	}
 
-	return findHash(HashData(path, locale, platform));
+	// the hashes correspond to the entries of the HET table
+	if (this->m_usesHetTable)
+	{
+		const uint32 index = this->m_hetTable->find(path.string(), *this->m_betTable);
+
+		return index == HetTable::notFound ? 0 : this->m_hashTable.hash(index);
+	}
+
+	// all three hash values are calculated in one single pass
+	const HashValues values = HashStrings(Archive::cryptTable(), path.string().c_str());
+
+	return this->m_hashTable.find(values.tableOffset, values.nameA, values.nameB, File::localeToInt(locale), File::platformToInt(platform));
 }
 
 File Archive::findFile(const HashData &hashData)
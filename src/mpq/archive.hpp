@@ -21,9 +21,15 @@
 #ifndef WC3LIB_MPQ_MPQ_HPP
 #define WC3LIB_MPQ_MPQ_HPP
 
+#include <functional>
+#include <map>
+#include <vector>
+
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/ptr_container/ptr_unordered_map.hpp>
 #include <boost/cast.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/foreach.hpp>
 
 /*
@@ -33,10 +39,16 @@
 
 #include "algorithm.hpp"
 #include "hash.hpp"
+#include "hashtable.hpp"
+#include "hettable.hpp"
+#include "bettable.hpp"
+#include "sectorcache.hpp"
 #include "block.hpp"
 #include "listfile.hpp"
 #include "attributes.hpp"
 #include "signature.hpp"
+#include "freespace.hpp"
+#include "compressionselection.hpp"
 
 namespace wc3lib
 {
@@ -50,6 +62,7 @@ class File;
  * \brief This class allows users to read, write and modify MPQ archives. MPQ (Mo'PaQ, short for Mike O'Brien Pack) is an archiving file format used in several of Blizzard Entertainment's games.
  *
  * Use \ref Archive::open() or \ref Archive::create() to open an existing or create a new MPQ archive on the filesystem.
+ * \ref Archive::open() can map the archive file into memory once. In this case all files and sectors are decompressed directly from the mapped data without opening the archive file again.
  *
  * For operations on the archive there is several functions with different variations:
  *
@@ -64,6 +77,8 @@ class File;
  * <li> \ref attributesFile() - accesses file "(attributes)" with extended attributes like timestamps and checksums of contained files </li>
  * </ul>
  *
+ * Decompressed sectors can be kept in memory by enabling the \ref sectorCache() which is shared by all files of the archive.
+ *
  * \note Synchronization is not implemented in any way since Boost IPC file locks are only "advisory locks". Therefore you should never call operations concurrently.
  *
  */
@@ -73,7 +88,9 @@ class Archive : public Format, private boost::noncopyable
 		enum class Format : uint16
 		{
 			Mpq1, /// Original format (Starcraft, Warcraft 3, Warcraft 3 The Frozen Throne, World of Warcraft)
-			Mpq2 /// Burning Crusade, large files (size can be larger than 2^32 -> up to 2^64)
+			Mpq2, /// Burning Crusade, large files (size can be larger than 2^32 -> up to 2^64)
+			Mpq3, /// Cataclysm beta, 64 bit archive size and HET and BET tables (\ref HetTable, \ref BetTable)
+			Mpq4 /// Cataclysm, sizes and MD5 checksums of all tables
 		};
 
 		/**
@@ -101,6 +118,8 @@ class Archive : public Format, private boost::noncopyable
 		static const byte identifier[4];
 		static const int16 formatVersion1Identifier;
 		static const int16 formatVersion2Identifier;
+		static const int16 formatVersion3Identifier;
+		static const int16 formatVersion4Identifier;
 
 		/**
 		 * 0xFFFFFFFE and 0xFFFFFFFF are reserved for deleted and empty blocks (by hashes).
@@ -116,6 +135,10 @@ class Archive : public Format, private boost::noncopyable
 		 * \return Returns static crypt table with size of \ref cryptTableSize.
 		 */
 		static const uint32* cryptTable();
+		/**
+		 * \return Returns the size of the header in the archive for format \p format in bytes including all extended headers.
+		 */
+		static uint32 headerSize(Format format);
 		static bool hasStrongDigitalSignature(istream &istream);
 		static std::streamsize strongDigitalSignature(istream &istream, StrongDigitalSignature &signature);
 
@@ -135,13 +158,15 @@ class Archive : public Format, private boost::noncopyable
 		 * \param sectorSize The size of file sectors.
 		 * \param startPosition The start position in the output file where the archive starts. All other space before will be skipped.
 		 * \return Returns size of all created file data in bytes.
+		 * \note Archives of the formats 3 and 4 cannot be modified. Use \ref ArchiveBuilder to create them.
 		 */
 		std::streamsize create(const boost::filesystem::path &path, uint32 hashTableEntries, uint32 blockTableEntries, Format format = Format::Mpq1, uint32 sectorSize = 4096, std::streampos startPosition = 0);
 		/**
 		 * Opens an MPQ file on the local file system at \p path.
 		 * This reads the block and hash tables.
+		 * \param mapped If this value is true, the archive file is mapped into memory until the archive is closed. Files and sectors are then decompressed directly from the mapped data without opening the file for every sector and without copying the raw sector data.
 		 */
-		std::streamsize open(const boost::filesystem::path &path);
+		std::streamsize open(const boost::filesystem::path &path, bool mapped = false);
 		/**
 		 * Closes the MPQ archive which clears all hashes and blocks.
 		 * If the archive is not open nothing happens.
@@ -193,6 +218,7 @@ class Archive : public Format, private boost::noncopyable
 		/**
 		 * Path of MPQ file \p mpqFile should be set if you use this method.
 		 * \param mpqFile An MPQ file is searched which has the same hash value as \p mpqFile.
+		 * The data of the file becomes free space (\ref freeSpace()) which is reused by added files.
 		 * \return Returns true if an MPQ file was found and deleted successfully.
 		 */
 		bool removeFile(const File &mpqFile);
@@ -208,15 +234,216 @@ class Archive : public Format, private boost::noncopyable
 		/**
 		 * Adds a new file to the archive.
 		 *
-		 * A file can only be added if there is a free or deleted block and free or deleted hash entry. Otherwise this method will return an invalid file.
+		 * A file can only be added if there is a free or deleted block and free or deleted hash entry.
+		 * The sectors of the file are compressed by up to \ref threads() threads.
 		 *
 		 * \return Returns the newly added file.
 		 *
 		 * \throws TooSmallHashTableException
 		 * \throws TooSmallBlockTableException
+		 * \sa addFiles()
 		 */
 		File addFile(const boost::filesystem::path &filePath, const byte *data, uint64 dataSize, Sector::Compression compression = Sector::Compression::Uncompressed, Block::Flags flags = Block::Flags::None, File::Locale locale = File::Locale::Neutral, File::Platform platform = File::Platform::Default);
 
+		/**
+		 * \brief A file which is added by \ref addFiles().
+		 */
+		struct NewFile
+		{
+			NewFile();
+			NewFile(const boost::filesystem::path &path, const byte *data, uint64 size, Sector::Compression compression = Sector::Compression::Uncompressed, Block::Flags flags = Block::Flags::None, File::Locale locale = File::Locale::Neutral, File::Platform platform = File::Platform::Default);
+
+			boost::filesystem::path path;
+			/**
+			 * The uncompressed data of \ref size bytes which has to be valid until \ref addFiles() returns.
+			 */
+			const byte *data;
+			uint64 size;
+			/**
+			 * The compression of the sectors. If \ref autoCompression is true it is replaced by the selected compression.
+			 */
+			Sector::Compression compression;
+			/**
+			 * The level of \ref compression (\ref Sector::compressData()). If \ref autoCompression is true it is replaced by the selected level.
+			 */
+			int compressionLevel;
+			/**
+			 * The level of IMA ADPCM if \ref compression contains it (\ref Sector::compressData()). If \ref autoCompression is true it is replaced by the selected level.
+			 */
+			int waveCompressionLevel;
+			/**
+			 * If this value is true the compression is selected for the file by \ref CompressionSelection.
+			 */
+			bool autoCompression;
+			Block::Flags flags;
+			File::Locale locale;
+			File::Platform platform;
+		};
+
+		typedef std::vector<NewFile> NewFiles;
+
+		/**
+		 * Adds all files \p files to the archive at once.
+		 *
+		 * The files are compressed by up to \ref threads() threads. A single file is compressed sector by sector by all threads.
+		 * Afterwards the blocks are written in the order of \p files and the block and hash entries are assigned in the same order.
+		 * Therefore the resulting archive does not depend on the number of threads.
+		 * The tables and the header are written only once which is much faster than calling \ref addFile() for every file.
+		 *
+		 * A file which exists already with the same path, locale and platform is replaced. It keeps its hash and block entries and its previous data becomes free space.
+		 * The blocks are placed best-fit into the free space of the archive (\ref freeSpace()) and only appended if they do not fit anywhere.
+		 * Only the header and the table entries starting with the first changed one are written again.
+		 *
+		 * The compression of every file with \ref NewFile::autoCompression is selected by \ref compressionSelection() and stored in \ref NewFile::compression and \ref NewFile::compressionLevel.
+		 *
+		 * \return Returns the added files in the order of \p files.
+		 * \throws TooSmallHashTableException Throws an exception if there are not enough free hash entries. Nothing is written in this case.
+		 * \throws TooSmallBlockTableException Throws an exception if there are not enough free block entries. Nothing is written in this case.
+		 * \throws Exception Throws an exception if a file could not be compressed. Nothing is written in this case.
+		 */
+		std::vector<File> addFiles(NewFiles &files);
+		/**
+		 * \return Returns the selection of the compression for added files with \ref NewFile::autoCompression. Its sample sizes and decompression budget can be changed.
+		 * \note \ref addFiles() sets the sector size of the selection to the sector size of the archive. For archives of format 3 or newer it allows the extended compressions (\ref CompressionSelection::setExtendedCompressions()) as well.
+		 */
+		CompressionSelection& compressionSelection();
+		const CompressionSelection& compressionSelection() const;
+
+		/**
+		 * \return Returns the unused extents of the archive which are left by removed and replaced files. They are determined when the archive is opened and reused by \ref addFiles().
+		 */
+		const FreeSpace& freeSpace() const;
+
+		/**
+		 * \param threads The number of threads which compress added files (\ref addFile(), \ref addFiles()). If this value is 0 \ref defaultThreads() is used.
+		 */
+		void setThreads(unsigned threads);
+		unsigned threads() const;
+
+		/**
+		 * Rewrites the archive file without the space of removed files (\ref removeFile()) and other unused space.
+		 *
+		 * All blocks which are referenced by used hash entries are written in the order of their current offsets directly behind the header and the tables.
+		 * The raw data of a block including its sector offset table is copied without decompressing it.
+		 * Only blocks which use \ref Block::Flags::UsesEncryptionKey and are moved have to be decrypted and encrypted again since their key depends on the block offset (\ref Block::fileKey()).
+		 * Their names are taken from the "(listfile)" file and \p entries.
+		 *
+		 * Indices of blocks and hashes are kept. Unused blocks are cleared.
+		 * Any data of the file before \ref startPosition() is kept but a strong digital signature behind the archive is dropped since it would not be valid anymore.
+		 *
+		 * The archive is written into a temporary file which replaces the archive file afterwards. Then the archive is opened again.
+		 *
+		 * \param entries Additional file paths which are used to find the names of encrypted files which have to be moved.
+		 * \return Returns the new size of the archive in bytes.
+		 * \throws Exception Throws an exception if the name of a block which has to be encrypted again is unknown. In this case the archive file is not changed.
+		 */
+		std::streamsize compact(const Listfile::Entries &entries = Listfile::Entries());
+
+		/**
+		 * \brief A block which is visited by \ref forEachBlock() with its decompressed data and all of its known paths.
+		 */
+		struct BlockContent
+		{
+			Block *block;
+			/**
+			 * The file of a hash which refers to the block. If any path of the block is known the file has the first one of \ref paths.
+			 */
+			File file;
+			/**
+			 * All known paths of the hashes which refer to the block. Several hashes might refer to the same block, for example with different locales.
+			 */
+			std::vector<string> paths;
+			/**
+			 * The decompressed data of \ref size bytes. It is only valid during the call of the function and only if \ref error is empty.
+			 */
+			const byte *data;
+			uint32 size;
+			/**
+			 * The reason why the data could not be decompressed, for example a corrupted sector or an unknown path of an encrypted file.
+			 */
+			string error;
+		};
+
+		/**
+		 * Function which is called by \ref forEachBlock() for every block. If it returns false no more blocks are visited.
+		 */
+		typedef std::function<bool(const BlockContent &content)> BlockFunction;
+
+		/**
+		 * Visits all blocks which are referenced by used hashes in the order of their offsets.
+		 * Tools which process all files of the archive read the archive file from the front to the back once instead of seeking for every single file which is looked up by its path.
+		 * The archive file is opened only once if it is not memory mapped.
+		 *
+		 * The paths of the blocks are taken from the "(listfile)" file and \p entries. The special files "(listfile)", "(attributes)" and "(signature)" are always known.
+		 * Errors of single blocks are reported in \ref BlockContent::error and do not stop the iteration.
+		 *
+		 * \param decompress If this value is false the blocks are not read at all and only their paths are resolved.
+		 * \return Returns the number of visited blocks.
+		 * \throws Exception Throws an exception if the archive is not open.
+		 */
+		std::size_t forEachBlock(const BlockFunction &function, const Listfile::Entries &entries = Listfile::Entries(), bool decompress = true);
+
+		/**
+		 * \brief The result of the verification of one block by \ref verify().
+		 */
+		struct BlockVerification
+		{
+			Block *block;
+			/**
+			 * All known paths of the hashes which refer to the block.
+			 */
+			std::vector<string> paths;
+			/**
+			 * The number of decompressed bytes.
+			 */
+			uint32 size;
+			/**
+			 * The calculated checksums of the decompressed data.
+			 */
+			CRC32 crc32;
+			MD5Checksum md5;
+			/**
+			 * A checksum is only checked if the "(attributes)" file contains it and if it is not zero.
+			 * The entry of the "(attributes)" file itself is always zero.
+			 */
+			bool crc32Checked;
+			bool crc32Valid;
+			bool md5Checked;
+			bool md5Valid;
+			/**
+			 * True if the block has not been decompressed since it is encrypted and none of its paths is known.
+			 * This does not indicate that the block is corrupted since archives do not have to list all their files.
+			 */
+			bool skipped;
+			/**
+			 * The reason why the data could not be decompressed, for example a corrupted sector.
+			 */
+			string error;
+
+			/**
+			 * \return Returns true if no error occured and all checked checksums match. A skipped block (\ref skipped) is valid as well.
+			 */
+			bool isValid() const;
+		};
+
+		typedef std::vector<BlockVerification> BlockVerifications;
+
+		/**
+		 * Decompresses all blocks which are referenced by used hashes and compares the CRC32 and MD5 checksums of their data with the ones stored in the "(attributes)" file.
+		 * The blocks are verified by up to \p threads threads. Every block is decompressed sector by sector and the checksums are calculated incrementally (\ref Attributes::Checksums).
+		 * Therefore no file is held completely in memory.
+		 *
+		 * If the archive is not memory mapped every thread opens the archive file once.
+		 * Errors of single blocks are reported in \ref BlockVerification::error and do not stop the verification.
+		 * Encrypted blocks without a known path cannot be decrypted and are only marked as \ref BlockVerification::skipped.
+		 *
+		 * \param entries Additional file paths which are required to decrypt encrypted files (\ref forEachBlock()).
+		 * \param threads The number of threads. If this value is 0 \ref defaultThreads() is used.
+		 * \return Returns the results of all blocks in the order of their offsets.
+		 * \throws Exception Throws an exception if the archive is not open.
+		 */
+		BlockVerifications verify(const Listfile::Entries &entries = Listfile::Entries(), unsigned threads = 0);
+
 		/**
 		 * Searches for hash table entry using \p hashData.
 		 * This function returns used hash entries as well as deleted and empty ones.
@@ -232,7 +459,8 @@ class Archive : public Format, private boost::noncopyable
 		 */
 		/**
 		 * Searches for hash table entry by generating an \ref HashData instance using \p path, \p locale and \p platform.
-		 * This function returns used hash entries as well as deleted and empty ones.
+		 * The hash table is probed like the MPQ format does it (\ref hashTable()) which does not allocate any memory.
+		 * This function returns used hash entries as well as deleted ones but prefers used ones.
 		 * \return Returns an 0 if no hash entry was found.
 		 *
 		 * \ingroup search
@@ -292,7 +520,7 @@ class Archive : public Format, private boost::noncopyable
 		uint32 sectorSize() const;
 		/**
 		 * \return Computes the original header sector size shift value by using formula:
-		 * sqrt(sectorSize / 512)
+		 * log2(sectorSize / 512)
 		 */
 		uint16 sectorSizeShift() const;
 		/**
@@ -309,6 +537,22 @@ class Archive : public Format, private boost::noncopyable
 		 * When \ref open() or \ref create() is called archive is opened automatically until destructor or \ref close() is called.
 		 */
 		bool isOpen() const;
+		/**
+		 * \return Returns true if the archive file is mapped into memory.
+		 * \sa open()
+		 */
+		bool isMapped() const;
+		/**
+		 * \param position The absolute position in the archive file (not relative to \ref startPosition()).
+		 * \param size The number of bytes which are accessed starting at \p position.
+		 * \return Returns a pointer to the mapped data of the archive file at \p position.
+		 * \throws Exception Throws an exception if the archive is not mapped or the range exceeds the mapped file.
+		 */
+		const byte* mappedData(uint64 position, std::size_t size) const;
+		/**
+		 * \return Returns the size of the mapped archive file or 0 if it is not mapped.
+		 */
+		std::size_t mappedSize() const;
 
 		/**
 		 * \return Returns all blocks from the block table.
@@ -332,6 +576,52 @@ class Archive : public Format, private boost::noncopyable
 		 * @}
 		 */
 
+		/**
+		 * \return Returns the flat hash table in the order of the archive's hash table which is used for searching files by their paths.
+		 */
+		const HashTable& hashTable() const;
+
+		/**
+		 * Archives of the formats 3 and 4 may contain a HET and a BET table.
+		 * If the archive has no classic hash table files are searched using the HET table (\ref findHash()) and there is one hash for every entry of the HET table.
+		 * Since the HET table does not store locales and platforms they are ignored in this case.
+		 * If it has no classic block table the blocks are created from the BET table.
+		 * \return Returns the HET or BET table or 0 if the archive does not contain it.
+		 *
+		 * @{
+		 */
+		const HetTable* hetTable() const;
+		const BetTable* betTable() const;
+		/**
+		 * @}
+		 */
+		/**
+		 * \return Returns true if the hashes have been created from the HET table since the archive has no classic hash table.
+		 * In this case the hash values (\ref HashData) of the hashes are unknown and files can only be found by their paths.
+		 */
+		bool usesHetTable() const;
+		/**
+		 * \return Returns the offset of the HET table relative to the start position or 0 if there is none.
+		 */
+		uint64 hetTableOffset() const;
+		/**
+		 * \return Returns the offset of the BET table relative to the start position or 0 if there is none.
+		 */
+		uint64 betTableOffset() const;
+
+		/**
+		 * The sector cache stores decompressed sectors of this archive. It is disabled by default.
+		 * Use \ref SectorCache::setMaxSize() to enable it.
+		 * Sectors of modified blocks are removed automatically.
+		 *
+		 * @{
+		 */
+		SectorCache& sectorCache();
+		const SectorCache& sectorCache() const;
+		/**
+		 * @}
+		 */
+
 		/**
 		 * \return Returns true if archive is not opened.
 		 */
@@ -351,9 +641,16 @@ class Archive : public Format, private boost::noncopyable
 		bool readExtendedBlockTable(istream &in, std::streamsize &size);
 		bool readHashTable(istream &in, uint32 entries, std::streamsize &size);
 		bool writeHeader(ostream &out, std::streamsize &size) const;
-		bool writeBlockTable(ostream &out, std::streamsize &size) const;
+		/**
+		 * Since the tables are encrypted with a key which depends on all previous entries the table is always encrypted completely.
+		 * \param firstEntry Only the entries starting with this index are written. The previous ones must not have changed.
+		 */
+		bool writeBlockTable(ostream &out, std::streamsize &size, uint32 firstEntry = 0) const;
 		bool writeExtendedBlockTable(ostream &out, std::streamsize &size) const;
-		bool writeHashTable(ostream &out, std::streamsize &size) const;
+		/**
+		 * \copydoc writeBlockTable()
+		 */
+		bool writeHashTable(ostream &out, std::streamsize &size, uint32 firstEntry = 0) const;
 		/**
 		 * @}
 		 */
@@ -365,6 +662,12 @@ class Archive : public Format, private boost::noncopyable
 		 */
 		void clear();
 
+		/**
+		 * Maps the archive file into memory again after it has been modified.
+		 * Does nothing if the archive is not mapped.
+		 */
+		void remap();
+
 		/**
 		 * Empty space entries should have BlockOffset and BlockSize nonzero, and FileSize and Flags zero.
 		 *
@@ -375,11 +678,20 @@ class Archive : public Format, private boost::noncopyable
 		 * \return Returns the block with the biggest offset.
 		 */
 		Block* lastOffsetBlock();
+		/**
+		 * Determines \ref freeSpace() from scratch. All space of the archive which is neither used by the header, the tables nor any used block is free.
+		 * Archives of the formats 3 and 4 have no free space since they cannot be modified.
+		 */
+		void updateFreeSpace();
+		/**
+		 * \return Returns the offset of a new block of \p size bytes. It is the best-fitting free extent or the end of the archive which grows by \p size bytes.
+		 */
+		uint64 allocateBlock(uint64 size);
 
 		/**
-		 * \return Returns the first unused or deleted hash which can be used for new files.
+		 * \return Returns the first unused or deleted hash which can be used for a new file with the \ref HashType::TableOffset hash value \p tableOffset.
 		 */
-		Hash* firstFreeHash();
+		Hash* firstFreeHash(uint32 tableOffset);
 
 		/**
 		 * \return Returns the next block offset as large unsigned integer. Next block offset means the offset of the next added block (last block offset + last block size / header size).
@@ -389,9 +701,50 @@ class Archive : public Format, private boost::noncopyable
 		 * Same as function \ref Archive::nextBlockOffset but divides large offset value into \p blockOffset and \p extendedBlockOffset.
 		 */
 		void nextBlockOffsets(uint32 &blockOffset, uint16 &extendedBlockOffset);
+		/**
+		 * \return Returns the used hash entry of the existing file which would be replaced by \p file or 0 if there is none.
+		 */
+		Hash* usedHash(const NewFile &file);
+		/**
+		 * Writes \p dataSize bytes of \p data as the new data of the existing file \p block with the path \p path into \p out.
+		 * The block keeps its index and its flags but refers to the new data which is placed by \ref allocateBlock().
+		 * \param compression The compression of the new data. It should be the compression of the previous data.
+		 * The extent of the previous data is stored in \p releasedSpace. It may only become free space after the tables have been written. Otherwise the file would be lost if writing stops in between.
+		 * The tables are not written.
+		 */
+		void replaceBlockData(ostream &out, Block *block, const string &path, const byte *data, uint32 dataSize, Sector::Compression compression, FreeSpace::Extents &releasedSpace);
 
-		/// This value is required for getting the first block offset (relative to the beginning of archive).
-		static const std::size_t headerSize;
+		/**
+		 * Reads the HET and BET tables and creates blocks and hashes from them if the archive has no classic tables.
+		 */
+		void readExtendedTables(istream &in, const ExtendedHeader4 *extendedHeader4, std::streamsize &size);
+		/**
+		 * \throws Exception Throws an exception if archives of the current format cannot be modified.
+		 */
+		void checkModifiable() const;
+
+		/**
+		 * File paths by their hash values \ref HashData::filePathHashA() and \ref HashData::filePathHashB().
+		 */
+		typedef std::map<std::pair<int32, int32>, string> PathsByHash;
+		/**
+		 * Blocks which are referenced by used hashes together with these hashes.
+		 */
+		typedef std::vector<std::pair<Block*, std::vector<Hash*> > > UsedBlocks;
+
+		/**
+		 * Calculates the hash values of \p entries, of the entries of the "(listfile)" file and of the special files.
+		 */
+		PathsByHash resolvePaths(const Listfile::Entries &entries);
+		/**
+		 * \return Returns all blocks which are referenced by used hashes sorted by their offsets. The hashes of every block are sorted by their indices.
+		 */
+		UsedBlocks usedBlocks() const;
+		/**
+		 * \return Returns the file of the hashes \p hashes which refer to the same block. The first hash with a known path is preferred.
+		 * \param paths All known paths of \p hashes are added to this container.
+		 */
+		File blockFile(const std::vector<Hash*> &hashes, const PathsByHash &pathsByHash, std::vector<string> &paths);
 
 		std::size_t m_size; /// The size of the header + the size of the archive, skipping start position.
 		boost::filesystem::path m_path;
@@ -399,13 +752,24 @@ class Archive : public Format, private boost::noncopyable
 		uint64 m_blockTableOffset; /// Relative to the start position.
 		uint64 m_extendedBlockTableOffset; /// Relative to the start position.
 		uint64 m_hashTableOffset; /// Relative to the start position.
+		uint64 m_hetTableOffset; /// Relative to the start position.
+		uint64 m_betTableOffset; /// Relative to the start position.
 		uint64 m_strongDigitalSignaturePosition; // position of strong digital signature in archive starting at its header ('NGIS')!
 		Format m_format;
 		uint32 m_sectorSize;
 		StrongDigitalSignature m_strongDigitalSignature;
 		bool m_isOpen;
+		boost::iostreams::mapped_file_source m_mappedFile;
 		Blocks m_blocks;
 		Hashes m_hashes;
+		HashTable m_hashTable;
+		boost::scoped_ptr<HetTable> m_hetTable;
+		boost::scoped_ptr<BetTable> m_betTable;
+		bool m_usesHetTable; /// True if the hashes have been created from the HET table since there is no classic hash table.
+		unsigned m_threads;
+		CompressionSelection m_compressionSelection;
+		FreeSpace m_freeSpace;
+		SectorCache m_sectorCache;
 };
 
 inline bool Archive::hasStrongDigitalSignature(istream &istream)
@@ -514,7 +878,14 @@ inline uint32 Archive::sectorSize() const
 
 inline uint16 Archive::sectorSizeShift() const
 {
-	return sqrt(this->m_sectorSize / 512);
+	uint16 shift = 0;
+
+	while ((512u << shift) < this->m_sectorSize)
+	{
+		++shift;
+	}
+
+	return shift;
 }
 
 inline bool Archive::hasStrongDigitalSignature() const
@@ -532,6 +903,56 @@ inline bool Archive::isOpen() const
 	return this->m_isOpen;
 }
 
+inline void Archive::setThreads(unsigned threads)
+{
+	this->m_threads = threads;
+}
+
+inline unsigned Archive::threads() const
+{
+	return this->m_threads;
+}
+
+inline CompressionSelection& Archive::compressionSelection()
+{
+	return this->m_compressionSelection;
+}
+
+inline const CompressionSelection& Archive::compressionSelection() const
+{
+	return this->m_compressionSelection;
+}
+
+inline const FreeSpace& Archive::freeSpace() const
+{
+	return this->m_freeSpace;
+}
+
+inline bool Archive::isMapped() const
+{
+	return this->m_mappedFile.is_open();
+}
+
+inline std::size_t Archive::mappedSize() const
+{
+	return this->isMapped() ? this->m_mappedFile.size() : 0;
+}
+
+inline const byte* Archive::mappedData(uint64 position, std::size_t size) const
+{
+	if (!this->isMapped())
+	{
+		throw Exception(_("Archive is not mapped into memory."));
+	}
+
+	if (position + size > this->m_mappedFile.size())
+	{
+		throw Exception(boost::format(_("Range at position %1% with size %2% exceeds the mapped archive file of size %3%.")) % position % size % this->m_mappedFile.size());
+	}
+
+	return this->m_mappedFile.data() + position;
+}
+
 inline Archive::Blocks& Archive::blocks()
 {
 	return this->m_blocks;
@@ -552,6 +973,46 @@ inline const Archive::Hashes& Archive::hashes() const
 	return this->m_hashes;
 }
 
+inline const HashTable& Archive::hashTable() const
+{
+	return this->m_hashTable;
+}
+
+inline const HetTable* Archive::hetTable() const
+{
+	return this->m_hetTable.get();
+}
+
+inline bool Archive::usesHetTable() const
+{
+	return this->m_usesHetTable;
+}
+
+inline const BetTable* Archive::betTable() const
+{
+	return this->m_betTable.get();
+}
+
+inline uint64 Archive::hetTableOffset() const
+{
+	return this->m_hetTableOffset;
+}
+
+inline uint64 Archive::betTableOffset() const
+{
+	return this->m_betTableOffset;
+}
+
+inline SectorCache& Archive::sectorCache()
+{
+	return this->m_sectorCache;
+}
+
+inline const SectorCache& Archive::sectorCache() const
+{
+	return this->m_sectorCache;
+}
+
 inline Block* Archive::firstFreeBlock()
 {
 	BOOST_FOREACH(Block &block, this->blocks())
@@ -584,19 +1045,9 @@ inline Block* Archive::lastOffsetBlock()
 	return result;
 }
 
-inline Hash* Archive::firstFreeHash()
+inline Hash* Archive::firstFreeHash(uint32 tableOffset)
 {
-	BOOST_FOREACH(Hashes::value_type pair, this->hashes())
-	{
-		Hash *hash = pair.second;
-
-		if (hash->empty() || hash->deleted())
-		{
-			return hash;
-		}
-	}
-
-	return 0;
+	return this->m_hashTable.findFree(tableOffset);
 }
 
 inline uint64 Archive::nextBlockOffset()
@@ -0,0 +1,534 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <limits>
+#include <set>
+#include <tuple>
+
+#include <boost/scoped_array.hpp>
+
+#include "archivebuilder.hpp"
+#include "algorithm.hpp"
+#include "attributes.hpp"
+#include "bettable.hpp"
+#include "hash.hpp"
+#include "hettable.hpp"
+#include "listfile.hpp"
+#include "parallel.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * The compressed but not yet encrypted data of one file.
+ * It can only be encrypted when its block offset is known.
+ */
+struct ArchiveBuilder::CompressedBlock
+{
+	string path;
+	File::Locale locale;
+	File::Platform platform;
+	Block::Flags flags;
+	uint32 fileSize;
+	/**
+	 * The offsets of all sectors in \ref data followed by the size of \ref data.
+	 */
+	std::vector<uint32> sectors;
+	std::vector<byte> data;
+	CRC32 crc32;
+	MD5Checksum md5;
+};
+
+ArchiveBuilder::ArchiveBuilder(Archive::Format format, uint32 sectorSize)
+: m_format(format)
+, m_sectorSize(sectorSize)
+, m_hashTableEntries(0)
+, m_blockTableEntries(0)
+, m_threads(0)
+, m_listfile(true)
+, m_attributes(true)
+{
+	if (sectorSize < 512 || (sectorSize & (sectorSize - 1)) != 0)
+	{
+		throw Exception(boost::format(_("Invalid sector size %1%. It has to be 512 multiplied by a power of two.")) % sectorSize);
+	}
+}
+
+void ArchiveBuilder::addFile(const boost::filesystem::path &path, const byte *data, uint64 dataSize, Sector::Compression compression, Block::Flags flags, File::Locale locale, File::Platform platform)
+{
+	Entry entry;
+	entry.path = path.string();
+	Listfile::toListfileEntry(entry.path);
+	entry.data.assign(data, data + dataSize);
+	entry.compression = compression;
+	entry.flags = flags;
+	entry.locale = locale;
+	entry.platform = platform;
+	this->m_entries.push_back(std::move(entry));
+}
+
+void ArchiveBuilder::importFile(const boost::filesystem::path &path, const boost::filesystem::path &source, Sector::Compression compression, Block::Flags flags, File::Locale locale, File::Platform platform)
+{
+	Entry entry;
+	entry.path = path.string();
+	Listfile::toListfileEntry(entry.path);
+	entry.source = source;
+	entry.compression = compression;
+	entry.flags = flags;
+	entry.locale = locale;
+	entry.platform = platform;
+	this->m_entries.push_back(std::move(entry));
+}
+
+uint32 ArchiveBuilder::hashTableEntries(uint32 files)
+{
+	const uint64 required = uint64(files) + uint64(files) / 3 + 1;
+	uint32 result = 16;
+
+	while (result < required)
+	{
+		result <<= 1;
+	}
+
+	return result;
+}
+
+void ArchiveBuilder::compress(const Entry &entry, CompressedBlock &block, unsigned threads) const
+{
+	std::vector<byte> sourceData;
+	const std::vector<byte> *data = &entry.data;
+
+	if (!entry.source.empty())
+	{
+		ifstream in(entry.source, std::ios::in | std::ios::binary);
+
+		if (!in)
+		{
+			throw Exception(boost::format(_("Unable to open file %1%.")) % entry.source);
+		}
+
+		sourceData.resize(boost::filesystem::file_size(entry.source));
+
+		if (!sourceData.empty())
+		{
+			std::streamsize size = 0;
+			wc3lib::read(in, sourceData[0], size, sourceData.size());
+		}
+
+		data = &sourceData;
+	}
+
+	block.path = entry.path;
+	block.locale = entry.locale;
+	block.platform = entry.platform;
+	block.fileSize = boost::numeric_cast<uint32>(data->size());
+	block.flags = Sector::fileFlags(entry.flags, entry.compression);
+	block.crc32 = Attributes::crc32(data->data(), data->size());
+	block.md5 = Attributes::md5(data->data(), data->size());
+
+	Sector::compressSectors(data->data(), block.fileSize, this->sectorSize(), block.flags, entry.compression, block.sectors, block.data, threads);
+}
+
+std::streamsize ArchiveBuilder::write(const boost::filesystem::path &path, std::streampos startPosition) const
+{
+	/*
+	 * Duplicated entries are detected before anything is compressed.
+	 */
+	typedef std::tuple<uint32, uint32, uint32, uint16, uint16> Key;
+	std::set<Key> keys;
+
+	BOOST_FOREACH(Entries::const_reference entry, this->entries())
+	{
+		const HashValues values = HashStrings(Archive::cryptTable(), entry.path.c_str());
+
+		if (!keys.insert(Key(values.tableOffset, values.nameA, values.nameB, File::localeToInt(entry.locale), File::platformToInt(entry.platform))).second)
+		{
+			throw Exception(boost::format(_("File %1% has been added twice.")) % entry.path);
+		}
+	}
+
+	const uint32 files = boost::numeric_cast<uint32>(this->entries().size()) + (this->listfile() ? 1 : 0) + (this->attributes() ? 1 : 0);
+	const uint32 blocksCount = std::max(files, this->blockTableEntries());
+	uint32 hashesCount = hashTableEntries(files);
+
+	if (this->hashTableEntries() > 0x80000000)
+	{
+		throw Exception(boost::format(_("Too many hash table entries: %1%.")) % this->hashTableEntries());
+	}
+
+	// Storm finds the hash of a file by masking its hash value with the table size minus one
+	while (hashesCount < this->hashTableEntries())
+	{
+		hashesCount <<= 1;
+	}
+
+	ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+
+	if (!out)
+	{
+		throw Exception(boost::format(_("Unable to create file \"%1%\".")) % path.string());
+	}
+
+	out.seekp(startPosition);
+
+	if (out.tellp() != startPosition)
+	{
+		throw Exception(boost::str(boost::format(_("Unable to start in file \"%1%\" at position %2%.")) % path.string() % startPosition));
+	}
+
+	std::streamsize size = 0;
+
+	/*
+	 * The layout is the same as the one of Archive::create(): the header and the tables are followed by the blocks.
+	 * Therefore further files can be appended by Archive::addFile().
+	 * The space for the header and the tables is reserved here but they are written at the end when all blocks are known.
+	 */
+	const uint32 headerSize = Archive::headerSize(this->format());
+	const uint64 blockTableOffset = headerSize;
+	const uint32 blockTableSize = blocksCount * sizeof(BlockTableEntry);
+	const uint64 extendedBlockTableOffset = blockTableOffset + blockTableSize;
+	const uint32 extendedBlockTableSize = this->format() != Archive::Format::Mpq1 ? blocksCount * sizeof(uint16) : 0;
+	const uint64 hashTableOffset = extendedBlockTableOffset + extendedBlockTableSize;
+	const uint32 hashTableSize = hashesCount * sizeof(HashTableEntry);
+	uint64 offset = hashTableOffset + hashTableSize;
+	const std::vector<byte> reserved(offset, 0);
+	wc3lib::write(out, reserved[0], size, reserved.size());
+
+	BlockTableEntry emptyBlock;
+	emptyBlock.blockOffset = 0;
+	emptyBlock.blockSize = 0;
+	emptyBlock.fileSize = 0;
+	emptyBlock.flags = 0;
+	std::vector<BlockTableEntry> blockTable(blocksCount, emptyBlock);
+	std::vector<uint16> extendedBlockTable(blocksCount, 0);
+
+	HashTableEntry emptyHash;
+	emptyHash.filePathHashA = 0;
+	emptyHash.filePathHashB = 0;
+	emptyHash.locale = 0;
+	emptyHash.platform = 0;
+	emptyHash.fileBlockIndex = Hash::blockIndexEmpty;
+	std::vector<HashTableEntry> hashTable(hashesCount, emptyHash);
+	// the paths of the blocks are required for the HET table
+	std::vector<string> blockPaths(blocksCount);
+
+	MD5Checksum emptyMd5;
+	memset(emptyMd5.checksum, 0, sizeof(emptyMd5.checksum));
+	Attributes::Crc32s crcs(blocksCount, 0);
+	Attributes::Md5s md5s(blocksCount, emptyMd5);
+
+	/*
+	 * Encrypts and writes a compressed block at the current offset and registers it in all tables.
+	 */
+	auto writeBlock = [&](uint32 index, CompressedBlock &block)
+	{
+		if (this->format() == Archive::Format::Mpq1 && offset > std::numeric_limits<uint32>::max())
+		{
+			throw Exception(boost::format(_("Archive %1% is too big for MPQ format 1.")) % path);
+		}
+
+		const uint32 blockOffset = static_cast<uint32>(offset);
+		const uint16 extendedBlockOffset = boost::numeric_cast<uint16>(offset >> 32);
+		const bool encrypted = block.flags & Block::Flags::IsEncrypted;
+		const uint32 fileKey = encrypted ? Block::fileKey(Listfile::fileName(block.path), block.flags, blockOffset, block.fileSize) : 0;
+		const uint32 blockSize = boost::numeric_cast<uint32>(Sector::writeBlock(out, block.sectors, block.data, block.flags, fileKey));
+		size += blockSize;
+		BlockTableEntry &blockTableEntry = blockTable[index];
+		blockTableEntry.blockOffset = blockOffset;
+		blockTableEntry.blockSize = blockSize;
+		blockTableEntry.fileSize = block.fileSize;
+		blockTableEntry.flags = static_cast<uint32>(block.flags);
+		extendedBlockTable[index] = extendedBlockOffset;
+		crcs[index] = block.crc32;
+		md5s[index] = block.md5;
+
+		// the hash is stored at the first free entry from where the search for the file starts
+		const HashValues values = HashStrings(Archive::cryptTable(), block.path.c_str());
+		uint32 hashIndex = values.tableOffset & (hashesCount - 1);
+
+		while (hashTable[hashIndex].fileBlockIndex != Hash::blockIndexEmpty)
+		{
+			hashIndex = (hashIndex + 1) & (hashesCount - 1);
+		}
+
+		HashTableEntry &hashTableEntry = hashTable[hashIndex];
+		hashTableEntry.filePathHashA = values.nameA;
+		hashTableEntry.filePathHashB = values.nameB;
+		hashTableEntry.locale = File::localeToInt(block.locale);
+		hashTableEntry.platform = File::platformToInt(block.platform);
+		hashTableEntry.fileBlockIndex = index;
+		blockPaths[index] = block.path;
+
+		offset += blockSize;
+	};
+
+	/*
+	 * Files are compressed in batches that not all compressed files have to be kept in memory.
+	 * The blocks of a batch are written in order of the entries. Therefore the layout is always the same.
+	 */
+	const unsigned threads = this->threads() == 0 ? defaultThreads() : this->threads();
+	const std::size_t batchSize = threads * 4;
+	std::vector<CompressedBlock> blocks;
+
+	for (std::size_t batchStart = 0; batchStart < this->entries().size(); batchStart += batchSize)
+	{
+		const std::size_t count = std::min(batchSize, this->entries().size() - batchStart);
+		blocks.clear();
+		blocks.resize(count);
+		// a single file is compressed by all threads sector by sector
+		const unsigned sectorThreads = count == 1 ? threads : 1;
+
+		parallelFor(count, threads, [&](std::size_t i)
+		{
+			const Entry &entry = this->entries()[batchStart + i];
+
+			try
+			{
+				this->compress(entry, blocks[i], sectorThreads);
+			}
+			catch (std::exception &exception)
+			{
+				throw Exception(boost::format(_("Error on compressing file %1%:\n%2%")) % entry.path % exception.what());
+			}
+		});
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			writeBlock(boost::numeric_cast<uint32>(batchStart + i), blocks[i]);
+		}
+	}
+
+	blocks.clear();
+	uint32 index = boost::numeric_cast<uint32>(this->entries().size());
+
+	if (this->listfile())
+	{
+		Listfile::Entries listfileEntries;
+		listfileEntries.reserve(this->entries().size());
+
+		BOOST_FOREACH(Entries::const_reference entry, this->entries())
+		{
+			listfileEntries.push_back(entry.path);
+		}
+
+		const string content = Listfile::content(listfileEntries);
+		Entry entry;
+		entry.path = "(listfile)";
+		entry.data.assign(content.begin(), content.end());
+		entry.compression = Sector::Compression::Deflated;
+		entry.flags = Block::Flags::None;
+		entry.locale = File::Locale::Neutral;
+		entry.platform = File::Platform::Default;
+
+		CompressedBlock block;
+		this->compress(entry, block, threads);
+		writeBlock(index++, block);
+	}
+
+	if (this->attributes())
+	{
+		/*
+		 * The attributes of the "(attributes)" file itself cannot be known and stay empty.
+		 */
+		ostringstream stream;
+		std::streamsize attributesSize = 0;
+		ExtendedAttributesHeader extendedAttributesHeader;
+		extendedAttributesHeader.version = Attributes::latestVersion;
+		extendedAttributesHeader.attributesPresent = static_cast<uint32>(Attributes::ExtendedAttributes::FileCrc32s | Attributes::ExtendedAttributes::FileMd5s);
+		wc3lib::write(stream, extendedAttributesHeader, attributesSize);
+
+		BOOST_FOREACH(Attributes::Crc32s::const_reference crc, crcs)
+		{
+			wc3lib::write(stream, crc, attributesSize);
+		}
+
+		BOOST_FOREACH(Attributes::Md5s::const_reference md5, md5s)
+		{
+			wc3lib::write(stream, md5, attributesSize);
+		}
+
+		const string content = stream.str();
+		Entry entry;
+		entry.path = "(attributes)";
+		entry.data.assign(content.begin(), content.end());
+		entry.compression = Sector::Compression::Deflated;
+		entry.flags = Block::Flags::None;
+		entry.locale = File::Locale::Neutral;
+		entry.platform = File::Platform::Default;
+
+		CompressedBlock block;
+		this->compress(entry, block, threads);
+		writeBlock(index++, block);
+	}
+
+	if (this->format() == Archive::Format::Mpq1 && offset > std::numeric_limits<uint32>::max())
+	{
+		throw Exception(boost::format(_("Archive %1% is too big for MPQ format 1.")) % path);
+	}
+
+	/*
+	 * The formats 3 and 4 store the HET and BET tables behind the blocks since the size of the BET table depends on the blocks.
+	 */
+	const bool extendedTables = this->format() == Archive::Format::Mpq3 || this->format() == Archive::Format::Mpq4;
+	uint64 hetTableOffset = 0;
+	uint64 betTableOffset = 0;
+	string hetTableData;
+	string betTableData;
+
+	if (extendedTables)
+	{
+		HetTable hetTable;
+		hetTable.create(hashesCount, blocksCount);
+		BetTable::Entries betEntries(blocksCount);
+		std::vector<uint64> nameHashes(blocksCount, 0);
+		const uint64 nameHashMask = (uint64(1) << (hetTable.nameHashBitSize() - 8)) - 1;
+
+		for (uint32 i = 0; i < blocksCount; ++i)
+		{
+			betEntries[i].filePosition = blockTable[i].blockOffset + (uint64(extendedBlockTable[i]) << 32);
+			betEntries[i].fileSize = blockTable[i].fileSize;
+			betEntries[i].compressedSize = blockTable[i].blockSize;
+			betEntries[i].flags = static_cast<Block::Flags>(blockTable[i].flags);
+
+			if (!blockPaths[i].empty())
+			{
+				hetTable.insert(blockPaths[i], i);
+				nameHashes[i] = hetTable.fileNameHash(blockPaths[i]) & nameHashMask;
+			}
+		}
+
+		BetTable betTable;
+		betTable.create(betEntries, nameHashes, hetTable.nameHashBitSize() - 8);
+
+		ostringstream hetStream;
+		hetTable.write(hetStream);
+		hetTableData = hetStream.str();
+		ostringstream betStream;
+		betTable.write(betStream);
+		betTableData = betStream.str();
+
+		hetTableOffset = offset;
+		out.seekp(startPosition + boost::numeric_cast<std::streamoff>(offset));
+		wc3lib::write(out, hetTableData[0], size, hetTableData.size());
+		offset += hetTableData.size();
+		betTableOffset = offset;
+		wc3lib::write(out, betTableData[0], size, betTableData.size());
+		offset += betTableData.size();
+	}
+
+	/*
+	 * The header and all tables are written only once after all blocks.
+	 */
+	out.seekp(startPosition + boost::numeric_cast<std::streamoff>(blockTableOffset));
+
+	if (blockTableSize > 0)
+	{
+		EncryptData(Archive::cryptTable(), blockTable.data(), blockTableSize, HashString(Archive::cryptTable(), "(block table)", HashType::FileKey));
+		wc3lib::write(out, blockTable[0], size, blockTableSize);
+	}
+
+	// As of the Burning Crusade Friends and Family beta, the extended block table is not encrypted.
+	if (extendedBlockTableSize > 0)
+	{
+		wc3lib::write(out, extendedBlockTable[0], size, extendedBlockTableSize);
+	}
+
+	EncryptData(Archive::cryptTable(), hashTable.data(), hashTableSize, HashString(Archive::cryptTable(), "(hash table)", HashType::FileKey));
+	wc3lib::write(out, hashTable[0], size, hashTableSize);
+
+	Header header;
+	memcpy(header.magic, Archive::identifier, 4);
+	header.headerSize = headerSize;
+	header.formatVersion = static_cast<uint16>(this->format());
+	header.sectorSizeShift = 0;
+
+	while ((512u << header.sectorSizeShift) < this->sectorSize())
+	{
+		++header.sectorSizeShift;
+	}
+
+	header.hashTableOffset = static_cast<uint32>(hashTableOffset);
+	header.blockTableOffset = static_cast<uint32>(blockTableOffset);
+	header.hashTableEntries = hashesCount;
+	header.blockTableEntries = blocksCount;
+
+	// the archive size is limited to 32 bit for the formats 1 and 2
+	header.archiveSize = static_cast<uint32>(offset);
+
+	/*
+	 * The header is written into a buffer first since the format 4 stores its MD5 checksum.
+	 * The extended headers are padded so their members have to be written one by one.
+	 */
+	ostringstream headerStream;
+	std::streamsize headerStreamSize = 0;
+	wc3lib::write(headerStream, header, headerStreamSize);
+
+	if (this->format() != Archive::Format::Mpq1)
+	{
+		wc3lib::write(headerStream, extendedBlockTableOffset, headerStreamSize);
+		wc3lib::write(headerStream, uint16(0), headerStreamSize);
+		wc3lib::write(headerStream, uint16(0), headerStreamSize);
+	}
+
+	if (extendedTables)
+	{
+		ExtendedHeader3 extendedHeader3;
+		extendedHeader3.archiveSize = offset;
+		extendedHeader3.betTableOffset = betTableOffset;
+		extendedHeader3.hetTableOffset = hetTableOffset;
+		wc3lib::write(headerStream, extendedHeader3, headerStreamSize);
+	}
+
+	if (this->format() == Archive::Format::Mpq4)
+	{
+		// the checksums are calculated from the encrypted tables
+		wc3lib::write(headerStream, uint64(hashTableSize), headerStreamSize);
+		wc3lib::write(headerStream, uint64(blockTableSize), headerStreamSize);
+		wc3lib::write(headerStream, uint64(extendedBlockTableSize), headerStreamSize);
+		wc3lib::write(headerStream, uint64(hetTableData.size()), headerStreamSize);
+		wc3lib::write(headerStream, uint64(betTableData.size()), headerStreamSize);
+		wc3lib::write(headerStream, uint32(0), headerStreamSize); // raw chunk size, no MD5 checksums of the raw data
+		wc3lib::write(headerStream, md5(reinterpret_cast<const byte*>(blockTable.data()), blockTableSize), headerStreamSize);
+		wc3lib::write(headerStream, md5(reinterpret_cast<const byte*>(hashTable.data()), hashTableSize), headerStreamSize);
+		wc3lib::write(headerStream, md5(reinterpret_cast<const byte*>(extendedBlockTable.data()), extendedBlockTableSize), headerStreamSize);
+		wc3lib::write(headerStream, md5(betTableData.data(), betTableData.size()), headerStreamSize);
+		wc3lib::write(headerStream, md5(hetTableData.data(), hetTableData.size()), headerStreamSize);
+		const string headerData = headerStream.str();
+		wc3lib::write(headerStream, md5(headerData.data(), headerData.size()), headerStreamSize);
+	}
+
+	const string headerData = headerStream.str();
+	out.seekp(startPosition);
+	wc3lib::write(out, headerData[0], size, headerData.size());
+
+	if (!out)
+	{
+		throw Exception(boost::format(_("Error on writing archive %1%.")) % path);
+	}
+
+	return boost::numeric_cast<std::streamsize>(offset);
+}
+
+}
+
+}
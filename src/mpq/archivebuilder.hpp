@@ -0,0 +1,239 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef WC3LIB_MPQ_ARCHIVEBUILDER_HPP
+#define WC3LIB_MPQ_ARCHIVEBUILDER_HPP
+
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "platform.hpp"
+#include "archive.hpp"
+#include "block.hpp"
+#include "file.hpp"
+#include "sector.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \brief Creates a complete MPQ archive with many files in one single pass.
+ *
+ * \ref Archive::addFile() searches for a free hash and block, appends the data and rewrites all tables for every single file.
+ * For archives with thousands of files this is quadratic.
+ * Instead the builder collects all entries first (\ref addFile(), \ref importFile()) and writes the archive at once (\ref write()):
+ * <ul>
+ * <li>The files are compressed by several threads in batches of a limited size that the memory usage stays bounded.</li>
+ * <li>The blocks are laid out contiguously in the order of the entries. Therefore the resulting archive does not depend on the number of threads.</li>
+ * <li>The "(listfile)" and "(attributes)" files as well as the hash table and the block table are written only once at the end.</li>
+ * </ul>
+ *
+ * Like in archives created by \ref Archive::create() the tables are placed in front of the blocks.
+ * For the formats 3 and 4 the HET and BET tables (\ref HetTable, \ref BetTable) are written behind the blocks in addition to the classic tables.
+ *
+ * The hash and block tables are sized automatically but they can be enlarged to leave space for files which are added later using \ref Archive::addFile().
+ *
+ * \sa Archive::create()
+ */
+class ArchiveBuilder : private boost::noncopyable
+{
+	public:
+		/**
+		 * \brief A single file which is added to the archive.
+		 */
+		struct Entry
+		{
+			/**
+			 * The path of the file in the archive in the format of "(listfile)" entries.
+			 */
+			string path;
+			/**
+			 * If this path is not empty the data is read from this file on the hard disk when the archive is written.
+			 * Otherwise \ref data is used.
+			 */
+			boost::filesystem::path source;
+			std::vector<byte> data;
+			Sector::Compression compression;
+			Block::Flags flags;
+			File::Locale locale;
+			File::Platform platform;
+		};
+
+		typedef std::vector<Entry> Entries;
+
+		/**
+		 * \param sectorSize The size of the archive's sectors which has to be 512 multiplied by a power of two.
+		 * \throws Exception Throws an exception if the sector size is invalid.
+		 */
+		ArchiveBuilder(Archive::Format format = Archive::Format::Mpq1, uint32 sectorSize = 4096);
+
+		/**
+		 * Adds a file with the data \p data of size \p dataSize which is copied.
+		 * If \p compression is not \ref Sector::Compression::Uncompressed the file is compressed (\ref Block::Flags::IsCompressed) or imploded (\ref Block::Flags::IsImploded) automatically.
+		 */
+		void addFile(const boost::filesystem::path &path, const byte *data, uint64 dataSize, Sector::Compression compression = Sector::Compression::Uncompressed, Block::Flags flags = Block::Flags::None, File::Locale locale = File::Locale::Neutral, File::Platform platform = File::Platform::Default);
+		/**
+		 * Adds the file \p source from the hard disk as \p path.
+		 * The file is not read before \ref write() is called.
+		 */
+		void importFile(const boost::filesystem::path &path, const boost::filesystem::path &source, Sector::Compression compression = Sector::Compression::Uncompressed, Block::Flags flags = Block::Flags::None, File::Locale locale = File::Locale::Neutral, File::Platform platform = File::Platform::Default);
+		const Entries& entries() const;
+		void clear();
+
+		Archive::Format format() const;
+		uint32 sectorSize() const;
+		/**
+		 * The hash table has at least \p entries entries. The number is rounded up to a power of two since Warcraft III and StormLib require it and it is enlarged automatically if there is too many files.
+		 * \ref write() throws an exception if \p entries is greater than 2^31.
+		 */
+		void setHashTableEntries(uint32 entries);
+		uint32 hashTableEntries() const;
+		/**
+		 * The block table has at least \p entries entries. It is enlarged automatically if there is too many files.
+		 */
+		void setBlockTableEntries(uint32 entries);
+		uint32 blockTableEntries() const;
+		/**
+		 * \param threads The number of threads used for compressing files. If this value is 0 \ref defaultThreads() is used.
+		 */
+		void setThreads(unsigned threads);
+		unsigned threads() const;
+		/**
+		 * Enables or disables the "(listfile)" file which contains the paths of all entries.
+		 */
+		void setListfile(bool listfile);
+		bool listfile() const;
+		/**
+		 * Enables or disables the "(attributes)" file which contains the CRC32 and MD5 checksums of all files.
+		 */
+		void setAttributes(bool attributes);
+		bool attributes() const;
+
+		/**
+		 * \return Returns the smallest power of two which can hold \p files files in a hash table with a load factor of 3/4 at most.
+		 */
+		static uint32 hashTableEntries(uint32 files);
+
+		/**
+		 * Writes the archive with all entries into a new file \p path starting at position \p startPosition.
+		 * An existing file is overwritten.
+		 * \return Returns the size of the written archive.
+		 * \throws Exception Throws an exception if a file could not be read, compressed or written or if a file has been added twice.
+		 */
+		std::streamsize write(const boost::filesystem::path &path, std::streampos startPosition = 0) const;
+
+	private:
+		struct CompressedBlock;
+
+		/**
+		 * \param threads The number of threads which compress the sectors of the file.
+		 */
+		void compress(const Entry &entry, CompressedBlock &block, unsigned threads) const;
+
+		Archive::Format m_format;
+		uint32 m_sectorSize;
+		uint32 m_hashTableEntries;
+		uint32 m_blockTableEntries;
+		unsigned m_threads;
+		bool m_listfile;
+		bool m_attributes;
+		Entries m_entries;
+};
+
+inline const ArchiveBuilder::Entries& ArchiveBuilder::entries() const
+{
+	return this->m_entries;
+}
+
+inline void ArchiveBuilder::clear()
+{
+	this->m_entries.clear();
+}
+
+inline Archive::Format ArchiveBuilder::format() const
+{
+	return this->m_format;
+}
+
+inline uint32 ArchiveBuilder::sectorSize() const
+{
+	return this->m_sectorSize;
+}
+
+inline void ArchiveBuilder::setHashTableEntries(uint32 entries)
+{
+	this->m_hashTableEntries = entries;
+}
+
+inline uint32 ArchiveBuilder::hashTableEntries() const
+{
+	return this->m_hashTableEntries;
+}
+
+inline void ArchiveBuilder::setBlockTableEntries(uint32 entries)
+{
+	this->m_blockTableEntries = entries;
+}
+
+inline uint32 ArchiveBuilder::blockTableEntries() const
+{
+	return this->m_blockTableEntries;
+}
+
+inline void ArchiveBuilder::setThreads(unsigned threads)
+{
+	this->m_threads = threads;
+}
+
+inline unsigned ArchiveBuilder::threads() const
+{
+	return this->m_threads;
+}
+
+inline void ArchiveBuilder::setListfile(bool listfile)
+{
+	this->m_listfile = listfile;
+}
+
+inline bool ArchiveBuilder::listfile() const
+{
+	return this->m_listfile;
+}
+
+inline void ArchiveBuilder::setAttributes(bool attributes)
+{
+	this->m_attributes = attributes;
+}
+
+inline bool ArchiveBuilder::attributes() const
+{
+	return this->m_attributes;
+}
+
+}
+
+}
+
+#endif
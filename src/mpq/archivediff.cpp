@@ -0,0 +1,553 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <boost/functional/hash.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+#include "archivediff.hpp"
+#include "algorithm.hpp"
+#include "attributes.hpp"
+#include "block.hpp"
+#include "parallel.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+namespace
+{
+
+typedef std::unordered_map<HashData, Hash*, boost::hash<HashData> > UsedHashes;
+
+/*
+ * Hash tables might contain deleted entries with the same hash values as used ones.
+ */
+UsedHashes usedHashes(Archive &archive)
+{
+	UsedHashes result;
+
+	for (Archive::Hashes::iterator iterator = archive.hashes().begin(); iterator != archive.hashes().end(); ++iterator)
+	{
+		Hash *hash = iterator->second;
+
+		if (!hash->empty() && !hash->deleted() && hash->block() != 0)
+		{
+			result.insert(std::make_pair(hash->cHashData(), hash));
+		}
+	}
+
+	return result;
+}
+
+/*
+ * The checksums of the "(attributes)" file of an archive by block indices.
+ * Checksums which are zero are unknown.
+ */
+struct Checksums
+{
+	Attributes::Crc32s crcs;
+	Attributes::Md5s md5s;
+};
+
+Checksums checksums(Archive &archive)
+{
+	Checksums result;
+
+	if (!archive.containsAttributesFile())
+	{
+		return result;
+	}
+
+	int32 version = 0;
+	Attributes::ExtendedAttributes extendedAttributes = Attributes::ExtendedAttributes::None;
+	Attributes::FileTimes fileTimes;
+
+	// a corrupted "(attributes)" file only makes the comparison slower
+	try
+	{
+		archive.attributesFile().attributes(version, extendedAttributes, result.crcs, fileTimes, result.md5s);
+	}
+	catch (const Exception &)
+	{
+		return Checksums();
+	}
+
+	if (!(extendedAttributes & Attributes::ExtendedAttributes::FileCrc32s))
+	{
+		result.crcs.clear();
+	}
+
+	if (!(extendedAttributes & Attributes::ExtendedAttributes::FileMd5s))
+	{
+		result.md5s.clear();
+	}
+
+	return result;
+}
+
+bool isSpecialFile(const string &path)
+{
+	return path == "(listfile)" || path == "(attributes)" || path == "(signature)";
+}
+
+/*
+ * Every thread requires its own archive file stream if the archive is not memory mapped.
+ * The streams are reused for all files which are compared by the same thread.
+ */
+class Streams
+{
+	public:
+		Streams(const Archive &archive) : m_archive(archive)
+		{
+		}
+
+		std::unique_ptr<ifstream> acquire()
+		{
+			std::unique_ptr<ifstream> stream;
+
+			if (this->m_archive.isMapped())
+			{
+				return stream;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(this->m_mutex);
+
+				if (!this->m_streams.empty())
+				{
+					stream.reset(this->m_streams.pop_back().release());
+				}
+			}
+
+			if (stream.get() == nullptr)
+			{
+				stream.reset(new ifstream(this->m_archive.path(), std::ios::in | std::ios::binary));
+			}
+
+			if (!*stream)
+			{
+				throw Exception(boost::format(_("Unable to open file \"%1%\".")) % this->m_archive.path());
+			}
+
+			return stream;
+		}
+
+		void release(std::unique_ptr<ifstream> &stream)
+		{
+			// a failed stream is not reused
+			if (stream.get() != nullptr && *stream)
+			{
+				std::lock_guard<std::mutex> lock(this->m_mutex);
+				this->m_streams.push_back(stream.release());
+			}
+		}
+
+	private:
+		const Archive &m_archive;
+		std::mutex m_mutex;
+		boost::ptr_vector<ifstream> m_streams;
+};
+
+/*
+ * A pool of buffers which are reused for the compared files instead of allocating them for every file.
+ * They are freed with the pool when the comparison has finished.
+ */
+class Buffers
+{
+	public:
+		typedef std::vector<byte> Buffer;
+
+		std::unique_ptr<Buffer> acquire()
+		{
+			std::lock_guard<std::mutex> lock(this->m_mutex);
+
+			if (this->m_buffers.empty())
+			{
+				return std::unique_ptr<Buffer>(new Buffer());
+			}
+
+			return std::unique_ptr<Buffer>(this->m_buffers.pop_back().release());
+		}
+
+		void release(std::unique_ptr<Buffer> &buffer)
+		{
+			std::lock_guard<std::mutex> lock(this->m_mutex);
+			this->m_buffers.push_back(buffer.release());
+		}
+
+	private:
+		std::mutex m_mutex;
+		boost::ptr_vector<Buffer> m_buffers;
+};
+
+/*
+ * Returns the raw data of \p block which points into the mapped archive or into \p buffer.
+ */
+const byte* rawData(const Archive &archive, const Block *block, ifstream *stream, std::vector<byte> &buffer)
+{
+	const uint64 position = archive.startPosition() + block->largeOffset();
+	const std::size_t size = block->blockSize();
+
+	if (stream == nullptr)
+	{
+		return archive.mappedData(position, size);
+	}
+
+	buffer.resize(size);
+
+	if (size > 0)
+	{
+		stream->seekg(boost::numeric_cast<std::streamoff>(position));
+		std::streamsize bytes = 0;
+		wc3lib::read(*stream, buffer[0], bytes, size);
+
+		if (bytes != boost::numeric_cast<std::streamsize>(size))
+		{
+			throw Exception(boost::format(_("Unable to read %1% bytes at position %2% from archive %3%.")) % size % position % archive.path());
+		}
+	}
+
+	return buffer.data();
+}
+
+/*
+ * The raw data of two blocks can only be compared if the same data results in the same content.
+ * The encryption key of blocks with Block::Flags::UsesEncryptionKey depends on their offsets.
+ */
+bool rawDataComparable(const Archive &oldArchive, const Block *oldBlock, const Archive &newArchive, const Block *newBlock)
+{
+	if (oldBlock->blockSize() != newBlock->blockSize() || oldBlock->flags() != newBlock->flags() || oldArchive.sectorSize() != newArchive.sectorSize())
+	{
+		return false;
+	}
+
+	return !(oldBlock->flags() & Block::Flags::UsesEncryptionKey) || oldBlock->largeOffset() == newBlock->largeOffset();
+}
+
+uint32 decompress(File &file, ifstream *stream, std::vector<byte> &buffer)
+{
+	buffer.resize(file.size());
+
+	if (stream != nullptr)
+	{
+		return file.decompress(*stream, buffer.data(), boost::numeric_cast<uint32>(buffer.size()));
+	}
+
+	return file.decompress(buffer.data(), boost::numeric_cast<uint32>(buffer.size()));
+}
+
+bool entryLess(const ArchiveDiff::Entry &first, const ArchiveDiff::Entry &second)
+{
+	if (first.path.empty() != second.path.empty())
+	{
+		return !first.path.empty();
+	}
+
+	if (first.path != second.path)
+	{
+		return first.path < second.path;
+	}
+
+	const HashData &a = first.hashData;
+	const HashData &b = second.hashData;
+
+	if (a.filePathHashA() != b.filePathHashA())
+	{
+		return a.filePathHashA() < b.filePathHashA();
+	}
+
+	if (a.filePathHashB() != b.filePathHashB())
+	{
+		return a.filePathHashB() < b.filePathHashB();
+	}
+
+	if (a.locale() != b.locale())
+	{
+		return a.locale() < b.locale();
+	}
+
+	return a.platform() < b.platform();
+}
+
+}
+
+ArchiveDiff::ArchiveDiff() : m_threads(0), m_useAttributes(true)
+{
+}
+
+ArchiveDiff::Entries ArchiveDiff::diff(Archive &oldArchive, Archive &newArchive, const Listfile::Entries &entries) const
+{
+	if (!oldArchive.isOpen() || !newArchive.isOpen())
+	{
+		throw Exception(_("Archive is not open."));
+	}
+
+	/*
+	 * Resolve the paths of both archives at once.
+	 */
+	Listfile::Entries paths = entries;
+	paths.push_back("(listfile)");
+	paths.push_back("(attributes)");
+	paths.push_back("(signature)");
+
+	if (oldArchive.containsListfileFile())
+	{
+		const Listfile::Entries listfileEntries = oldArchive.listfileFile().entries();
+		paths.insert(paths.end(), listfileEntries.begin(), listfileEntries.end());
+	}
+
+	if (newArchive.containsListfileFile())
+	{
+		const Listfile::Entries listfileEntries = newArchive.listfileFile().entries();
+		paths.insert(paths.end(), listfileEntries.begin(), listfileEntries.end());
+	}
+
+	std::vector<const char*> pathStrings;
+	pathStrings.reserve(paths.size());
+
+	BOOST_FOREACH(Listfile::Entries::const_reference path, paths)
+	{
+		pathStrings.push_back(path.c_str());
+	}
+
+	std::vector<HashValues> hashValues(paths.size());
+	HashStrings(Archive::cryptTable(), pathStrings.data(), pathStrings.size(), hashValues.data());
+	std::map<std::pair<int32, int32>, string> pathsByHash;
+
+	for (std::size_t i = 0; i < paths.size(); ++i)
+	{
+		// the first path wins since the entries of the caller are preferred
+		pathsByHash.insert(std::make_pair(std::make_pair(static_cast<int32>(hashValues[i].nameA), static_cast<int32>(hashValues[i].nameB)), paths[i]));
+	}
+
+	/*
+	 * Pair the files of both archives by their hash values.
+	 */
+	const UsedHashes oldHashes = usedHashes(oldArchive);
+	const UsedHashes newHashes = usedHashes(newArchive);
+	Entries result;
+	result.reserve(std::max(oldHashes.size(), newHashes.size()));
+
+	auto addEntry = [&](const HashData &hashData, Hash *oldHash, Hash *newHash)
+	{
+		Entry entry;
+		entry.hashData = hashData;
+		std::map<std::pair<int32, int32>, string>::const_iterator iterator = pathsByHash.find(std::make_pair(hashData.filePathHashA(), hashData.filePathHashB()));
+
+		if (iterator != pathsByHash.end())
+		{
+			entry.path = iterator->second;
+		}
+
+		entry.status = oldHash == 0 ? Status::Added : (newHash == 0 ? Status::Removed : Status::Unchanged);
+		entry.check = Check::None;
+
+		if (oldHash != 0)
+		{
+			entry.oldFile = File(&oldArchive, oldHash, entry.path);
+		}
+
+		if (newHash != 0)
+		{
+			entry.newFile = File(&newArchive, newHash, entry.path);
+		}
+
+		result.push_back(entry);
+	};
+
+	BOOST_FOREACH(UsedHashes::const_reference oldHash, oldHashes)
+	{
+		UsedHashes::const_iterator iterator = newHashes.find(oldHash.first);
+		addEntry(oldHash.first, oldHash.second, iterator != newHashes.end() ? iterator->second : 0);
+	}
+
+	BOOST_FOREACH(UsedHashes::const_reference newHash, newHashes)
+	{
+		if (oldHashes.find(newHash.first) == oldHashes.end())
+		{
+			addEntry(newHash.first, 0, newHash.second);
+		}
+	}
+
+	std::sort(result.begin(), result.end(), entryLess);
+
+	/*
+	 * The checks which do not require reading any data are done first.
+	 * Only the remaining pairs are compared by the threads.
+	 */
+	Checksums oldChecksums;
+	Checksums newChecksums;
+
+	if (this->useAttributes())
+	{
+		oldChecksums = checksums(oldArchive);
+		newChecksums = checksums(newArchive);
+	}
+
+	MD5Checksum emptyMd5;
+	memset(emptyMd5.checksum, 0, sizeof(emptyMd5.checksum));
+	std::vector<std::size_t> remaining;
+
+	for (std::size_t i = 0; i < result.size(); ++i)
+	{
+		Entry &entry = result[i];
+
+		if (entry.status != Status::Unchanged)
+		{
+			continue;
+		}
+
+		const Block *oldBlock = entry.oldFile.block();
+		const Block *newBlock = entry.newFile.block();
+
+		if (oldBlock->fileSize() != newBlock->fileSize())
+		{
+			entry.status = Status::Changed;
+			entry.check = Check::Size;
+
+			continue;
+		}
+
+		const uint32 oldIndex = oldBlock->index();
+		const uint32 newIndex = newBlock->index();
+
+		if (oldIndex < oldChecksums.md5s.size() && newIndex < newChecksums.md5s.size() && !(oldChecksums.md5s[oldIndex] == emptyMd5) && !(newChecksums.md5s[newIndex] == emptyMd5))
+		{
+			entry.status = oldChecksums.md5s[oldIndex] == newChecksums.md5s[newIndex] ? Status::Unchanged : Status::Changed;
+			entry.check = Check::Md5;
+
+			continue;
+		}
+
+		// equal CRC32 checksums are conclusive for files of the same size as well
+		if (oldIndex < oldChecksums.crcs.size() && newIndex < newChecksums.crcs.size() && oldChecksums.crcs[oldIndex] != 0 && newChecksums.crcs[newIndex] != 0)
+		{
+			entry.status = oldChecksums.crcs[oldIndex] == newChecksums.crcs[newIndex] ? Status::Unchanged : Status::Changed;
+			entry.check = Check::Crc32;
+
+			continue;
+		}
+
+		remaining.push_back(i);
+	}
+
+	Streams oldStreams(oldArchive);
+	Streams newStreams(newArchive);
+	Buffers buffers;
+
+	parallelFor(remaining.size(), this->threads(), [&](std::size_t i)
+	{
+		Entry &entry = result[remaining[i]];
+		std::unique_ptr<ifstream> oldStream;
+		std::unique_ptr<ifstream> newStream;
+		std::unique_ptr<Buffers::Buffer> oldBuffer = buffers.acquire();
+		std::unique_ptr<Buffers::Buffer> newBuffer = buffers.acquire();
+
+		try
+		{
+			oldStream = oldStreams.acquire();
+			newStream = newStreams.acquire();
+			const Block *oldBlock = entry.oldFile.block();
+			const Block *newBlock = entry.newFile.block();
+
+			if (rawDataComparable(oldArchive, oldBlock, newArchive, newBlock))
+			{
+				const byte *oldData = rawData(oldArchive, oldBlock, oldStream.get(), *oldBuffer);
+				const byte *newData = rawData(newArchive, newBlock, newStream.get(), *newBuffer);
+
+				if (memcmp(oldData, newData, oldBlock->blockSize()) == 0)
+				{
+					entry.check = Check::RawData;
+					oldStreams.release(oldStream);
+					newStreams.release(newStream);
+					buffers.release(oldBuffer);
+					buffers.release(newBuffer);
+
+					return;
+				}
+			}
+
+			if (entry.path.empty() && ((oldBlock->flags() & Block::Flags::IsEncrypted) || (newBlock->flags() & Block::Flags::IsEncrypted)))
+			{
+				throw Exception(_("Unknown path of encrypted file."));
+			}
+
+			const uint32 oldSize = decompress(entry.oldFile, oldStream.get(), *oldBuffer);
+			const uint32 newSize = decompress(entry.newFile, newStream.get(), *newBuffer);
+			entry.status = oldSize == newSize && memcmp(oldBuffer->data(), newBuffer->data(), oldSize) == 0 ? Status::Unchanged : Status::Changed;
+			entry.check = Check::Content;
+		}
+		catch (const std::exception &exception)
+		{
+			entry.status = Status::Changed;
+			entry.error = exception.what();
+		}
+
+		oldStreams.release(oldStream);
+		newStreams.release(newStream);
+		buffers.release(oldBuffer);
+		buffers.release(newBuffer);
+	});
+
+	return result;
+}
+
+std::size_t ArchiveDiff::addPatchFiles(const Entries &entries, ArchiveBuilder &builder, Entries &skippedEntries, Sector::Compression compression)
+{
+	std::vector<byte> buffer;
+	std::size_t result = 0;
+	skippedEntries.clear();
+
+	BOOST_FOREACH(Entries::const_reference entry, entries)
+	{
+		if ((entry.status != Status::Added && entry.status != Status::Changed) || isSpecialFile(entry.path))
+		{
+			continue;
+		}
+
+		if (!entry.error.empty() || entry.path.empty())
+		{
+			skippedEntries.push_back(entry);
+
+			continue;
+		}
+
+		File file = entry.newFile;
+		const uint32 size = decompress(file, nullptr, buffer);
+		const Block::Flags flags = static_cast<Block::Flags>(static_cast<uint32>(file.block()->flags()) & static_cast<uint32>(Block::Flags::IsEncrypted | Block::Flags::UsesEncryptionKey | Block::Flags::IsSingleUnit));
+		builder.addFile(entry.path, buffer.data(), size, compression, flags, File::intToLocale(entry.hashData.locale()), File::intToPlatform(entry.hashData.platform()));
+		++result;
+	}
+
+	return result;
+}
+
+}
+
+}
@@ -0,0 +1,195 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef WC3LIB_MPQ_ARCHIVEDIFF_HPP
+#define WC3LIB_MPQ_ARCHIVEDIFF_HPP
+
+#include <vector>
+
+#include "platform.hpp"
+#include "archive.hpp"
+#include "archivebuilder.hpp"
+#include "file.hpp"
+#include "hash.hpp"
+#include "listfile.hpp"
+#include "sector.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \brief Finds the files which differ between two archives and creates patch archives which contain only these files.
+ *
+ * The files of both archives are paired by their hash values (\ref HashData) which consist of the hashed path, the locale and the platform.
+ * Therefore files are compared even if their paths are unknown.
+ *
+ * Every pair is checked by the cheapest possible check first (\ref Check):
+ * <ol>
+ * <li>Files with different sizes have changed.</li>
+ * <li>The MD5 or CRC32 checksums of the "(attributes)" files of both archives are compared if both archives contain them.</li>
+ * <li>The raw data of both blocks is compared without decompressing it.</li>
+ * <li>Only if all of these checks are inconclusive both files are decompressed and their contents are compared.</li>
+ * </ol>
+ * The pairs are compared by several threads. Archives which are opened memory mapped (\ref Archive::open()) are compared without copying their raw data.
+ *
+ * \sa Archive::verify()
+ */
+class ArchiveDiff
+{
+	public:
+		enum class Status
+		{
+			Unchanged,
+			/**
+			 * The file only exists in the new archive.
+			 */
+			Added,
+			/**
+			 * The file only exists in the old archive.
+			 */
+			Removed,
+			Changed
+		};
+
+		/**
+		 * \brief The check which has decided the status of a file.
+		 */
+		enum class Check
+		{
+			/**
+			 * The file exists only in one of the archives.
+			 */
+			None,
+			Size,
+			Md5,
+			Crc32,
+			/**
+			 * The raw data of both blocks is equal.
+			 */
+			RawData,
+			/**
+			 * Both files have been decompressed.
+			 */
+			Content
+		};
+
+		/**
+		 * \brief The result of the comparison of one file.
+		 */
+		struct Entry
+		{
+			HashData hashData;
+			/**
+			 * The path of the file or an empty string if it is unknown.
+			 */
+			string path;
+			Status status;
+			Check check;
+			/**
+			 * The file of the old archive which is invalid if the file has been added.
+			 */
+			File oldFile;
+			/**
+			 * The file of the new archive which is invalid if the file has been removed.
+			 */
+			File newFile;
+			/**
+			 * The reason why the files could not be compared, for example an unknown path of an encrypted file.
+			 * Files which could not be compared are reported as changed.
+			 */
+			string error;
+		};
+
+		typedef std::vector<Entry> Entries;
+
+		ArchiveDiff();
+
+		/**
+		 * \param threads The number of threads used for comparing files. If this value is 0 \ref defaultThreads() is used.
+		 */
+		void setThreads(unsigned threads);
+		unsigned threads() const;
+		/**
+		 * If this value is false the checksums of the "(attributes)" files are ignored which might be outdated if an archive has been modified by a tool which does not update them.
+		 * By default they are used.
+		 */
+		void setUseAttributes(bool useAttributes);
+		bool useAttributes() const;
+
+		/**
+		 * Compares all files of \p oldArchive with the files of \p newArchive.
+		 * The paths of the files are taken from the "(listfile)" files of both archives and \p entries. The special files "(listfile)", "(attributes)" and "(signature)" are always known.
+		 * Errors of single files are reported in \ref Entry::error and do not stop the comparison.
+		 *
+		 * \return Returns the results of all files including the unchanged ones. Files with known paths are sorted by their paths and come first.
+		 * \throws Exception Throws an exception if one of the archives is not open.
+		 */
+		Entries diff(Archive &oldArchive, Archive &newArchive, const Listfile::Entries &entries = Listfile::Entries()) const;
+
+		/**
+		 * Adds all added and changed files of \p entries to \p builder with the data of the new archive.
+		 * The files keep their locales and platforms and whether they are encrypted or stored in a single unit.
+		 * An archive which is written by \p builder contains only these files and can be used as patch archive for the old archive.
+		 * Removed files cannot be expressed by a patch archive.
+		 *
+		 * The special files "(listfile)", "(attributes)" and "(signature)" are skipped since they are created by the builder itself.
+		 * Added and changed files with unknown paths and files which could not be compared (\ref Entry::error) cannot be added and are stored in \p skippedEntries.
+		 * In this case the patch archive is incomplete.
+		 *
+		 * \param skippedEntries The added and changed files which have not been added to \p builder.
+		 * \param compression The compression of the files in the patch archive.
+		 * \return Returns the number of added files.
+		 * \throws Exception Throws an exception if a file could not be decompressed.
+		 */
+		static std::size_t addPatchFiles(const Entries &entries, ArchiveBuilder &builder, Entries &skippedEntries, Sector::Compression compression = Sector::Compression::Deflated);
+
+	private:
+		unsigned m_threads;
+		bool m_useAttributes;
+};
+
+inline void ArchiveDiff::setThreads(unsigned threads)
+{
+	this->m_threads = threads;
+}
+
+inline unsigned ArchiveDiff::threads() const
+{
+	return this->m_threads;
+}
+
+inline void ArchiveDiff::setUseAttributes(bool useAttributes)
+{
+	this->m_useAttributes = useAttributes;
+}
+
+inline bool ArchiveDiff::useAttributes() const
+{
+	return this->m_useAttributes;
+}
+
+}
+
+}
+
+#endif
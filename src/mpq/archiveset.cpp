@@ -0,0 +1,213 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <algorithm>
+
+#include "archiveset.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+const ArchiveSet::Priority ArchiveSet::war3Priority;
+const ArchiveSet::Priority ArchiveSet::war3XPriority;
+const ArchiveSet::Priority ArchiveSet::war3XLocalPriority;
+const ArchiveSet::Priority ArchiveSet::war3PatchPriority;
+
+ArchiveSet::ArchiveSet()
+{
+}
+
+Archive& ArchiveSet::addArchive(const boost::filesystem::path &path, Priority priority, bool mapped)
+{
+	std::unique_ptr<Archive> archive(new Archive());
+	archive->open(path, mapped);
+
+	return this->addArchive(std::move(archive), priority);
+}
+
+Archive& ArchiveSet::addArchive(std::unique_ptr<Archive> archive, Priority priority)
+{
+	if (archive.get() == nullptr || !archive->isOpen())
+	{
+		throw Exception(_("Archive is not open."));
+	}
+
+	// archives with equal priorities which have been added later are preferred
+	Sources::iterator iterator = std::upper_bound(this->m_sources.begin(), this->m_sources.end(), priority, [](Priority priority, const Source &source) { return priority < source.priority; });
+	Source source;
+	source.priority = priority;
+	source.archive = std::move(archive);
+	Archive &result = *source.archive;
+	this->m_sources.insert(iterator, std::move(source));
+	this->buildIndex();
+
+	return result;
+}
+
+std::size_t ArchiveSet::addDefaultArchives(const boost::filesystem::path &directory, bool mapped)
+{
+	const std::pair<const char*, Priority> archives[] =
+	{
+		std::make_pair("war3.mpq", war3Priority),
+		std::make_pair("war3x.mpq", war3XPriority),
+		std::make_pair("War3xlocal.mpq", war3XLocalPriority),
+		std::make_pair("War3Patch.mpq", war3PatchPriority)
+	};
+	std::size_t result = 0;
+
+	for (std::size_t i = 0; i < sizeof(archives) / sizeof(archives[0]); ++i)
+	{
+		const boost::filesystem::path path = directory / archives[i].first;
+
+		if (boost::filesystem::is_regular_file(path))
+		{
+			this->addArchive(path, archives[i].second, mapped);
+			++result;
+		}
+	}
+
+	return result;
+}
+
+bool ArchiveSet::removeArchive(const boost::filesystem::path &path)
+{
+	// archives store absolute paths
+	const boost::filesystem::path absolutePath = boost::filesystem::system_complete(path);
+	Sources::iterator iterator = std::find_if(this->m_sources.begin(), this->m_sources.end(), [&absolutePath](const Source &source) { return source.archive->path() == absolutePath; });
+
+	if (iterator == this->m_sources.end())
+	{
+		return false;
+	}
+
+	this->m_sources.erase(iterator);
+	this->buildIndex();
+
+	return true;
+}
+
+void ArchiveSet::clear()
+{
+	this->m_index.clear();
+	this->m_hetSources.clear();
+	this->m_sources.clear();
+}
+
+File ArchiveSet::findFile(const HashData &hashData) const
+{
+	Index::const_iterator iterator = this->m_index.find(hashData);
+
+	if (iterator == this->m_index.end())
+	{
+		return File();
+	}
+
+	return File(this->m_sources[iterator->second.source].archive.get(), iterator->second.hash, "");
+}
+
+File ArchiveSet::findFile(const boost::filesystem::path &path, File::Locale locale, File::Platform platform) const
+{
+	Index::const_iterator iterator = this->m_index.find(HashData(path, locale, platform));
+
+	/*
+	 * Archives which only use a HET table and have a higher priority than the found file have to be searched by the path.
+	 * The sources are searched starting with the highest priority.
+	 */
+	for (std::vector<std::size_t>::const_reverse_iterator source = this->m_hetSources.rbegin(); source != this->m_hetSources.rend(); ++source)
+	{
+		if (iterator != this->m_index.end() && *source < iterator->second.source)
+		{
+			break;
+		}
+
+		File file = this->m_sources[*source].archive->findFile(path, locale, platform);
+
+		if (file.isValid())
+		{
+			return file;
+		}
+	}
+
+	if (iterator == this->m_index.end())
+	{
+		return File();
+	}
+
+	return File(this->m_sources[iterator->second.source].archive.get(), iterator->second.hash, path);
+}
+
+std::unique_ptr<FileInputStream> ArchiveSet::openFile(const boost::filesystem::path &path, File::Locale locale, File::Platform platform) const
+{
+	const File file = this->findFile(path, locale, platform);
+
+	if (!file.isValid())
+	{
+		return std::unique_ptr<FileInputStream>();
+	}
+
+	return std::unique_ptr<FileInputStream>(new FileInputStream(file));
+}
+
+void ArchiveSet::buildIndex()
+{
+	this->m_index.clear();
+	this->m_hetSources.clear();
+	std::size_t hashes = 0;
+
+	for (std::size_t i = 0; i < this->m_sources.size(); ++i)
+	{
+		hashes += this->m_sources[i].archive->hashes().size();
+	}
+
+	this->m_index.reserve(hashes);
+
+	for (std::size_t i = 0; i < this->m_sources.size(); ++i)
+	{
+		Archive &archive = *this->m_sources[i].archive;
+
+		if (archive.usesHetTable())
+		{
+			this->m_hetSources.push_back(i);
+
+			continue;
+		}
+
+		for (Archive::Hashes::iterator iterator = archive.hashes().begin(); iterator != archive.hashes().end(); ++iterator)
+		{
+			Hash *hash = iterator->second;
+
+			if (!hash->empty() && !hash->deleted() && hash->block() != 0)
+			{
+				IndexEntry entry;
+				entry.source = i;
+				entry.hash = hash;
+				// the sources are sorted by their priorities
+				this->m_index[hash->cHashData()] = entry;
+			}
+		}
+	}
+}
+
+}
+
+}
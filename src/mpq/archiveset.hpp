@@ -0,0 +1,178 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef WC3LIB_MPQ_ARCHIVESET_HPP
+#define WC3LIB_MPQ_ARCHIVESET_HPP
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+
+#include "platform.hpp"
+#include "archive.hpp"
+#include "file.hpp"
+#include "filestreambuf.hpp"
+#include "hash.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \brief Several archives which are searched like one single archive where archives with higher priorities overlay the files of archives with lower priorities.
+ *
+ * Warcraft III loads its files from "war3.mpq", "war3x.mpq", "War3xlocal.mpq" and "War3Patch.mpq" and finally from the map.
+ * A file of an archive with a higher priority replaces the file with the same path, locale and platform of all archives with lower priorities.
+ * If several archives have the same priority the archive which has been added last is preferred.
+ *
+ * Instead of searching every archive one after another all used hashes of all archives are merged into one single index by their hash values (\ref HashData)
+ * whenever an archive is added or removed. Therefore finding a file (\ref findFile()) requires only one lookup independent of the number of archives.
+ * Files are read by \ref FileInputStream directly from the archives without extracting them into temporary files.
+ *
+ * Archives which only contain a HET table (\ref Archive::usesHetTable()) do not store the hash values of their files. They are searched by \ref Archive::findFile() in addition to the index.
+ *
+ * \note The archives must not be modified while they belong to the set since the index would not be updated.
+ */
+class ArchiveSet : private boost::noncopyable
+{
+	public:
+		/**
+		 * Archives with higher priorities are preferred.
+		 */
+		typedef std::size_t Priority;
+
+		/**
+		 * \brief One archive of the set with its priority.
+		 */
+		struct Source
+		{
+			Priority priority;
+			std::unique_ptr<Archive> archive;
+		};
+
+		/**
+		 * The sources are sorted by their priorities starting with the lowest one.
+		 */
+		typedef std::vector<Source> Sources;
+
+		/**
+		 * The priorities of the archives of Warcraft III which are used by \ref addDefaultArchives().
+		 * @{
+		 */
+		static const Priority war3Priority = 20;
+		static const Priority war3XPriority = 21;
+		static const Priority war3XLocalPriority = 22;
+		static const Priority war3PatchPriority = 23;
+		/**
+		 * @}
+		 */
+
+		ArchiveSet();
+
+		/**
+		 * Opens the archive \p path and adds it with the priority \p priority.
+		 * \param mapped If this value is true the archive file is mapped into memory (\ref Archive::open()).
+		 * \return Returns the opened archive which belongs to the set.
+		 * \throws Exception Throws an exception if the archive could not be opened. The set is not changed in this case.
+		 */
+		Archive& addArchive(const boost::filesystem::path &path, Priority priority = 0, bool mapped = false);
+		/**
+		 * Adds the already opened archive \p archive with the priority \p priority.
+		 * \throws Exception Throws an exception if \p archive is not open.
+		 */
+		Archive& addArchive(std::unique_ptr<Archive> archive, Priority priority = 0);
+		/**
+		 * Adds the archives "war3.mpq", "war3x.mpq", "War3xlocal.mpq" and "War3Patch.mpq" of the Warcraft III directory \p directory with their default priorities.
+		 * Archives which do not exist are skipped. Maps should be added with a higher priority than \ref war3PatchPriority.
+		 * \return Returns the number of added archives.
+		 * \throws Exception Throws an exception if an existing archive could not be opened.
+		 */
+		std::size_t addDefaultArchives(const boost::filesystem::path &directory, bool mapped = false);
+		/**
+		 * Removes and closes the archive with the file path \p path.
+		 * \return Returns true if the archive has been removed.
+		 */
+		bool removeArchive(const boost::filesystem::path &path);
+		/**
+		 * Removes and closes all archives.
+		 */
+		void clear();
+
+		const Sources& sources() const;
+
+		/**
+		 * Searches the file with the hash values \p hashData in all archives which do not only use a HET table.
+		 * \return Returns the file of the archive with the highest priority or an invalid file if no archive contains it.
+		 */
+		File findFile(const HashData &hashData) const;
+		/**
+		 * Searches the file \p path with the locale \p locale and the platform \p platform in all archives.
+		 * \param path The path of the file in the format of "(listfile)" entries.
+		 * \return Returns the file of the archive with the highest priority or an invalid file if no archive contains it.
+		 */
+		File findFile(const boost::filesystem::path &path, File::Locale locale = File::Locale::Neutral, File::Platform platform = File::Platform::Default) const;
+		/**
+		 * Opens the file \p path of the archive with the highest priority for reading.
+		 * \return Returns a stream which decompresses the file sector by sector or 0 if no archive contains the file.
+		 * \throws Exception Throws an exception if the file could not be opened.
+		 */
+		std::unique_ptr<FileInputStream> openFile(const boost::filesystem::path &path, File::Locale locale = File::Locale::Neutral, File::Platform platform = File::Platform::Default) const;
+
+	private:
+		/**
+		 * \brief A used hash of a source in the index.
+		 */
+		struct IndexEntry
+		{
+			std::size_t source;
+			Hash *hash;
+		};
+
+		typedef std::unordered_map<HashData, IndexEntry, boost::hash<HashData> > Index;
+
+		/**
+		 * Adds the used hashes of all sources to the index. Sources with higher indices replace the hashes of sources with lower indices.
+		 */
+		void buildIndex();
+
+		Sources m_sources;
+		Index m_index;
+		/**
+		 * The indices of all sources which only use a HET table sorted by their priorities.
+		 */
+		std::vector<std::size_t> m_hetSources;
+};
+
+inline const ArchiveSet::Sources& ArchiveSet::sources() const
+{
+	return this->m_sources;
+}
+
+}
+
+}
+
+#endif
@@ -19,6 +19,7 @@
  ***************************************************************************/
 
 #include <boost/crc.hpp>
+#include <boost/scoped_array.hpp>
 
 #include "attributes.hpp"
 #include "mpq.hpp"
@@ -32,6 +33,8 @@ namespace wc3lib
 namespace mpq
 {
 
+const int32 Attributes::latestVersion;
+
 CRC32 Attributes::crc32(const byte* data, std::size_t dataSize)
 {
 	boost::crc_32_type result; // TODO get correct CRC paramaters for MPQ (specification?)
@@ -46,6 +49,36 @@ MD5Checksum Attributes::md5(const byte* data, std::size_t dataSize)
 	return mpq::md5(data, dataSize);
 }
 
+Attributes::Checksums::Checksums() : m_md5(new MD5())
+{
+}
+
+Attributes::Checksums::~Checksums()
+{
+}
+
+void Attributes::Checksums::process(const byte *data, std::size_t dataSize)
+{
+	this->m_crc32.process_bytes((const void*)data, dataSize);
+	this->m_md5->update((unsigned char*)data, boost::numeric_cast<unsigned int>(dataSize));
+}
+
+CRC32 Attributes::Checksums::crc32() const
+{
+	return this->m_crc32.checksum();
+}
+
+MD5Checksum Attributes::Checksums::md5()
+{
+	this->m_md5->finalize();
+	// the digest is allocated by the MD5 implementation
+	const boost::scoped_array<unsigned char> digest(this->m_md5->raw_digest());
+	MD5Checksum result;
+	memcpy(result.checksum, digest.get(), sizeof(result.checksum));
+
+	return result;
+}
+
 bool Attributes::checkCrc(const byte *data, std::size_t dataSize, CRC32 crc)
 {
 	// TODO implement CRC check
@@ -22,9 +22,14 @@
 #define WC3LIB_MPQ_ATTRIBUTES_HPP
 
 #include <vector>
+#include <memory>
+
+#include <boost/crc.hpp>
 
 #include "file.hpp"
 
+class MD5;
+
 namespace wc3lib
 {
 
@@ -87,6 +92,31 @@ class Attributes : public File
 		static MD5Checksum md5(const byte *data, std::size_t dataSize);
 		/**@}*/
 
+		/**
+		 * \brief Calculates the CRC32 and MD5 checksums of data which is processed in several parts.
+		 *
+		 * This allows calculating the checksums of files sector by sector (\ref File::decompress(const File::SectorFunction&, istream*)) without holding their whole data.
+		 * The results are equal to \ref crc32() and \ref md5() of the whole data.
+		 */
+		class Checksums
+		{
+			public:
+				Checksums();
+				~Checksums();
+
+				void process(const byte *data, std::size_t dataSize);
+
+				CRC32 crc32() const;
+				/**
+				 * Finalizes the MD5 checksum. No more data can be processed afterwards.
+				 */
+				MD5Checksum md5();
+
+			private:
+				boost::crc_32_type m_crc32;
+				std::unique_ptr<MD5> m_md5;
+		};
+
 		/**
 		 * Checks \p data of size \p dataSize with the given checksum and returns
 		 * if the data matches the checksum.
@@ -0,0 +1,238 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+
+#include <boost/format.hpp>
+
+#include "bettable.hpp"
+#include "archive.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+const byte BetTable::identifier[4] = { 'B', 'E', 'T', 0x1A };
+const uint32 BetTable::version = 1;
+
+BetTable::Entry::Entry() : filePosition(0), fileSize(0), compressedSize(0), flags(Block::Flags::None)
+{
+}
+
+BetTable::BetTable()
+{
+	this->clear();
+}
+
+void BetTable::create(const Entries &entries, const std::vector<uint64> &nameHashes, uint32 nameHashBitCount)
+{
+	this->clear();
+
+	uint64 maxFilePosition = 0;
+	uint64 maxFileSize = 0;
+	uint64 maxCompressedSize = 0;
+	std::vector<uint32> flagIndices;
+	flagIndices.reserve(entries.size());
+
+	// every different combination of flags is stored only once
+	BOOST_FOREACH(Entries::const_reference entry, entries)
+	{
+		maxFilePosition = std::max(maxFilePosition, entry.filePosition);
+		maxFileSize = std::max(maxFileSize, entry.fileSize);
+		maxCompressedSize = std::max(maxCompressedSize, entry.compressedSize);
+		const uint32 flags = static_cast<uint32>(entry.flags);
+		std::vector<uint32>::iterator iterator = std::find(this->m_flags.begin(), this->m_flags.end(), flags);
+
+		if (iterator == this->m_flags.end())
+		{
+			this->m_flags.push_back(flags);
+			iterator = this->m_flags.end() - 1;
+		}
+
+		flagIndices.push_back(boost::numeric_cast<uint32>(iterator - this->m_flags.begin()));
+	}
+
+	BetTableHeader &header = this->m_header;
+	header.entryCount = boost::numeric_cast<uint32>(entries.size());
+	header.unknown = 0x10;
+	header.bitCountFilePosition = bitCount(maxFilePosition);
+	header.bitCountFileSize = bitCount(maxFileSize);
+	header.bitCountCompressedSize = bitCount(maxCompressedSize);
+	header.bitCountFlagIndex = this->m_flags.empty() ? 0 : bitCount(this->m_flags.size() - 1);
+	header.bitCountUnknown = 0;
+	header.bitIndexFilePosition = 0;
+	header.bitIndexFileSize = header.bitIndexFilePosition + header.bitCountFilePosition;
+	header.bitIndexCompressedSize = header.bitIndexFileSize + header.bitCountFileSize;
+	header.bitIndexFlagIndex = header.bitIndexCompressedSize + header.bitCountCompressedSize;
+	header.bitIndexUnknown = header.bitIndexFlagIndex + header.bitCountFlagIndex;
+	header.tableEntrySize = header.bitIndexUnknown + header.bitCountUnknown;
+	header.nameHashBitCount = nameHashBitCount;
+	header.nameHashBitExtra = 0;
+	header.nameHashBitTotal = nameHashBitCount;
+	header.nameHashArraySize = boost::numeric_cast<uint32>((uint64(header.entryCount) * header.nameHashBitTotal + 7) / 8);
+	header.flagCount = boost::numeric_cast<uint32>(this->m_flags.size());
+
+	this->m_table.assign((uint64(header.entryCount) * header.tableEntrySize + 7) / 8, 0);
+	this->m_nameHashes.assign(header.nameHashArraySize, 0);
+
+	for (uint32 i = 0; i < header.entryCount; ++i)
+	{
+		const uint64 bitIndex = uint64(i) * header.tableEntrySize;
+		writeBits(this->m_table.data(), bitIndex + header.bitIndexFilePosition, header.bitCountFilePosition, entries[i].filePosition);
+		writeBits(this->m_table.data(), bitIndex + header.bitIndexFileSize, header.bitCountFileSize, entries[i].fileSize);
+		writeBits(this->m_table.data(), bitIndex + header.bitIndexCompressedSize, header.bitCountCompressedSize, entries[i].compressedSize);
+		writeBits(this->m_table.data(), bitIndex + header.bitIndexFlagIndex, header.bitCountFlagIndex, flagIndices[i]);
+
+		if (i < nameHashes.size())
+		{
+			writeBits(this->m_nameHashes.data(), uint64(i) * header.nameHashBitTotal, header.nameHashBitCount, nameHashes[i]);
+		}
+	}
+
+	header.tableSize = boost::numeric_cast<uint32>(sizeof(ExtendedTableHeader) + sizeof(BetTableHeader) + this->m_flags.size() * sizeof(uint32) + this->m_table.size() + this->m_nameHashes.size());
+}
+
+void BetTable::clear()
+{
+	memset(&this->m_header, 0, sizeof(this->m_header));
+	this->m_header.tableSize = sizeof(ExtendedTableHeader) + sizeof(BetTableHeader);
+	this->m_flags.clear();
+	this->m_table.clear();
+	this->m_nameHashes.clear();
+}
+
+std::streamsize BetTable::read(istream &istream, uint64 tableSize)
+{
+	std::streamsize size = 0;
+	ExtendedTableHeader extendedTableHeader;
+	wc3lib::read(istream, extendedTableHeader, size);
+
+	if (size != sizeof(extendedTableHeader) || memcmp(extendedTableHeader.magic, BetTable::identifier, sizeof(BetTable::identifier)) != 0)
+	{
+		throw Exception(_("Missing BET table identifier."));
+	}
+
+	if (extendedTableHeader.version != BetTable::version)
+	{
+		throw Exception(boost::format(_("Unknown BET table version %1%.")) % extendedTableHeader.version);
+	}
+
+	if (tableSize > sizeof(extendedTableHeader) + extendedTableHeader.dataSize)
+	{
+		throw Exception(_("Compressed BET tables are not supported."));
+	}
+
+	if (extendedTableHeader.dataSize < sizeof(BetTableHeader))
+	{
+		throw Exception(boost::format(_("BET table is too small (%1% bytes).")) % extendedTableHeader.dataSize);
+	}
+
+	std::vector<byte> data(extendedTableHeader.dataSize);
+	std::streamsize dataSize = 0;
+	wc3lib::read(istream, data[0], dataSize, data.size());
+	size += dataSize;
+
+	if (dataSize != boost::numeric_cast<std::streamsize>(data.size()))
+	{
+		throw Exception(_("Unexpected end of BET table."));
+	}
+
+	DecryptData(Archive::cryptTable(), data.data(), boost::numeric_cast<uint32>(data.size()), HashString(Archive::cryptTable(), "(block table)", HashType::FileKey));
+
+	BetTableHeader header;
+	memcpy(&header, data.data(), sizeof(header));
+	const uint64 tableBytes = (uint64(header.entryCount) * header.tableEntrySize + 7) / 8;
+	const uint64 requiredSize = sizeof(header) + uint64(header.flagCount) * sizeof(uint32) + tableBytes + header.nameHashArraySize;
+
+	if (requiredSize > data.size() || header.bitCountFilePosition > 64 || header.bitCountFileSize > 64 || header.bitCountCompressedSize > 64 || header.bitCountFlagIndex > 32 || header.nameHashBitCount > 64 || header.nameHashBitCount > header.nameHashBitTotal || (uint64(header.entryCount) * header.nameHashBitTotal + 7) / 8 > header.nameHashArraySize)
+	{
+		throw Exception(_("Invalid BET table header."));
+	}
+
+	const byte *position = data.data() + sizeof(header);
+	this->m_header = header;
+	this->m_flags.resize(header.flagCount);
+
+	if (!this->m_flags.empty())
+	{
+		memcpy(this->m_flags.data(), position, this->m_flags.size() * sizeof(uint32));
+	}
+
+	position += this->m_flags.size() * sizeof(uint32);
+	this->m_table.assign(position, position + tableBytes);
+	position += tableBytes;
+	this->m_nameHashes.assign(position, position + header.nameHashArraySize);
+
+	return size;
+}
+
+std::streamsize BetTable::write(ostream &ostream) const
+{
+	std::vector<byte> data;
+	data.reserve(this->size() - sizeof(ExtendedTableHeader));
+	const byte *header = reinterpret_cast<const byte*>(&this->m_header);
+	data.insert(data.end(), header, header + sizeof(this->m_header));
+	const byte *flags = reinterpret_cast<const byte*>(this->m_flags.data());
+	data.insert(data.end(), flags, flags + this->m_flags.size() * sizeof(uint32));
+	data.insert(data.end(), this->m_table.begin(), this->m_table.end());
+	data.insert(data.end(), this->m_nameHashes.begin(), this->m_nameHashes.end());
+
+	EncryptData(Archive::cryptTable(), data.data(), boost::numeric_cast<uint32>(data.size()), HashString(Archive::cryptTable(), "(block table)", HashType::FileKey));
+
+	ExtendedTableHeader extendedTableHeader;
+	memcpy(extendedTableHeader.magic, BetTable::identifier, sizeof(BetTable::identifier));
+	extendedTableHeader.version = BetTable::version;
+	extendedTableHeader.dataSize = boost::numeric_cast<uint32>(data.size());
+
+	std::streamsize size = 0;
+	wc3lib::write(ostream, extendedTableHeader, size);
+	wc3lib::write(ostream, data[0], size, data.size());
+
+	return size;
+}
+
+BetTable::Entry BetTable::entry(uint32 index) const
+{
+	const uint64 bitIndex = uint64(index) * this->m_header.tableEntrySize;
+	Entry result;
+	result.filePosition = readBits(this->m_table.data(), bitIndex + this->m_header.bitIndexFilePosition, this->m_header.bitCountFilePosition);
+	result.fileSize = readBits(this->m_table.data(), bitIndex + this->m_header.bitIndexFileSize, this->m_header.bitCountFileSize);
+	result.compressedSize = readBits(this->m_table.data(), bitIndex + this->m_header.bitIndexCompressedSize, this->m_header.bitCountCompressedSize);
+	const uint64 flagIndex = readBits(this->m_table.data(), bitIndex + this->m_header.bitIndexFlagIndex, this->m_header.bitCountFlagIndex);
+
+	if (flagIndex < this->m_flags.size())
+	{
+		result.flags = static_cast<Block::Flags>(this->m_flags[flagIndex]);
+	}
+
+	return result;
+}
+
+uint64 BetTable::nameHash2(uint32 index) const
+{
+	return readBits(this->m_nameHashes.data(), uint64(index) * this->m_header.nameHashBitTotal, this->m_header.nameHashBitCount);
+}
+
+}
+
+}
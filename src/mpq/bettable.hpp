@@ -0,0 +1,133 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef WC3LIB_MPQ_BETTABLE_HPP
+#define WC3LIB_MPQ_BETTABLE_HPP
+
+#include <vector>
+
+#include "platform.hpp"
+#include "block.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \brief Block extended table (BET) of the MPQ formats 3 and 4.
+ *
+ * The BET table replaces the block table. All entries are bit-packed using as few bits for each field as the largest value requires.
+ * Flags are not stored per entry but as index into a small array of all different flag combinations.
+ * Additionally the table stores the lower bits of the file name hashes (\ref nameHash2()) which are used to verify matches of the HET table (\ref HetTable).
+ *
+ * The entries are kept bit-packed in memory and are only decoded on access (\ref entry()).
+ *
+ * \sa HetTable
+ * \sa Archive::betTable()
+ */
+class BetTable
+{
+	public:
+		struct Entry
+		{
+			Entry();
+
+			uint64 filePosition; /// Offset of the block relative to the archive's start position.
+			uint64 fileSize;
+			uint64 compressedSize;
+			Block::Flags flags;
+		};
+
+		typedef std::vector<Entry> Entries;
+
+		static const byte identifier[4];
+		static const uint32 version;
+
+		BetTable();
+
+		/**
+		 * Fills the table with \p entries.
+		 * \param nameHashes The lower \p nameHashBitCount bits of the file name hashes for all entries.
+		 * \param nameHashBitCount The number of bits of the stored file name hashes.
+		 */
+		void create(const Entries &entries, const std::vector<uint64> &nameHashes, uint32 nameHashBitCount);
+		void clear();
+
+		/**
+		 * Reads the table at the current position of \p istream and decrypts it.
+		 * \param tableSize The size of the table stored in the header of the archive or 0 if it is unknown. Compressed tables are not supported.
+		 * \throws Exception Throws an exception if the table is invalid.
+		 */
+		std::streamsize read(istream &istream, uint64 tableSize = 0);
+		/**
+		 * Writes the encrypted table at the current position of \p ostream.
+		 */
+		std::streamsize write(ostream &ostream) const;
+		/**
+		 * \return Returns the size of the written table in bytes including the \ref ExtendedTableHeader.
+		 */
+		uint32 size() const;
+
+		uint32 entryCount() const;
+		bool empty() const;
+		/**
+		 * Decodes the entry at \p index.
+		 */
+		Entry entry(uint32 index) const;
+		/**
+		 * \return Returns the lower \ref nameHashBitCount() bits of the file name hash of the entry at \p index.
+		 */
+		uint64 nameHash2(uint32 index) const;
+		uint32 nameHashBitCount() const;
+
+	private:
+		BetTableHeader m_header;
+		std::vector<uint32> m_flags;
+		std::vector<byte> m_table;
+		std::vector<byte> m_nameHashes;
+};
+
+inline uint32 BetTable::size() const
+{
+	return this->m_header.tableSize;
+}
+
+inline uint32 BetTable::entryCount() const
+{
+	return this->m_header.entryCount;
+}
+
+inline bool BetTable::empty() const
+{
+	return this->entryCount() == 0;
+}
+
+inline uint32 BetTable::nameHashBitCount() const
+{
+	return this->m_header.nameHashBitCount;
+}
+
+}
+
+}
+
+#endif
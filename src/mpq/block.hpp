@@ -178,6 +178,11 @@ inline constexpr bool operator&(Block::Flags x, Block::Flags y)
 	return static_cast<bool>(static_cast<uint32>(x) & static_cast<uint32>(y));
 }
 
+inline constexpr Block::Flags operator|(Block::Flags x, Block::Flags y)
+{
+	return static_cast<Block::Flags>(static_cast<uint32>(x) | static_cast<uint32>(y));
+}
+
 inline bool Block::hasSectorOffsetTable(Block::Flags flags)
 {
 	return !(flags & Block::Flags::IsSingleUnit) && ((flags & Block::Flags::IsCompressed) || (flags & Block::Flags::IsImploded));
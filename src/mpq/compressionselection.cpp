@@ -0,0 +1,421 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+
+#include "compressionselection.hpp"
+#include "algorithm.hpp"
+#include "imaadpcm.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+namespace
+{
+
+/*
+ * Listfile entries use backslashes.
+ */
+string extension(const string &path)
+{
+	const string::size_type separator = path.find_last_of("\\/");
+	const string fileName = path.substr(separator == string::npos ? 0 : separator + 1);
+	const string::size_type index = fileName.find_last_of('.');
+
+	if (index == string::npos)
+	{
+		return "";
+	}
+
+	return boost::algorithm::to_lower_copy(fileName.substr(index));
+}
+
+uint32 readUint32(const byte *data)
+{
+	return uint32(uint8(data[0])) | (uint32(uint8(data[1])) << 8) | (uint32(uint8(data[2])) << 16) | (uint32(uint8(data[3])) << 24);
+}
+
+uint16 readUint16(const byte *data)
+{
+	return uint16(uint8(data[0]) | (uint8(data[1]) << 8));
+}
+
+}
+
+CompressionSelection::Candidate::Candidate(Sector::Compression compression, int compressionLevel, int waveCompressionLevel)
+: compression(compression)
+, compressionLevel(compressionLevel)
+, waveCompressionLevel(waveCompressionLevel)
+{
+}
+
+CompressionSelection::Result::Result()
+: compression(Sector::Compression::Uncompressed)
+, compressionLevel(Sector::defaultCompressionLevel)
+, waveCompressionLevel(Sector::defaultWaveCompressionLevel)
+, sampleSize(0)
+, compressedSampleSize(0)
+, compressedFormat(false)
+{
+}
+
+CompressionSelection::CompressionSelection(uint32 sectorSize)
+: m_sectorSize(sectorSize)
+, m_sampleSectors(8)
+, m_decompressionBudget(3.0)
+, m_extendedCompressions(false)
+, m_waveCompressionLevels(1, Sector::defaultWaveCompressionLevel)
+{
+}
+
+CompressionSelection::Candidates CompressionSelection::candidates(bool extendedCompressions)
+{
+	// the best level of zlib
+	const int bestLevel = 9;
+	Candidates result;
+	result.push_back(Candidate(Sector::Compression::Deflated));
+	result.push_back(Candidate(Sector::Compression::Deflated, bestLevel));
+	result.push_back(Candidate(Sector::Compression::Bzip2Compressed));
+	result.push_back(Candidate(Sector::Compression::Imploded));
+	result.push_back(Candidate(Sector::Compression::Huffman | Sector::Compression::Deflated));
+	result.push_back(Candidate(Sector::Compression::Huffman | Sector::Compression::Deflated, bestLevel));
+
+	if (extendedCompressions)
+	{
+		result.push_back(Candidate(Sector::Compression::Sparse | Sector::Compression::Deflated));
+
+		if (findCodec(static_cast<uint8>(Sector::Compression::Lzma)) != 0)
+		{
+			result.push_back(Candidate(Sector::Compression::Lzma));
+		}
+	}
+
+	return result;
+}
+
+Sector::Compression CompressionSelection::waveCompression(const string &path, const byte *data, uint32 dataSize, uint32 sectorSize)
+{
+	if (extension(path) != ".wav" || dataSize < 12 || memcmp(data, "RIFF", 4) != 0 || memcmp(data + 8, "WAVE", 4) != 0)
+	{
+		return Sector::Compression::Uncompressed;
+	}
+
+	uint16 channels = 0;
+	uint32 offset = 12;
+
+	/*
+	 * The format chunk has to precede the data chunk.
+	 */
+	while (dataSize - offset >= 8)
+	{
+		const uint32 chunkSize = readUint32(data + offset + 4);
+		const uint32 chunkData = offset + 8;
+
+		if (memcmp(data + offset, "fmt ", 4) == 0)
+		{
+			// 1 is uncompressed PCM
+			if (chunkSize < 16 || dataSize - chunkData < 16 || readUint16(data + chunkData) != 1 || readUint16(data + chunkData + 14) != 16)
+			{
+				return Sector::Compression::Uncompressed;
+			}
+
+			channels = readUint16(data + chunkData + 2);
+		}
+		else if (memcmp(data + offset, "data", 4) == 0)
+		{
+			const uint32 blockAlign = 2 * channels;
+
+			/*
+			 * The header has to fit into the first sector which is not compressed lossy.
+			 * The samples have to last until the end of the file that no other data is compressed lossy.
+			 */
+			if ((channels != 1 && channels != 2) || chunkData >= sectorSize || chunkSize != dataSize - chunkData || chunkSize % blockAlign != 0 || (sectorSize - chunkData) % blockAlign != 0 || sectorSize % blockAlign != 0)
+			{
+				return Sector::Compression::Uncompressed;
+			}
+
+			return Sector::Compression::Huffman | (channels == 1 ? Sector::Compression::ImaAdpcmMono : Sector::Compression::ImaAdpcmStereo);
+		}
+
+		// chunks are padded to an even size
+		const uint64 next = uint64(chunkData) + chunkSize + chunkSize % 2;
+
+		if (next > dataSize)
+		{
+			break;
+		}
+
+		offset = boost::numeric_cast<uint32>(next);
+	}
+
+	return Sector::Compression::Uncompressed;
+}
+
+double CompressionSelection::decompressionCost(Sector::Compression compression)
+{
+	/*
+	 * Rough estimates of the decompression time per byte of the codecs relative to zlib.
+	 * A measured time would make the selection depend on the machine and the load of other threads.
+	 */
+	Sector::Compression stages[Sector::maxStages];
+	const std::size_t stagesCount = Sector::decompressionStages(compression, stages);
+	double result = 0.0;
+
+	for (std::size_t i = 0; i < stagesCount; ++i)
+	{
+		switch (stages[i])
+		{
+			case Sector::Compression::Deflated:
+			case Sector::Compression::Imploded:
+				result += 1.0;
+
+				break;
+
+			case Sector::Compression::Huffman:
+				result += 1.5;
+
+				break;
+
+			case Sector::Compression::Bzip2Compressed:
+				result += 6.0;
+
+				break;
+
+			case Sector::Compression::Lzma:
+				result += 3.0;
+
+				break;
+
+			case Sector::Compression::Sparse:
+				result += 0.25;
+
+				break;
+
+			case Sector::Compression::ImaAdpcmMono:
+			case Sector::Compression::ImaAdpcmStereo:
+				result += 0.5;
+
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	return result;
+}
+
+bool CompressionSelection::isCompressedFormat(const string &path)
+{
+	static const char *extensions[] =
+	{
+		".blp",
+		".mp3",
+		".jpg",
+		".jpeg",
+		".png",
+		".ogg",
+		".zip",
+		".gz",
+		".bz2",
+		".mpq",
+		".w3m",
+		".w3x",
+		".w3n"
+	};
+
+	const string fileExtension = extension(path);
+
+	if (fileExtension.empty())
+	{
+		return false;
+	}
+
+	for (std::size_t i = 0; i < sizeof(extensions) / sizeof(const char*); ++i)
+	{
+		if (fileExtension == extensions[i])
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+string CompressionSelection::name(Sector::Compression compression)
+{
+	if (compression == Sector::Compression::Uncompressed)
+	{
+		return "Uncompressed";
+	}
+
+	if (compression == Sector::Compression::Lzma)
+	{
+		return "LZMA";
+	}
+
+	static const Sector::Compression flags[] =
+	{
+		Sector::Compression::Huffman,
+		Sector::Compression::Deflated,
+		Sector::Compression::Imploded,
+		Sector::Compression::Bzip2Compressed,
+		Sector::Compression::Sparse,
+		Sector::Compression::ImaAdpcmMono,
+		Sector::Compression::ImaAdpcmStereo
+	};
+
+	string result;
+
+	for (std::size_t i = 0; i < sizeof(flags) / sizeof(Sector::Compression); ++i)
+	{
+		if (compression & flags[i])
+		{
+			if (!result.empty())
+			{
+				result += '+';
+			}
+
+			const Codec *codec = Sector::codec(flags[i]);
+			result += codec != 0 ? codec->name() : "Unknown";
+		}
+	}
+
+	return result;
+}
+
+CompressionSelection::Result CompressionSelection::select(const string &path, const byte *data, uint32 dataSize) const
+{
+	Result result;
+
+	if (isCompressedFormat(path))
+	{
+		result.compressedFormat = true;
+		result.sampleSize = dataSize;
+		result.compressedSampleSize = dataSize;
+
+		return result;
+	}
+
+	/*
+	 * The sampled sectors are spread evenly over the whole file.
+	 */
+	const uint32 sectorsCount = dataSize / this->sectorSize() + (dataSize % this->sectorSize() > 0 ? 1 : 0);
+	const uint32 samplesCount = std::min(sectorsCount, this->sampleSectors());
+	std::vector<uint32> samples;
+
+	for (uint32 i = 0; i < samplesCount; ++i)
+	{
+		samples.push_back(boost::numeric_cast<uint32>(uint64(i) * sectorsCount / samplesCount));
+	}
+
+	BOOST_FOREACH(uint32 sample, samples)
+	{
+		result.sampleSize += std::min(this->sectorSize(), dataSize - sample * this->sectorSize());
+	}
+
+	// without any candidate the file is stored uncompressed
+	result.compressedSampleSize = result.sampleSize;
+
+	if (samples.empty())
+	{
+		return result;
+	}
+
+	Candidates compressions = candidates(this->extendedCompressions());
+	const Sector::Compression wave = waveCompression(path, data, dataSize, this->sectorSize());
+
+	if (wave != Sector::Compression::Uncompressed)
+	{
+		int waveCompressionLevel = Sector::defaultWaveCompressionLevel;
+
+		// the first sector is not compressed lossy since it contains the header
+		BOOST_FOREACH(uint32 sample, samples)
+		{
+			if (sample > 0)
+			{
+				const uint32 sectorSize = std::min(this->sectorSize(), dataSize - sample * this->sectorSize());
+				std::vector<byte> best(sectorSize);
+				uint32 bestSize = sectorSize;
+				const uint32 channels = (wave & Sector::Compression::ImaAdpcmMono) ? 1 : 2;
+
+				if (!ImaAdpcm::compressBest(data + sample * this->sectorSize(), sectorSize, best.data(), bestSize, channels, this->waveCompressionLevels(), waveCompressionLevel))
+				{
+					waveCompressionLevel = Sector::defaultWaveCompressionLevel;
+				}
+
+				break;
+			}
+		}
+
+		compressions.push_back(Candidate(wave, Sector::defaultCompressionLevel, waveCompressionLevel));
+	}
+
+	std::vector<byte> compressed;
+	const double maxCost = this->decompressionBudget() * decompressionCost(Sector::Compression::Deflated);
+	// the smallest sample is only selected if it is smaller than the uncompressed one
+	uint32 bestSize = result.sampleSize;
+
+	BOOST_FOREACH(const Candidate &candidate, compressions)
+	{
+		if (this->decompressionBudget() > 0.0 && decompressionCost(candidate.compression) > maxCost)
+		{
+			continue;
+		}
+
+		const Block::Flags flags = Sector::fileFlags(Block::Flags::None, candidate.compression);
+		uint32 size = 0;
+
+		BOOST_FOREACH(uint32 sample, samples)
+		{
+			const byte *sectorData = data + sample * this->sectorSize();
+			const uint32 sectorSize = std::min(this->sectorSize(), dataSize - sample * this->sectorSize());
+			// the first sector is compressed like Sector::compressSectors() does it
+			const Sector::Compression compression = sample == 0 ? Sector::firstSectorCompression(candidate.compression) : candidate.compression;
+			Sector::compressData(sectorData, sectorSize, flags, compression, compressed, candidate.waveCompressionLevel, candidate.compressionLevel);
+			size += boost::numeric_cast<uint32>(compressed.size());
+		}
+
+		if (size < bestSize)
+		{
+			bestSize = size;
+			result.compression = candidate.compression;
+			result.compressionLevel = candidate.compressionLevel;
+			result.waveCompressionLevel = candidate.waveCompressionLevel;
+			result.compressedSampleSize = size;
+		}
+	}
+
+	return result;
+}
+
+}
+
+}
@@ -0,0 +1,229 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef WC3LIB_MPQ_COMPRESSIONSELECTION_HPP
+#define WC3LIB_MPQ_COMPRESSIONSELECTION_HPP
+
+#include <vector>
+
+#include "platform.hpp"
+#include "sector.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \brief Selects the compression of a file by compressing a sample of its sectors with several candidates.
+ *
+ * Up to \ref sampleSectors() sectors which are spread evenly over the file are compressed with every candidate (\ref candidates()).
+ * The candidate with the smallest sample is selected if its estimated decompression cost (\ref decompressionCost()) is not more than \ref decompressionBudget() times the cost of \ref Sector::Compression::Deflated which is the default compression of Warcraft III.
+ * This keeps the archive small without making loading slower.
+ * The cost is a fixed estimate instead of a measured time that the selection is the same on every run and for any number of threads.
+ * If no candidate makes the sample smaller the file is stored uncompressed.
+ *
+ * Files which are compressed already (for example BLP textures or MP3 music) are never sampled and stored uncompressed.
+ *
+ * WAV files with 16 bit PCM samples get an additional candidate with \ref Sector::Compression::Huffman and IMA ADPCM (\ref waveCompression()).
+ * Since IMA ADPCM is lossy the first sector which contains the RIFF header is compressed without it (\ref Sector::firstSectorCompression()).
+ * The wave compression level of the candidate is the best one of \ref waveCompressionLevels() for the first sampled sector after the header (\ref ImaAdpcm::compressBest()).
+ *
+ * \sa Archive::NewFile::autoCompression
+ */
+class CompressionSelection
+{
+	public:
+		/**
+		 * \brief A compression which is tried on the sample together with the level of its algorithms.
+		 */
+		struct Candidate
+		{
+			Candidate(Sector::Compression compression = Sector::Compression::Uncompressed, int compressionLevel = Sector::defaultCompressionLevel, int waveCompressionLevel = Sector::defaultWaveCompressionLevel);
+
+			Sector::Compression compression;
+			/**
+			 * The level which is passed to \ref Sector::compressData().
+			 */
+			int compressionLevel;
+			/**
+			 * The level of IMA ADPCM which is passed to \ref Sector::compressData().
+			 */
+			int waveCompressionLevel;
+		};
+
+		/**
+		 * \brief The selected compression of a file together with the results of its sample.
+		 */
+		struct Result
+		{
+			Result();
+
+			Sector::Compression compression;
+			/**
+			 * The level of \ref compression which has to be used for all sectors of the file.
+			 */
+			int compressionLevel;
+			/**
+			 * The level of IMA ADPCM which has to be used for all sectors of the file.
+			 */
+			int waveCompressionLevel;
+			/**
+			 * The size of the uncompressed sample.
+			 */
+			uint32 sampleSize;
+			/**
+			 * The size of the sample compressed with \ref compression.
+			 */
+			uint32 compressedSampleSize;
+			/**
+			 * True if the file has not been sampled because of its extension.
+			 */
+			bool compressedFormat;
+		};
+
+		typedef std::vector<Candidate> Candidates;
+
+		/**
+		 * \param sectorSize The sector size of the archive which the files are added to.
+		 */
+		explicit CompressionSelection(uint32 sectorSize = 4096);
+
+		void setSectorSize(uint32 sectorSize);
+		uint32 sectorSize() const;
+		/**
+		 * \param sampleSectors The maximum number of sectors which are compressed by every candidate. It is at least 1.
+		 */
+		void setSampleSectors(uint32 sampleSectors);
+		uint32 sampleSectors() const;
+		/**
+		 * \param decompressionBudget The factor by which the decompression cost (\ref decompressionCost()) of a candidate may exceed the cost of \ref Sector::Compression::Deflated. If this value is 0 only the size counts.
+		 */
+		void setDecompressionBudget(double decompressionBudget);
+		double decompressionBudget() const;
+		/**
+		 * \param extendedCompressions If this value is true \ref Sector::Compression::Lzma and \ref Sector::Compression::Sparse are tried as well. Warcraft III cannot decompress them. Therefore they are disabled by default.
+		 */
+		void setExtendedCompressions(bool extendedCompressions);
+		bool extendedCompressions() const;
+		/**
+		 * \param waveCompressionLevels The wave compression levels which are tried for WAV files. By default only \ref Sector::defaultWaveCompressionLevel is used since IMA ADPCM is lossy.
+		 */
+		void setWaveCompressionLevels(const std::vector<int> &waveCompressionLevels);
+		const std::vector<int>& waveCompressionLevels() const;
+
+		/**
+		 * \return Returns all compressions which are tried on every file: \ref Sector::Compression::Deflated with its default and its best level, \ref Sector::Compression::Bzip2Compressed, \ref Sector::Compression::Imploded and \ref Sector::Compression::Huffman combined with \ref Sector::Compression::Deflated with both levels.
+		 * If \p extendedCompressions is true \ref Sector::Compression::Sparse combined with \ref Sector::Compression::Deflated and \ref Sector::Compression::Lzma (if there is a codec for it) follow.
+		 * Candidates with the default level come first that they are preferred if the sizes are equal.
+		 */
+		static Candidates candidates(bool extendedCompressions = false);
+		/**
+		 * Checks the RIFF header of the file \p path with the data \p data of size \p dataSize.
+		 * The file must have the extension ".wav" and contain uncompressed 16 bit PCM samples with one or two channels in a data chunk up to its end.
+		 * All sectors except the first one which contains the header have to start at a sample.
+		 * \return Returns \ref Sector::Compression::Huffman combined with \ref Sector::Compression::ImaAdpcmMono or \ref Sector::Compression::ImaAdpcmStereo if the file can be compressed with it. Otherwise it returns \ref Sector::Compression::Uncompressed.
+		 */
+		static Sector::Compression waveCompression(const string &path, const byte *data, uint32 dataSize, uint32 sectorSize);
+		/**
+		 * \return Returns the estimated cost of decompressing one byte with all algorithms of \p compression relative to \ref Sector::Compression::Deflated whose cost is 1.
+		 */
+		static double decompressionCost(Sector::Compression compression);
+		/**
+		 * \return Returns true if the file \p path has the extension of a format which is compressed already.
+		 */
+		static bool isCompressedFormat(const string &path);
+		/**
+		 * \return Returns the names of the algorithms of \p compression separated by '+' or "Uncompressed".
+		 */
+		static string name(Sector::Compression compression);
+
+		/**
+		 * Selects the compression for the file \p path with the data \p data of size \p dataSize.
+		 * This function is thread-safe and its result only depends on its arguments and the settings of the selection.
+		 * \throws Exception Throws an exception if one of the codecs fails.
+		 */
+		Result select(const string &path, const byte *data, uint32 dataSize) const;
+
+	private:
+		uint32 m_sectorSize;
+		uint32 m_sampleSectors;
+		double m_decompressionBudget;
+		bool m_extendedCompressions;
+		std::vector<int> m_waveCompressionLevels;
+};
+
+inline void CompressionSelection::setSectorSize(uint32 sectorSize)
+{
+	this->m_sectorSize = sectorSize;
+}
+
+inline uint32 CompressionSelection::sectorSize() const
+{
+	return this->m_sectorSize;
+}
+
+inline void CompressionSelection::setSampleSectors(uint32 sampleSectors)
+{
+	this->m_sampleSectors = std::max<uint32>(sampleSectors, 1);
+}
+
+inline uint32 CompressionSelection::sampleSectors() const
+{
+	return this->m_sampleSectors;
+}
+
+inline void CompressionSelection::setDecompressionBudget(double decompressionBudget)
+{
+	this->m_decompressionBudget = decompressionBudget;
+}
+
+inline double CompressionSelection::decompressionBudget() const
+{
+	return this->m_decompressionBudget;
+}
+
+inline void CompressionSelection::setExtendedCompressions(bool extendedCompressions)
+{
+	this->m_extendedCompressions = extendedCompressions;
+}
+
+inline bool CompressionSelection::extendedCompressions() const
+{
+	return this->m_extendedCompressions;
+}
+
+inline void CompressionSelection::setWaveCompressionLevels(const std::vector<int> &waveCompressionLevels)
+{
+	this->m_waveCompressionLevels = waveCompressionLevels;
+}
+
+inline const std::vector<int>& CompressionSelection::waveCompressionLevels() const
+{
+	return this->m_waveCompressionLevels;
+}
+
+}
+
+}
+
+#endif
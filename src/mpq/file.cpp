@@ -18,9 +18,14 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 
+#include <limits>
+
+#include <boost/scoped_ptr.hpp>
+
 #include "file.hpp"
 #include "hash.hpp"
 #include "archive.hpp"
+#include "parallel.hpp"
 
 namespace wc3lib
 {
@@ -35,6 +40,58 @@ std::streamsize File::compress(istream &istream, Sector::Compression compression
 
 std::streamsize File::decompress(ostream &ostream)
 {
+	/*
+	 * Memory mapped archives are decompressed sector by sector directly from the mapped data.
+	 */
+	if (this->archive()->isMapped())
+	{
+		Sector::Sectors sectors;
+		this->sectors(sectors);
+
+		if (sectors.empty() && hasSectorOffsetTable() && isEncrypted() && path().empty())
+		{
+			std::cerr << boost::format(_("Warning: Writing data from file with block index %1% and hash index %2% failed because we need its path to decrypt its data.")) % block()->index() % hash()->index() << std::endl;
+
+			return 0;
+		}
+
+		std::vector<byte> buffer;
+		std::streamsize bytes = 0;
+
+		BOOST_FOREACH(Sector::Sectors::const_reference sector, sectors)
+		{
+			const uint32 bufferSize = std::max(std::max(sector.uncompressedSize(), sector.sectorSize()), this->archive()->sectorSize());
+
+			if (buffer.size() < bufferSize)
+			{
+				buffer.resize(bufferSize);
+			}
+
+			try
+			{
+				const SectorCache::Data cached = sector.cachedData();
+
+				if (cached.get() != nullptr)
+				{
+					ostream.write(cached->data(), cached->size());
+					bytes += sector.sectorSize();
+
+					continue;
+				}
+
+				const uint32 size = sector.decompress(this->archive()->mappedData(sector.position(), sector.sectorSize()), sector.sectorSize(), buffer.data(), bufferSize);
+				ostream.write(buffer.data(), size);
+				bytes += sector.sectorSize();
+			}
+			catch (Exception &exception)
+			{
+				throw Exception(boost::format(_("Sector error (sector %1%, file %2%):\n%3%")) % sector.sectorIndex() % this->path() % exception.what());
+			}
+		}
+
+		return bytes;
+	}
+
 	ifstream ifstream(this->archive()->path(), std::ios_base::in | std::ios_base::binary);
 
 	if (!ifstream)
@@ -78,6 +135,277 @@ std::streamsize File::decompress(istream &istream, ostream &ostream)
 	return bytes;
 }
 
+std::streamsize File::decompress(ostream &ostream, unsigned threads)
+{
+	if (threads == 1)
+	{
+		return this->decompress(ostream);
+	}
+
+	/*
+	 * All sectors are decompressed into one preallocated buffer which is written in order afterwards.
+	 */
+	std::vector<byte> buffer(this->size());
+	const uint32 size = this->decompress(buffer.data(), buffer.size(), threads);
+	ostream.write(buffer.data(), size);
+
+	return size;
+}
+
+uint32 File::decompress(byte *buffer, uint32 bufferSize, unsigned threads)
+{
+	if (this->archive()->isMapped())
+	{
+		return this->decompressSectors(nullptr, buffer, bufferSize, threads);
+	}
+
+	ifstream ifstream(this->archive()->path(), std::ios_base::in | std::ios_base::binary);
+
+	if (!ifstream)
+	{
+		throw Exception(boost::format(_("Unable to open file %1%.")) % this->archive()->path());
+	}
+
+	return this->decompressSectors(&ifstream, buffer, bufferSize, threads);
+}
+
+uint32 File::decompress(istream &istream, byte *buffer, uint32 bufferSize, unsigned threads)
+{
+	return this->decompressSectors(&istream, buffer, bufferSize, threads);
+}
+
+uint32 File::decompress(const SectorFunction &function, istream *istream)
+{
+	boost::scoped_ptr<ifstream> archiveStream;
+
+	if (istream == nullptr && !this->archive()->isMapped())
+	{
+		archiveStream.reset(new ifstream(this->archive()->path(), std::ios_base::in | std::ios_base::binary));
+
+		if (!*archiveStream)
+		{
+			throw Exception(boost::format(_("Unable to open file %1%.")) % this->archive()->path());
+		}
+
+		istream = archiveStream.get();
+	}
+
+	Sector::Sectors sectors;
+
+	if (istream != nullptr)
+	{
+		this->sectors(*istream, sectors);
+	}
+	else
+	{
+		this->sectors(sectors);
+	}
+
+	if (sectors.empty() && hasSectorOffsetTable() && isEncrypted() && path().empty())
+	{
+		throw Exception(boost::format(_("Unable to decrypt file with block index %1% and hash index %2% without its path.")) % block()->index() % hash()->index());
+	}
+
+	/*
+	 * The buffers are only as large as the largest sector and reused for all sectors.
+	 */
+	std::vector<byte> data;
+	std::vector<byte> buffer;
+	uint32 bytes = 0;
+
+	BOOST_FOREACH(Sector::Sectors::const_reference sector, sectors)
+	{
+		try
+		{
+			const SectorCache::Data cached = sector.cachedData();
+
+			if (cached.get() != nullptr)
+			{
+				const uint32 size = std::min<uint32>(cached->size(), sector.uncompressedSize());
+				function(cached->data(), size);
+				bytes += size;
+
+				continue;
+			}
+
+			const byte *sectorData = nullptr;
+
+			if (istream != nullptr)
+			{
+				data.resize(std::max<std::size_t>(data.size(), sector.sectorSize()));
+				istream->seekg(sector.position());
+				std::streamsize size = 0;
+
+				if (sector.sectorSize() > 0)
+				{
+					wc3lib::read(*istream, data[0], size, sector.sectorSize());
+				}
+
+				sectorData = data.data();
+			}
+			else
+			{
+				sectorData = this->archive()->mappedData(sector.position(), sector.sectorSize());
+			}
+
+			buffer.resize(std::max<std::size_t>(buffer.size(), sector.uncompressedSize()));
+			const uint32 size = sector.decompress(sectorData, sector.sectorSize(), buffer.data(), sector.uncompressedSize());
+			function(buffer.data(), size);
+			bytes += size;
+		}
+		catch (Exception &exception)
+		{
+			throw Exception(boost::format(_("Sector error (sector %1%, file %2%):\n%3%")) % sector.sectorIndex() % this->path() % exception.what());
+		}
+	}
+
+	return bytes;
+}
+
+uint32 File::decompressSectors(istream *istream, byte *buffer, uint32 bufferSize, unsigned threads)
+{
+	if (bufferSize < this->size())
+	{
+		throw Exception(boost::format(_("Buffer of size %1% is too small for file %2% of size %3%.")) % bufferSize % this->path() % this->size());
+	}
+
+	Sector::Sectors sectors;
+
+	if (istream != nullptr)
+	{
+		this->sectors(*istream, sectors);
+	}
+	else
+	{
+		this->sectors(sectors);
+	}
+
+	if (sectors.empty() && hasSectorOffsetTable() && isEncrypted() && path().empty())
+	{
+		std::cerr << boost::format(_("Warning: Writing data from file with block index %1% and hash index %2% failed because we need its path to decrypt its data.")) % block()->index() % hash()->index() << std::endl;
+
+		return 0;
+	}
+
+	if (sectors.empty())
+	{
+		return 0;
+	}
+
+	/*
+	 * Sectors which are in the archive's sector cache do not have to be read or decompressed again.
+	 */
+	std::vector<SectorCache::Data> cached(sectors.size());
+
+	for (std::size_t i = 0; i < sectors.size(); ++i)
+	{
+		cached[i] = sectors[i].cachedData();
+	}
+
+	/*
+	 * Without a mapping the raw data of all uncached sectors is read at once since the sectors are stored contiguously.
+	 * Afterwards the sectors are independent from each other and can be decompressed in any order.
+	 */
+	std::vector<byte> data;
+	uint64 dataPosition = 0;
+
+	if (istream != nullptr)
+	{
+		uint64 dataEnd = 0;
+		dataPosition = std::numeric_limits<uint64>::max();
+
+		for (std::size_t i = 0; i < sectors.size(); ++i)
+		{
+			if (cached[i].get() == nullptr)
+			{
+				dataPosition = std::min(dataPosition, sectors[i].position());
+				dataEnd = std::max(dataEnd, sectors[i].position() + sectors[i].sectorSize());
+			}
+		}
+
+		if (dataEnd > dataPosition)
+		{
+			data.resize(dataEnd - dataPosition);
+		}
+
+		if (!data.empty())
+		{
+			istream->seekg(dataPosition);
+			std::streamsize size = 0;
+			wc3lib::read(*istream, data[0], size, data.size());
+		}
+	}
+
+	/*
+	 * The output offset of each sector is determined by the uncompressed sizes of its previous sectors.
+	 */
+	std::vector<uint32> offsets(sectors.size());
+	std::vector<uint32> sizes(sectors.size());
+	uint32 offset = 0;
+
+	for (std::size_t i = 0; i < sectors.size(); ++i)
+	{
+		offsets[i] = offset;
+		offset += sectors[i].uncompressedSize();
+	}
+
+	if (offset > bufferSize)
+	{
+		throw Exception(boost::format(_("Buffer of size %1% is too small for the sectors of file %2% of size %3%.")) % bufferSize % this->path() % offset);
+	}
+
+	parallelFor(sectors.size(), threads, [&](std::size_t i)
+	{
+		const Sector &sector = sectors[i];
+
+		try
+		{
+			if (cached[i].get() != nullptr)
+			{
+				sizes[i] = std::min<uint32>(cached[i]->size(), sector.uncompressedSize());
+				memcpy(buffer + offsets[i], cached[i]->data(), sizes[i]);
+
+				return;
+			}
+
+			const byte *sectorData = nullptr;
+
+			if (istream != nullptr)
+			{
+				sectorData = data.data() + (sector.position() - dataPosition);
+			}
+			else
+			{
+				sectorData = this->archive()->mappedData(sector.position(), sector.sectorSize());
+			}
+
+			sizes[i] = sector.decompress(sectorData, sector.sectorSize(), buffer + offsets[i], sector.uncompressedSize());
+		}
+		catch (Exception &exception)
+		{
+			throw Exception(boost::format(_("Sector error (sector %1%, file %2%):\n%3%")) % sector.sectorIndex() % this->path() % exception.what());
+		}
+	});
+
+	/*
+	 * Usually every sector fills its whole part of the buffer.
+	 * Otherwise the data is moved together in order.
+	 */
+	uint32 bytes = 0;
+
+	for (std::size_t i = 0; i < sectors.size(); ++i)
+	{
+		if (bytes != offsets[i])
+		{
+			memmove(buffer + bytes, buffer + offsets[i], sizes[i]);
+		}
+
+		bytes += sizes[i];
+	}
+
+	return bytes;
+}
+
 File::Locale File::locale() const
 {
 	return File::intToLocale(this->hash()->cHashData().locale());
@@ -123,13 +451,8 @@ std::streamsize File::sectors(istream &istream, Sector::Sectors &sectors)
 		return 0;
 	}
 
-	istream.seekg(archive()->startPosition());
-	istream.seekg(this->block()->blockOffset(), std::ios::cur);
-
-	if (archive()->format() == Archive::Format::Mpq2 && block()->extendedBlockOffset() > 0)
-	{
-		istream.seekg(block()->extendedBlockOffset(), std::ios::cur);
-	}
+	// since the format 2 the offset can have more than 32 bits
+	istream.seekg(boost::numeric_cast<std::streamoff>(archive()->startPosition() + (archive()->format() == Archive::Format::Mpq1 ? this->block()->blockOffset() : this->block()->largeOffset())));
 
 	/*
 	 * The filename is required for sectors which are encrypted to decrypt them using the file's key + the sector index.
@@ -202,9 +525,10 @@ std::streamsize File::sectors(istream &istream, Sector::Sectors &sectors)
 		// The remaining uncompressed size of the file
 		uint32 remainingUncompressedSize = this->size();
 
-		if (offsets[0] > 0)
+		// the first sector usually starts directly behind the sector offset table
+		if (offsets[0] > readSize)
 		{
-			std::cerr << boost::format(_("%1% useless bytes in file %2%.")) % offsets[0] % this->path() << std::endl;
+			std::cerr << boost::format(_("%1% useless bytes in file %2%.")) % (offsets[0] - readSize) % this->path() << std::endl;
 		}
 
 		for (uint32 i = 0; i < sectorsCount; ++i)
@@ -238,6 +562,13 @@ void File::changePath(const boost::filesystem::path &path)
 
 std::streamsize File::sectors(Sector::Sectors &sectors)
 {
+	if (archive()->isMapped())
+	{
+		iarraystream istream(archive()->mappedData(0, archive()->mappedSize()), archive()->mappedSize());
+
+		return this->sectors(istream, sectors);
+	}
+
 	ifstream istream(archive()->path(), std::ios::in | std::ios::binary);
 
 	if (!istream)
@@ -22,6 +22,7 @@
 #define WC3LIB_MPQ_MPQFILE_HPP
 
 #include <vector>
+#include <functional>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string/replace.hpp>
@@ -100,6 +101,7 @@ class File
 		virtual std::streamsize compress(istream &istream, Sector::Compression compression = Sector::Compression::Uncompressed);
 		/**
 		 * Writes uncompressed file data into output stream \p ostream.
+		 * If the archive is memory mapped (\ref Archive::isMapped()) the sectors are decompressed directly from the mapped archive file.
 		 * \return Returns size of written data.
 		 */
 		virtual std::streamsize decompress(ostream &ostream);
@@ -107,6 +109,42 @@ class File
 		 * Same as \ref decompress(ostream &) but doesn't work independently since it expects to be at the correct position in archive using \p istream as input archive stream.
 		 */
 		virtual std::streamsize decompress(istream &istream, ostream &ostream);
+		/**
+		 * Same as \ref decompress(ostream &) but decompresses the sectors using up to \p threads threads.
+		 * The sectors are decompressed into a preallocated buffer of \ref size() bytes which is written into \p ostream in order afterwards.
+		 * \param threads The number of threads. If this value is 0 \ref defaultThreads() is used. If it is 1 no additional threads are used.
+		 * \return Returns size of written data.
+		 */
+		std::streamsize decompress(ostream &ostream, unsigned threads);
+		/**
+		 * Decompresses the whole file data into the caller-supplied buffer \p buffer without any intermediate streams.
+		 * If the archive is memory mapped (\ref Archive::isMapped()) the sectors are decompressed directly from the mapped archive file.
+		 * Otherwise the raw data of all sectors is read at once.
+		 * Since sectors are independent from each other once the sector offset table has been read they can be decompressed by several threads.
+		 * \param bufferSize Size of \p buffer which has to be at least \ref size().
+		 * \param threads The number of threads used for decompressing the sectors. If this value is 0 \ref defaultThreads() is used.
+		 * \return Returns the number of bytes written into \p buffer.
+		 * \throws Exception Throws an exception if the buffer is too small or a sector could not be decompressed.
+		 */
+		uint32 decompress(byte *buffer, uint32 bufferSize, unsigned threads = 1);
+		/**
+		 * Same as \ref decompress(byte*, uint32, unsigned) but reads the sectors from \p istream which has to be the opened archive file.
+		 * This avoids opening the archive file again if many files are decompressed one after another.
+		 */
+		uint32 decompress(istream &istream, byte *buffer, uint32 bufferSize, unsigned threads = 1);
+
+		/**
+		 * \brief Function which receives the decompressed data of one sector.
+		 */
+		typedef std::function<void(const byte *data, uint32 size)> SectorFunction;
+		/**
+		 * Decompresses the file sector by sector and calls \p function with the data of every sector in order.
+		 * Only the data of one sector is held at once which allows processing large files (for example calculating checksums) without decompressing them completely.
+		 * \param istream The opened archive file. If this value is 0 the sectors are read from the mapped archive or the archive file is opened.
+		 * \return Returns the number of decompressed bytes.
+		 * \throws Exception Throws an exception if a sector could not be decompressed.
+		 */
+		uint32 decompress(const SectorFunction &function, istream *istream = nullptr);
 
 		/**
 		 * \todo Implement removal of all data from the block which should mark hash as deleted and clear the block and should be synchronized with the archive.
@@ -205,6 +243,8 @@ class File
 
 	protected:
 		friend Archive;
+		friend class ArchiveDiff;
+		friend class ArchiveSet;
 
 		/**
 		 * Valid MPQ files are created by \ref Archive only.
@@ -223,6 +263,11 @@ class File
 		void changePath(const boost::filesystem::path &path);
 
 	private:
+		/**
+		 * Reads the sectors from \p istream or directly from the mapped archive if \p istream is 0.
+		 */
+		uint32 decompressSectors(istream *istream, byte *buffer, uint32 bufferSize, unsigned threads);
+
 		Archive *m_archive;
 		Hash *m_hash;
 		boost::filesystem::path m_path;
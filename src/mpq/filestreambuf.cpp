@@ -0,0 +1,264 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <algorithm>
+
+#include "filestreambuf.hpp"
+#include "archive.hpp"
+#include "block.hpp"
+#include "hash.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+FileStreamBuf::FileStreamBuf(const File &file)
+: m_file(file)
+, m_sector(0)
+, m_position(0)
+{
+	if (this->m_file.hasSectorOffsetTable() && this->m_file.isEncrypted() && this->m_file.path().empty())
+	{
+		throw Exception(boost::format(_("Reading data from file with block index %1% and hash index %2% failed because we need its path to decrypt its data.")) % this->m_file.block()->index() % this->m_file.hash()->index());
+	}
+
+	if (this->m_file.archive()->isMapped())
+	{
+		this->m_file.sectors(this->m_sectors);
+	}
+	else
+	{
+		this->m_archiveStream.reset(new ifstream(this->m_file.archive()->path(), std::ios_base::in | std::ios_base::binary));
+
+		if (!*this->m_archiveStream)
+		{
+			throw Exception(boost::format(_("Unable to open file %1%.")) % this->m_file.archive()->path());
+		}
+
+		this->m_file.sectors(*this->m_archiveStream, this->m_sectors);
+	}
+
+	/*
+	 * The uncompressed offsets allow finding the sector of any position without decompressing the previous sectors.
+	 */
+	this->m_offsets.reserve(this->m_sectors.size() + 1);
+	uint32 offset = 0;
+
+	BOOST_FOREACH(Sector::Sectors::const_reference sector, this->m_sectors)
+	{
+		this->m_offsets.push_back(offset);
+		offset += sector.uncompressedSize();
+	}
+
+	this->m_offsets.push_back(offset);
+	this->m_sector = this->m_sectors.size();
+}
+
+FileStreamBuf::~FileStreamBuf()
+{
+}
+
+FileStreamBuf::int_type FileStreamBuf::underflow()
+{
+	if (this->gptr() < this->egptr())
+	{
+		return traits_type::to_int_type(*this->gptr());
+	}
+
+	const uint32 position = this->position();
+
+	if (position >= this->size())
+	{
+		return traits_type::eof();
+	}
+
+	// the last sector whose offset is not behind the position contains it
+	const std::size_t index = std::upper_bound(this->m_offsets.begin(), this->m_offsets.end(), position) - this->m_offsets.begin() - 1;
+	this->load(index);
+
+	const uint32 sectorPosition = position - this->m_offsets[index];
+
+	if (sectorPosition >= static_cast<uint32>(this->egptr() - this->eback()))
+	{
+		return traits_type::eof();
+	}
+
+	this->setg(this->eback(), this->eback() + sectorPosition, this->egptr());
+
+	return traits_type::to_int_type(*this->gptr());
+}
+
+FileStreamBuf::pos_type FileStreamBuf::seekoff(off_type off, std::ios_base::seekdir way, std::ios_base::openmode which)
+{
+	off_type position = 0;
+
+	switch (way)
+	{
+		case std::ios_base::beg:
+		{
+			position = off;
+
+			break;
+		}
+
+		case std::ios_base::cur:
+		{
+			position = static_cast<off_type>(this->position()) + off;
+
+			break;
+		}
+
+		case std::ios_base::end:
+		{
+			position = static_cast<off_type>(this->size()) + off;
+
+			break;
+		}
+
+		default:
+		{
+			return pos_type(off_type(-1));
+		}
+	}
+
+	return this->seekpos(pos_type(position), which);
+}
+
+FileStreamBuf::pos_type FileStreamBuf::seekpos(pos_type pos, std::ios_base::openmode which)
+{
+	const off_type position = off_type(pos);
+
+	if (!(which & std::ios_base::in) || position < 0 || position > static_cast<off_type>(this->size()))
+	{
+		return pos_type(off_type(-1));
+	}
+
+	/*
+	 * Seeking inside of the loaded sector only moves the get pointer.
+	 * Otherwise the sector is decompressed by the next call of underflow().
+	 */
+	if (this->m_sector < this->m_sectors.size())
+	{
+		const off_type sectorPosition = position - static_cast<off_type>(this->m_offsets[this->m_sector]);
+
+		if (sectorPosition >= 0 && sectorPosition <= this->egptr() - this->eback())
+		{
+			this->setg(this->eback(), this->eback() + sectorPosition, this->egptr());
+
+			return pos;
+		}
+	}
+
+	this->m_sector = this->m_sectors.size();
+	this->m_position = static_cast<uint32>(position);
+	this->m_cached.reset();
+	this->setg(nullptr, nullptr, nullptr);
+
+	return pos;
+}
+
+std::streamsize FileStreamBuf::showmanyc()
+{
+	const uint32 position = this->position();
+
+	if (position >= this->size())
+	{
+		return -1;
+	}
+
+	return this->size() - position;
+}
+
+uint32 FileStreamBuf::position() const
+{
+	if (this->m_sector < this->m_sectors.size())
+	{
+		return this->m_offsets[this->m_sector] + static_cast<uint32>(this->gptr() - this->eback());
+	}
+
+	return this->m_position;
+}
+
+void FileStreamBuf::load(std::size_t index)
+{
+	const Sector &sector = this->m_sectors[index];
+	this->m_sector = this->m_sectors.size();
+	this->m_cached = sector.cachedData();
+
+	if (this->m_cached.get() != nullptr)
+	{
+		byte *data = const_cast<byte*>(this->m_cached->data());
+		this->setg(data, data, data + this->m_cached->size());
+		this->m_sector = index;
+
+		return;
+	}
+
+	try
+	{
+		const Archive *archive = this->m_file.archive();
+		const byte *data = nullptr;
+
+		if (archive->isMapped())
+		{
+			data = archive->mappedData(sector.position(), sector.sectorSize());
+		}
+		else
+		{
+			if (this->m_data.size() < sector.sectorSize())
+			{
+				this->m_data.resize(sector.sectorSize());
+			}
+
+			if (sector.sectorSize() > 0)
+			{
+				this->m_archiveStream->seekg(sector.position());
+				std::streamsize bytes = 0;
+				wc3lib::read(*this->m_archiveStream, this->m_data[0], bytes, sector.sectorSize());
+			}
+
+			data = this->m_data.data();
+		}
+
+		const uint32 bufferSize = std::max(std::max(sector.uncompressedSize(), sector.sectorSize()), archive->sectorSize());
+
+		if (this->m_buffer.size() < bufferSize)
+		{
+			this->m_buffer.resize(bufferSize);
+		}
+
+		const uint32 size = sector.decompress(data, sector.sectorSize(), this->m_buffer.data(), bufferSize);
+		this->setg(this->m_buffer.data(), this->m_buffer.data(), this->m_buffer.data() + size);
+		this->m_sector = index;
+	}
+	catch (Exception &exception)
+	{
+		this->setg(nullptr, nullptr, nullptr);
+		this->m_position = this->m_offsets[index];
+
+		throw Exception(boost::format(_("Sector error (sector %1%, file %2%):\n%3%")) % sector.sectorIndex() % this->m_file.path() % exception.what());
+	}
+}
+
+}
+
+}
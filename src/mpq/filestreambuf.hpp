@@ -0,0 +1,169 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef WC3LIB_MPQ_FILESTREAMBUF_HPP
+#define WC3LIB_MPQ_FILESTREAMBUF_HPP
+
+#include <streambuf>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "platform.hpp"
+#include "file.hpp"
+#include "sector.hpp"
+#include "sectorcache.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \brief Random-access stream buffer which decompresses the sectors of an MPQ file on demand.
+ *
+ * Instead of decompressing the whole file at once (\ref File::decompress()) only the sector which contains the current read position is decompressed.
+ * When the reader advances behind the end of the sector or seeks to another position the corresponding sector is decompressed.
+ * Therefore the required memory is bounded by one sector and its raw data.
+ *
+ * If the archive is memory mapped (\ref Archive::isMapped()) sectors are decompressed directly from the mapped data.
+ * Otherwise the archive file is opened once by the stream buffer.
+ * Sectors which are in the archive's sector cache (\ref Archive::sectorCache()) are used without copying them.
+ *
+ * Decompression errors are thrown as \ref Exception by \ref underflow().
+ *
+ * \note The archive must not be modified while the stream buffer is used.
+ *
+ * \sa FileInputStream
+ */
+class FileStreamBuf : public std::basic_streambuf<byte>, private boost::noncopyable
+{
+	public:
+		/**
+		 * Reads the sector offset table of \p file.
+		 * \throws Exception Throws an exception if the archive file could not be opened or the file is encrypted and its path is unknown.
+		 */
+		explicit FileStreamBuf(const File &file);
+		virtual ~FileStreamBuf();
+
+		const File& file() const;
+		/**
+		 * \return Returns the uncompressed size of the file.
+		 */
+		uint32 size() const;
+		const Sector::Sectors& sectors() const;
+
+	protected:
+		virtual int_type underflow() override;
+		virtual pos_type seekoff(off_type off, std::ios_base::seekdir way, std::ios_base::openmode which = std::ios_base::in) override;
+		virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which = std::ios_base::in) override;
+		virtual std::streamsize showmanyc() override;
+
+	private:
+		/**
+		 * \return Returns the uncompressed position of the next character of the get area.
+		 */
+		uint32 position() const;
+		/**
+		 * Decompresses the sector with index \p index and makes it the get area.
+		 */
+		void load(std::size_t index);
+
+		File m_file;
+		/**
+		 * Only used if the archive is not memory mapped.
+		 */
+		boost::scoped_ptr<ifstream> m_archiveStream;
+		Sector::Sectors m_sectors;
+		/**
+		 * The uncompressed offset of every sector in the file followed by the uncompressed size of the file.
+		 */
+		std::vector<uint32> m_offsets;
+		/**
+		 * The index of the sector in the get area or the number of sectors if no sector is loaded.
+		 */
+		std::size_t m_sector;
+		/**
+		 * The position which is used by the next \ref underflow() if no sector is loaded.
+		 */
+		uint32 m_position;
+		std::vector<byte> m_data;
+		std::vector<byte> m_buffer;
+		SectorCache::Data m_cached;
+};
+
+inline const File& FileStreamBuf::file() const
+{
+	return this->m_file;
+}
+
+inline uint32 FileStreamBuf::size() const
+{
+	return this->m_offsets.back();
+}
+
+inline const Sector::Sectors& FileStreamBuf::sectors() const
+{
+	return this->m_sectors;
+}
+
+/**
+ * \brief Input stream which reads an MPQ file sector by sector using a \ref FileStreamBuf.
+ *
+ * It can be passed to any \ref Format::read() implementation to parse a file directly from the archive:
+ * \code
+ * mpq::FileInputStream istream(archive.findFile("war3map.w3e"));
+ * environment.read(istream);
+ * \endcode
+ *
+ * Decompression errors are rethrown by the reading functions since \ref std::ios_base::badbit is set in the exception mask.
+ */
+class FileInputStream : public istream
+{
+	public:
+		explicit FileInputStream(const File &file);
+
+		FileStreamBuf* rdbuf() const;
+
+	private:
+		/*
+		 * Mutable since std::basic_istream::rdbuf() is const as well.
+		 */
+		mutable FileStreamBuf m_streamBuf;
+};
+
+inline FileInputStream::FileInputStream(const File &file) : istream(nullptr), m_streamBuf(file)
+{
+	this->init(&this->m_streamBuf);
+	this->exceptions(std::ios_base::badbit);
+}
+
+inline FileStreamBuf* FileInputStream::rdbuf() const
+{
+	return &this->m_streamBuf;
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,114 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include "freespace.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+FreeSpace::FreeSpace() : m_size(0)
+{
+}
+
+void FreeSpace::clear()
+{
+	this->m_extents.clear();
+	this->m_extentsBySize.clear();
+	this->m_size = 0;
+}
+
+void FreeSpace::insert(uint64 offset, uint64 size)
+{
+	if (size == 0)
+	{
+		return;
+	}
+
+	// merge with the following extent
+	Extents::iterator next = this->m_extents.lower_bound(offset);
+
+	if (next != this->m_extents.end() && next->first == offset + size)
+	{
+		size += next->second;
+		this->eraseExtent(next);
+	}
+
+	// merge with the preceding extent
+	Extents::iterator previous = this->m_extents.lower_bound(offset);
+
+	if (previous != this->m_extents.begin())
+	{
+		--previous;
+
+		if (previous->first + previous->second == offset)
+		{
+			offset = previous->first;
+			size += previous->second;
+			this->eraseExtent(previous);
+		}
+	}
+
+	this->insertExtent(offset, size);
+}
+
+bool FreeSpace::allocate(uint64 size, uint64 &offset)
+{
+	std::set<std::pair<uint64, uint64> >::iterator iterator = this->m_extentsBySize.lower_bound(std::make_pair(size, uint64(0)));
+
+	if (iterator == this->m_extentsBySize.end())
+	{
+		return false;
+	}
+
+	const uint64 extentOffset = iterator->second;
+	const uint64 extentSize = iterator->first;
+	this->eraseExtent(this->m_extents.find(extentOffset));
+
+	if (extentSize > size)
+	{
+		this->insertExtent(extentOffset + size, extentSize - size);
+	}
+
+	offset = extentOffset;
+
+	return true;
+}
+
+void FreeSpace::insertExtent(uint64 offset, uint64 size)
+{
+	this->m_extents.insert(std::make_pair(offset, size));
+	this->m_extentsBySize.insert(std::make_pair(size, offset));
+	this->m_size += size;
+}
+
+void FreeSpace::eraseExtent(Extents::iterator iterator)
+{
+	this->m_extentsBySize.erase(std::make_pair(iterator->second, iterator->first));
+	this->m_size -= iterator->second;
+	this->m_extents.erase(iterator);
+}
+
+}
+
+}
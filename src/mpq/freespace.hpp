@@ -0,0 +1,101 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef WC3LIB_MPQ_FREESPACE_HPP
+#define WC3LIB_MPQ_FREESPACE_HPP
+
+#include <map>
+#include <set>
+
+#include "platform.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \brief Free list of the unused extents of an archive.
+ *
+ * Removed and replaced blocks leave unused space in the archive which is stored as extents of an offset and a size.
+ * Adjacent extents are merged.
+ * New blocks are placed best-fit into the smallest extent they fit into (\ref allocate()) that the archive does only grow if there is no fitting extent.
+ *
+ * \sa Archive::freeSpace()
+ */
+class FreeSpace
+{
+	public:
+		/**
+		 * Extent sizes by their offsets.
+		 */
+		typedef std::map<uint64, uint64> Extents;
+
+		FreeSpace();
+
+		void clear();
+		/**
+		 * Marks the \p size bytes at \p offset as unused and merges them with adjacent extents.
+		 * The bytes must not overlap any free extent.
+		 */
+		void insert(uint64 offset, uint64 size);
+		/**
+		 * Takes \p size bytes from the smallest extent which is large enough. If there are several ones the one with the lowest offset is used.
+		 * The remaining bytes of the extent stay free.
+		 * \param offset The offset of the allocated bytes.
+		 * \return Returns false if no extent is large enough. \p offset is not changed in this case.
+		 */
+		bool allocate(uint64 size, uint64 &offset);
+
+		const Extents& extents() const;
+		/**
+		 * \return Returns the size of all extents in bytes.
+		 */
+		uint64 size() const;
+
+	private:
+		void insertExtent(uint64 offset, uint64 size);
+		void eraseExtent(Extents::iterator iterator);
+
+		Extents m_extents;
+		/**
+		 * The extents sorted by their sizes and offsets for the best-fit search.
+		 */
+		std::set<std::pair<uint64, uint64> > m_extentsBySize;
+		uint64 m_size;
+};
+
+inline const FreeSpace::Extents& FreeSpace::extents() const
+{
+	return this->m_extents;
+}
+
+inline uint64 FreeSpace::size() const
+{
+	return this->m_size;
+}
+
+}
+
+}
+
+#endif
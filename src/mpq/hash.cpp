@@ -37,8 +37,11 @@ HashData::HashData(int32 filePathHashA, int32 filePathHashB, uint16 locale, uint
 {
 }
 
-HashData::HashData(const boost::filesystem::path& path, File::Locale locale, File::Platform platform) : m_filePathHashA(HashString(Archive::cryptTable(), path.string().c_str(), HashType::NameA)), m_filePathHashB(HashString(Archive::cryptTable(), path.string().c_str(), HashType::NameB)), m_locale(File::localeToInt(locale)), m_platform(File::platformToInt(platform))
+HashData::HashData(const boost::filesystem::path& path, File::Locale locale, File::Platform platform) : m_locale(File::localeToInt(locale)), m_platform(File::platformToInt(platform))
 {
+	const HashValues values = HashStrings(Archive::cryptTable(), path.string().c_str());
+	this->m_filePathHashA = values.nameA;
+	this->m_filePathHashB = values.nameB;
 }
 
 HashData::HashData(const HashData &other) : m_filePathHashA(other.m_filePathHashA), m_filePathHashB(other.m_filePathHashB), m_locale(other.m_locale), m_platform(other.m_platform)
@@ -81,7 +84,9 @@ bool HashData::isHash(int32 nameHashA, int32 nameHashB, uint16 locale, uint16 pl
 
 bool HashData::isHash(const boost::filesystem::path &path, File::Locale locale, File::Platform platform) const
 {
-	return isHash(HashString(Archive::cryptTable(), path.string().c_str(), HashType::NameA), HashString(Archive::cryptTable(), path.string().c_str(), HashType::NameB), File::localeToInt(locale), File::platformToInt(platform));
+	const HashValues values = HashStrings(Archive::cryptTable(), path.string().c_str());
+
+	return isHash(values.nameA, values.nameB, File::localeToInt(locale), File::platformToInt(platform));
 }
 
 const uint32 Hash::blockIndexDeleted = 0xFFFFFFFE;
@@ -152,18 +157,17 @@ std::streamsize Hash::write(ostream& ostream) const
 
 void Hash::removeData()
 {
-	// If the next entry is empty, mark this one as empty; otherwise, mark this as deleted.
-	Archive::Hashes::const_iterator iterator = this->mpq()->hashes().find(this->hashData());
+	const HashTable &hashTable = this->mpq()->hashTable();
 
-	if (iterator == this->mpq()->hashes().end())
+	if (this->index() >= hashTable.size() || hashTable.hash(this->index()) != this)
 	{
 		throw Exception(_("Hash is not in archive."));
 	}
 
-	++iterator;
+	const uint32 nextIndex = (this->index() + 1) % hashTable.size();
 
 	// If the next entry is empty, mark this one as empty; otherwise, mark this as deleted.
-	if (iterator != this->mpq()->hashes().end() && !iterator->second->empty())
+	if (nextIndex != this->index() && !hashTable.hash(nextIndex)->empty())
 	{
 		this->m_deleted = true;
 	}
@@ -221,8 +225,9 @@ bool Hash::isHash(int32 nameHashA, int32 nameHashB, enum File::Locale locale, en
 /// @todo Write data into hash table.
 void Hash::changePath(const boost::filesystem::path &path)
 {
-	this->hashData().setFilePathHashA(HashString(Archive::cryptTable(), path.string().c_str(), HashType::NameA));
-	this->hashData().setFilePathHashB(HashString(Archive::cryptTable(), path.string().c_str(), HashType::NameB));
+	const HashValues values = HashStrings(Archive::cryptTable(), path.string().c_str());
+	this->hashData().setFilePathHashA(values.nameA);
+	this->hashData().setFilePathHashB(values.nameB);
 }
 
 HashTableEntry Hash::toHashTableEntry() const
@@ -233,7 +238,7 @@ HashTableEntry Hash::toHashTableEntry() const
 	{
 		result.fileBlockIndex = blockIndexDeleted;
 	}
-	if (this->empty())
+	else if (this->empty())
 	{
 		result.fileBlockIndex = blockIndexEmpty;
 	}
@@ -0,0 +1,132 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "hashtable.hpp"
+#include "hash.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+HashTable::HashTable()
+{
+}
+
+void HashTable::resize(uint32 size)
+{
+	HashTableEntry entry;
+	entry.filePathHashA = 0;
+	entry.filePathHashB = 0;
+	entry.locale = 0;
+	entry.platform = 0;
+	entry.fileBlockIndex = Hash::blockIndexEmpty;
+
+	this->m_entries.assign(size, entry);
+	this->m_hashes.assign(size, nullptr);
+}
+
+void HashTable::clear()
+{
+	this->m_entries.clear();
+	this->m_hashes.clear();
+}
+
+void HashTable::set(Hash *hash)
+{
+	this->m_hashes[hash->index()] = hash;
+	this->update(*hash);
+}
+
+void HashTable::update(const Hash &hash)
+{
+	this->m_entries[hash.index()] = hash.toHashTableEntry();
+}
+
+Hash* HashTable::find(uint32 tableOffset, int32 filePathHashA, int32 filePathHashB, uint16 locale, uint16 platform) const
+{
+	if (this->empty())
+	{
+		return nullptr;
+	}
+
+	const uint32 start = this->startIndex(tableOffset);
+	uint32 index = start;
+	Hash *deleted = nullptr;
+
+	do
+	{
+		const HashTableEntry &entry = this->m_entries[index];
+
+		// an empty entry terminates the search
+		if (entry.fileBlockIndex == Hash::blockIndexEmpty)
+		{
+			break;
+		}
+
+		if (entry.filePathHashA == filePathHashA && entry.filePathHashB == filePathHashB && entry.locale == locale && entry.platform == platform)
+		{
+			if (entry.fileBlockIndex != Hash::blockIndexDeleted)
+			{
+				return this->m_hashes[index];
+			}
+			else if (deleted == nullptr)
+			{
+				deleted = this->m_hashes[index];
+			}
+		}
+
+		index = (index + 1) % this->size();
+	}
+	while (index != start);
+
+	return deleted;
+}
+
+Hash* HashTable::findFree(uint32 tableOffset) const
+{
+	if (this->empty())
+	{
+		return nullptr;
+	}
+
+	const uint32 start = this->startIndex(tableOffset);
+	uint32 index = start;
+
+	do
+	{
+		const uint32 blockIndex = this->m_entries[index].fileBlockIndex;
+
+		if (blockIndex == Hash::blockIndexEmpty || blockIndex == Hash::blockIndexDeleted)
+		{
+			return this->m_hashes[index];
+		}
+
+		index = (index + 1) % this->size();
+	}
+	while (index != start);
+
+	return nullptr;
+}
+
+}
+
+}
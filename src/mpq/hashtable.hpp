@@ -0,0 +1,138 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef WC3LIB_MPQ_HASHTABLE_HPP
+#define WC3LIB_MPQ_HASHTABLE_HPP
+
+#include <vector>
+
+#include <boost/cast.hpp>
+
+#include "platform.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+class Hash;
+
+/**
+ * \brief Flat copy of an archive's hash table which is probed exactly like the MPQ format does it.
+ *
+ * All hash table entries are stored contiguously in the order of the hash table of the archive.
+ * Additionally every index refers to its corresponding \ref Hash instance.
+ *
+ * A file is searched by starting at the entry with the index of its \ref HashType::TableOffset hash value modulo the table size.
+ * From there on the entries are checked linearly until the file is found or an empty entry terminates the search.
+ * Deleted entries do not terminate the search.
+ * Therefore searching does not allocate any memory and only touches the entries of one collision chain.
+ *
+ * \note The table has to be updated using \ref set() whenever a hash entry of the archive changes.
+ *
+ * \sa Archive::hashTable()
+ */
+class HashTable
+{
+	public:
+		typedef std::vector<HashTableEntry> Entries;
+		typedef std::vector<Hash*> Hashes;
+
+		HashTable();
+
+		/**
+		 * Resizes the table to \p size empty entries.
+		 */
+		void resize(uint32 size);
+		void clear();
+		/**
+		 * Assigns hash \p hash to its index (\ref Hash::index()) and updates the corresponding entry.
+		 */
+		void set(Hash *hash);
+		/**
+		 * Updates the entry of hash \p hash without changing the hash instance at its index.
+		 */
+		void update(const Hash &hash);
+
+		uint32 size() const;
+		bool empty() const;
+		const Entries& entries() const;
+		const HashTableEntry& entry(uint32 index) const;
+		Hash* hash(uint32 index) const;
+
+		/**
+		 * \return Returns the index where the search for a file with the \ref HashType::TableOffset hash value \p tableOffset starts.
+		 */
+		uint32 startIndex(uint32 tableOffset) const;
+
+		/**
+		 * Searches for an entry with the given hash values starting at the index of \p tableOffset.
+		 * Entries which are not deleted are preferred. Only if there is no such entry a deleted one is returned.
+		 * \return Returns the found hash or 0 if there is no matching entry.
+		 */
+		Hash* find(uint32 tableOffset, int32 filePathHashA, int32 filePathHashB, uint16 locale, uint16 platform) const;
+		/**
+		 * Searches for the first empty or deleted entry starting at the index of \p tableOffset.
+		 * This is the entry which has to be used for a newly added file that it can be found again by \ref find().
+		 * \return Returns the free hash or 0 if the table is full.
+		 */
+		Hash* findFree(uint32 tableOffset) const;
+
+	private:
+		Entries m_entries;
+		Hashes m_hashes;
+};
+
+inline uint32 HashTable::size() const
+{
+	return boost::numeric_cast<uint32>(this->m_entries.size());
+}
+
+inline bool HashTable::empty() const
+{
+	return this->m_entries.empty();
+}
+
+inline const HashTable::Entries& HashTable::entries() const
+{
+	return this->m_entries;
+}
+
+inline const HashTableEntry& HashTable::entry(uint32 index) const
+{
+	return this->m_entries[index];
+}
+
+inline Hash* HashTable::hash(uint32 index) const
+{
+	return this->m_hashes[index];
+}
+
+inline uint32 HashTable::startIndex(uint32 tableOffset) const
+{
+	return tableOffset % this->size();
+}
+
+}
+
+}
+
+#endif
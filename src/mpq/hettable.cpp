@@ -0,0 +1,236 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cstring>
+
+#include <boost/format.hpp>
+
+#include "hettable.hpp"
+#include "bettable.hpp"
+#include "archive.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+const byte HetTable::identifier[4] = { 'H', 'E', 'T', 0x1A };
+const uint32 HetTable::version = 1;
+const byte HetTable::entryFree = static_cast<byte>(0x00);
+const byte HetTable::entryDeleted = static_cast<byte>(0x80);
+const uint32 HetTable::notFound = 0xFFFFFFFF;
+
+HetTable::HetTable()
+{
+	this->clear();
+}
+
+void HetTable::create(uint32 totalCount, uint32 entryCount, uint32 nameHashBitSize)
+{
+	if (nameHashBitSize < 8 || nameHashBitSize > 64)
+	{
+		throw Exception(boost::format(_("Invalid HET name hash bit size %1%.")) % nameHashBitSize);
+	}
+
+	this->clear();
+
+	HetTableHeader &header = this->m_header;
+	header.entryCount = entryCount;
+	header.totalCount = totalCount;
+	header.nameHashBitSize = nameHashBitSize;
+	header.indexSizeTotal = bitCount(entryCount);
+	header.indexSizeExtra = 0;
+	header.indexSize = header.indexSizeTotal;
+	header.indexTableSize = boost::numeric_cast<uint32>((uint64(header.indexSizeTotal) * totalCount + 7) / 8);
+	header.tableSize = sizeof(ExtendedTableHeader) + sizeof(HetTableHeader) + totalCount + header.indexTableSize;
+
+	this->m_nameHashes.assign(totalCount, HetTable::entryFree);
+	this->m_fileIndices.assign(header.indexTableSize, 0);
+}
+
+void HetTable::clear()
+{
+	memset(&this->m_header, 0, sizeof(this->m_header));
+	this->m_header.tableSize = sizeof(ExtendedTableHeader) + sizeof(HetTableHeader);
+	this->m_nameHashes.clear();
+	this->m_fileIndices.clear();
+}
+
+uint32 HetTable::insert(const string &path, uint32 fileIndex)
+{
+	if (this->totalCount() == 0)
+	{
+		return HetTable::notFound;
+	}
+
+	const uint64 hash = this->fileNameHash(path);
+	const uint32 start = static_cast<uint32>(hash % this->totalCount());
+	uint32 index = start;
+
+	do
+	{
+		// deleted entries cannot be reused since their value is a valid name hash as well
+		if (this->m_nameHashes[index] == HetTable::entryFree)
+		{
+			this->m_nameHashes[index] = static_cast<byte>(hash >> (this->nameHashBitSize() - 8));
+			writeBits(this->m_fileIndices.data(), uint64(index) * this->m_header.indexSizeTotal, this->m_header.indexSize, fileIndex);
+
+			return index;
+		}
+
+		index = (index + 1) % this->totalCount();
+	}
+	while (index != start);
+
+	return HetTable::notFound;
+}
+
+std::streamsize HetTable::read(istream &istream, uint64 tableSize)
+{
+	std::streamsize size = 0;
+	ExtendedTableHeader extendedTableHeader;
+	wc3lib::read(istream, extendedTableHeader, size);
+
+	if (size != sizeof(extendedTableHeader) || memcmp(extendedTableHeader.magic, HetTable::identifier, sizeof(HetTable::identifier)) != 0)
+	{
+		throw Exception(_("Missing HET table identifier."));
+	}
+
+	if (extendedTableHeader.version != HetTable::version)
+	{
+		throw Exception(boost::format(_("Unknown HET table version %1%.")) % extendedTableHeader.version);
+	}
+
+	if (tableSize > sizeof(extendedTableHeader) + extendedTableHeader.dataSize)
+	{
+		throw Exception(_("Compressed HET tables are not supported."));
+	}
+
+	if (extendedTableHeader.dataSize < sizeof(HetTableHeader))
+	{
+		throw Exception(boost::format(_("HET table is too small (%1% bytes).")) % extendedTableHeader.dataSize);
+	}
+
+	std::vector<byte> data(extendedTableHeader.dataSize);
+	std::streamsize dataSize = 0;
+	wc3lib::read(istream, data[0], dataSize, data.size());
+	size += dataSize;
+
+	if (dataSize != boost::numeric_cast<std::streamsize>(data.size()))
+	{
+		throw Exception(_("Unexpected end of HET table."));
+	}
+
+	DecryptData(Archive::cryptTable(), data.data(), boost::numeric_cast<uint32>(data.size()), HashString(Archive::cryptTable(), "(hash table)", HashType::FileKey));
+
+	HetTableHeader header;
+	memcpy(&header, data.data(), sizeof(header));
+
+	if (sizeof(header) + uint64(header.totalCount) + header.indexTableSize > data.size() || header.nameHashBitSize < 8 || header.nameHashBitSize > 64 || header.indexSize > 32 || header.indexSize > header.indexSizeTotal || (uint64(header.totalCount) * header.indexSizeTotal + 7) / 8 > header.indexTableSize)
+	{
+		throw Exception(_("Invalid HET table header."));
+	}
+
+	const byte *position = data.data() + sizeof(header);
+	this->m_header = header;
+	this->m_nameHashes.assign(position, position + header.totalCount);
+	position += header.totalCount;
+	this->m_fileIndices.assign(position, position + header.indexTableSize);
+
+	return size;
+}
+
+std::streamsize HetTable::write(ostream &ostream) const
+{
+	std::vector<byte> data;
+	data.reserve(this->size() - sizeof(ExtendedTableHeader));
+	const byte *header = reinterpret_cast<const byte*>(&this->m_header);
+	data.insert(data.end(), header, header + sizeof(this->m_header));
+	data.insert(data.end(), this->m_nameHashes.begin(), this->m_nameHashes.end());
+	data.insert(data.end(), this->m_fileIndices.begin(), this->m_fileIndices.end());
+
+	EncryptData(Archive::cryptTable(), data.data(), boost::numeric_cast<uint32>(data.size()), HashString(Archive::cryptTable(), "(hash table)", HashType::FileKey));
+
+	ExtendedTableHeader extendedTableHeader;
+	memcpy(extendedTableHeader.magic, HetTable::identifier, sizeof(HetTable::identifier));
+	extendedTableHeader.version = HetTable::version;
+	extendedTableHeader.dataSize = boost::numeric_cast<uint32>(data.size());
+
+	std::streamsize size = 0;
+	wc3lib::write(ostream, extendedTableHeader, size);
+	wc3lib::write(ostream, data[0], size, data.size());
+
+	return size;
+}
+
+uint32 HetTable::find(const string &path, const BetTable &betTable) const
+{
+	if (this->totalCount() == 0)
+	{
+		return HetTable::notFound;
+	}
+
+	const uint64 hash = this->fileNameHash(path);
+	const byte hash1 = static_cast<byte>(hash >> (this->nameHashBitSize() - 8));
+	const uint32 start = static_cast<uint32>(hash % this->totalCount());
+	uint32 index = start;
+
+	// a free entry terminates the search
+	while (this->m_nameHashes[index] != HetTable::entryFree)
+	{
+		if (this->m_nameHashes[index] == hash1)
+		{
+			const uint32 fileIndex = this->fileIndex(index);
+
+			// the lower bits of the hash are compared using the BET table
+			if (fileIndex < betTable.entryCount() && ((uint64(static_cast<unsigned char>(hash1)) << betTable.nameHashBitCount()) | betTable.nameHash2(fileIndex)) == hash)
+			{
+				return index;
+			}
+		}
+
+		index = (index + 1) % this->totalCount();
+
+		if (index == start)
+		{
+			break;
+		}
+	}
+
+	return HetTable::notFound;
+}
+
+uint64 HetTable::fileNameHash(const string &path) const
+{
+	const uint64 andMask = this->nameHashBitSize() >= 64 ? ~uint64(0) : (uint64(1) << this->nameHashBitSize()) - 1;
+	const uint64 orMask = uint64(1) << (this->nameHashBitSize() - 1);
+
+	return (HashStringJenkins(path.c_str()) & andMask) | orMask;
+}
+
+uint32 HetTable::fileIndex(uint32 index) const
+{
+	return static_cast<uint32>(readBits(this->m_fileIndices.data(), uint64(index) * this->m_header.indexSizeTotal, this->m_header.indexSize));
+}
+
+}
+
+}
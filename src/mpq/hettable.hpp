@@ -0,0 +1,151 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef WC3LIB_MPQ_HETTABLE_HPP
+#define WC3LIB_MPQ_HETTABLE_HPP
+
+#include <vector>
+
+#include "platform.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+class BetTable;
+
+/**
+ * \brief Hash extended table (HET) of the MPQ formats 3 and 4.
+ *
+ * The HET table replaces the hash table for finding files by their paths.
+ * It uses 64 bit Jenkins hashes of the file paths (\ref HashStringJenkins()) which are masked to \ref nameHashBitSize() bits (\ref fileNameHash()).
+ * Every entry only stores the upper 8 bits of the hash and the bit-packed index of the file's entry in the BET table (\ref BetTable).
+ * The remaining bits are stored in the BET table and compared to verify a match.
+ *
+ * Like the hash table it is probed linearly starting at the index of the hash modulo \ref totalCount() until a free entry is found.
+ *
+ * \sa BetTable
+ * \sa Archive::hetTable()
+ */
+class HetTable
+{
+	public:
+		static const byte identifier[4];
+		static const uint32 version;
+		static const byte entryFree;
+		/**
+		 * Since the highest bit of every name hash is set this value is also a valid upper byte of a name hash.
+		 * Therefore only entries with this value which do not refer to a valid file index are considered deleted.
+		 */
+		static const byte entryDeleted;
+		/**
+		 * Returned by \ref find() if no entry is found.
+		 */
+		static const uint32 notFound;
+
+		HetTable();
+
+		/**
+		 * Creates an empty table with \p totalCount entries for up to \p entryCount files.
+		 */
+		void create(uint32 totalCount, uint32 entryCount, uint32 nameHashBitSize = 64);
+		void clear();
+		/**
+		 * Adds the file with the path \p path which has the index \p fileIndex in the BET table.
+		 * \return Returns the index of the used entry or \ref notFound if the table is full.
+		 */
+		uint32 insert(const string &path, uint32 fileIndex);
+
+		/**
+		 * Reads the table at the current position of \p istream and decrypts it.
+		 * \param tableSize The size of the table stored in the header of the archive or 0 if it is unknown. Compressed tables are not supported.
+		 * \throws Exception Throws an exception if the table is invalid.
+		 */
+		std::streamsize read(istream &istream, uint64 tableSize = 0);
+		/**
+		 * Writes the encrypted table at the current position of \p ostream.
+		 */
+		std::streamsize write(ostream &ostream) const;
+		/**
+		 * \return Returns the size of the written table in bytes including the \ref ExtendedTableHeader.
+		 */
+		uint32 size() const;
+
+		/**
+		 * Searches for the file with the path \p path and verifies the match using the name hashes of \p betTable.
+		 * \return Returns the index of the found entry or \ref notFound.
+		 */
+		uint32 find(const string &path, const BetTable &betTable) const;
+
+		/**
+		 * \return Returns the masked 64 bit file name hash of \p path which is used by this table.
+		 */
+		uint64 fileNameHash(const string &path) const;
+
+		uint32 totalCount() const;
+		uint32 entryCount() const;
+		uint32 nameHashBitSize() const;
+		/**
+		 * \return Returns the upper 8 bits of the file name hash stored in entry \p index. Free entries return \ref entryFree.
+		 */
+		byte nameHash1(uint32 index) const;
+		/**
+		 * \return Returns the index of the file in the BET table which is stored in entry \p index.
+		 */
+		uint32 fileIndex(uint32 index) const;
+
+	private:
+		HetTableHeader m_header;
+		std::vector<byte> m_nameHashes;
+		std::vector<byte> m_fileIndices;
+};
+
+inline uint32 HetTable::size() const
+{
+	return this->m_header.tableSize;
+}
+
+inline uint32 HetTable::totalCount() const
+{
+	return this->m_header.totalCount;
+}
+
+inline uint32 HetTable::entryCount() const
+{
+	return this->m_header.entryCount;
+}
+
+inline uint32 HetTable::nameHashBitSize() const
+{
+	return this->m_header.nameHashBitSize;
+}
+
+inline byte HetTable::nameHash1(uint32 index) const
+{
+	return this->m_nameHashes[index];
+}
+
+}
+
+}
+
+#endif
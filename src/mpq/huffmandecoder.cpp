@@ -0,0 +1,467 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <algorithm>
+#include <cstring>
+
+#include <boost/cast.hpp>
+
+#include "huffmandecoder.hpp"
+#include "algorithm.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+namespace
+{
+
+/*
+ * The weight tables of "lib/huffman" have 258 entries for each of the nine compression types.
+ */
+const uint32 weightTablesCount = 9;
+const uint32 weightTableSize = 258;
+
+/*
+ * Reads the bits of the data starting with the lowest bit of each byte.
+ * It is a local object of the decompression that the compiler can keep its state in registers although the output may alias everything.
+ */
+class BitReader
+{
+	public:
+		BitReader(const byte *in, uint32 inSize) : m_in(in), m_end(in + inSize), m_buffer(0), m_count(0), m_consumed(0)
+		{
+		}
+
+		uint32 peek(uint32 count)
+		{
+			if (this->m_count < count)
+			{
+				this->refill();
+			}
+
+			return uint32(this->m_buffer & ((uint64(1) << count) - 1));
+		}
+
+		void skip(uint32 count)
+		{
+			this->m_buffer >>= count;
+			this->m_count -= count;
+			this->m_consumed += count;
+		}
+
+		uint32 bit()
+		{
+			const uint32 result = this->peek(1);
+			this->skip(1);
+
+			return result;
+		}
+
+		/**
+		 * \return Returns the number of consumed bits which might be greater than the size of the data.
+		 */
+		uint64 consumed() const
+		{
+			return this->m_consumed;
+		}
+
+	private:
+		void refill()
+		{
+			while (this->m_count <= 56 && this->m_in != this->m_end)
+			{
+				this->m_buffer |= uint64(static_cast<uint8>(*this->m_in++)) << this->m_count;
+				this->m_count += 8;
+			}
+
+			// behind the end of the data there are zero bits
+			if (this->m_in == this->m_end)
+			{
+				this->m_count = 64;
+			}
+		}
+
+		const byte *m_in;
+		const byte *m_end;
+		uint64 m_buffer;
+		uint32 m_count;
+		uint64 m_consumed;
+};
+
+}
+
+HuffmanDecoder::HuffmanDecoder()
+: m_version(0)
+{
+	memset(this->m_lookup, 0, sizeof(this->m_lookup));
+	// the node "none" is a dummy which is never part of the list
+	memset(&this->m_tree, 0, sizeof(this->m_tree));
+}
+
+const HuffmanDecoder::Tree& HuffmanDecoder::initialTree(uint32 type)
+{
+	struct InitialTrees
+	{
+		InitialTrees()
+		{
+			HuffmanDecoder decoder;
+
+			for (uint32 i = 0; i < weightTablesCount; ++i)
+			{
+				decoder.buildTree(i);
+				trees[i] = decoder.m_tree;
+			}
+		}
+
+		Tree trees[weightTablesCount];
+	};
+
+	// the initialization of local static variables is thread-safe
+	static const InitialTrees initialTrees;
+
+	return initialTrees.trees[type];
+}
+
+uint16 HuffmanDecoder::createNode()
+{
+	if (this->m_tree.nodesCount == maxNodes)
+	{
+		return none;
+	}
+
+	Node &node = this->m_tree.nodes[this->m_tree.nodesCount];
+	node.parent = none;
+	node.child = none;
+
+	return this->m_tree.nodesCount++;
+}
+
+void HuffmanDecoder::buildTree(uint32 type)
+{
+	this->m_tree.nodesCount = 0;
+	this->m_tree.nodes[head].next = head;
+	this->m_tree.nodes[head].prev = head;
+
+	for (std::size_t i = 0; i < sizeof(this->m_tree.nodesByValue) / sizeof(uint16); ++i)
+	{
+		this->m_tree.nodesByValue[i] = none;
+	}
+
+	const unsigned char *weights = huffman::THuffmannTree::Table1502A630 + type * weightTableSize;
+	uint32 maxWeight = 0;
+
+	/*
+	 * The leaves are sorted by their weights. A leaf with the greatest weight is inserted in front of the ones with the same weight, otherwise behind them.
+	 */
+	for (uint32 value = 0; value < 0x100; ++value)
+	{
+		const uint32 weight = weights[value];
+
+		if (weight == 0)
+		{
+			continue;
+		}
+
+		const uint16 node = this->createNode();
+		this->m_tree.nodes[node].value = value;
+		this->m_tree.nodes[node].weight = weight;
+		this->m_tree.nodesByValue[value] = node;
+
+		if (weight >= maxWeight)
+		{
+			maxWeight = weight;
+			this->insertAfter(node, head);
+
+			continue;
+		}
+
+		uint16 position = this->m_tree.nodes[head].prev;
+
+		while (position != head && this->m_tree.nodes[position].weight < weight)
+		{
+			position = this->m_tree.nodes[position].prev;
+		}
+
+		this->insertAfter(node, position);
+	}
+
+	// the end of the data and the escape code have the lowest weights
+	for (uint32 value = endValue; value <= escapeValue; ++value)
+	{
+		const uint16 node = this->createNode();
+		this->m_tree.nodes[node].value = value;
+		this->m_tree.nodes[node].weight = 1;
+		this->m_tree.nodesByValue[value] = node;
+		this->insertAfter(node, this->m_tree.nodes[head].prev);
+	}
+
+	/*
+	 * The two nodes with the lowest weights get a parent until there is only the root left.
+	 */
+	uint16 child = this->m_tree.nodes[head].prev;
+
+	while (child != head && this->m_tree.nodes[child].prev != head)
+	{
+		const uint16 sibling = this->m_tree.nodes[child].prev;
+		const uint16 node = this->createNode();
+		const uint32 weight = this->m_tree.nodes[child].weight + this->m_tree.nodes[sibling].weight;
+		this->m_tree.nodes[node].weight = weight;
+		this->m_tree.nodes[node].child = child;
+		this->m_tree.nodes[child].parent = node;
+		this->m_tree.nodes[sibling].parent = node;
+
+		if (weight >= maxWeight)
+		{
+			maxWeight = weight;
+			this->insertAfter(node, head);
+		}
+		else
+		{
+			uint16 position = this->m_tree.nodes[sibling].prev;
+
+			while (position != head && this->m_tree.nodes[position].weight < weight)
+			{
+				position = this->m_tree.nodes[position].prev;
+			}
+
+			this->insertAfter(node, position);
+		}
+
+		child = this->m_tree.nodes[sibling].prev;
+	}
+}
+
+void HuffmanDecoder::incrementWeight(uint16 node)
+{
+	for ( ; node != none; node = this->m_tree.nodes[node].parent)
+	{
+		const uint32 weight = ++this->m_tree.nodes[node].weight;
+
+		/*
+		 * Find the first node in front of this one with a lower weight.
+		 * It is swapped with this node that the list stays sorted.
+		 */
+		uint16 swapped = node;
+		uint16 position = this->m_tree.nodes[node].prev;
+
+		while (position != head && this->m_tree.nodes[position].weight < weight)
+		{
+			swapped = position;
+			position = this->m_tree.nodes[position].prev;
+		}
+
+		if (swapped == node)
+		{
+			continue;
+		}
+
+		this->remove(swapped);
+		this->insertAfter(swapped, node);
+		this->remove(node);
+		this->insertAfter(node, position);
+
+		/*
+		 * Both nodes swap their positions in the tree.
+		 */
+		Node &item = this->m_tree.nodes[node];
+		Node &swappedItem = this->m_tree.nodes[swapped];
+		const uint16 swappedParentChild = this->m_tree.nodes[swappedItem.parent].child;
+
+		if (this->m_tree.nodes[item.parent].child == node)
+		{
+			this->m_tree.nodes[item.parent].child = swapped;
+		}
+
+		if (swappedParentChild == swapped)
+		{
+			this->m_tree.nodes[swappedItem.parent].child = node;
+		}
+
+		std::swap(item.parent, swappedItem.parent);
+		++this->m_version;
+	}
+}
+
+uint32 HuffmanDecoder::decompress(const byte *in, uint32 inSize, byte *out, uint32 outSize)
+{
+	if (outSize == 0 || inSize == 0)
+	{
+		return 0;
+	}
+
+	BitReader reader(in, inSize);
+	const uint32 type = reader.peek(8);
+	reader.skip(8);
+
+	if (type >= weightTablesCount)
+	{
+		return 0;
+	}
+
+	this->m_tree = initialTree(type);
+
+	const bool adaptive = type == 0;
+	// all previous lookup entries become invalid
+	++this->m_version;
+
+	if (this->m_version == 0)
+	{
+		memset(this->m_lookup, 0, sizeof(this->m_lookup));
+		this->m_version = 1;
+	}
+
+	const uint64 inBits = uint64(inSize) * 8;
+	uint32 outPosition = 0;
+
+	for (;;)
+	{
+		// corrupted data does not contain the end
+		if (reader.consumed() > inBits)
+		{
+			return 0;
+		}
+
+		const uint32 index = reader.peek(lookupBits);
+		LookupEntry &entry = this->m_lookup[index];
+		uint32 value = 0;
+
+		if (entry.version == this->m_version && !entry.isNode)
+		{
+			reader.skip(entry.bits);
+			value = entry.value;
+		}
+		else
+		{
+			uint16 node = this->m_tree.nodes[head].next;
+			uint32 bits = 0;
+			const bool hasEntry = entry.version == this->m_version;
+
+			if (hasEntry)
+			{
+				reader.skip(lookupBits);
+				node = entry.value;
+				bits = lookupBits;
+			}
+
+			uint16 lookupNode = none;
+
+			do
+			{
+				node = this->m_tree.nodes[node].child;
+
+				if (reader.bit())
+				{
+					node = this->m_tree.nodes[node].prev;
+				}
+
+				if (++bits == lookupBits)
+				{
+					lookupNode = node;
+				}
+			}
+			while (this->m_tree.nodes[node].child != none);
+
+			/*
+			 * Only the entry of the looked up bits is filled since filling all entries with the same lower bits costs more than it saves if the tree changes often.
+			 */
+			if (!hasEntry)
+			{
+				entry.version = this->m_version;
+
+				if (bits > lookupBits)
+				{
+					entry.bits = lookupBits;
+					entry.value = lookupNode;
+					entry.isNode = true;
+				}
+				else
+				{
+					entry.bits = boost::numeric_cast<uint16>(bits);
+					entry.value = boost::numeric_cast<uint16>(this->m_tree.nodes[node].value);
+					entry.isNode = false;
+				}
+			}
+
+			value = this->m_tree.nodes[node].value;
+		}
+
+		if (value == escapeValue)
+		{
+			// the new byte is added as sibling of the node with the lowest weight
+			value = reader.peek(8);
+			reader.skip(8);
+			const uint16 parent = this->m_tree.nodes[head].prev;
+			const uint16 copy = this->createNode();
+			const uint16 node = this->createNode();
+
+			if (node == none)
+			{
+				return 0;
+			}
+
+			this->insertAfter(copy, this->m_tree.nodes[head].prev);
+			this->m_tree.nodes[copy].parent = parent;
+			this->m_tree.nodes[copy].value = this->m_tree.nodes[parent].value;
+			this->m_tree.nodes[copy].weight = this->m_tree.nodes[parent].weight;
+			this->m_tree.nodesByValue[this->m_tree.nodes[copy].value] = copy;
+
+			this->insertAfter(node, this->m_tree.nodes[head].prev);
+			this->m_tree.nodes[node].parent = parent;
+			this->m_tree.nodes[node].value = value;
+			this->m_tree.nodes[node].weight = 0;
+			this->m_tree.nodesByValue[value] = node;
+
+			this->m_tree.nodes[parent].child = node;
+			this->incrementWeight(node);
+
+			if (!adaptive)
+			{
+				this->incrementWeight(this->m_tree.nodesByValue[value]);
+			}
+		}
+
+		if (value == endValue)
+		{
+			break;
+		}
+
+		out[outPosition++] = static_cast<byte>(value);
+
+		if (outPosition == outSize)
+		{
+			break;
+		}
+
+		if (adaptive)
+		{
+			this->incrementWeight(this->m_tree.nodesByValue[value]);
+		}
+	}
+
+	return outPosition;
+}
+
+}
+
+}
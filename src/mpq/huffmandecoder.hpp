@@ -0,0 +1,166 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef WC3LIB_MPQ_HUFFMANDECODER_HPP
+#define WC3LIB_MPQ_HUFFMANDECODER_HPP
+
+#include <boost/noncopyable.hpp>
+
+#include "platform.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \brief Table-driven decoder of sectors which are compressed with \ref Sector::Compression::Huffman.
+ *
+ * The format uses an adaptive Huffman tree which is initialized from one of nine weight tables selected by the first byte of the data.
+ * Bytes which are not in the tree are escaped and added to the tree. With the compression type 0 the tree is updated after every byte.
+ * The output is bit-identical to the decompression of "lib/huffman" (\ref decompressHuffman()).
+ *
+ * Instead of walking the tree bit by bit the decoder looks up \ref lookupBits bits at once in a table which contains the decoded byte of every short code or the inner node after \ref lookupBits bits of longer codes.
+ * The table entries are filled while decoding and remain valid until the structure of the tree changes.
+ * The initial trees of the nine weight tables are built only once and copied for every sector.
+ * The nodes are stored in an array and linked by their indices.
+ *
+ * An instance can be reused for any number of sectors without allocating memory. It must not be used by several threads at once.
+ */
+class HuffmanDecoder : private boost::noncopyable
+{
+	public:
+		/**
+		 * The number of bits which are looked up at once.
+		 */
+		static const uint32 lookupBits = 8;
+
+		HuffmanDecoder();
+
+		/**
+		 * Decompresses \p inSize bytes of \p in into \p out until the end of the data or until \p outSize bytes have been written.
+		 * \return Returns the number of written bytes or 0 if the data is corrupted.
+		 */
+		uint32 decompress(const byte *in, uint32 inSize, byte *out, uint32 outSize);
+
+	private:
+		/**
+		 * One leaf or inner node of the tree which is also an element of a list of all nodes sorted by their weights in descending order.
+		 * The child with the lower weight is stored. The other child is its predecessor in the list.
+		 */
+		struct Node
+		{
+			uint16 next;
+			uint16 prev;
+			uint16 parent;
+			uint16 child;
+			uint32 value;
+			uint32 weight;
+		};
+
+		struct LookupEntry
+		{
+			uint32 version;
+			/**
+			 * The number of bits of a short code or \ref lookupBits if the tree has to be walked further from \ref value.
+			 */
+			uint16 bits;
+			/**
+			 * The decoded value of a short code or the inner node after \ref lookupBits bits.
+			 */
+			uint16 value;
+			bool isNode;
+		};
+
+		/**
+		 * There is one leaf for every byte value, the end of the data and the escape code and the inner nodes.
+		 */
+		static const uint16 maxNodes = 0x203;
+		/**
+		 * The list head whose successor is the root with the highest weight and whose predecessor is the node with the lowest weight.
+		 */
+		static const uint16 head = maxNodes;
+		/**
+		 * The index of missing parents and children.
+		 */
+		static const uint16 none = maxNodes + 1;
+		static const uint32 endValue = 0x100;
+		static const uint32 escapeValue = 0x101;
+
+		/**
+		 * The nodes and the leaves of all values of the tree.
+		 */
+		struct Tree
+		{
+			Node nodes[maxNodes + 2];
+			uint16 nodesCount;
+			uint16 nodesByValue[0x102];
+		};
+
+		/**
+		 * Building the initial tree of a compression type is more expensive than decompressing most sectors.
+		 * Therefore the initial trees of all compression types are built once and copied for every sector.
+		 * \return Returns the initial tree of the compression type \p type.
+		 */
+		static const Tree& initialTree(uint32 type);
+		void buildTree(uint32 type);
+		/**
+		 * \return Returns a new node which is not part of the list or \ref none if there are no more nodes.
+		 */
+		uint16 createNode();
+		void remove(uint16 node);
+		void insertAfter(uint16 node, uint16 position);
+		/**
+		 * Increments the weights of \p node and of all its ancestors and swaps nodes to keep the list sorted.
+		 */
+		void incrementWeight(uint16 node);
+
+		Tree m_tree;
+		LookupEntry m_lookup[1 << lookupBits];
+		/**
+		 * Every change of the structure of the tree invalidates all lookup entries by incrementing the version.
+		 */
+		uint32 m_version;
+};
+
+inline void HuffmanDecoder::remove(uint16 node)
+{
+	Node &item = this->m_tree.nodes[node];
+	this->m_tree.nodes[item.prev].next = item.next;
+	this->m_tree.nodes[item.next].prev = item.prev;
+}
+
+inline void HuffmanDecoder::insertAfter(uint16 node, uint16 position)
+{
+	Node &item = this->m_tree.nodes[node];
+	Node &positionItem = this->m_tree.nodes[position];
+	item.next = positionItem.next;
+	item.prev = position;
+	this->m_tree.nodes[positionItem.next].prev = node;
+	positionItem.next = node;
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,402 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <boost/cast.hpp>
+
+#include "imaadpcm.hpp"
+#include "sector.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+namespace
+{
+
+const int32 stepSizes[ImaAdpcm::stepsCount] =
+{
+	0x0007, 0x0008, 0x0009, 0x000A, 0x000B, 0x000C, 0x000D, 0x000E,
+	0x0010, 0x0011, 0x0013, 0x0015, 0x0017, 0x0019, 0x001C, 0x001F,
+	0x0022, 0x0025, 0x0029, 0x002D, 0x0032, 0x0037, 0x003C, 0x0042,
+	0x0049, 0x0050, 0x0058, 0x0061, 0x006B, 0x0076, 0x0082, 0x008F,
+	0x009D, 0x00AD, 0x00BE, 0x00D1, 0x00E6, 0x00FD, 0x0117, 0x0133,
+	0x0151, 0x0173, 0x0198, 0x01C1, 0x01EE, 0x0220, 0x0256, 0x0292,
+	0x02D4, 0x031C, 0x036C, 0x03C3, 0x0424, 0x048E, 0x0502, 0x0583,
+	0x0610, 0x06AB, 0x0756, 0x0812, 0x08E0, 0x09C3, 0x0ABD, 0x0BD0,
+	0x0CFF, 0x0E4C, 0x0FBA, 0x114C, 0x1307, 0x14EE, 0x1706, 0x1954,
+	0x1BDC, 0x1EA5, 0x21B6, 0x2515, 0x28CA, 0x2CDF, 0x315B, 0x364B,
+	0x3BB9, 0x41B2, 0x4844, 0x4F7E, 0x5771, 0x602F, 0x69CE, 0x7462,
+	0x7FFF
+};
+
+/*
+ * The change of the step index for the lower 5 bits of every encoded sample.
+ */
+const int32 stepIndexChanges[0x20] =
+{
+	-1, 0, -1, 4, -1, 2, -1, 6, -1, 1, -1, 5, -1, 3, -1, 7,
+	-1, 1, -1, 5, -1, 3, -1, 7, -1, 2, -1, 4, -1, 6, -1, 8
+};
+
+const int32 maxStepIndex = ImaAdpcm::stepsCount - 1;
+
+inline int32 nextStepIndex(int32 index, uint32 code)
+{
+	return std::min(std::max(index + stepIndexChanges[code & 0x1F], 0), maxStepIndex);
+}
+
+inline int32 clampSample(int32 sample)
+{
+	return std::min(std::max(sample, -32768), 32767);
+}
+
+inline int16 readSample(const byte *in)
+{
+	int16 result;
+	memcpy(&result, in, sizeof(result));
+
+	return result;
+}
+
+inline void writeSample(byte *out, int32 sample)
+{
+	const int16 value = static_cast<int16>(sample);
+	memcpy(out, &value, sizeof(value));
+}
+
+/*
+ * The state of one channel.
+ */
+struct Channel
+{
+	int32 stepIndex;
+	int32 sample;
+};
+
+}
+
+ImaAdpcm::ImaAdpcm() : m_shift(0x100)
+{
+}
+
+void ImaAdpcm::buildDifferences(uint32 shift)
+{
+	if (shift == this->m_shift)
+	{
+		return;
+	}
+
+	for (uint32 index = 0; index < stepsCount; ++index)
+	{
+		const int32 step = stepSizes[index];
+
+		for (uint32 code = 0; code < 0x40; ++code)
+		{
+			int32 difference = shift < 16 ? step >> shift : 0;
+
+			for (uint32 bit = 0; bit < 6; ++bit)
+			{
+				if (code & (1 << bit))
+				{
+					difference += step >> bit;
+				}
+			}
+
+			this->m_differences[index][code] = difference;
+		}
+	}
+
+	this->m_shift = shift;
+}
+
+uint32 ImaAdpcm::decompress(const byte *in, uint32 inSize, byte *out, uint32 outSize, uint32 channels)
+{
+	const uint32 headerSize = 2 + channels * 2;
+
+	if (channels < 1 || channels > 2 || inSize < headerSize || outSize < channels * 2)
+	{
+		return 0;
+	}
+
+	this->buildDifferences(static_cast<uint8>(in[1]));
+	Channel states[2];
+
+	for (uint32 i = 0; i < channels; ++i)
+	{
+		states[i].stepIndex = initialStepIndex;
+		states[i].sample = readSample(in + 2 + i * 2);
+		writeSample(out + i * 2, states[i].sample);
+	}
+
+	const uint32 samplesCount = outSize / 2;
+	uint32 position = channels;
+	uint32 channel = channels - 1;
+	const bool stereo = channels == 2;
+
+	for (const byte *code = in + headerSize, *end = in + inSize; code != end && position < samplesCount; ++code)
+	{
+		const uint32 value = static_cast<uint8>(*code);
+
+		if (stereo)
+		{
+			channel ^= 1;
+		}
+
+		Channel &state = states[channel];
+
+		if (value < 0x80)
+		{
+			const int32 difference = this->m_differences[state.stepIndex][value & 0x3F];
+			state.sample = clampSample(value & 0x40 ? state.sample - difference : state.sample + difference);
+			state.stepIndex = nextStepIndex(state.stepIndex, value);
+			writeSample(out + position * 2, state.sample);
+			++position;
+		}
+		else if (value == 0x80)
+		{
+			state.stepIndex = std::max(state.stepIndex - 1, 0);
+			writeSample(out + position * 2, state.sample);
+			++position;
+		}
+		// 0x82 changes nothing but the channel
+		else if (value != 0x82)
+		{
+			state.stepIndex = value == 0x81 ? std::min(state.stepIndex + 8, maxStepIndex) : std::max(state.stepIndex - 8, 0);
+
+			// the next byte belongs to the same channel
+			if (stereo)
+			{
+				channel ^= 1;
+			}
+		}
+	}
+
+	return position * 2;
+}
+
+uint32 ImaAdpcm::bitShift(int waveCompressionLevel)
+{
+	// the compression level of "lib/wave" is greater by one
+	if (0 < waveCompressionLevel && waveCompressionLevel <= 2)
+	{
+		return 3;
+	}
+	else if (waveCompressionLevel == 3)
+	{
+		return 5;
+	}
+
+	return 4;
+}
+
+bool ImaAdpcm::compress(const byte *in, uint32 inSize, byte *out, uint32 &outSize, uint32 channels, int waveCompressionLevel)
+{
+	uint64 error = 0;
+
+	return compress(in, inSize, out, outSize, channels, bitShift(waveCompressionLevel), error);
+}
+
+bool ImaAdpcm::compress(const byte *in, uint32 inSize, byte *out, uint32 &outSize, uint32 channels, uint32 shift, uint64 &error)
+{
+	const uint32 headerSize = 2 + channels * 2;
+	const uint32 samplesCount = inSize / 2;
+	const uint32 maxSize = outSize;
+	error = 0;
+	outSize = 0;
+
+	if (channels < 1 || channels > 2 || samplesCount < channels || maxSize < headerSize)
+	{
+		return false;
+	}
+
+	out[0] = 0;
+	out[1] = static_cast<byte>(shift);
+	Channel states[2];
+
+	for (uint32 i = 0; i < channels; ++i)
+	{
+		states[i].stepIndex = initialStepIndex;
+		states[i].sample = readSample(in + i * 2);
+		writeSample(out + 2 + i * 2, states[i].sample);
+	}
+
+	/*
+	 * Like "lib/wave" the number of bytes which increase the step size is limited.
+	 */
+	uint32 increases = samplesCount > headerSize ? samplesCount - headerSize : 0;
+	// only 2 bits for compression level 4, 3 bits for 5 and 4 bits for 6
+	const int32 maxBit = std::min(1 << (shift - 1), 0x20);
+	uint32 position = headerSize;
+	uint32 channel = channels - 1;
+
+	for (uint32 i = channels; i < samplesCount; ++i)
+	{
+		if (position + 2 > maxSize)
+		{
+			outSize = position;
+
+			return false;
+		}
+
+		if (channels == 2)
+		{
+			channel ^= 1;
+		}
+
+		Channel &state = states[channel];
+		const int32 sample = readSample(in + i * 2);
+		const int32 difference = std::abs(sample - state.sample);
+		const uint32 sign = sample >= state.sample ? 0 : 0x40;
+		int32 step = stepSizes[state.stepIndex];
+
+		if (difference < (step >> (shift + 1)))
+		{
+			state.stepIndex = std::max(state.stepIndex - 1, 0);
+			out[position++] = static_cast<byte>(0x80);
+		}
+		else
+		{
+			while (difference > step * 2 && state.stepIndex < maxStepIndex && increases > 0)
+			{
+				if (position == maxSize)
+				{
+					outSize = position;
+
+					return false;
+				}
+
+				state.stepIndex = std::min(state.stepIndex + 8, maxStepIndex);
+				step = stepSizes[state.stepIndex];
+				out[position++] = static_cast<byte>(0x81);
+				--increases;
+			}
+
+			const int32 base = step >> shift;
+			int32 total = 0;
+			uint32 code = 0;
+
+			for (int32 bit = 1; ; bit <<= 1)
+			{
+				if (total + step <= difference)
+				{
+					total += step;
+					code |= bit;
+				}
+
+				if (bit == maxBit)
+				{
+					break;
+				}
+
+				step >>= 1;
+			}
+
+			state.sample = clampSample(sign ? state.sample - (total + base) : state.sample + (total + base));
+
+			if (position == maxSize)
+			{
+				outSize = position;
+
+				return false;
+			}
+
+			out[position++] = static_cast<byte>(code | sign);
+			state.stepIndex = nextStepIndex(state.stepIndex, code);
+		}
+
+		const int64 sampleError = sample - state.sample;
+		error += uint64(sampleError * sampleError);
+	}
+
+	outSize = position;
+
+	return true;
+}
+
+bool ImaAdpcm::compressBest(const byte *in, uint32 inSize, byte *out, uint32 &outSize, uint32 channels, const std::vector<int> &waveCompressionLevels, int &waveCompressionLevel)
+{
+	struct Candidate
+	{
+		std::vector<byte> data;
+		uint32 size;
+		bool fits;
+		uint32 huffmanSize;
+		uint64 error;
+	};
+
+	std::vector<Candidate> candidates(waveCompressionLevels.size());
+
+	for (std::size_t i = 0; i < candidates.size(); ++i)
+	{
+		Candidate &candidate = candidates[i];
+		candidate.data.resize(outSize);
+		candidate.size = outSize;
+		candidate.fits = compress(in, inSize, candidate.data.data(), candidate.size, channels, bitShift(waveCompressionLevels[i]), candidate.error);
+		candidate.huffmanSize = candidate.size;
+
+		if (candidate.fits)
+		{
+			std::vector<byte> huffman(candidate.size * 2 + 1024);
+			uint32 huffmanSize = boost::numeric_cast<uint32>(huffman.size());
+
+			if (Sector::codec(Sector::Compression::Huffman)->compress(candidate.data.data(), candidate.size, huffman.data(), huffmanSize, waveCompressionLevels[i]))
+			{
+				candidate.huffmanSize = huffmanSize;
+			}
+		}
+	}
+
+	std::size_t best = candidates.size();
+
+	for (std::size_t i = 0; i < candidates.size(); ++i)
+	{
+		if (!candidates[i].fits)
+		{
+			continue;
+		}
+
+		if (best == candidates.size() || candidates[i].huffmanSize < candidates[best].huffmanSize || (candidates[i].huffmanSize == candidates[best].huffmanSize && candidates[i].error < candidates[best].error))
+		{
+			best = i;
+		}
+	}
+
+	if (best == candidates.size())
+	{
+		outSize = 0;
+
+		return false;
+	}
+
+	memcpy(out, candidates[best].data.data(), candidates[best].size);
+	outSize = candidates[best].size;
+	waveCompressionLevel = waveCompressionLevels[best];
+
+	return true;
+}
+
+}
+
+}
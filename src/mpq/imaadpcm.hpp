@@ -0,0 +1,113 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef WC3LIB_MPQ_IMAADPCM_HPP
+#define WC3LIB_MPQ_IMAADPCM_HPP
+
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "platform.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \brief Codec of sectors which are compressed with \ref Sector::Compression::ImaAdpcmMono or \ref Sector::Compression::ImaAdpcmStereo.
+ *
+ * The data consists of 16 bit little endian samples. The channels of stereo data are interleaved.
+ * Compressed data starts with a zero byte, the bit shift of the compression level and the first sample of every channel.
+ * It is followed by one byte per sample and bytes which change the step size.
+ * The output is compatible with Warcraft III and with "lib/wave".
+ *
+ * The decoder looks up the sample difference of every step size and encoded sample in a table which is built once for every bit shift.
+ * Both channels of stereo data have separate states which do not depend on each other. Samples are clamped without branches.
+ *
+ * An instance of the decoder can be reused for any number of sectors. It must not be used by several threads at once.
+ */
+class ImaAdpcm : private boost::noncopyable
+{
+	public:
+		/**
+		 * The number of step sizes. Every channel starts with the step index \ref initialStepIndex.
+		 */
+		static const uint32 stepsCount = 89;
+		static const uint32 initialStepIndex = 0x2C;
+
+		ImaAdpcm();
+
+		/**
+		 * Decompresses \p inSize bytes of \p in into \p out until the end of the data or until \p outSize bytes have been written.
+		 * \param channels 1 for mono or 2 for stereo data.
+		 * \return Returns the number of written bytes or 0 if the data is corrupted.
+		 */
+		uint32 decompress(const byte *in, uint32 inSize, byte *out, uint32 outSize, uint32 channels);
+
+		/**
+		 * \return Returns the bit shift which is stored in the compressed data for the wave compression level \p waveCompressionLevel like \ref compressWaveMono().
+		 */
+		static uint32 bitShift(int waveCompressionLevel);
+
+		/**
+		 * Compresses \p inSize bytes of samples of \p in into \p out.
+		 * \param outSize The size of \p out which is set to the number of written bytes.
+		 * \param channels 1 for mono or 2 for stereo data.
+		 * \param waveCompressionLevel The wave compression level like \ref Sector::defaultWaveCompressionLevel.
+		 * \return Returns false if the compressed data does not fit into \p out. If there are no samples or \p out can not hold the header \p outSize is 0.
+		 */
+		static bool compress(const byte *in, uint32 inSize, byte *out, uint32 &outSize, uint32 channels, int waveCompressionLevel);
+		/**
+		 * Compresses \p inSize bytes of samples of \p in with all wave compression levels of \p waveCompressionLevels and keeps the best output in \p out.
+		 * The levels are tried one after another since the callers compress several sectors or files concurrently (\ref CompressionSelection::select()).
+		 * Since compressed samples are always compressed with \ref Sector::Compression::Huffman afterwards the best output is the one which is the smallest after the Huffman compression.
+		 * If two outputs have the same size the one with fewer differences to the original samples is kept.
+		 * \param waveCompressionLevel Is set to the wave compression level of the kept output.
+		 * \return Returns false if the output of no compression level fits into \p out.
+		 */
+		static bool compressBest(const byte *in, uint32 inSize, byte *out, uint32 &outSize, uint32 channels, const std::vector<int> &waveCompressionLevels, int &waveCompressionLevel);
+
+	private:
+		/**
+		 * \param error Is set to the sum of the squared differences of the decompressed and the original samples.
+		 */
+		static bool compress(const byte *in, uint32 inSize, byte *out, uint32 &outSize, uint32 channels, uint32 shift, uint64 &error);
+		/**
+		 * Builds the differences for the bit shift \p shift if they have not been built for it.
+		 */
+		void buildDifferences(uint32 shift);
+
+		/**
+		 * The difference of the predicted sample for every step index and the lower 6 bits of every encoded sample.
+		 */
+		int32 m_differences[stepsCount][0x40];
+		/**
+		 * The bit shift of \ref m_differences or a value greater than 0xFF if there are no differences.
+		 */
+		uint32 m_shift;
+};
+
+}
+
+}
+
+#endif
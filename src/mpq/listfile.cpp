@@ -21,7 +21,6 @@
 #include <set>
 
 #include <boost/algorithm/string.hpp>
-#include <boost/algorithm/string_regex.hpp>
 
 #include "listfile.hpp"
 #include "mpq.hpp"
@@ -40,22 +39,95 @@ Listfile::Listfile(Archive *mpq, Hash *hash) : File(mpq, hash, "(listfile)")
 {
 }
 
+namespace
+{
+
+inline bool isSeparator(char c)
+{
+	return c == ';' || c == '\r' || c == '\n';
+}
+
+/*
+ * Position and size of one directory or file name of a path.
+ */
+typedef std::pair<string::size_type, string::size_type> PathToken;
+
+/*
+ * Splits \p path at the character '\\' like boost::algorithm::split() with boost::algorithm::token_compress_on does without copying the tokens.
+ */
+void splitPath(const string &path, std::vector<PathToken> &tokens)
+{
+	tokens.clear();
+	string::size_type begin = 0;
+
+	while (true)
+	{
+		const string::size_type end = path.find('\\', begin);
+
+		if (end == string::npos)
+		{
+			tokens.push_back(PathToken(begin, path.size() - begin));
+
+			break;
+		}
+
+		tokens.push_back(PathToken(begin, end - begin));
+		begin = path.find_first_not_of('\\', end);
+
+		if (begin == string::npos)
+		{
+			tokens.push_back(PathToken(path.size(), 0));
+
+			break;
+		}
+	}
+}
+
+}
+
 Listfile::Entries Listfile::entries(const string &content)
 {
 	Entries result;
 
-	// specification says:
-	// "and is simply a text file with file paths separated by ';', 0Dh, 0Ah, or some combination of these."
-	// regex gets all combinations
-	boost::algorithm::split_regex(result, content,
-		boost::regex(
-			"("
-			"\r\n;|\r;\n|\n\r;|\n;\r|;\n\r|;\r\n|"
-			"\r;|\r\n|\n\r|\n;|;\n|;\r|"
-			"\r|\n|;"
-			")"
-		));
-	
+	/*
+	 * Specification says:
+	 * "and is simply a text file with file paths separated by ';', 0Dh, 0Ah, or some combination of these."
+	 * One separator consists of up to three different characters of ';', '\r' and '\n' in any order.
+	 * Repeated characters separate empty entries.
+	 * The content is scanned only once without any regular expression.
+	 */
+	const char *data = content.data();
+	const std::size_t size = content.size();
+	std::size_t begin = 0;
+	std::size_t i = 0;
+
+	while (i < size)
+	{
+		if (!isSeparator(data[i]))
+		{
+			++i;
+
+			continue;
+		}
+
+		result.push_back(string(data + begin, i - begin));
+		const char first = data[i++];
+
+		if (i < size && isSeparator(data[i]) && data[i] != first)
+		{
+			const char second = data[i++];
+
+			if (i < size && isSeparator(data[i]) && data[i] != first && data[i] != second)
+			{
+				++i;
+			}
+		}
+
+		begin = i;
+	}
+
+	result.push_back(string(data + begin, size - begin));
+
 	return result;
 }
 
@@ -67,6 +139,7 @@ string Listfile::content(const Listfile::Entries &entries)
 Listfile::CaseSensitiveEntries Listfile::caseSensitiveEntries(const Listfile::Entries &entries)
 {
 	CaseSensitiveEntries result;
+	std::vector<PathToken> pathTokens;
 
 	BOOST_FOREACH(Entries::const_reference ref, entries)
 	{
@@ -75,37 +148,35 @@ Listfile::CaseSensitiveEntries Listfile::caseSensitiveEntries(const Listfile::En
 		{
 			/*
 			 * Split relative path up into directory paths and replace the single dirs by the alread found ones.
+			 * The entry is converted into upper case only once. The keys of the directory paths are built from the keys of the single dirs.
 			 */
-			std::vector<string> pathTokens;
-			boost::algorithm::split(pathTokens, ref, boost::algorithm::is_any_of("\\"), boost::algorithm::token_compress_on);
-			stringstream sstream;
+			splitPath(ref, pathTokens);
+			const string upperRef = boost::algorithm::to_upper_copy(ref);
+			string longValue;
+			string longKey;
 
 			for (std::size_t i = 0; i < pathTokens.size(); ++i)
 			{
 				if (i != 0)
 				{
-					sstream << '\\';
+					longValue += '\\';
+					longKey += '\\';
 				}
 
-				const string value = pathTokens[i];
-				const string key = boost::to_upper_copy(value);
+				const string key = upperRef.substr(pathTokens[i].first, pathTokens[i].second);
 				CaseSensitiveEntries::iterator iterator = result.find(key);
 
 				if (iterator == result.end())
 				{
-					//std::cerr << "Key: " << key << ", Value: " << value << std::endl;
-					iterator = result.insert(std::make_pair(key, value)).first;
+					iterator = result.insert(std::make_pair(key, ref.substr(pathTokens[i].first, pathTokens[i].second))).first;
 				}
 
-				sstream << iterator->second;
-				const string longValue = sstream.str();
-				const string longKey = boost::to_upper_copy(longValue);
-				iterator = result.find(longKey);
+				longValue += iterator->second;
+				longKey += key;
 
-				if (iterator == result.end())
+				if (result.find(longKey) == result.end())
 				{
-					//std::cerr << "Key: " << longKey << ", Value: " << longValue << std::endl;
-					iterator = result.insert(std::make_pair(longKey, longValue)).first;
+					result.insert(std::make_pair(longKey, longValue));
 				}
 			}
 		}
@@ -129,8 +200,7 @@ Listfile::Entries Listfile::caseSensitiveFileEntries(const Listfile::Entries &en
 			{
 				if (index != string::npos)
 				{
-					const string key = boost::to_upper_copy(ref);
-					const CaseSensitiveEntries::const_iterator iterator = uniqueEntries.find(key);
+					const CaseSensitiveEntries::const_iterator iterator = uniqueEntries.find(boost::algorithm::to_upper_copy(ref));
 
 					if (iterator != uniqueEntries.end())
 					{
@@ -158,6 +228,7 @@ Listfile::Entries Listfile::caseSensitiveDirEntries(const Listfile::Entries &ent
 	 * Store which directories have already been added to the result to keep directories unique.
 	 */
 	std::set<string> dirEntriesDone;
+	std::vector<PathToken> pathTokens;
 	Entries result;
 
 	BOOST_FOREACH(Entries::const_reference ref, entries)
@@ -171,9 +242,10 @@ Listfile::Entries Listfile::caseSensitiveDirEntries(const Listfile::Entries &ent
 			/*
 			 * Now take for each dirname token the case sensitive corresponding entry.
 			 */
-			std::vector<string> pathTokens;
-			boost::algorithm::split(pathTokens, ref, boost::algorithm::is_any_of("\\"), boost::algorithm::token_compress_on);
-			stringstream sstream;
+			splitPath(ref, pathTokens);
+			const string upperRef = boost::algorithm::to_upper_copy(ref);
+			string doneValue;
+			string doneKey;
 			const std::size_t dirPathTokensSize = pathTokens.size() - 1;
 			/*
 			 * Count the inner directory levels to make sure that none recursive entries are being added if not wished by the user.
@@ -182,29 +254,26 @@ Listfile::Entries Listfile::caseSensitiveDirEntries(const Listfile::Entries &ent
 
 			for (std::size_t i = 0; i < dirPathTokensSize && (recursive || countInnerDirLevels < 1); ++i)
 			{
-				const string key = boost::to_upper_copy(pathTokens[i]);
+				const string key = upperRef.substr(pathTokens[i].first, pathTokens[i].second);
 				const CaseSensitiveEntries::const_iterator iterator = uniqueEntries.find(key);
 
 				if (iterator != uniqueEntries.end())
 				{
 					if (i > 0)
 					{
-						sstream << '\\';
+						doneValue += '\\';
+						doneKey += '\\';
 					}
 
-					sstream << iterator->second;
-
-					const string doneValue = sstream.str();
+					doneValue += iterator->second;
+					doneKey += key;
 
 					if ((doneValue.size() > prefix.size() && boost::istarts_with(doneValue, prefix)))
 					{
 						++countInnerDirLevels;
-						const string doneKey = boost::to_upper_copy(doneValue);
-						const std::set<string>::const_iterator doneIterator = dirEntriesDone.find(doneKey);
 
-						if (doneIterator == dirEntriesDone.cend())
+						if (dirEntriesDone.insert(doneKey).second)
 						{
-							dirEntriesDone.insert(doneKey);
 							result.push_back(doneValue);
 						}
 					}
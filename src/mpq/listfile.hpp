@@ -47,6 +47,8 @@ namespace mpq
  *
  * Use \ref Listfile::caseSensitiveFileEntries() or \ref Listfile::caseSensitiveDirEntries()  if you want filter entries by directory and identify sub directories.
  *
+ * \ref ListfileIndex answers these queries much faster if many directories are listed.
+ *
  * \ref Listfile::existingEntries() filters only existing listfile entries.
  *
  * \sa Attributes
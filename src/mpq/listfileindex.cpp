@@ -0,0 +1,284 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <boost/algorithm/string.hpp>
+#include <boost/foreach.hpp>
+#include <boost/numeric/conversion/cast.hpp>
+
+#include "listfileindex.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+namespace
+{
+
+inline uint64 childKey(uint32 parent, uint32 name)
+{
+	return (static_cast<uint64>(parent) << 32) | name;
+}
+
+}
+
+ListfileIndex::ListfileIndex() : m_files(0), m_directories(0)
+{
+	this->clear();
+}
+
+ListfileIndex::ListfileIndex(const Listfile::Entries &entries) : m_files(0), m_directories(0)
+{
+	this->clear();
+	this->add(entries);
+}
+
+void ListfileIndex::add(const string &entry)
+{
+	uint32 node = 0;
+	string::size_type begin = 0;
+
+	while (begin < entry.size())
+	{
+		string::size_type end = entry.find('\\', begin);
+
+		if (end == string::npos)
+		{
+			end = entry.size();
+		}
+
+		// skip empty directory names
+		if (end > begin)
+		{
+			const string name = entry.substr(begin, end - begin);
+			const uint32 nameIndex = this->intern(boost::algorithm::to_upper_copy(name), name);
+			uint32 childNode = this->child(node, nameIndex);
+
+			if (childNode == 0)
+			{
+				childNode = boost::numeric_cast<uint32>(this->m_nodes.size());
+				Node newNode;
+				newNode.name = nameIndex;
+				newNode.file = false;
+				newNode.directory = false;
+				this->m_nodes.push_back(newNode);
+				this->m_nodes[node].children.push_back(childNode);
+				this->m_children.insert(std::make_pair(childKey(node, nameIndex), childNode));
+			}
+
+			/*
+			 * Every name which is followed by another one is a directory.
+			 * The last name of the entry is the file.
+			 */
+			Node &current = this->m_nodes[childNode];
+
+			if (entry.find_first_not_of('\\', end) != string::npos)
+			{
+				if (!current.directory)
+				{
+					current.directory = true;
+					++this->m_directories;
+				}
+			}
+			else if (!current.file)
+			{
+				current.file = true;
+				++this->m_files;
+			}
+
+			node = childNode;
+		}
+
+		begin = end + 1;
+	}
+}
+
+void ListfileIndex::add(const Listfile::Entries &entries)
+{
+	BOOST_FOREACH(Listfile::Entries::const_reference ref, entries)
+	{
+		this->add(ref);
+	}
+}
+
+void ListfileIndex::clear()
+{
+	this->m_nodes.clear();
+	this->m_children.clear();
+	this->m_nameIndices.clear();
+	this->m_names.clear();
+	this->m_files = 0;
+	this->m_directories = 0;
+
+	// top level directory
+	Node root;
+	root.name = 0;
+	root.file = false;
+	root.directory = true;
+	this->m_nodes.push_back(root);
+}
+
+bool ListfileIndex::containsFile(const string &entry) const
+{
+	uint32 node = 0;
+
+	return this->findNode(entry, node) && this->m_nodes[node].file;
+}
+
+bool ListfileIndex::containsDirectory(const string &dirPath) const
+{
+	uint32 node = 0;
+
+	return this->findNode(dirPath, node) && this->m_nodes[node].directory;
+}
+
+Listfile::Entries ListfileIndex::fileEntries(const string &prefix, bool recursive) const
+{
+	Listfile::Entries result;
+	uint32 node = 0;
+	string path;
+
+	if (this->findNode(prefix, node, &path) && this->m_nodes[node].directory)
+	{
+		this->collect(node, path, true, recursive, result);
+	}
+
+	return result;
+}
+
+Listfile::Entries ListfileIndex::dirEntries(const string &prefix, bool recursive) const
+{
+	Listfile::Entries result;
+	uint32 node = 0;
+	string path;
+
+	if (this->findNode(prefix, node, &path) && this->m_nodes[node].directory)
+	{
+		this->collect(node, path, false, recursive, result);
+	}
+
+	return result;
+}
+
+uint32 ListfileIndex::intern(const string &upperName, const string &name)
+{
+	const std::pair<std::unordered_map<string, uint32>::iterator, bool> result = this->m_nameIndices.insert(std::make_pair(upperName, boost::numeric_cast<uint32>(this->m_names.size())));
+
+	if (result.second)
+	{
+		this->m_names.push_back(name);
+	}
+
+	return result.first->second;
+}
+
+uint32 ListfileIndex::child(uint32 parent, uint32 name) const
+{
+	const std::unordered_map<uint64, uint32>::const_iterator iterator = this->m_children.find(childKey(parent, name));
+
+	if (iterator != this->m_children.end())
+	{
+		return iterator->second;
+	}
+
+	return 0;
+}
+
+bool ListfileIndex::findNode(const string &path, uint32 &node, string *casePath) const
+{
+	node = 0;
+	string::size_type begin = 0;
+
+	while (begin < path.size())
+	{
+		string::size_type end = path.find('\\', begin);
+
+		if (end == string::npos)
+		{
+			end = path.size();
+		}
+
+		if (end > begin)
+		{
+			const std::unordered_map<string, uint32>::const_iterator iterator = this->m_nameIndices.find(boost::algorithm::to_upper_copy(path.substr(begin, end - begin)));
+
+			if (iterator == this->m_nameIndices.end())
+			{
+				return false;
+			}
+
+			node = this->child(node, iterator->second);
+
+			if (node == 0)
+			{
+				return false;
+			}
+
+			if (casePath != 0)
+			{
+				if (!casePath->empty())
+				{
+					*casePath += '\\';
+				}
+
+				*casePath += this->m_names[iterator->second];
+			}
+		}
+
+		begin = end + 1;
+	}
+
+	return true;
+}
+
+void ListfileIndex::collect(uint32 node, string &path, bool files, bool recursive, Listfile::Entries &result) const
+{
+	const string::size_type pathSize = path.size();
+
+	BOOST_FOREACH(uint32 childNode, this->m_nodes[node].children)
+	{
+		const Node &child = this->m_nodes[childNode];
+
+		if (pathSize > 0)
+		{
+			path += '\\';
+		}
+
+		path += this->m_names[child.name];
+
+		if (files ? child.file : child.directory)
+		{
+			result.push_back(path);
+		}
+
+		if (recursive && child.directory)
+		{
+			this->collect(childNode, path, files, recursive, result);
+		}
+
+		path.resize(pathSize);
+	}
+}
+
+}
+
+}
@@ -0,0 +1,152 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef WC3LIB_MPQ_LISTFILEINDEX_HPP
+#define WC3LIB_MPQ_LISTFILEINDEX_HPP
+
+#include <vector>
+#include <unordered_map>
+
+#include "platform.hpp"
+#include "listfile.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \brief Case insensitive directory tree of listfile entries which answers directory queries without scanning all entries.
+ *
+ * \ref Listfile::caseSensitiveFileEntries() and \ref Listfile::caseSensitiveDirEntries() scan all entries for every single query.
+ * Listing many directories (for example in a tree view or a file browser) results in a quadratic number of string comparisons.
+ * The index is built only once from the entries and each query only visits the sub tree of the queried directory.
+ *
+ * Every directory and file name is interned by its upper case name. Like in \ref Listfile::caseSensitiveEntries() the first found case of a name is used for all entries.
+ * For example the entries "Units\Human\Footman.mdx" and "UNITS\human\Peasant.mdx" result in the directory "Units\Human" which contains both files.
+ * Empty directory names of entries like "Units\\Footman.mdx" are skipped.
+ *
+ * All results are unique and listed in the order of insertion with the contents of a directory following the directory itself.
+ *
+ * \sa Listfile
+ */
+class ListfileIndex
+{
+	public:
+		ListfileIndex();
+		explicit ListfileIndex(const Listfile::Entries &entries);
+
+		/**
+		 * Adds the file path \p entry and all of its directories.
+		 * Empty entries are ignored.
+		 */
+		void add(const string &entry);
+		void add(const Listfile::Entries &entries);
+		void clear();
+
+		/**
+		 * \return Returns the number of unique file paths.
+		 */
+		std::size_t files() const;
+		/**
+		 * \return Returns the number of unique directory paths.
+		 */
+		std::size_t directories() const;
+
+		/**
+		 * \return Returns true if the file path \p entry has been added. The comparison is case insensitive.
+		 */
+		bool containsFile(const string &entry) const;
+		/**
+		 * \param dirPath A directory path with or without a trailing '\'.
+		 * \return Returns true if the directory \p dirPath exists. The empty top level directory always exists.
+		 */
+		bool containsDirectory(const string &dirPath) const;
+
+		/**
+		 * Gets the case sensitive file paths of all files of the directory \p prefix.
+		 * \param prefix The directory path with or without a trailing '\'. An empty prefix lists the top level directory.
+		 * \param recursive If this value is true the files of all sub directories are listed as well.
+		 * \return Returns the file paths which use the first found case of every name. If the directory does not exist an empty container is returned.
+		 */
+		Listfile::Entries fileEntries(const string &prefix = "", bool recursive = true) const;
+		/**
+		 * Gets the case sensitive directory paths of all sub directories of the directory \p prefix.
+		 * The directory \p prefix itself is not part of the result.
+		 * \param prefix The directory path with or without a trailing '\'. An empty prefix lists the top level directory.
+		 * \param recursive If this value is true the sub directories of all sub directories are listed as well.
+		 * \return Returns the directory paths without trailing '\'.
+		 */
+		Listfile::Entries dirEntries(const string &prefix = "", bool recursive = true) const;
+
+	private:
+		struct Node
+		{
+			uint32 name;
+			bool file;
+			bool directory;
+			std::vector<uint32> children;
+		};
+
+		/**
+		 * \return Returns the unique index of the name \p upperName. Unknown names are added with their case sensitive value \p name.
+		 */
+		uint32 intern(const string &upperName, const string &name);
+		/**
+		 * \return Returns the child node of \p parent with the name \p name or 0 if it does not exist.
+		 */
+		uint32 child(uint32 parent, uint32 name) const;
+		/**
+		 * Finds the node of the path \p path. The top level directory is found for an empty path.
+		 * \param casePath If this value is not 0 the case sensitive path of the found node is appended.
+		 * \return Returns false if the path does not exist.
+		 */
+		bool findNode(const string &path, uint32 &node, string *casePath = 0) const;
+		void collect(uint32 node, string &path, bool files, bool recursive, Listfile::Entries &result) const;
+
+		/// All nodes. The first node is the top level directory.
+		std::vector<Node> m_nodes;
+		/// The child nodes by the index of their parent node and the index of their name.
+		std::unordered_map<uint64, uint32> m_children;
+		/// The interned names by their upper case value.
+		std::unordered_map<string, uint32> m_nameIndices;
+		/// The first found case sensitive value of every interned name.
+		std::vector<string> m_names;
+		std::size_t m_files;
+		std::size_t m_directories;
+};
+
+inline std::size_t ListfileIndex::files() const
+{
+	return this->m_files;
+}
+
+inline std::size_t ListfileIndex::directories() const
+{
+	return this->m_directories;
+}
+
+}
+
+}
+
+#endif
@@ -0,0 +1,278 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <unordered_set>
+
+#include "listfilerecovery.hpp"
+#include "algorithm.hpp"
+#include "hash.hpp"
+#include "parallel.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+namespace
+{
+
+/*
+ * The number of candidates which are generated and hashed at once by one thread.
+ */
+const uint64 batchSize = 4096;
+
+/*
+ * More candidates would take days to be hashed.
+ */
+const uint64 maxCandidates = uint64(1) << 40;
+
+inline uint64 hashKey(uint32 nameA, uint32 nameB)
+{
+	return (uint64(nameA) << 32) | uint64(nameB);
+}
+
+/*
+ * Counts the candidates of a pattern with \p wildcards '*' characters.
+ */
+uint64 patternCandidates(std::size_t wildcards, std::size_t words)
+{
+	uint64 result = 1;
+
+	for (std::size_t i = 0; i < wildcards; ++i)
+	{
+		if (words != 0 && result > maxCandidates / words)
+		{
+			return std::numeric_limits<uint64>::max();
+		}
+
+		result *= words;
+	}
+
+	return result;
+}
+
+}
+
+ListfileRecovery::ListfileRecovery() : m_threads(0)
+{
+}
+
+Listfile::Entries ListfileRecovery::defaultPatterns()
+{
+	static const char *patterns[] =
+	{
+		"(listfile)",
+		"(attributes)",
+		"(signature)",
+		"war3map.j",
+		"war3map.lua",
+		"Scripts\\war3map.j",
+		"Scripts\\war3map.lua",
+		"war3map.w3e",
+		"war3map.w3i",
+		"war3map.wtg",
+		"war3map.wct",
+		"war3map.wts",
+		"war3map.w3r",
+		"war3map.w3c",
+		"war3map.w3s",
+		"war3map.w3u",
+		"war3map.w3t",
+		"war3map.w3a",
+		"war3map.w3b",
+		"war3map.w3d",
+		"war3map.w3q",
+		"war3map.w3h",
+		"war3map.shd",
+		"war3map.mmp",
+		"war3map.wpm",
+		"war3map.doo",
+		"war3map.imp",
+		"war3mapUnits.doo",
+		"war3mapMap.blp",
+		"war3mapMap.tga",
+		"war3mapPreview.tga",
+		"war3mapMisc.txt",
+		"war3mapSkin.txt",
+		"war3mapExtra.txt",
+		"war3campaign.w3f",
+		"war3campaign.w3u",
+		"war3campaign.w3t",
+		"war3campaign.w3a",
+		"war3campaign.w3b",
+		"war3campaign.w3d",
+		"war3campaign.w3q",
+		"war3campaign.wts",
+		"war3campaign.imp",
+		"war3campaignImported\\*",
+		"war3mapImported\\*",
+		"war3mapImported\\*.blp",
+		"war3mapImported\\*.mdx",
+		"war3mapImported\\*.mp3",
+		"war3mapImported\\*.wav",
+		"Units\\*.slk",
+		"Units\\*.txt",
+		"Scripts\\*.j",
+		"ReplaceableTextures\\CommandButtons\\BTN*.blp",
+		"ReplaceableTextures\\CommandButtonsDisabled\\DISBTN*.blp",
+		"ReplaceableTextures\\PassiveButtons\\PASBTN*.blp"
+	};
+
+	return Listfile::Entries(patterns, patterns + sizeof(patterns) / sizeof(const char*));
+}
+
+uint64 ListfileRecovery::candidates() const
+{
+	uint64 result = 0;
+
+	BOOST_FOREACH(Listfile::Entries::const_reference pattern, this->patterns())
+	{
+		const uint64 count = patternCandidates(std::count(pattern.begin(), pattern.end(), '*'), this->words().size());
+
+		if (count == std::numeric_limits<uint64>::max() || result > std::numeric_limits<uint64>::max() - count)
+		{
+			return std::numeric_limits<uint64>::max();
+		}
+
+		result += count;
+	}
+
+	return result;
+}
+
+Listfile::Entries ListfileRecovery::recover(const Archive &archive) const
+{
+	/*
+	 * Collect the hash values of all used hash entries.
+	 */
+	std::unordered_set<uint64> hashValues;
+
+	for (uint32 i = 0; i < archive.hashTable().size(); ++i)
+	{
+		const Hash *hash = archive.hashTable().hash(i);
+
+		if (!hash->empty() && !hash->deleted())
+		{
+			hashValues.insert(hashKey(static_cast<uint32>(hash->cHashData().filePathHashA()), static_cast<uint32>(hash->cHashData().filePathHashB())));
+		}
+	}
+
+	/*
+	 * Several candidates might match the same hash entry, for example with different cases.
+	 * The first candidate by its pattern index and its index in the pattern is kept that the result does not depend on the order of the threads.
+	 */
+	typedef std::pair<std::size_t, uint64> CandidateIndex;
+	std::map<uint64, std::pair<CandidateIndex, string> > found;
+	std::mutex foundMutex;
+
+	for (std::size_t patternIndex = 0; patternIndex < this->patterns().size() && !hashValues.empty(); ++patternIndex)
+	{
+		const string &pattern = this->patterns()[patternIndex];
+		std::vector<string> parts;
+		boost::algorithm::split(parts, pattern, boost::algorithm::is_any_of("*"));
+		const std::size_t wildcards = parts.size() - 1;
+		const uint64 count = patternCandidates(wildcards, this->words().size());
+
+		if (count > maxCandidates)
+		{
+			throw Exception(boost::format(_("Pattern \"%1%\" results in too many candidates.")) % pattern);
+		}
+
+		const uint64 batches = (count + batchSize - 1) / batchSize;
+
+		parallelFor(boost::numeric_cast<std::size_t>(batches), this->threads(), [&](std::size_t batch)
+		{
+			const uint64 first = batch * batchSize;
+			const uint64 last = std::min(count, first + batchSize);
+			std::vector<string> candidates;
+			candidates.reserve(boost::numeric_cast<std::size_t>(last - first));
+
+			/*
+			 * The index of a candidate is the number of the combination of words with the first '*' as least significant digit.
+			 */
+			for (uint64 index = first; index < last; ++index)
+			{
+				string candidate = parts[0];
+				uint64 remainder = index;
+
+				for (std::size_t i = 0; i < wildcards; ++i)
+				{
+					candidate += this->words()[boost::numeric_cast<std::size_t>(remainder % this->words().size())];
+					remainder /= this->words().size();
+					candidate += parts[i + 1];
+				}
+
+				candidates.push_back(candidate);
+			}
+
+			std::vector<const char*> strings(candidates.size());
+
+			for (std::size_t i = 0; i < candidates.size(); ++i)
+			{
+				strings[i] = candidates[i].c_str();
+			}
+
+			std::vector<HashValues> values(candidates.size());
+			HashStrings(Archive::cryptTable(), strings.data(), strings.size(), values.data());
+
+			for (std::size_t i = 0; i < candidates.size(); ++i)
+			{
+				const uint64 key = hashKey(values[i].nameA, values[i].nameB);
+
+				if (hashValues.find(key) != hashValues.end())
+				{
+					const CandidateIndex candidateIndex(patternIndex, first + i);
+					std::lock_guard<std::mutex> lock(foundMutex);
+					std::map<uint64, std::pair<CandidateIndex, string> >::iterator iterator = found.find(key);
+
+					if (iterator == found.end())
+					{
+						found.insert(std::make_pair(key, std::make_pair(candidateIndex, candidates[i])));
+					}
+					else if (candidateIndex < iterator->second.first)
+					{
+						iterator->second = std::make_pair(candidateIndex, candidates[i]);
+					}
+				}
+			}
+		});
+	}
+
+	Listfile::Entries result;
+	result.reserve(found.size());
+
+	for (std::map<uint64, std::pair<CandidateIndex, string> >::const_iterator iterator = found.begin(); iterator != found.end(); ++iterator)
+	{
+		result.push_back(iterator->second.second);
+	}
+
+	std::sort(result.begin(), result.end());
+
+	return result;
+}
+
+}
+
+}
@@ -0,0 +1,135 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef WC3LIB_MPQ_LISTFILERECOVERY_HPP
+#define WC3LIB_MPQ_LISTFILERECOVERY_HPP
+
+#include "platform.hpp"
+#include "archive.hpp"
+#include "listfile.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \brief Recovers the paths of files of archives which have no "(listfile)" file.
+ *
+ * Hash tables only contain the hash values (\ref HashType::NameA and \ref HashType::NameB) of the file paths.
+ * Without the paths encrypted files cannot be decrypted and files cannot be shown by their names.
+ * Therefore candidate paths are hashed and compared with the hash values of all used hash entries of an archive.
+ *
+ * The candidates are generated from patterns. Every '*' of a pattern is replaced by every word of the word list (\ref addWord()).
+ * For example the pattern "ReplaceableTextures\CommandButtons\BTN*.blp" with the words "Footman" and "Peasant" results in the candidates
+ * "ReplaceableTextures\CommandButtons\BTNFootman.blp" and "ReplaceableTextures\CommandButtons\BTNPeasant.blp".
+ * Patterns without any '*' are candidates themselves. A pattern with several '*' results in all combinations of words.
+ *
+ * The candidates are generated and hashed in batches (\ref HashStrings()) by several threads.
+ *
+ * \note Only the classic hash table is used. Archives which only contain HET and BET tables cannot be recovered.
+ */
+class ListfileRecovery
+{
+	public:
+		ListfileRecovery();
+
+		void addWord(const string &word);
+		void addWords(const Listfile::Entries &words);
+		const Listfile::Entries& words() const;
+		void addPattern(const string &pattern);
+		void addPatterns(const Listfile::Entries &patterns);
+		const Listfile::Entries& patterns() const;
+		/**
+		 * \param threads The number of threads used for hashing the candidates. If this value is 0 \ref defaultThreads() is used.
+		 */
+		void setThreads(unsigned threads);
+		unsigned threads() const;
+
+		/**
+		 * \return Returns the names of the files of Warcraft III maps and some patterns of common directories.
+		 */
+		static Listfile::Entries defaultPatterns();
+
+		/**
+		 * \return Returns the number of candidates which are generated from all patterns and words.
+		 */
+		uint64 candidates() const;
+
+		/**
+		 * Hashes all candidates and compares them with the used hash entries of \p archive.
+		 * If several candidates have the same hash values (for example with different cases) only the first one is returned.
+		 * \return Returns the found paths sorted alphabetically.
+		 * \throws Exception Throws an exception if a pattern results in too many candidates.
+		 */
+		Listfile::Entries recover(const Archive &archive) const;
+
+	private:
+		Listfile::Entries m_words;
+		Listfile::Entries m_patterns;
+		unsigned m_threads;
+};
+
+inline void ListfileRecovery::addWord(const string &word)
+{
+	this->m_words.push_back(word);
+}
+
+inline void ListfileRecovery::addWords(const Listfile::Entries &words)
+{
+	this->m_words.insert(this->m_words.end(), words.begin(), words.end());
+}
+
+inline const Listfile::Entries& ListfileRecovery::words() const
+{
+	return this->m_words;
+}
+
+inline void ListfileRecovery::addPattern(const string &pattern)
+{
+	this->m_patterns.push_back(pattern);
+}
+
+inline void ListfileRecovery::addPatterns(const Listfile::Entries &patterns)
+{
+	this->m_patterns.insert(this->m_patterns.end(), patterns.begin(), patterns.end());
+}
+
+inline const Listfile::Entries& ListfileRecovery::patterns() const
+{
+	return this->m_patterns;
+}
+
+inline void ListfileRecovery::setThreads(unsigned threads)
+{
+	this->m_threads = threads;
+}
+
+inline unsigned ListfileRecovery::threads() const
+{
+	return this->m_threads;
+}
+
+}
+
+}
+
+#endif
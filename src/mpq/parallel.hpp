@@ -0,0 +1,126 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef WC3LIB_MPQ_PARALLEL_HPP
+#define WC3LIB_MPQ_PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \return Returns the number of threads which should be used by default for parallel operations. This is at least 1.
+ */
+inline unsigned defaultThreads()
+{
+	return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+/**
+ * \brief Calls \p function for every index from 0 to \p count - 1 using up to \p threads threads.
+ *
+ * Indices are handed out dynamically so threads which finish early pick up the remaining work.
+ * The calling thread takes part in the work. If \p threads is 0 \ref defaultThreads() is used.
+ * If \p threads is 1 or there is only one index everything runs in the calling thread.
+ *
+ * The first exception thrown by \p function stops handing out further indices and is rethrown in the calling thread after all threads have been joined.
+ *
+ * \param function Function object with the signature void(std::size_t index).
+ */
+template<typename Function>
+void parallelFor(std::size_t count, unsigned threads, Function function)
+{
+	if (threads == 0)
+	{
+		threads = defaultThreads();
+	}
+
+	if (threads == 1 || count <= 1)
+	{
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			function(i);
+		}
+
+		return;
+	}
+
+	std::atomic<std::size_t> next(0);
+	std::exception_ptr exception;
+	std::mutex exceptionMutex;
+
+	auto worker = [&]()
+	{
+		for (std::size_t i = next++; i < count; i = next++)
+		{
+			try
+			{
+				function(i);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(exceptionMutex);
+
+				if (!exception)
+				{
+					exception = std::current_exception();
+				}
+
+				next = count;
+			}
+		}
+	};
+
+	std::vector<std::thread> workers;
+	const std::size_t workersCount = std::min<std::size_t>(threads, count) - 1;
+	workers.reserve(workersCount);
+
+	for (std::size_t i = 0; i < workersCount; ++i)
+	{
+		workers.push_back(std::thread(worker));
+	}
+
+	worker();
+
+	for (std::thread &thread : workers)
+	{
+		thread.join();
+	}
+
+	if (exception)
+	{
+		std::rethrow_exception(exception);
+	}
+}
+
+}
+
+}
+
+#endif
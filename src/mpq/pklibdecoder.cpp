@@ -0,0 +1,340 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include <algorithm>
+#include <cstring>
+
+#include "pklibdecoder.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+namespace
+{
+
+/*
+ * The length code of the end of the data.
+ */
+const uint32 endLength = 0x205;
+
+/*
+ * Reads the bits of the data starting with the lowest bit of each byte.
+ * Like explode() skipping bits fails if less than 8 bits would remain.
+ */
+class BitReader
+{
+	public:
+		BitReader(const byte *in, const byte *end) : m_in(in), m_end(end), m_buffer(0), m_count(0), m_remaining(uint64(end - in) * 8)
+		{
+		}
+
+		/*
+		 * Loads enough bits for decoding one literal or repetition.
+		 */
+		void refill()
+		{
+			while (this->m_count <= 56 && this->m_in != this->m_end)
+			{
+				this->m_buffer |= uint64(static_cast<uint8>(*this->m_in++)) << this->m_count;
+				this->m_count += 8;
+			}
+		}
+
+		uint32 peek(uint32 count) const
+		{
+			return uint32(this->m_buffer & ((uint64(1) << count) - 1));
+		}
+
+		bool skip(uint32 count)
+		{
+			if (this->m_remaining < uint64(count) + 8)
+			{
+				return false;
+			}
+
+			this->m_buffer >>= count;
+			this->m_count -= count;
+			this->m_remaining -= count;
+
+			return true;
+		}
+
+	private:
+		const byte *m_in;
+		const byte *m_end;
+		uint64 m_buffer;
+		uint32 m_count;
+		uint64 m_remaining;
+};
+
+/*
+ * Decodes a byte of the compression type CMP_ASCII like DecodeLit() of explode().
+ * Returns a value greater than 0xFF if the data is corrupted.
+ */
+uint32 decodeAscii(const TDcmpStruct &tables, BitReader &reader)
+{
+	const uint32 invalid = 0x100;
+	uint32 value = 0;
+
+	if (reader.peek(8) != 0)
+	{
+		value = tables.offs2C34[reader.peek(8)];
+
+		if (value == 0xFF)
+		{
+			if (reader.peek(6) != 0)
+			{
+				if (!reader.skip(4))
+				{
+					return invalid;
+				}
+
+				value = tables.offs2D34[reader.peek(8)];
+			}
+			else
+			{
+				if (!reader.skip(6))
+				{
+					return invalid;
+				}
+
+				value = tables.offs2E34[reader.peek(7)];
+			}
+		}
+	}
+	else
+	{
+		if (!reader.skip(8))
+		{
+			return invalid;
+		}
+
+		value = tables.offs2EB4[reader.peek(8)];
+	}
+
+	return reader.skip(tables.ChBitsAsc[value]) ? value : invalid;
+}
+
+/*
+ * Copies a repetition of "length" bytes which starts "distance" bytes before "position".
+ * The circular buffer of explode() is initialized with zeros which are copied if the repetition starts in front of the output.
+ */
+void copy(byte *out, uint32 position, uint32 distance, uint32 length)
+{
+	byte *target = out + position;
+
+	if (distance > position)
+	{
+		for (uint32 i = 0; i < length; ++i)
+		{
+			target[i] = position + i >= distance ? out[position + i - distance] : 0;
+		}
+	}
+	else if (distance >= length)
+	{
+		memcpy(target, target - distance, length);
+	}
+	else if (distance == 1)
+	{
+		memset(target, target[-1], length);
+	}
+	else
+	{
+		const byte *source = target - distance;
+
+		// every block is read before it is overwritten
+		if (distance >= 8)
+		{
+			for ( ; length >= 8; length -= 8, target += 8, source += 8)
+			{
+				memcpy(target, source, 8);
+			}
+		}
+
+		for (uint32 i = 0; i < length; ++i)
+		{
+			target[i] = source[i];
+		}
+	}
+}
+
+/*
+ * Provides the header of an empty stream of the compression type CMP_ASCII once which is enough for explode() to generate all tables.
+ */
+unsigned int readHeader(char *buf, unsigned int * /* size */, void *param)
+{
+	bool &read = *reinterpret_cast<bool*>(param);
+
+	if (read)
+	{
+		return 0;
+	}
+
+	const char header[] = { CMP_ASCII, 4, 0, 0, 0 };
+	memcpy(buf, header, sizeof(header));
+	read = true;
+
+	return sizeof(header);
+}
+
+void writeNothing(char * /* buf */, unsigned int * /* size */, void * /* param */)
+{
+}
+
+}
+
+PklibDecoder::PklibDecoder()
+{
+	memset(&this->m_tables, 0, sizeof(this->m_tables));
+	bool read = false;
+	explode(readHeader, writeNothing, reinterpret_cast<char*>(&this->m_tables), &read);
+}
+
+unsigned int PklibDecoder::decompress(const byte *in, uint32 inSize, byte *out, uint32 &outSize) const
+{
+	const uint32 maxSize = outSize;
+	outSize = 0;
+
+	// the same checks in the same order as explode()
+	if (inSize <= 4)
+	{
+		return CMP_BAD_DATA;
+	}
+
+	const uint32 type = static_cast<uint8>(in[0]);
+	const uint32 dictionaryBits = static_cast<uint8>(in[1]);
+
+	if (dictionaryBits < 4 || dictionaryBits > 6)
+	{
+		return CMP_INVALID_DICTSIZE;
+	}
+
+	if (type != CMP_BINARY && type != CMP_ASCII)
+	{
+		return CMP_INVALID_MODE;
+	}
+
+	const TDcmpStruct &tables = this->m_tables;
+	BitReader reader(in + 2, in + inSize);
+	uint32 position = 0;
+
+	while (position < maxSize)
+	{
+		reader.refill();
+
+		if (reader.peek(1) == 0)
+		{
+			if (!reader.skip(1))
+			{
+				break;
+			}
+
+			uint32 value = 0;
+
+			if (type == CMP_BINARY)
+			{
+				value = reader.peek(8);
+
+				if (!reader.skip(8))
+				{
+					break;
+				}
+			}
+			else
+			{
+				value = decodeAscii(tables, reader);
+
+				if (value > 0xFF)
+				{
+					break;
+				}
+			}
+
+			out[position++] = static_cast<byte>(value);
+
+			continue;
+		}
+
+		if (!reader.skip(1))
+		{
+			break;
+		}
+
+		const uint32 lengthCode = tables.LengthCodes[reader.peek(8)];
+
+		if (!reader.skip(tables.LenBits[lengthCode]))
+		{
+			break;
+		}
+
+		uint32 length = lengthCode;
+		const uint32 extraBits = tables.ExLenBits[lengthCode];
+
+		if (extraBits != 0)
+		{
+			const uint32 extra = reader.peek(extraBits);
+
+			// the end of the data may be missing the last bits
+			if (!reader.skip(extraBits) && lengthCode + extra != 0x10E)
+			{
+				break;
+			}
+
+			length = tables.LenBase[lengthCode] + extra;
+		}
+
+		if (length == endLength)
+		{
+			outSize = position;
+
+			return CMP_NO_ERROR;
+		}
+
+		length += 2;
+		const uint32 distanceCode = tables.DistPosCodes[reader.peek(8)];
+
+		if (!reader.skip(tables.DistBits[distanceCode]))
+		{
+			break;
+		}
+
+		const uint32 distanceBits = length == 2 ? 2 : dictionaryBits;
+		const uint32 distance = ((distanceCode << distanceBits) | reader.peek(distanceBits)) + 1;
+
+		if (!reader.skip(distanceBits))
+		{
+			break;
+		}
+
+		length = std::min(length, maxSize - position);
+		copy(out, position, distance, length);
+		position += length;
+	}
+
+	outSize = position;
+
+	return position == maxSize ? CMP_NO_ERROR : CMP_ABORT;
+}
+
+}
+
+}
@@ -0,0 +1,67 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef WC3LIB_MPQ_PKLIBDECODER_HPP
+#define WC3LIB_MPQ_PKLIBDECODER_HPP
+
+#include <boost/noncopyable.hpp>
+
+#include <pklib/pklib.h>
+
+#include "platform.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \brief Decoder of sectors which are compressed with \ref Sector::Compression::Imploded (PKWare Data Compression Library).
+ *
+ * Unlike explode() of "lib/pklib" the decoder writes directly into the output buffer instead of using a circular buffer and callbacks for reading and writing.
+ * Repetitions are copied in blocks of 8 bytes or with a single copy if they do not overlap the current position.
+ * The output is identical to \ref decompressPklib() including truncated output of corrupted data.
+ *
+ * The decoding tables are generated by explode() itself when the decoder is constructed. An instance can be reused for any number of sectors. It must not be used by several threads at once.
+ */
+class PklibDecoder : private boost::noncopyable
+{
+	public:
+		PklibDecoder();
+
+		/**
+		 * Decompresses \p inSize bytes of \p in into \p out until the end of the data or until \p outSize bytes have been written.
+		 * \param outSize The size of \p out. It is set to the number of written bytes which might be greater than 0 even if an error occurred.
+		 * \return Returns CMP_NO_ERROR on success or the error code of explode().
+		 */
+		unsigned int decompress(const byte *in, uint32 inSize, byte *out, uint32 &outSize) const;
+
+	private:
+		/**
+		 * The tables of the decompression structure are filled by explode().
+		 */
+		TDcmpStruct m_tables;
+};
+
+}
+
+}
+
+#endif
@@ -80,6 +80,9 @@ struct Header
 	uint32 blockTableEntries;
 };
 
+/**
+ * \note Since the structure is padded it has to be read and written member by member. It has a size of 12 bytes in the archive.
+ */
 struct ExtendedHeader /// MPQ format 2
 {
 	uint64 extendedBlockTableOffset;
@@ -87,6 +90,77 @@ struct ExtendedHeader /// MPQ format 2
 	uint16 blockTableOffsetHigh;
 };
 
+struct ExtendedHeader3 /// MPQ format 3
+{
+	uint64 archiveSize;
+	uint64 betTableOffset;
+	uint64 hetTableOffset;
+};
+
+/**
+ * \note Since the structure is padded it has to be read and written member by member. It has a size of 140 bytes in the archive.
+ */
+struct ExtendedHeader4 /// MPQ format 4
+{
+	uint64 hashTableSize;
+	uint64 blockTableSize;
+	uint64 extendedBlockTableSize;
+	uint64 hetTableSize;
+	uint64 betTableSize;
+	uint32 rawChunkSize;
+	MD5Checksum blockTableMd5;
+	MD5Checksum hashTableMd5;
+	MD5Checksum extendedBlockTableMd5;
+	MD5Checksum betTableMd5;
+	MD5Checksum hetTableMd5;
+	MD5Checksum headerMd5; /// MD5 checksum of the whole header except this checksum.
+};
+
+/**
+ * Common header of the HET and BET tables which is not encrypted.
+ */
+struct ExtendedTableHeader
+{
+	byte magic[4];
+	uint32 version;
+	uint32 dataSize; /// Size of the following encrypted table data in bytes.
+};
+
+struct HetTableHeader
+{
+	uint32 tableSize; /// Size of the whole table including \ref ExtendedTableHeader.
+	uint32 entryCount; /// Maximum number of files.
+	uint32 totalCount; /// Number of entries in the table.
+	uint32 nameHashBitSize;
+	uint32 indexSizeTotal;
+	uint32 indexSizeExtra;
+	uint32 indexSize;
+	uint32 indexTableSize; /// Size of the bit-packed block indices in bytes.
+};
+
+struct BetTableHeader
+{
+	uint32 tableSize; /// Size of the whole table including \ref ExtendedTableHeader.
+	uint32 entryCount;
+	uint32 unknown;
+	uint32 tableEntrySize; /// Size of one entry in bits.
+	uint32 bitIndexFilePosition;
+	uint32 bitIndexFileSize;
+	uint32 bitIndexCompressedSize;
+	uint32 bitIndexFlagIndex;
+	uint32 bitIndexUnknown;
+	uint32 bitCountFilePosition;
+	uint32 bitCountFileSize;
+	uint32 bitCountCompressedSize;
+	uint32 bitCountFlagIndex;
+	uint32 bitCountUnknown;
+	uint32 nameHashBitTotal;
+	uint32 nameHashBitExtra;
+	uint32 nameHashBitCount;
+	uint32 nameHashArraySize; /// Size of the bit-packed name hashes in bytes.
+	uint32 flagCount;
+};
+
 struct HashTableEntry
 {
 	int32 filePathHashA;
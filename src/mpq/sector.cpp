@@ -22,6 +22,7 @@
 #include "sector.hpp"
 #include "archive.hpp"
 #include "file.hpp"
+#include "parallel.hpp"
 
 namespace wc3lib
 {
@@ -29,54 +30,39 @@ namespace wc3lib
 namespace mpq
 {
 
-namespace
-{
+const int Sector::defaultWaveCompressionLevel;
 
-inline const char* bzip2Error(int error)
+std::size_t Sector::decompressionStages(Compression compression, Compression stages[maxStages])
 {
-	if (error == boost::iostreams::bzip2::data_error)
+	if (compression == Compression::Lzma)
 	{
-		return _("Data error: Compressed data stream is corrupted.");
-	}
+		stages[0] = Compression::Lzma;
 
-	if (error == boost::iostreams::bzip2::data_error_magic)
-	{
-		return _("Data error magic: Compressed data stream does not begin with the 'magic' sequence 'B' 'Z' 'h'.");
+		return 1;
 	}
 
-	if (error == boost::iostreams::bzip2::config_error)
+	static const Compression order[] =
 	{
-		return _("Config error: libbzip2 has been improperly configured for the current platform.");
-	}
-
-	return "";
-}
-
-inline const char* zlibError(int error)
-{
-	if (error == boost::iostreams::zlib::stream_error)
-	{
-		return _("Stream error: Compressed data stream or parameter configuration is corrupted.");
-	}
-
-	if (error == boost::iostreams::zlib::version_error)
-	{
-		return _("Version error: Incompatible versions.");
-	}
-
-	if (error == boost::iostreams::zlib::data_error)
-	{
-		return _("Data error: Compressed data stream is corrupted.");
-	}
-
-	if (error == boost::iostreams::zlib::buf_error)
+		Compression::Bzip2Compressed,
+		Compression::Imploded,
+		Compression::Deflated,
+		Compression::Huffman,
+		Compression::ImaAdpcmStereo,
+		Compression::ImaAdpcmMono,
+		Compression::Sparse
+	};
+
+	std::size_t result = 0;
+
+	for (std::size_t i = 0; i < sizeof(order) / sizeof(Compression); ++i)
 	{
-		return _("Buff error: Internal error.");
+		if (compression & order[i])
+		{
+			stages[result++] = order[i];
+		}
 	}
 
-	return "";
-}
-
+	return result;
 }
 
 Sector::Sector(Archive *archive, Block *block, const string &fileName, uint32 index, uint32 offset, uint32 size, uint32 uncompressedSize)
@@ -142,6 +128,26 @@ std::streamsize Sector::decompress(ostream &ostream) const
 		return 0;
 	}
 
+	const SectorCache::Data cached = this->cachedData();
+
+	if (cached)
+	{
+		ostream.write(cached->data(), cached->size());
+
+		return dataSize;
+	}
+
+	/*
+	 * Memory mapped archives are decompressed directly from the mapped data without opening the file again.
+	 */
+	if (archive()->isMapped())
+	{
+		const byte *data = archive()->mappedData(position(), dataSize);
+		decompress(data, dataSize, ostream);
+
+		return dataSize;
+	}
+
 	ifstream ifstream(archive()->path(), std::ios_base::in | std::ios_base::binary);
 
 	if (!ifstream)
@@ -163,12 +169,31 @@ std::streamsize Sector::decompress(istream &istream, ostream &ostream) const
 		return 0;
 	}
 
-	// TODO unnecessary copying into array! Directly decompress data from stream!
-	boost::scoped_array<byte> data(new byte[dataSize]);
+	// cached sectors do not have to be read at all
+	const SectorCache::Data cached = this->cachedData();
+
+	if (cached)
+	{
+		ostream.write(cached->data(), cached->size());
+
+		return dataSize;
+	}
+
+	/*
+	 * The raw data is read into a buffer which is kept per thread to avoid allocations for every sector.
+	 * Use a memory mapped archive (\ref Archive::open()) to avoid this copy completely.
+	 */
+	static thread_local std::vector<byte> data;
+
+	if (data.size() < dataSize)
+	{
+		data.resize(dataSize);
+	}
+
 	std::streamsize bytes = 0;
 	wc3lib::read(istream, data[0], bytes, dataSize);
 
-	decompress(data.get(), dataSize, ostream);
+	decompress(data.data(), dataSize, ostream);
 
 	return bytes;
 }
@@ -206,6 +231,16 @@ void Sector::seekp(ostream &ostream) const
 	}
 }
 
+uint64 Sector::position() const
+{
+	if (this->archive()->format() == Archive::Format::Mpq1)
+	{
+		return this->archive()->startPosition() + this->block()->blockOffset() + this->sectorOffset();
+	}
+
+	return this->archive()->startPosition() + this->block()->largeOffset() + this->sectorOffset();
+}
+
 void Sector::seekg(istream &istream) const
 {
 	istream.seekg(this->archive()->startPosition());
@@ -332,21 +367,15 @@ byte* Sector::compress(const byte *buffer, uint32 bufferSize, Block::Flags flags
 
 		if (compression & Sector::Compression::Deflated) // Deflated (see ZLib)
 		{
-			iarraystream istream(buffer, bufferSize);
-			//arraystream ostream;
-			std::basic_stringstream<byte> ostream; // TODO unbuffered stream doesnt work.
+			uint32 outLength = bufferSize * 2 + 1024;
+			boost::scoped_array<byte> out(new byte[outLength]); // NOTE do always allocate enough memory.
 
-			try
-			{
-				size = compressZlib(istream, ostream);
-			}
-			catch (boost::iostreams::zlib_error &error)
+			if (Sector::codec(Sector::Compression::Deflated)->compress(buffer, bufferSize, out.get(), outLength, defaultCompressionLevel))
 			{
-				throw Exception(zlibError(error.error()));
+				data.reset(new byte[outLength]);
+				memcpy(data.get(), out.get(), outLength);
+				size = outLength;
 			}
-
-			data.reset(new byte[size]);
-			ostream.read(data.get(), size);
 		}
 
 		// Imploded sectors are the raw compressed data following compression with the implode algorithm (these sectors can only be in imploded files).
@@ -373,22 +402,15 @@ byte* Sector::compress(const byte *buffer, uint32 bufferSize, Block::Flags flags
 
 		if (compression & Sector::Compression::Bzip2Compressed) // BZip2 compressed (see BZip2)
 		{
-			iarraystream istream(buffer, bufferSize);
-			//arraystream ostream;
-			std::basic_stringstream<byte> ostream; // TODO unbuffered stream doesnt work
+			uint32 outLength = bufferSize * 2 + 1024;
+			boost::scoped_array<byte> out(new byte[outLength]); // NOTE do always allocate enough memory.
 
-			try
+			if (Sector::codec(Sector::Compression::Bzip2Compressed)->compress(buffer, bufferSize, out.get(), outLength, defaultCompressionLevel))
 			{
-				size = compressBzip2(istream, ostream);
-			}
-			catch (boost::iostreams::bzip2_error &error)
-			{
-
-				throw Exception(bzip2Error(error.error()));
+				data.reset(new byte[outLength]);
+				memcpy(data.get(), out.get(), outLength);
+				size = outLength;
 			}
-
-			data.reset(new byte[size]);
-			ostream.read(data.get(), size);
 		}
 	}
 
@@ -407,6 +429,199 @@ byte* Sector::compress(const byte *buffer, uint32 bufferSize, Block::Flags flags
 	return result;
 }
 
+Block::Flags Sector::fileFlags(Block::Flags flags, Compression compression)
+{
+	flags = flags | Block::Flags::IsFile;
+
+	if (compression == Compression::Imploded)
+	{
+		flags = flags | Block::Flags::IsImploded;
+	}
+	else if (compression != Compression::Uncompressed)
+	{
+		flags = flags | Block::Flags::IsCompressed;
+	}
+
+	return flags;
+}
+
+Sector::Compression Sector::firstSectorCompression(Compression compression)
+{
+	return static_cast<Compression>(static_cast<uint8>(compression) & ~(static_cast<uint8>(Compression::ImaAdpcmMono) | static_cast<uint8>(Compression::ImaAdpcmStereo)));
+}
+
+void Sector::compressSectors(const byte *data, uint32 dataSize, uint32 sectorSize, Block::Flags flags, Compression compression, std::vector<uint32> &sectorOffsets, std::vector<byte> &output, unsigned threads, int waveCompressionLevel, int compressionLevel)
+{
+	/*
+	 * Single unit files consist of one sector only.
+	 */
+	if ((flags & Block::Flags::IsSingleUnit) && ((flags & Block::Flags::IsCompressed) || (flags & Block::Flags::IsImploded)))
+	{
+		sectorSize = std::max<uint32>(dataSize, 1);
+	}
+
+	const std::size_t sectorsCount = dataSize / sectorSize + (dataSize % sectorSize > 0 ? 1 : 0);
+	sectorOffsets.clear();
+	sectorOffsets.reserve(sectorsCount + 1);
+	output.clear();
+	output.reserve(dataSize);
+
+	/*
+	 * Without additional threads one buffer is reused for all sectors.
+	 * Otherwise every sector is compressed into its own buffer and the buffers are joined in order.
+	 */
+	if (threads == 1 || sectorsCount <= 1)
+	{
+		std::vector<byte> sector;
+
+		for (uint32 offset = 0; offset < dataSize; offset += sectorSize)
+		{
+			compressData(data + offset, std::min(sectorSize, dataSize - offset), flags, offset == 0 ? firstSectorCompression(compression) : compression, sector, waveCompressionLevel, compressionLevel);
+			sectorOffsets.push_back(boost::numeric_cast<uint32>(output.size()));
+			output.insert(output.end(), sector.begin(), sector.end());
+		}
+	}
+	else
+	{
+		std::vector<std::vector<byte> > sectors(sectorsCount);
+
+		parallelFor(sectorsCount, threads, [&](std::size_t i)
+		{
+			const uint32 offset = boost::numeric_cast<uint32>(i * sectorSize);
+			compressData(data + offset, std::min(sectorSize, dataSize - offset), flags, i == 0 ? firstSectorCompression(compression) : compression, sectors[i], waveCompressionLevel, compressionLevel);
+		});
+
+		BOOST_FOREACH(const std::vector<byte> &sector, sectors)
+		{
+			sectorOffsets.push_back(boost::numeric_cast<uint32>(output.size()));
+			output.insert(output.end(), sector.begin(), sector.end());
+		}
+	}
+
+	sectorOffsets.push_back(boost::numeric_cast<uint32>(output.size()));
+}
+
+std::streamsize Sector::writeBlock(ostream &ostream, const std::vector<uint32> &sectorOffsets, std::vector<byte> &data, Block::Flags flags, uint32 fileKey)
+{
+	std::streamsize size = 0;
+	const uint32 sectorsCount = boost::numeric_cast<uint32>(sectorOffsets.size() - 1);
+	const bool encrypted = flags & Block::Flags::IsEncrypted;
+
+	if (Block::hasSectorOffsetTable(flags))
+	{
+		const uint32 sectorOffsetTableSize = boost::numeric_cast<uint32>(sectorOffsets.size() * sizeof(uint32));
+		// the sector offsets are relative to the block offset and therefore include the size of the table itself
+		std::vector<uint32> sectorOffsetTable(sectorOffsets);
+
+		BOOST_FOREACH(uint32 &sectorOffset, sectorOffsetTable)
+		{
+			sectorOffset += sectorOffsetTableSize;
+		}
+
+		// The SectorOffsetTable, if present, is encrypted using the key - 1.
+		if (encrypted)
+		{
+			EncryptData(Archive::cryptTable(), sectorOffsetTable.data(), sectorOffsetTableSize, fileKey - 1);
+		}
+
+		wc3lib::write(ostream, sectorOffsetTable[0], size, sectorOffsetTableSize);
+	}
+
+	if (encrypted)
+	{
+		for (uint32 i = 0; i < sectorsCount; ++i)
+		{
+			EncryptData(Archive::cryptTable(), data.data() + sectorOffsets[i], sectorOffsets[i + 1] - sectorOffsets[i], fileKey + i);
+		}
+	}
+
+	if (!data.empty())
+	{
+		wc3lib::write(ostream, data[0], size, data.size());
+	}
+
+	return size;
+}
+
+bool Sector::compressData(const byte *data, uint32 dataSize, Block::Flags flags, Compression compression, std::vector<byte> &output, int waveCompressionLevel, int compressionLevel)
+{
+	output.clear();
+
+	/*
+	 * Some algorithms produce more data than their input and cannot detect an overflow. The output buffers are large enough for all of them.
+	 * If the output does not fit the data is stored uncompressed anyway.
+	 */
+	const uint32 bufferSize = dataSize * 2 + 1024;
+
+	// Imploded sectors are the raw compressed data following compression with the implode algorithm (these sectors can only be in imploded files).
+	if (flags & Block::Flags::IsImploded)
+	{
+		output.resize(bufferSize);
+		uint32 outLength = bufferSize;
+
+		if (Sector::codec(Compression::Imploded)->compress(data, dataSize, output.data(), outLength, compressionLevel))
+		{
+			output.resize(outLength);
+		}
+		else
+		{
+			output.clear();
+		}
+	}
+	// Compressed sectors (only found in compressed - not imploded - files) are compressed with one or more compression algorithms.
+	else if (flags & Block::Flags::IsCompressed)
+	{
+		/*
+		 * The compression stages are applied in the reverse order of Sector::decompressData().
+		 * Each stage compresses the output of the previous one.
+		 */
+		Compression stages[maxStages];
+		const std::size_t stagesCount = decompressionStages(compression, stages);
+		std::vector<byte> buffers[2];
+		std::size_t usedStages = 0;
+		const byte *input = data;
+		uint32 inputSize = dataSize;
+		bool fits = true;
+
+		for (std::size_t i = stagesCount; i > 0 && fits; --i)
+		{
+			const Codec *codec = Sector::codec(stages[i - 1]);
+
+			if (codec == 0)
+			{
+				throw Exception(boost::format(_("No codec for compression %1%.")) % static_cast<int>(stages[i - 1]));
+			}
+
+			// the buffers are used alternately since the input of the stage might be the previous output
+			std::vector<byte> &stageOutput = buffers[usedStages++ % 2];
+			stageOutput.resize(bufferSize);
+			uint32 outLength = bufferSize;
+			const bool wave = stages[i - 1] == Compression::ImaAdpcmMono || stages[i - 1] == Compression::ImaAdpcmStereo;
+			fits = codec->compress(input, inputSize, stageOutput.data(), outLength, wave ? waveCompressionLevel : compressionLevel);
+			input = stageOutput.data();
+			inputSize = outLength;
+		}
+
+		if (fits)
+		{
+			// the compression byte counts towards the sector size
+			output.reserve(inputSize + 1);
+			output.push_back(static_cast<byte>(compression));
+			output.insert(output.end(), input, input + inputSize);
+		}
+	}
+
+	// NOTE The sector is stored uncompressed if the data cannot be compressed by at least one byte including the compression byte.
+	if (output.empty() || output.size() >= dataSize)
+	{
+		output.assign(data, data + dataSize);
+
+		return false;
+	}
+
+	return true;
+}
+
 std::streamsize Sector::writeSectors(ostream &ostream, const Sectors &sectors, Block::Flags flags, uint32 compressedFileSize, uint32 uncompressedFileSize, uint32 blockOffset, const string &fileName)
 {
 	std::streamsize bytes = 0;
@@ -509,8 +724,57 @@ std::streamsize Sector::compress(const byte *buffer, uint32 bufferSize, ostream
 }
 
 
-void Sector::decompress(byte *data, uint32 dataSize, ostream &ostream) const
+void Sector::decompress(const byte *data, uint32 dataSize, ostream &ostream) const
+{
+	const uint32 bufferSize = uncompressedSize() > 0 ? std::max(uncompressedSize(), dataSize) : std::max(this->archive()->sectorSize(), dataSize);
+	static thread_local std::vector<byte> buffer;
+
+	if (buffer.size() < bufferSize)
+	{
+		buffer.resize(bufferSize);
+	}
+
+	const uint32 size = decompress(data, dataSize, buffer.data(), bufferSize);
+
+	/*
+	 * Now write the decompressed buffer into the output stream.
+	 */
+	ostream.write(buffer.data(), size);
+}
+
+uint32 Sector::decompress(const byte *data, uint32 dataSize, byte *buffer, uint32 bufferSize) const
+{
+	const uint32 size = this->decompressData(data, dataSize, buffer, bufferSize);
+	SectorCache &cache = this->archive()->sectorCache();
+
+	if (cache.enabled())
+	{
+		cache.insert(this->block()->index(), this->sectorIndex(), buffer, size);
+	}
+
+	return size;
+}
+
+SectorCache::Data Sector::cachedData() const
 {
+	SectorCache &cache = this->archive()->sectorCache();
+
+	if (!cache.enabled())
+	{
+		return SectorCache::Data();
+	}
+
+	return cache.find(this->block()->index(), this->sectorIndex());
+}
+
+uint32 Sector::decompressData(const byte *data, uint32 dataSize, byte *buffer, uint32 bufferSize) const
+{
+	/*
+	 * The mapped or read archive data is never modified. Only encrypted sectors have to be copied since they are decrypted in place.
+	 * The copy is kept per thread to avoid allocations for every sector.
+	 */
+	static thread_local std::vector<byte> decrypted;
+
 	/*
 	 * If the file is encrypted, each sector (after compression/implosion, if applicable) is encrypted with the file's key.
 	 * Each sector is encrypted using the key + the 0-based index of the sector in the file.
@@ -518,164 +782,136 @@ void Sector::decompress(byte *data, uint32 dataSize, ostream &ostream) const
 	 */
 	if (this->block()->flags() & Block::Flags::IsEncrypted)
 	{
-		DecryptData(Archive::cryptTable(), reinterpret_cast<void*>(data), dataSize, this->sectorKey());
+		if (decrypted.size() < dataSize)
+		{
+			decrypted.resize(dataSize);
+		}
+
+		memcpy(decrypted.data(), data, dataSize);
+		DecryptData(Archive::cryptTable(), reinterpret_cast<void*>(decrypted.data()), dataSize, this->sectorKey());
+		data = decrypted.data();
 	}
 
 	// NOTE This byte counts towards the total sector size, meaning that the sector will be stored uncompressed if the data cannot be compressed by at least two bytes
-	if (compressionSucceded())
+	if (!compressionSucceded())
 	{
+		// If data could not be compressed properly there is no compression byte since it can always be determined if compression succeeded by checking the byte counts.
+		if (dataSize > bufferSize)
+		{
+			throw Exception(boost::format(_("Sector %1% with size %2% does not fit into buffer of size %3%.")) % sectorIndex() % dataSize % bufferSize);
+		}
+
 		/*
-		 * Now decompress in the correct order
+		 * Now write the original data into the output buffer which could not be compressed properly.
 		 */
-		int outLength = boost::numeric_cast<int>(uncompressedSize() > 0 ? uncompressedSize() : this->archive()->sectorSize());
-		// NOTE do always allocate enough memory.
-		boost::scoped_array<byte> buffer(new byte[outLength]);
+		memcpy(buffer, data, dataSize);
 
-		// Imploded sectors are the raw compressed data following compression with the implode algorithm (these sectors can only be in imploded files).
-		if (this->block()->flags() & Block::Flags::IsImploded)
+		return dataSize;
+	}
+
+	uint32 outLength = bufferSize;
+
+	// Imploded sectors are the raw compressed data following compression with the implode algorithm (these sectors can only be in imploded files).
+	if (this->block()->flags() & Block::Flags::IsImploded)
+	{
+		if (!Sector::codec(Compression::Imploded)->decompress(data, dataSize, buffer, outLength))
 		{
-			if (this->compression() & Sector::Compression::Imploded)
-			{
-				decompressPklib(buffer.get(), outLength, reinterpret_cast<char* const>(data), boost::numeric_cast<int>(dataSize));
+			throw Exception(boost::format(_("Sector %1% does not fit into buffer of size %2% after decompression with \"%3%\".")) % sectorIndex() % bufferSize % "Imploded");
+		}
 
 #ifdef DEBUG
-				sizeCheck(outLength, *this, "Imploded:Imploded");
+		sizeCheck(outLength, *this, "Imploded:Imploded");
 #endif
-			}
-		}
-		// Compressed sectors (only found in compressed - not imploded - files) are compressed with one or more compression algorithms.
-		else if (this->block()->flags() & Block::Flags::IsCompressed)
-		{
-			const_cast<Sector*>(this)->setCompression(static_cast<Sector::Compression>(data[0])); // first byte contains compression
 
-			// NOTE the following decompression statements do skip this value (starting at buffer index 1)
-			byte *realData = &data[1];
-			const uint32 realDataSize = dataSize - 1;
+		return outLength;
+	}
 
-			if (this->compression() & Sector::Compression::Bzip2Compressed) // BZip2 compressed (see BZip2)
-			{
-				/*
-				 * NOTE Does not copy the stream. Only provides a source.
-				 */
-				iarraystream istream(realData, realDataSize);
-				// TODO unbuffered streams are not supported.
-				stringstream ostream;
-				std::streamsize size = 0;
-
-				try
-				{
-					size = decompressBzip2(istream, ostream, archive()->sectorSize());
-				}
-				catch (boost::iostreams::bzip2_error &error)
-				{
-					throw Exception(bzip2Error(error.error()));
-				}
+	// Compressed sectors (only found in compressed - not imploded - files) are compressed with one or more compression algorithms.
+	if (!(this->block()->flags() & Block::Flags::IsCompressed))
+	{
+		memcpy(buffer, data, dataSize);
 
-#ifdef DEBUG
-				sizeCheck(size, *this, "Bzip2");
-#endif
+		return dataSize;
+	}
 
-				outLength = boost::numeric_cast<int>(size);
-				ostream.read(buffer.get(), size);
-			}
+	const_cast<Sector*>(this)->setCompression(static_cast<Sector::Compression>(data[0])); // first byte contains compression
 
-			// Imploded sectors are the raw compressed data following compression with the implode algorithm (these sectors can only be in imploded files).
-			// NOTE but in this situation it's compressed not imploded file!!!
-			if (this->compression() & Sector::Compression::Imploded)
-			{
-				std::cerr << boost::format(_("%1%: Sector %2% is imploded but file is not.")) % archive()->path() % sectorIndex() << std::endl;
-				decompressPklib(buffer.get(), outLength, reinterpret_cast<char* const>(realData), boost::numeric_cast<int>(realDataSize));
+	/*
+	 * The decompression stages are applied in the reverse order of the compression.
+	 * Each stage decompresses the output of the previous one.
+	 */
+	Compression stages[maxStages];
+	const std::size_t usedStagesCount = decompressionStages(this->compression(), stages);
 
-#ifdef DEBUG
-				sizeCheck(outLength, *this, "Imploded");
-#endif
-			}
+	// NOTE the following decompression statements do skip the compression byte (starting at buffer index 1)
+	const byte *input = &data[1];
+	uint32 inputSize = dataSize - 1;
 
-			if (this->compression() & Sector::Compression::Deflated) // Deflated (see ZLib)
-			{
-				/*
-				 * NOTE Does not copy the stream. Only provides a source.
-				 */
-				iarraystream istream(realData, realDataSize);
-				// TODO unbuffered streams are not supported.
-				stringstream ostream;
-				std::streamsize size = 0;
-
-				try
-				{
-					size = decompressZlib(istream, ostream, archive()->sectorSize());
-				}
-				catch (boost::iostreams::zlib_error &error)
-				{
-					throw Exception(zlibError(error.error()));
-				}
+	if (usedStagesCount == 0)
+	{
+		if (inputSize > bufferSize)
+		{
+			throw Exception(boost::format(_("Sector %1% with size %2% does not fit into buffer of size %3%.")) % sectorIndex() % inputSize % bufferSize);
+		}
 
-#ifdef DEBUG
-				sizeCheck(size, *this, "Deflated");
-#endif
+		memcpy(buffer, input, inputSize);
 
-				outLength = boost::numeric_cast<int>(size);
-				ostream.read(buffer.get(), size);
-			}
+		return inputSize;
+	}
 
-			if (this->compression() & Sector::Compression::Huffman) // Huffman encoded
-			{
-				const int state = decompressHuffman(buffer.get(), &outLength, (char*)realData, boost::numeric_cast<int>(realDataSize));
-				//int state = huffman_decode_memory((const unsigned char*)realData, boost::numeric_cast<unsigned int>(realDataSize), &out, &outLength);
+	/*
+	 * Intermediate results are stored alternately in two buffers per thread.
+	 * The last stage always writes into the caller-supplied buffer.
+	 */
+	static thread_local std::vector<byte> intermediate[2];
 
-				if (state != 1)
-				{
-					throw Exception(boost::format(_("Huffman error %1%.")) % state);
-				}
+	for (std::size_t i = 0; i < usedStagesCount; ++i)
+	{
+		const Compression stage = stages[i];
+		byte *output = buffer;
 
-#ifdef DEBUG
-				sizeCheck(outLength, *this, "Huffman");
-#endif
-			}
+		if (i + 1 < usedStagesCount)
+		{
+			std::vector<byte> &next = intermediate[i % 2];
 
-			if (this->compression() & Sector::Compression::ImaAdpcmStereo) // IMA ADPCM stereo
+			if (next.size() < bufferSize)
 			{
-				if (decompressWaveStereo((unsigned char*const)realData, boost::numeric_cast<int>(realDataSize), (unsigned char*)buffer.get(), outLength) == 0)
-				{
-					throw Exception(_("Wave stereo decompression error."));
-				}
-
-#ifdef DEBUG
-				sizeCheck(outLength, *this, "Stereo");
-#endif
+				next.resize(bufferSize);
 			}
 
-			if (this->compression() & Sector::Compression::ImaAdpcmMono) // IMA ADPCM mono
-			{
-				if (decompressWaveMono((unsigned char*const)realData, boost::numeric_cast<int>(realDataSize), (unsigned char*)buffer.get(), outLength) == 0)
-				{
-					throw Exception(_("Wave mono decompression error."));
-				}
+			output = next.data();
+		}
 
-#ifdef DEBUG
-				sizeCheck(outLength, *this, "Mono");
-#endif
-			}
+		const Codec *codec = Sector::codec(stage);
+
+		if (codec == 0)
+		{
+			throw Exception(boost::format(_("No codec for compression %1%.")) % static_cast<int>(stage));
 		}
 
-		/*
-		 * Now write the decompressed buffer into the output stream.
-		 */
-		ostream.write(buffer.get(), outLength);
-	}
-	else
-	{
-		// If data could not be compressed properly there is no compression byte since it can always be determined if compression succeeded by checking the byte counts.
-		if ((this->block()->flags() & Block::Flags::IsCompressed) || (this->block()->flags() & Block::Flags::IsImploded))
+		// Imploded sectors are the raw compressed data following compression with the implode algorithm (these sectors can only be in imploded files).
+		// NOTE but in this situation it's compressed not imploded file!!!
+		if (stage == Compression::Imploded)
 		{
-			std::cerr << boost::format(_("%1%: Sector %2% with compressed size %3% and uncompressed size %4% could not be compressed properly. Archive sector size (uncompressed) is %5%.")) % "Sector" % sectorIndex() % this->sectorSize() % this->uncompressedSize() % archive()->sectorSize() << std::endl;
+			std::cerr << boost::format(_("%1%: Sector %2% is imploded but file is not.")) % archive()->path() % sectorIndex() << std::endl;
 		}
 
-		/*
-		 * Now write the original data into the output stream which could not be compressed properly.
-		 */
-		ostream.write(data, dataSize);
+		outLength = bufferSize;
+
+		if (!codec->decompress(input, inputSize, output, outLength))
+		{
+			throw Exception(boost::format(_("Sector %1% does not fit into buffer of size %2% after decompression with \"%3%\".")) % sectorIndex() % bufferSize % codec->name());
+		}
+
+#ifdef DEBUG
+		sizeCheck(outLength, *this, codec->name());
+#endif
+
+		input = output;
+		inputSize = outLength;
 	}
+
+	return inputSize;
 }
 
 }
@@ -21,10 +21,14 @@
 #ifndef WC3LIB_MPQ_SECTOR_HPP
 #define WC3LIB_MPQ_SECTOR_HPP
 
+#include <vector>
+
 #include <boost/scoped_array.hpp>
 
 #include "platform.hpp"
+#include "algorithm.hpp"
 #include "block.hpp"
+#include "sectorcache.hpp"
 
 namespace wc3lib
 {
@@ -55,6 +59,14 @@ class Sector
 		// TODO get best values
 		static const int defaultWaveCompressionLevel = 3;
 		static const int defaultHuffmanCompressionType = 0;
+		/**
+		 * The compression level which lets Deflated and Bzip2 use their default level like the Boost streams.
+		 */
+		static const int defaultCompressionLevel = -1;
+		/**
+		 * The maximum number of algorithms which can be combined in one compression byte.
+		 */
+		static const std::size_t maxStages = 8;
 
 		/**
 		 * For compressed files (\ref mpq::File::isCompressed()) or imploded files (\ref mpq::File::isImploded()) a compression type might be set
@@ -74,8 +86,8 @@ class Sector
 			Imploded = 0x08, /// Imploded (see PKWare Data Compression Library)
 			Bzip2Compressed = 0x10, /// BZip2 compressed (see BZip2)
 
-			Sparse = 0x20, /// <a href="http://www.zezula.net/en/mpq/stormlib/sfileaddfileex.html">Source</a>.
-			Lzma = 0x12 /// <a href="http://www.zezula.net/en/mpq/stormlib/sfileaddfileex.html">Source</a>.
+			Sparse = 0x20, /// <a href="http://www.zezula.net/en/mpq/stormlib/sfileaddfileex.html">Source</a>. Runs of zero bytes are removed. Can be combined with \ref Deflated or \ref Bzip2Compressed.
+			Lzma = 0x12 /// <a href="http://www.zezula.net/en/mpq/stormlib/sfileaddfileex.html">Source</a>. Cannot be combined with other algorithms. Requires liblzma (HAS_LZMA).
 		};
 
 		/**
@@ -102,6 +114,8 @@ class Sector
 		std::streamsize compress(const byte *buffer, const uint32 bufferSize, int waveCompressionLevel = defaultWaveCompressionLevel);
 		/**
 		 * Writes sector data into output stream \p ostream.
+		 * If the sector is cached (\ref cachedData()) the archive is not accessed at all.
+		 * If the archive is memory mapped (\ref Archive::isMapped()) the data is decompressed directly from the mapped archive file.
 		 * \return Returns size of written data.
 		 */
 		std::streamsize decompress(ostream &ostream) const;
@@ -109,6 +123,24 @@ class Sector
 		 * Same as \ref Sector::decompress(ostream &) const but doesn't work independently since it expects to be at the correct position in archive using \p istream as input archive stream.
 		 */
 		std::streamsize decompress(istream &istream, ostream &ostream) const;
+		/**
+		 * Decompresses the raw sector data \p data of size \p dataSize as it is stored in the archive into the caller-supplied buffer \p buffer.
+		 * \p data is never modified. It is only copied if the sector has to be decrypted. Therefore it can point directly into a memory mapped archive.
+		 * \param bufferSize The size of \p buffer which should be at least \ref uncompressedSize().
+		 * If the sector cache of the archive is enabled (\ref Archive::sectorCache()) the decompressed data is stored in it.
+		 * \return Returns the number of bytes written into \p buffer.
+		 * \throws Exception Throws an exception if the decompression fails or the data does not fit into the buffer.
+		 */
+		uint32 decompress(const byte *data, uint32 dataSize, byte *buffer, uint32 bufferSize) const;
+		/**
+		 * \return Returns the decompressed data of the sector from the sector cache of the archive (\ref Archive::sectorCache()) or an empty pointer if it is not cached or the cache is disabled.
+		 */
+		SectorCache::Data cachedData() const;
+
+		/**
+		 * \return Returns the absolute position of the sector's data in the archive file: archive offset + block offset + sector offset.
+		 */
+		uint64 position() const;
 
 		/**
 		 * Seeks the put position of the given output stream to the offset of the sector.
@@ -170,6 +202,70 @@ class Sector
 		 * \note The returned array is allocated on the heap and has to be deleted!
 		 */
 		static byte* compress(const byte *buffer, uint32 bufferSize, Block::Flags flags, Compression compression, uint32 &size, int waveCompressionLevel = defaultWaveCompressionLevel);
+		/**
+		 * Compresses the uncompressed data \p data of one single sector with size \p dataSize and stores the result exactly as the sector has to be stored in the archive (without encryption) into \p output.
+		 *
+		 * In imploded files (\ref Block::Flags::IsImploded) the data is imploded.
+		 * In compressed files (\ref Block::Flags::IsCompressed) the compression byte is prepended and all algorithms of \p compression are applied one after another in the reverse order of the decompression.
+		 * If the result is not smaller than \p dataSize the data is stored uncompressed as the format demands it.
+		 *
+		 * The function does not depend on any archive. Therefore several sectors can be compressed concurrently.
+		 *
+		 * \param waveCompressionLevel The level of the IMA ADPCM algorithms.
+		 * \param compressionLevel The level of all other algorithms. Deflated accepts 0 to 9 and Bzip2 1 to 9. Other values use the default level (\ref defaultCompressionLevel).
+		 * \return Returns true if the data has been compressed. Otherwise \p output contains the uncompressed data.
+		 * \throws Exception Throws an exception if one of the algorithms fails.
+		 */
+		static bool compressData(const byte *data, uint32 dataSize, Block::Flags flags, Compression compression, std::vector<byte> &output, int waveCompressionLevel = defaultWaveCompressionLevel, int compressionLevel = defaultCompressionLevel);
+		/**
+		 * \return Returns the block flags of a file with the flags \p flags whose sectors are compressed with \p compression.
+		 * These are \p flags with \ref Block::Flags::IsFile and \ref Block::Flags::IsImploded or \ref Block::Flags::IsCompressed.
+		 */
+		static Block::Flags fileFlags(Block::Flags flags, Compression compression);
+		/**
+		 * Stores the algorithms of the compression byte \p compression in the order of the decompression into \p stages.
+		 * The compression applies them in the reverse order.
+		 * LZMA uses the bits of Deflated and Bzip2Compressed but cannot be combined with any other algorithm.
+		 * \return Returns the number of stored algorithms.
+		 */
+		static std::size_t decompressionStages(Compression compression, Compression stages[maxStages]);
+		/**
+		 * The first sector of a WAV file contains its RIFF header which must not be compressed lossy.
+		 * Therefore it uses the compression \p compression without the IMA ADPCM algorithms like the compression of the following sectors in StormLib.
+		 * \return Returns the compression of the first sector of a file whose other sectors are compressed with \p compression.
+		 */
+		static Compression firstSectorCompression(Compression compression);
+		/**
+		 * Compresses the whole file data \p data with size \p dataSize sector by sector using \ref compressData() and stores all sectors one after another in \p output.
+		 * A compressed or imploded single unit file (\ref Block::Flags::IsSingleUnit) consists of one sector only.
+		 *
+		 * The first sector is compressed with \ref firstSectorCompression() that the header of a WAV file stays lossless.
+		 * The sectors are compressed by up to \p threads threads. The result is the same for any number of threads.
+		 *
+		 * \param sectorSize The sector size of the archive.
+		 * \param flags The flags of the block which should be the result of \ref fileFlags().
+		 * \param sectorOffsets This container is filled with the offsets of all sectors in \p output followed by the size of \p output.
+		 * \param threads The number of threads. If this value is 0 \ref defaultThreads() is used.
+		 * \throws Exception Throws an exception if one of the algorithms fails.
+		 */
+		static void compressSectors(const byte *data, uint32 dataSize, uint32 sectorSize, Block::Flags flags, Compression compression, std::vector<uint32> &sectorOffsets, std::vector<byte> &output, unsigned threads = 1, int waveCompressionLevel = defaultWaveCompressionLevel, int compressionLevel = defaultCompressionLevel);
+		/**
+		 * Writes the data of a block whose sectors have been compressed by \ref compressSectors() into \p ostream.
+		 * If the block has a sector offset table (\ref Block::hasSectorOffsetTable()) it is written in front of the sectors.
+		 * Its offsets are relative to the block and therefore include the size of the table itself.
+		 * If the block is encrypted the table and all sectors are encrypted with the file key \p fileKey (\ref Block::fileKey()). Therefore \p data is modified.
+		 * \return Returns the number of written bytes which is the size of the block.
+		 */
+		static std::streamsize writeBlock(ostream &ostream, const std::vector<uint32> &sectorOffsets, std::vector<byte> &data, Block::Flags flags, uint32 fileKey);
+		/**
+		 * \return Returns the size of the block which \ref writeBlock() writes for the same arguments. It is known before the block offset which is required for the file key.
+		 */
+		static uint32 blockSize(const std::vector<uint32> &sectorOffsets, const std::vector<byte> &data, Block::Flags flags);
+		/**
+		 * \return Returns the codec which is registered for the single compression flag \p compression or 0 if there is none.
+		 * \sa findCodec()
+		 */
+		static const Codec* codec(Compression compression);
 		/**
 		 * Writes the file sectors' meta data into output stream \p ostream.
 		 * This requires some information about the file data already since for encrypted files this information is used to encrypt the sector table.
@@ -218,10 +314,16 @@ class Sector
 
 		/**
 		 * Decompresses data from an input buffer into an output stream.
+		 * \p data is not modified.
 		 *
 		 * For internal usage.
 		 */
-		void decompress(byte *data, uint32 dataSize, ostream &ostream) const;
+		void decompress(const byte *data, uint32 dataSize, ostream &ostream) const;
+		/**
+		 * Decompresses the sector data without using the sector cache.
+		 * \sa decompress(const byte*, uint32, byte*, uint32) const
+		 */
+		uint32 decompressData(const byte *data, uint32 dataSize, byte *buffer, uint32 bufferSize) const;
 
 		/**
 		 * The corresponding archive of the sector which is required to determine the sector size.
@@ -244,6 +346,21 @@ inline constexpr bool operator&(Sector::Compression x, Sector::Compression y)
 	return static_cast<bool>(static_cast<byte>(x) & static_cast<byte>(y));
 }
 
+inline constexpr Sector::Compression operator|(Sector::Compression x, Sector::Compression y)
+{
+	return static_cast<Sector::Compression>(static_cast<uint8>(x) | static_cast<uint8>(y));
+}
+
+inline uint32 Sector::blockSize(const std::vector<uint32> &sectorOffsets, const std::vector<byte> &data, Block::Flags flags)
+{
+	return boost::numeric_cast<uint32>((Block::hasSectorOffsetTable(flags) ? sectorOffsets.size() * sizeof(uint32) : 0) + data.size());
+}
+
+inline const Codec* Sector::codec(Compression compression)
+{
+	return findCodec(static_cast<uint8>(compression));
+}
+
 inline Archive* Sector::archive() const
 {
 	return this->m_archive;
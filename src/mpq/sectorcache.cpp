@@ -0,0 +1,186 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "sectorcache.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+SectorCache::SectorCache(std::size_t maxSize)
+: m_maxSize(maxSize)
+, m_size(0)
+, m_hits(0)
+, m_misses(0)
+, m_evictions(0)
+{
+}
+
+void SectorCache::setMaxSize(std::size_t maxSize)
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex);
+	this->m_maxSize = maxSize;
+	this->evict(maxSize);
+}
+
+std::size_t SectorCache::maxSize() const
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex);
+
+	return this->m_maxSize;
+}
+
+std::size_t SectorCache::size() const
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex);
+
+	return this->m_size;
+}
+
+std::size_t SectorCache::count() const
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex);
+
+	return this->m_index.size();
+}
+
+SectorCache::Data SectorCache::find(uint32 blockIndex, uint32 sectorIndex)
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex);
+	Index::iterator iterator = this->m_index.find(key(blockIndex, sectorIndex));
+
+	if (iterator == this->m_index.end())
+	{
+		++this->m_misses;
+
+		return Data();
+	}
+
+	++this->m_hits;
+	// move to the front since it is the most recently used sector now
+	this->m_entries.splice(this->m_entries.begin(), this->m_entries, iterator->second);
+
+	return iterator->second->data;
+}
+
+void SectorCache::insert(uint32 blockIndex, uint32 sectorIndex, const byte *data, std::size_t size)
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex);
+
+	if (size > this->m_maxSize)
+	{
+		return;
+	}
+
+	const Key sectorKey = key(blockIndex, sectorIndex);
+	Index::iterator iterator = this->m_index.find(sectorKey);
+
+	// another thread might have inserted the same sector already
+	if (iterator != this->m_index.end())
+	{
+		this->m_size -= iterator->second->data->size();
+		this->m_entries.erase(iterator->second);
+		this->m_index.erase(iterator);
+	}
+
+	this->evict(this->m_maxSize - size);
+
+	Entry entry;
+	entry.key = sectorKey;
+	entry.data.reset(new std::vector<byte>(data, data + size));
+	this->m_entries.push_front(entry);
+	this->m_index.insert(std::make_pair(sectorKey, this->m_entries.begin()));
+	this->m_size += size;
+}
+
+void SectorCache::remove(uint32 blockIndex)
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex);
+	Entries::iterator iterator = this->m_entries.begin();
+
+	while (iterator != this->m_entries.end())
+	{
+		if (uint32(iterator->key >> 32) == blockIndex)
+		{
+			this->m_size -= iterator->data->size();
+			this->m_index.erase(iterator->key);
+			iterator = this->m_entries.erase(iterator);
+		}
+		else
+		{
+			++iterator;
+		}
+	}
+}
+
+void SectorCache::clear()
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex);
+	this->m_entries.clear();
+	this->m_index.clear();
+	this->m_size = 0;
+}
+
+uint64 SectorCache::hits() const
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex);
+
+	return this->m_hits;
+}
+
+uint64 SectorCache::misses() const
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex);
+
+	return this->m_misses;
+}
+
+uint64 SectorCache::evictions() const
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex);
+
+	return this->m_evictions;
+}
+
+void SectorCache::resetCounters()
+{
+	std::lock_guard<std::mutex> lock(this->m_mutex);
+	this->m_hits = 0;
+	this->m_misses = 0;
+	this->m_evictions = 0;
+}
+
+void SectorCache::evict(std::size_t maxSize)
+{
+	while (this->m_size > maxSize && !this->m_entries.empty())
+	{
+		const Entry &entry = this->m_entries.back();
+		this->m_size -= entry.data->size();
+		this->m_index.erase(entry.key);
+		this->m_entries.pop_back();
+		++this->m_evictions;
+	}
+}
+
+}
+
+}
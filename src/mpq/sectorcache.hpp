@@ -0,0 +1,155 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef WC3LIB_MPQ_SECTORCACHE_HPP
+#define WC3LIB_MPQ_SECTORCACHE_HPP
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "platform.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+/**
+ * \brief Size-bounded LRU cache of decompressed sectors of one archive.
+ *
+ * Sectors are identified by the index of their block and their index in the block.
+ * If the cache is enabled (\ref enabled()) decompressed sectors are stored until the sum of their sizes exceeds \ref maxSize().
+ * Then the least recently used sectors are evicted.
+ * Files which are decompressed repeatedly (for example "(listfile)" or SLK files) can then be returned without reading and decompressing their sectors again.
+ *
+ * The number of hits, misses and evictions is counted to measure the efficiency of the cache.
+ *
+ * All member functions are thread-safe since sectors might be decompressed by several threads.
+ *
+ * \sa Archive::sectorCache()
+ */
+class SectorCache : private boost::noncopyable
+{
+	public:
+		/**
+		 * Cached data is shared that it stays valid even if the sector is evicted while it is still being used.
+		 */
+		typedef std::shared_ptr<const std::vector<byte> > Data;
+
+		/**
+		 * \param maxSize The maximum size of all cached sectors in bytes. If this value is 0 the cache is disabled.
+		 */
+		explicit SectorCache(std::size_t maxSize = 0);
+
+		/**
+		 * Changes the maximum size in bytes and evicts sectors if necessary.
+		 * Setting it to 0 disables the cache and removes all sectors.
+		 */
+		void setMaxSize(std::size_t maxSize);
+		std::size_t maxSize() const;
+		bool enabled() const;
+		/**
+		 * \return Returns the size of all cached sectors in bytes.
+		 */
+		std::size_t size() const;
+		/**
+		 * \return Returns the number of cached sectors.
+		 */
+		std::size_t count() const;
+
+		/**
+		 * Searches for the decompressed data of a sector and marks it as most recently used.
+		 * \return Returns the cached data or an empty pointer if the sector is not cached.
+		 */
+		Data find(uint32 blockIndex, uint32 sectorIndex);
+		/**
+		 * Stores \p size bytes of decompressed \p data of a sector as most recently used one.
+		 * Sectors which are larger than \ref maxSize() are not cached at all.
+		 */
+		void insert(uint32 blockIndex, uint32 sectorIndex, const byte *data, std::size_t size);
+		/**
+		 * Removes all sectors of the block with index \p blockIndex.
+		 * This has to be done whenever the block's data changes.
+		 */
+		void remove(uint32 blockIndex);
+		/**
+		 * Removes all sectors. The counters are kept.
+		 */
+		void clear();
+
+		uint64 hits() const;
+		uint64 misses() const;
+		uint64 evictions() const;
+		void resetCounters();
+
+	private:
+		typedef uint64 Key;
+
+		struct Entry
+		{
+			Key key;
+			Data data;
+		};
+
+		typedef std::list<Entry> Entries;
+		typedef std::unordered_map<Key, Entries::iterator> Index;
+
+		static Key key(uint32 blockIndex, uint32 sectorIndex);
+
+		/**
+		 * Evicts the least recently used sectors until the cache does not exceed \p maxSize.
+		 * Expects the mutex to be locked.
+		 */
+		void evict(std::size_t maxSize);
+
+		mutable std::mutex m_mutex;
+		std::size_t m_maxSize;
+		std::size_t m_size;
+		/**
+		 * The most recently used sector is the first one.
+		 */
+		Entries m_entries;
+		Index m_index;
+		uint64 m_hits;
+		uint64 m_misses;
+		uint64 m_evictions;
+};
+
+inline bool SectorCache::enabled() const
+{
+	return this->maxSize() > 0;
+}
+
+inline SectorCache::Key SectorCache::key(uint32 blockIndex, uint32 sectorIndex)
+{
+	return (Key(blockIndex) << 32) | sectorIndex;
+}
+
+}
+
+}
+
+#endif
@@ -112,6 +112,11 @@ std::string compressionString(Sector::Compression compression)
 	{
 		return _("Uncompressed");
 	}
+	// LZMA uses the bits of two other algorithms but cannot be combined with them
+	else if (compression == Sector::Compression::Lzma)
+	{
+		return _("Lzma");
+	}
 	else
 	{
 		bool empty = true;
@@ -189,17 +194,6 @@ std::string compressionString(Sector::Compression compression)
 			empty = false;
 		}
 
-		if (compression & Sector::Compression::Lzma)
-		{
-			if (!empty)
-			{
-				sstream << ", ";
-			}
-
-			sstream << _("Lzma");
-			empty = false;
-		}
-
 		return sstream.str();
 	}
 
@@ -256,6 +250,12 @@ std::string formatString(Archive::Format format)
 
 		case Archive::Format::Mpq2:
 			return _("MPQ2");
+
+		case Archive::Format::Mpq3:
+			return _("MPQ3");
+
+		case Archive::Format::Mpq4:
+			return _("MPQ4");
 	}
 
 	return _("Invalid");
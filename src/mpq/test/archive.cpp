@@ -20,14 +20,25 @@
 
 #define BOOST_TEST_MODULE ArchiveTest
 #include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <cstring>
 #include <sstream>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
 
 #include <boost/scoped_ptr.hpp>
 #include <boost/scoped_array.hpp>
 
 #include "../archive.hpp"
+#include "../archivebuilder.hpp"
+#include "../archivediff.hpp"
+#include "../archiveset.hpp"
 #include "../algorithm.hpp"
+#include "../filestreambuf.hpp"
+#include "testdata.hpp"
 
 #ifndef BOOST_TEST_DYN_LINK
 #error Define BOOST_TEST_DYN_LINK for proper definition of main function.
@@ -39,6 +50,7 @@
 
 using namespace wc3lib;
 using namespace wc3lib::mpq;
+using namespace wc3lib::mpq::test;
 
 /**
  * Constructs a basic MPQ archive with one block and one hash entry (basically one file) and tests the basic IO methods of the class Archive.
@@ -343,6 +355,322 @@ BOOST_AUTO_TEST_CASE(AddFileUncompressedEncrypted)
 	BOOST_REQUIRE_EQUAL(data, "Hello World!");
 }
 
+BOOST_AUTO_TEST_CASE(AddFileUncompressedEncryptedMapped)
+{
+	if (boost::filesystem::exists("addfilemapped.mpq"))
+	{
+		boost::filesystem::remove("addfilemapped.mpq");
+	}
+
+	Archive archive;
+	archive.create("addfilemapped.mpq", 1, 1);
+
+	BOOST_REQUIRE(archive.isOpen());
+
+	string data = "Hello World!";
+
+	File file = archive.addFile("test.txt", data.c_str(), data.size(), Sector::Compression::Uncompressed, Block::Flags::IsEncrypted);
+
+	BOOST_REQUIRE(file.isValid());
+
+	archive.close();
+
+	archive.open("addfilemapped.mpq", true);
+
+	BOOST_REQUIRE(archive.isOpen());
+	BOOST_REQUIRE(archive.isMapped());
+	BOOST_REQUIRE_EQUAL(archive.blocks().size(), 1);
+	BOOST_REQUIRE_EQUAL(archive.hashes().size(), 1);
+
+	file = archive.findFile("test.txt");
+
+	BOOST_REQUIRE(file.isValid());
+
+	stringstream sstream;
+	file.decompress(sstream);
+
+	BOOST_REQUIRE_EQUAL(sstream.str(), "Hello World!");
+
+	// decompress into a buffer without any streams
+	std::vector<byte> buffer(file.size());
+	BOOST_REQUIRE_EQUAL(file.decompress(buffer.data(), buffer.size()), data.size());
+	BOOST_REQUIRE_EQUAL(string(buffer.begin(), buffer.end()), "Hello World!");
+}
+
+BOOST_AUTO_TEST_CASE(DecompressParallel)
+{
+	if (boost::filesystem::exists("decompressparallel.mpq"))
+	{
+		boost::filesystem::remove("decompressparallel.mpq");
+	}
+
+	Archive archive;
+	archive.create("decompressparallel.mpq", 1, 1);
+
+	BOOST_REQUIRE(archive.isOpen());
+
+	// use many sectors
+	string data;
+
+	for (std::size_t i = 0; i < 20 * archive.sectorSize() + 13; ++i)
+	{
+		data.push_back(static_cast<byte>(i * 7 + i / 256));
+	}
+
+	File file = archive.addFile("test.txt", data.c_str(), data.size());
+
+	BOOST_REQUIRE(file.isValid());
+
+	archive.close();
+
+	archive.open("decompressparallel.mpq");
+
+	BOOST_REQUIRE(archive.isOpen());
+
+	file = archive.findFile("test.txt");
+
+	BOOST_REQUIRE(file.isValid());
+
+	stringstream sstream;
+	BOOST_REQUIRE_EQUAL(file.decompress(sstream, 4), data.size());
+	BOOST_REQUIRE(sstream.str() == data);
+
+	std::vector<byte> buffer(file.size());
+	BOOST_REQUIRE_EQUAL(file.decompress(buffer.data(), buffer.size(), 0), data.size());
+	BOOST_REQUIRE(string(buffer.begin(), buffer.end()) == data);
+}
+
+BOOST_AUTO_TEST_CASE(SectorCacheHitsAndEvictions)
+{
+	if (boost::filesystem::exists("sectorcache.mpq"))
+	{
+		boost::filesystem::remove("sectorcache.mpq");
+	}
+
+	Archive archive;
+	archive.create("sectorcache.mpq", 4, 4);
+
+	BOOST_REQUIRE(archive.isOpen());
+
+	string data;
+
+	for (std::size_t i = 0; i < 4 * archive.sectorSize(); ++i)
+	{
+		data.push_back(static_cast<byte>(i * 13 + i / 256));
+	}
+
+	File file = archive.addFile("test.txt", data.c_str(), data.size());
+
+	BOOST_REQUIRE(file.isValid());
+
+	archive.close();
+
+	archive.open("sectorcache.mpq", true);
+
+	BOOST_REQUIRE(archive.isOpen());
+	BOOST_REQUIRE(!archive.sectorCache().enabled());
+
+	archive.sectorCache().setMaxSize(4 * archive.sectorSize());
+
+	file = archive.findFile("test.txt");
+
+	BOOST_REQUIRE(file.isValid());
+
+	stringstream sstream;
+	file.decompress(sstream);
+	BOOST_REQUIRE(sstream.str() == data);
+	BOOST_REQUIRE_EQUAL(archive.sectorCache().hits(), 0);
+	BOOST_REQUIRE_EQUAL(archive.sectorCache().misses(), 4);
+	BOOST_REQUIRE_EQUAL(archive.sectorCache().count(), 4);
+	BOOST_REQUIRE_EQUAL(archive.sectorCache().size(), data.size());
+
+	// every sector is taken from the cache now
+	std::vector<byte> buffer(file.size());
+	BOOST_REQUIRE_EQUAL(file.decompress(buffer.data(), buffer.size(), 2), data.size());
+	BOOST_REQUIRE(string(buffer.begin(), buffer.end()) == data);
+	BOOST_REQUIRE_EQUAL(archive.sectorCache().hits(), 4);
+	BOOST_REQUIRE_EQUAL(archive.sectorCache().evictions(), 0);
+
+	// only two sectors fit into the cache
+	archive.sectorCache().setMaxSize(2 * archive.sectorSize());
+	BOOST_REQUIRE_EQUAL(archive.sectorCache().count(), 2);
+	BOOST_REQUIRE_EQUAL(archive.sectorCache().evictions(), 2);
+
+	archive.sectorCache().resetCounters();
+	sstream.str("");
+	file.decompress(sstream);
+	BOOST_REQUIRE(sstream.str() == data);
+	BOOST_REQUIRE_EQUAL(archive.sectorCache().hits() + archive.sectorCache().misses(), 4);
+	BOOST_REQUIRE(archive.sectorCache().evictions() > 0);
+	BOOST_REQUIRE(archive.sectorCache().size() <= archive.sectorCache().maxSize());
+
+	archive.sectorCache().setMaxSize(0);
+	BOOST_REQUIRE_EQUAL(archive.sectorCache().count(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(SectorCacheInvalidation)
+{
+	if (boost::filesystem::exists("sectorcacheinvalidation.mpq"))
+	{
+		boost::filesystem::remove("sectorcacheinvalidation.mpq");
+	}
+
+	Archive archive;
+	archive.create("sectorcacheinvalidation.mpq", 4, 4);
+
+	BOOST_REQUIRE(archive.isOpen());
+
+	archive.sectorCache().setMaxSize(1024 * 1024);
+
+	const string data = "Old content";
+	File file = archive.addFile("test.txt", data.c_str(), data.size());
+
+	BOOST_REQUIRE(file.isValid());
+
+	stringstream sstream;
+	file.decompress(sstream);
+	BOOST_REQUIRE_EQUAL(sstream.str(), data);
+	BOOST_REQUIRE_EQUAL(archive.sectorCache().count(), 1);
+
+	BOOST_REQUIRE(archive.removeFile(file));
+	BOOST_REQUIRE_EQUAL(archive.sectorCache().count(), 0);
+
+	// the new file might reuse the block of the removed one
+	const string newData = "New content!";
+	file = archive.addFile("test.txt", newData.c_str(), newData.size());
+
+	BOOST_REQUIRE(file.isValid());
+
+	sstream.str("");
+	file.decompress(sstream);
+	BOOST_REQUIRE_EQUAL(sstream.str(), newData);
+}
+
+BOOST_AUTO_TEST_CASE(FileInputStreamRandomAccess)
+{
+	if (boost::filesystem::exists("fileinputstream.mpq"))
+	{
+		boost::filesystem::remove("fileinputstream.mpq");
+	}
+
+	Archive archive;
+	archive.create("fileinputstream.mpq", 4, 4);
+
+	BOOST_REQUIRE(archive.isOpen());
+
+	string data;
+
+	for (std::size_t i = 0; i < 5 * archive.sectorSize() + 100; ++i)
+	{
+		data.push_back(static_cast<byte>(i * 31 + i / 256));
+	}
+
+	BOOST_REQUIRE(archive.addFile("test.txt", data.c_str(), data.size()).isValid());
+
+	archive.close();
+
+	// read from the archive file as well as from the mapped archive
+	for (int mapped = 0; mapped < 2; ++mapped)
+	{
+		archive.open("fileinputstream.mpq", mapped == 1);
+
+		BOOST_REQUIRE(archive.isOpen());
+
+		FileInputStream istream(archive.findFile("test.txt"));
+		BOOST_REQUIRE_EQUAL(istream.rdbuf()->size(), data.size());
+		BOOST_REQUIRE_EQUAL(istream.rdbuf()->sectors().size(), 6);
+
+		// sequential reading across all sectors
+		string result((std::istreambuf_iterator<byte>(istream)), std::istreambuf_iterator<byte>());
+		BOOST_REQUIRE(result == data);
+
+		// seeking into the middle of a sector and reading across the sector boundary
+		const std::size_t position = 3 * archive.sectorSize() - 10;
+		istream.clear();
+		istream.seekg(position);
+		BOOST_REQUIRE_EQUAL(istream.tellg(), position);
+
+		byte buffer[20];
+		istream.read(buffer, sizeof(buffer));
+		BOOST_REQUIRE_EQUAL(istream.gcount(), sizeof(buffer));
+		BOOST_REQUIRE(string(buffer, sizeof(buffer)) == data.substr(position, sizeof(buffer)));
+		BOOST_REQUIRE_EQUAL(istream.tellg(), position + sizeof(buffer));
+
+		// seeking backwards relative to the current position and from the end
+		istream.seekg(-static_cast<std::streamoff>(archive.sectorSize()), std::ios::cur);
+		BOOST_REQUIRE_EQUAL(istream.get(), static_cast<unsigned char>(data[position + sizeof(buffer) - archive.sectorSize()]));
+
+		istream.seekg(-1, std::ios::end);
+		BOOST_REQUIRE_EQUAL(istream.get(), static_cast<unsigned char>(data.back()));
+		BOOST_REQUIRE_EQUAL(istream.get(), std::char_traits<byte>::eof());
+
+		archive.close();
+	}
+}
+
+BOOST_AUTO_TEST_CASE(HashTableProbing)
+{
+	if (boost::filesystem::exists("hashtableprobing.mpq"))
+	{
+		boost::filesystem::remove("hashtableprobing.mpq");
+	}
+
+	const uint32 entries = 16;
+	Archive archive;
+	archive.create("hashtableprobing.mpq", entries, entries);
+
+	BOOST_REQUIRE(archive.isOpen());
+	BOOST_REQUIRE_EQUAL(archive.hashTable().size(), entries);
+
+	std::vector<string> paths;
+
+	for (uint32 i = 0; i < 10; ++i)
+	{
+		paths.push_back((boost::format("file%1%.txt") % i).str());
+		const string data = paths.back();
+		File file = archive.addFile(paths.back(), data.c_str(), data.size());
+		BOOST_REQUIRE(file.isValid());
+
+		/*
+		 * Every file has to be stored at the index where the MPQ format starts searching or behind it.
+		 */
+		const uint32 start = HashString(Archive::cryptTable(), paths.back().c_str(), HashType::TableOffset) % entries;
+		BOOST_REQUIRE_EQUAL(archive.hashTable().hash(file.hash()->index()), file.hash());
+		BOOST_REQUIRE_EQUAL(archive.hashTable().entry(file.hash()->index()).fileBlockIndex, file.block()->index());
+		BOOST_REQUIRE(archive.hashTable().hash(start)->block() != 0);
+	}
+
+	archive.close();
+	archive.open("hashtableprobing.mpq");
+
+	BOOST_REQUIRE(archive.isOpen());
+	BOOST_REQUIRE_EQUAL(archive.hashTable().size(), entries);
+
+	BOOST_FOREACH(const string &path, paths)
+	{
+		File file = archive.findFile(path);
+		BOOST_REQUIRE(file.isValid());
+		BOOST_REQUIRE_EQUAL(archive.hashTable().hash(file.hash()->index()), file.hash());
+
+		stringstream sstream;
+		file.decompress(sstream);
+		BOOST_REQUIRE_EQUAL(sstream.str(), path);
+	}
+
+	BOOST_REQUIRE(!archive.findFile("missing.txt").isValid());
+
+	// removing files must not break the collision chains of the remaining files
+	for (std::size_t i = 0; i < paths.size(); i += 2)
+	{
+		BOOST_REQUIRE(archive.removeFile(archive.findFile(paths[i])));
+	}
+
+	for (std::size_t i = 0; i < paths.size(); ++i)
+	{
+		BOOST_REQUIRE_EQUAL(archive.findFile(paths[i]).isValid(), i % 2 != 0);
+	}
+}
+
 BOOST_AUTO_TEST_CASE(RemoveFile)
 {
 	if (boost::filesystem::exists("removefile.mpq"))
@@ -400,3 +728,768 @@ BOOST_AUTO_TEST_CASE(RemoveFile)
 
 	BOOST_REQUIRE(!file.isValid());
 }
+
+BOOST_AUTO_TEST_CASE(CompactArchive)
+{
+	const uint32 sectorSize = 4096;
+	string data;
+
+	for (std::size_t i = 0; i < 3 * sectorSize + 100; ++i)
+	{
+		data.push_back(static_cast<byte>('a' + (i / 5) % 26));
+	}
+
+	// compact the archive file as well as the mapped archive
+	for (int mapped = 0; mapped < 2; ++mapped)
+	{
+		if (boost::filesystem::exists("compact.mpq"))
+		{
+			boost::filesystem::remove("compact.mpq");
+		}
+
+		/*
+		 * The removed file is stored first that all other files have to be moved.
+		 * The encrypted files use keys which depend on their offsets.
+		 */
+		ArchiveBuilder builder;
+		builder.addFile("removed.txt", data.c_str(), data.size());
+		builder.addFile("first.txt", data.c_str(), data.size(), Sector::Compression::Deflated);
+		builder.addFile("units\\secret.txt", data.c_str(), data.size(), Sector::Compression::Deflated, Block::Flags::IsEncrypted | Block::Flags::UsesEncryptionKey);
+		builder.addFile("units\\plain.txt", data.c_str(), data.size(), Sector::Compression::Uncompressed, Block::Flags::IsEncrypted | Block::Flags::UsesEncryptionKey);
+		builder.write("compact.mpq");
+
+		Archive archive;
+		archive.open("compact.mpq", mapped == 1);
+
+		BOOST_REQUIRE(archive.isOpen());
+		BOOST_REQUIRE(archive.removeFile(archive.findFile("removed.txt")));
+
+		const uintmax_t oldSize = boost::filesystem::file_size("compact.mpq");
+		const std::streamsize newSize = archive.compact();
+
+		BOOST_REQUIRE(archive.isOpen());
+		BOOST_REQUIRE_EQUAL(archive.isMapped(), mapped == 1);
+		BOOST_REQUIRE_EQUAL(boost::filesystem::file_size("compact.mpq"), newSize);
+		BOOST_REQUIRE_EQUAL(oldSize - newSize, data.size());
+		BOOST_REQUIRE(!archive.findFile("removed.txt").isValid());
+		// the removed block is not referenced anymore
+		BOOST_REQUIRE(archive.blocks()[0].unused());
+
+		// the blocks are stored contiguously behind the tables now
+		uint64 offset = archive.hashTableOffset() + archive.hashes().size() * sizeof(HashTableEntry);
+		std::vector<const Block*> blocks;
+
+		BOOST_FOREACH(Archive::Blocks::const_reference block, archive.blocks())
+		{
+			if (!block.unused())
+			{
+				blocks.push_back(&block);
+			}
+		}
+
+		std::sort(blocks.begin(), blocks.end(), [](const Block *first, const Block *second) { return first->largeOffset() < second->largeOffset(); });
+
+		BOOST_FOREACH(const Block *block, blocks)
+		{
+			BOOST_REQUIRE_EQUAL(block->largeOffset(), offset);
+			offset += block->blockSize();
+		}
+
+		BOOST_REQUIRE_EQUAL(offset, newSize);
+
+		const char *paths[] = { "first.txt", "units\\secret.txt", "units\\plain.txt" };
+
+		BOOST_FOREACH(const char *path, paths)
+		{
+			File file = archive.findFile(path);
+			BOOST_REQUIRE(file.isValid());
+
+			stringstream sstream;
+			file.decompress(sstream);
+			BOOST_REQUIRE(sstream.str() == data);
+		}
+
+		BOOST_REQUIRE(archive.containsListfileFile());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(ForEachBlock)
+{
+	const string data = testData(3 * 4096 + 100);
+
+	for (int mapped = 0; mapped < 2; ++mapped)
+	{
+		/*
+		 * Without a "(listfile)" file the paths of the files are only known from the entries.
+		 */
+		ArchiveBuilder builder;
+		builder.setListfile(false);
+		builder.setAttributes(false);
+		builder.addFile("c.txt", data.c_str(), data.size(), Sector::Compression::Deflated);
+		builder.addFile("units\\secret.txt", data.c_str(), data.size(), Sector::Compression::Deflated, Block::Flags::IsEncrypted | Block::Flags::UsesEncryptionKey);
+		builder.addFile("a.txt", data.c_str(), 100);
+		builder.addFile("a.txt", data.c_str(), 200, Sector::Compression::Uncompressed, Block::Flags::None, File::Locale::German);
+		builder.write("foreachblock.mpq");
+
+		Archive archive;
+		archive.open("foreachblock.mpq", mapped == 1);
+
+		std::vector<uint64> offsets;
+		std::vector<std::vector<string> > paths;
+		std::vector<string> contents;
+		std::vector<string> errors;
+
+		const Archive::BlockFunction function = [&](const Archive::BlockContent &content)
+		{
+			offsets.push_back(content.block->largeOffset());
+			paths.push_back(content.paths);
+			contents.push_back(content.error.empty() ? string(content.data, content.size) : string());
+			errors.push_back(content.error);
+
+			return true;
+		};
+
+		BOOST_REQUIRE_EQUAL(archive.forEachBlock(function), 4);
+		BOOST_REQUIRE(std::is_sorted(offsets.begin(), offsets.end()));
+		BOOST_REQUIRE(paths[0].empty());
+		BOOST_REQUIRE(contents[0] == data);
+		// the encrypted file cannot be decrypted without its path
+		BOOST_REQUIRE(!errors[1].empty());
+		BOOST_REQUIRE(contents[2] == data.substr(0, 100));
+		BOOST_REQUIRE(contents[3] == data.substr(0, 200));
+
+		Listfile::Entries entries;
+		entries.push_back("a.txt");
+		entries.push_back("units\\secret.txt");
+		entries.push_back("c.txt");
+		offsets.clear();
+		paths.clear();
+		contents.clear();
+		errors.clear();
+
+		BOOST_REQUIRE_EQUAL(archive.forEachBlock(function, entries), 4);
+		BOOST_REQUIRE(std::is_sorted(offsets.begin(), offsets.end()));
+		BOOST_REQUIRE_EQUAL(paths[0].size(), 1);
+		BOOST_REQUIRE_EQUAL(paths[0][0], "c.txt");
+		BOOST_REQUIRE_EQUAL(paths[1][0], "units\\secret.txt");
+		BOOST_REQUIRE(errors[1].empty());
+		BOOST_REQUIRE(contents[1] == data);
+		// both locales have their own block with the same path
+		BOOST_REQUIRE_EQUAL(paths[2][0], "a.txt");
+		BOOST_REQUIRE_EQUAL(paths[3][0], "a.txt");
+
+		// the iteration stops as soon as the function returns false
+		std::size_t visited = 0;
+		BOOST_REQUIRE_EQUAL(archive.forEachBlock([&](const Archive::BlockContent &) { ++visited; return false; }, entries, false), 1);
+		BOOST_REQUIRE_EQUAL(visited, 1);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Verify)
+{
+	const string data = testData(3 * 4096 + 100);
+
+	for (int mapped = 0; mapped < 2; ++mapped)
+	{
+		ArchiveBuilder builder;
+		builder.addFile("c.txt", data.c_str(), data.size(), Sector::Compression::Deflated);
+		builder.addFile("units\\secret.txt", data.c_str(), data.size(), Sector::Compression::Bzip2Compressed, Block::Flags::IsEncrypted | Block::Flags::UsesEncryptionKey);
+		builder.addFile("a.txt", data.c_str(), 100);
+		builder.write("verify.mpq");
+
+		Archive::BlockVerifications verifications;
+
+		{
+			Archive archive;
+			archive.open("verify.mpq", mapped == 1);
+			// "(listfile)" contains the path of the encrypted file
+			verifications = archive.verify(Listfile::Entries(), 2);
+
+			// "c.txt", "units\secret.txt", "a.txt", "(listfile)" and "(attributes)"
+			BOOST_REQUIRE_EQUAL(verifications.size(), 5);
+
+			BOOST_FOREACH(Archive::BlockVerifications::const_reference verification, verifications)
+			{
+				BOOST_REQUIRE(verification.error.empty());
+				BOOST_REQUIRE(verification.isValid());
+
+				if (verification.paths.front() == "(attributes)")
+				{
+					BOOST_REQUIRE(!verification.crc32Checked);
+					BOOST_REQUIRE(!verification.md5Checked);
+				}
+				else
+				{
+					BOOST_REQUIRE(verification.crc32Checked);
+					BOOST_REQUIRE(verification.md5Checked);
+				}
+
+				if (verification.paths.front() == "c.txt" || verification.paths.front() == "units\\secret.txt")
+				{
+					BOOST_REQUIRE_EQUAL(verification.size, data.size());
+					BOOST_REQUIRE_EQUAL(verification.crc32, Attributes::crc32(data.c_str(), data.size()));
+					BOOST_REQUIRE(verification.md5 == Attributes::md5(data.c_str(), data.size()));
+				}
+			}
+		}
+
+		/*
+		 * Changes the last byte of the uncompressed file "a.txt".
+		 */
+		uint64 position = 0;
+
+		{
+			Archive archive;
+			archive.open("verify.mpq");
+			const File file = archive.findFile("a.txt");
+			BOOST_REQUIRE(file.isValid());
+			position = archive.startPosition() + file.block()->largeOffset() + file.block()->blockSize() - 1;
+		}
+
+		{
+			std::fstream stream("verify.mpq", std::ios::in | std::ios::out | std::ios::binary);
+			stream.seekp(position);
+			stream.put('#');
+		}
+
+		Archive archive;
+		archive.open("verify.mpq", mapped == 1);
+		verifications = archive.verify(Listfile::Entries(), 1);
+		std::size_t invalid = 0;
+
+		BOOST_FOREACH(Archive::BlockVerifications::const_reference verification, verifications)
+		{
+			if (!verification.isValid())
+			{
+				++invalid;
+				BOOST_REQUIRE_EQUAL(verification.paths.front(), "a.txt");
+				BOOST_REQUIRE(verification.error.empty());
+				BOOST_REQUIRE(!verification.crc32Valid);
+				BOOST_REQUIRE(!verification.md5Valid);
+			}
+		}
+
+		BOOST_REQUIRE_EQUAL(invalid, 1);
+	}
+
+	/*
+	 * Without a listfile the encrypted file cannot be decrypted but is not corrupted either.
+	 */
+	ArchiveBuilder builder;
+	builder.setListfile(false);
+	builder.addFile("units\\secret.txt", data.c_str(), data.size(), Sector::Compression::Deflated, Block::Flags::IsEncrypted | Block::Flags::UsesEncryptionKey);
+	builder.addFile("c.txt", data.c_str(), data.size(), Sector::Compression::Deflated);
+	builder.write("verifyunknown.mpq");
+
+	Archive archive;
+	archive.open("verifyunknown.mpq");
+	const Archive::BlockVerifications verifications = archive.verify();
+	std::size_t skipped = 0;
+
+	BOOST_FOREACH(Archive::BlockVerifications::const_reference verification, verifications)
+	{
+		BOOST_REQUIRE(verification.error.empty());
+		BOOST_REQUIRE(verification.isValid());
+
+		if (verification.skipped)
+		{
+			++skipped;
+			BOOST_REQUIRE(verification.paths.empty());
+			BOOST_REQUIRE(verification.block->flags() & Block::Flags::IsEncrypted);
+		}
+	}
+
+	BOOST_REQUIRE_EQUAL(skipped, 1);
+}
+
+/*
+ * Adds compressed and encrypted files with several sectors at once.
+ * The archive has to be the same for any number of threads.
+ */
+BOOST_AUTO_TEST_CASE(AddFiles)
+{
+	std::vector<string> contents;
+
+	for (std::size_t i = 0; i < 5; ++i)
+	{
+		string data;
+
+		for (std::size_t j = 0; j < (i + 1) * 4096 + 77; ++j)
+		{
+			data.push_back(static_cast<byte>('a' + (j / (i + 3)) % 26));
+		}
+
+		contents.push_back(data);
+	}
+
+	const char *paths[] = { "a.txt", "units\\b.txt", "units\\c.txt", "d.txt", "e.txt" };
+	const Sector::Compression compressions[] = { Sector::Compression::Deflated, Sector::Compression::Bzip2Compressed, Sector::Compression::Imploded, Sector::Compression::Uncompressed, Sector::Compression::Deflated };
+	const Block::Flags flags[] = { Block::Flags::None, Block::Flags::IsEncrypted | Block::Flags::UsesEncryptionKey, Block::Flags::None, Block::Flags::IsEncrypted, Block::Flags::IsSingleUnit };
+	std::vector<string> archives;
+
+	for (unsigned threads = 1; threads <= 4; threads += 3)
+	{
+		const string path = (boost::format("addfiles%1%.mpq") % threads).str();
+
+		if (boost::filesystem::exists(path))
+		{
+			boost::filesystem::remove(path);
+		}
+
+		Archive archive;
+		archive.create(path, 16, 8);
+		archive.setThreads(threads);
+
+		Archive::NewFiles newFiles;
+
+		for (std::size_t i = 0; i < contents.size(); ++i)
+		{
+			newFiles.push_back(Archive::NewFile(paths[i], contents[i].c_str(), contents[i].size(), compressions[i], flags[i]));
+		}
+
+		const std::vector<File> files = archive.addFiles(newFiles);
+		BOOST_REQUIRE_EQUAL(files.size(), contents.size());
+
+		// a single file is compressed sector by sector
+		BOOST_REQUIRE(archive.addFile("f.txt", contents[4].c_str(), contents[4].size(), Sector::Compression::Deflated).isValid());
+
+		archive.close();
+		archive.open(path);
+
+		for (std::size_t i = 0; i < contents.size(); ++i)
+		{
+			File file = archive.findFile(paths[i]);
+			BOOST_REQUIRE(file.isValid());
+			stringstream sstream;
+			file.decompress(sstream);
+			BOOST_REQUIRE(sstream.str() == contents[i]);
+		}
+
+		File file = archive.findFile("f.txt");
+		BOOST_REQUIRE(file.isValid());
+		BOOST_REQUIRE(file.isCompressed());
+		BOOST_REQUIRE(file.compressedSize() < contents[4].size());
+		stringstream sstream;
+		file.decompress(sstream);
+		BOOST_REQUIRE(sstream.str() == contents[4]);
+
+		ifstream in(path, std::ios::in | std::ios::binary);
+		archives.push_back(string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()));
+	}
+
+	BOOST_REQUIRE(archives[0] == archives[1]);
+
+	// nothing is written if the tables are too small
+	Archive archive;
+	archive.open("addfiles1.mpq");
+	Archive::NewFiles newFiles;
+
+	for (std::size_t i = 0; i < 3; ++i)
+	{
+		newFiles.push_back(Archive::NewFile((boost::format("new%1%.txt") % i).str(), contents[0].c_str(), contents[0].size()));
+	}
+
+	const uintmax_t size = boost::filesystem::file_size("addfiles1.mpq");
+	BOOST_CHECK_THROW(archive.addFiles(newFiles), Archive::TooSmallBlockTableException);
+	BOOST_REQUIRE_EQUAL(boost::filesystem::file_size("addfiles1.mpq"), size);
+}
+
+/*
+ * The "(listfile)" and "(attributes)" files of the archive are updated when files are added.
+ */
+BOOST_AUTO_TEST_CASE(AddFilesUpdatesListfileAndAttributes)
+{
+	string data;
+
+	for (std::size_t i = 0; i < 2 * 4096 + 10; ++i)
+	{
+		data.push_back(static_cast<byte>('a' + (i / 5) % 26));
+	}
+
+	ArchiveBuilder builder;
+	builder.setBlockTableEntries(8);
+	builder.addFile("old.txt", data.c_str(), data.size(), Sector::Compression::Deflated);
+	builder.write("addfilesattributes.mpq");
+
+	Archive archive;
+	archive.open("addfilesattributes.mpq");
+
+	Archive::NewFiles newFiles;
+	newFiles.push_back(Archive::NewFile("new.txt", data.c_str(), 100, Sector::Compression::Deflated));
+	newFiles.push_back(Archive::NewFile("units\\new.txt", data.c_str(), data.size(), Sector::Compression::Bzip2Compressed, Block::Flags::IsEncrypted));
+	archive.addFiles(newFiles);
+	archive.close();
+
+	archive.open("addfilesattributes.mpq");
+	const Listfile::Entries entries = archive.listfileFile().entries();
+	BOOST_REQUIRE_EQUAL(entries.size(), 3);
+	BOOST_REQUIRE_EQUAL(entries[1], "new.txt");
+	BOOST_REQUIRE_EQUAL(entries[2], "units\\new.txt");
+
+	const Archive::BlockVerifications verifications = archive.verify();
+	BOOST_REQUIRE_EQUAL(verifications.size(), 5);
+
+	BOOST_FOREACH(Archive::BlockVerifications::const_reference verification, verifications)
+	{
+		BOOST_REQUIRE(verification.isValid());
+
+		if (verification.paths.front() != "(attributes)")
+		{
+			BOOST_REQUIRE(verification.crc32Checked);
+			BOOST_REQUIRE(verification.md5Checked);
+		}
+	}
+}
+
+/*
+ * The "(listfile)" file keeps its compression when it is updated.
+ */
+BOOST_AUTO_TEST_CASE(AddFilesKeepsListfileCompression)
+{
+	Listfile::Entries entries;
+
+	for (int i = 0; i < 200; ++i)
+	{
+		entries.push_back((boost::format("units\\file%1%.txt") % i).str());
+	}
+
+	const string content = Listfile::content(entries);
+	ArchiveBuilder builder;
+	builder.setListfile(false);
+	builder.setAttributes(false);
+	builder.setBlockTableEntries(4);
+	builder.addFile("(listfile)", content.c_str(), content.size(), Sector::Compression::Bzip2Compressed);
+	builder.write("addfileslistfilecompression.mpq");
+
+	Archive archive;
+	archive.open("addfileslistfilecompression.mpq");
+
+	Archive::NewFiles newFiles;
+	newFiles.push_back(Archive::NewFile("new.txt", content.c_str(), 100, Sector::Compression::Deflated));
+	archive.addFiles(newFiles);
+	archive.close();
+
+	archive.open("addfileslistfilecompression.mpq");
+	Listfile listfile = archive.listfileFile();
+	ifstream in("addfileslistfilecompression.mpq", std::ios_base::in | std::ios_base::binary);
+	Sector::Sectors sectors;
+	listfile.sectors(in, sectors);
+	BOOST_REQUIRE(!sectors.empty());
+	BOOST_REQUIRE(sectors.front().compressionSucceded());
+	sectors.front().seekg(in);
+	ostringstream out;
+	sectors.front().decompress(in, out);
+	BOOST_REQUIRE(sectors.front().compression() == Sector::Compression::Bzip2Compressed);
+	BOOST_REQUIRE_EQUAL(listfile.entries().size(), 201);
+}
+
+BOOST_AUTO_TEST_CASE(FreeSpaceBestFit)
+{
+	FreeSpace freeSpace;
+	freeSpace.insert(100, 50);
+	freeSpace.insert(300, 20);
+	freeSpace.insert(500, 30);
+	// merged with both neighbours
+	freeSpace.insert(150, 10);
+	freeSpace.insert(90, 10);
+	BOOST_REQUIRE_EQUAL(freeSpace.extents().size(), 3);
+	BOOST_REQUIRE_EQUAL(freeSpace.extents().begin()->first, 90);
+	BOOST_REQUIRE_EQUAL(freeSpace.extents().begin()->second, 70);
+	BOOST_REQUIRE_EQUAL(freeSpace.size(), 120);
+
+	uint64 offset = 0;
+	// the smallest extent which is large enough is used
+	BOOST_REQUIRE(freeSpace.allocate(25, offset));
+	BOOST_CHECK_EQUAL(offset, 500);
+	BOOST_REQUIRE(freeSpace.allocate(20, offset));
+	BOOST_CHECK_EQUAL(offset, 300);
+	BOOST_REQUIRE(freeSpace.allocate(60, offset));
+	BOOST_CHECK_EQUAL(offset, 90);
+	BOOST_CHECK(!freeSpace.allocate(11, offset));
+	BOOST_CHECK_EQUAL(offset, 90);
+	BOOST_CHECK_EQUAL(freeSpace.size(), 15);
+}
+
+BOOST_AUTO_TEST_CASE(AddFilesReusesFreeSpace)
+{
+	string data;
+
+	for (std::size_t i = 0; i < 3 * 4096; ++i)
+	{
+		data.push_back(static_cast<byte>(i * 7 + i / 4096));
+	}
+
+	ArchiveBuilder builder;
+	builder.setBlockTableEntries(8);
+	// the sizes of the free space are only predictable without any updated "(listfile)" and "(attributes)" files
+	builder.setListfile(false);
+	builder.setAttributes(false);
+	builder.addFile("a.txt", data.c_str(), data.size());
+	builder.addFile("b.txt", data.c_str(), data.size());
+	builder.addFile("c.txt", data.c_str(), data.size());
+	builder.write("freespace.mpq");
+
+	Archive archive;
+	archive.open("freespace.mpq");
+	const uint64 fileSize = boost::filesystem::file_size("freespace.mpq");
+	const std::size_t size = archive.size();
+	BOOST_REQUIRE_EQUAL(archive.freeSpace().size(), 0);
+
+	// the space of the removed file is reused by the smaller file
+	BOOST_REQUIRE(archive.removeFile(archive.findFile("a.txt")));
+	BOOST_REQUIRE_EQUAL(archive.freeSpace().size(), data.size());
+	BOOST_REQUIRE_EQUAL(archive.size(), size);
+	const string newData = data.substr(0, 4096);
+	archive.addFile("d.txt", newData.c_str(), newData.size());
+	BOOST_CHECK_EQUAL(archive.freeSpace().size(), data.size() - newData.size());
+
+	/*
+	 * A changed file keeps its entries.
+	 * Its previous data is not overwritten since the file would be lost if writing stopped before the tables are written.
+	 * It becomes free space afterwards.
+	 */
+	const uint32 blockIndex = archive.findFile("b.txt").block()->index();
+	const uint64 blockOffset = archive.findFile("b.txt").block()->largeOffset();
+	const string changedData(data.rbegin(), data.rend());
+	File changedFile = archive.addFile("b.txt", changedData.c_str(), changedData.size());
+	BOOST_CHECK_EQUAL(changedFile.block()->index(), blockIndex);
+	BOOST_CHECK(changedFile.block()->largeOffset() != blockOffset);
+	BOOST_CHECK_EQUAL(archive.size(), size + data.size());
+	BOOST_CHECK_EQUAL(archive.freeSpace().size(), data.size() - newData.size() + data.size());
+	BOOST_CHECK_EQUAL(boost::filesystem::file_size("freespace.mpq"), fileSize + data.size());
+	archive.close();
+
+	// the free space is determined from the tables
+	archive.open("freespace.mpq");
+	BOOST_CHECK_EQUAL(archive.freeSpace().size(), data.size() - newData.size() + data.size());
+	BOOST_CHECK(!archive.findFile("a.txt").isValid());
+
+	std::vector<std::pair<string, string> > files;
+	files.push_back(std::make_pair("b.txt", changedData));
+	files.push_back(std::make_pair("c.txt", data));
+	files.push_back(std::make_pair("d.txt", newData));
+
+	for (std::size_t i = 0; i < files.size(); ++i)
+	{
+		File file = archive.findFile(files[i].first);
+		BOOST_REQUIRE(file.isValid());
+		stringstream sstream;
+		file.decompress(sstream);
+		BOOST_CHECK(sstream.str() == files[i].second);
+	}
+
+	// the free space of the replaced file is reused and the archive does not grow
+	archive.addFile("e.txt", data.c_str(), data.size());
+	BOOST_CHECK_EQUAL(archive.freeSpace().size(), data.size() - newData.size());
+	BOOST_CHECK_EQUAL(boost::filesystem::file_size("freespace.mpq"), fileSize + data.size());
+}
+
+/*
+ * Pairs the files of two archives and decides their statuses by the cheapest check.
+ */
+BOOST_AUTO_TEST_CASE(DiffArchives)
+{
+	const string data = testData(3 * 4096 + 100);
+
+	string changedData = data;
+	changedData[5000] = '#';
+
+	ArchiveBuilder oldBuilder;
+	oldBuilder.addFile("a.txt", data.c_str(), data.size(), Sector::Compression::Deflated);
+	oldBuilder.addFile("b.txt", data.c_str(), data.size(), Sector::Compression::Deflated);
+	oldBuilder.addFile("c.txt", data.c_str(), data.size());
+	oldBuilder.addFile("d.txt", data.c_str(), data.size(), Sector::Compression::Deflated);
+	oldBuilder.addFile("units\\secret.txt", data.c_str(), data.size(), Sector::Compression::Bzip2Compressed, Block::Flags::IsEncrypted | Block::Flags::UsesEncryptionKey);
+	oldBuilder.addFile("f.txt", data.c_str(), data.size());
+	oldBuilder.write("diffold.mpq");
+
+	ArchiveBuilder newBuilder;
+	newBuilder.addFile("a.txt", data.c_str(), data.size(), Sector::Compression::Deflated);
+	newBuilder.addFile("b.txt", changedData.c_str(), changedData.size(), Sector::Compression::Deflated);
+	newBuilder.addFile("d.txt", data.c_str(), data.size(), Sector::Compression::Bzip2Compressed);
+	newBuilder.addFile("units\\secret.txt", data.c_str(), data.size(), Sector::Compression::Bzip2Compressed, Block::Flags::IsEncrypted | Block::Flags::UsesEncryptionKey);
+	newBuilder.addFile("e.txt", data.c_str(), 100);
+	newBuilder.addFile("f.txt", data.c_str(), 100);
+	newBuilder.write("diffnew.mpq");
+
+	for (int mapped = 0; mapped < 2; ++mapped)
+	{
+		Archive oldArchive;
+		oldArchive.open("diffold.mpq", mapped == 1);
+		Archive newArchive;
+		newArchive.open("diffnew.mpq", mapped == 1);
+
+		for (int useAttributes = 0; useAttributes < 2; ++useAttributes)
+		{
+			ArchiveDiff diff;
+			diff.setThreads(useAttributes == 1 ? 1 : 4);
+			diff.setUseAttributes(useAttributes == 1);
+			const ArchiveDiff::Entries entries = diff.diff(oldArchive, newArchive);
+
+			// all files with "(listfile)" and "(attributes)"
+			BOOST_REQUIRE_EQUAL(entries.size(), 9);
+			std::map<string, const ArchiveDiff::Entry*> entriesByPath;
+
+			BOOST_FOREACH(ArchiveDiff::Entries::const_reference entry, entries)
+			{
+				BOOST_REQUIRE(!entry.path.empty());
+				BOOST_REQUIRE(entry.error.empty());
+				entriesByPath[entry.path] = &entry;
+			}
+
+			BOOST_REQUIRE_EQUAL(entries.front().path, "(attributes)");
+			BOOST_CHECK(entriesByPath["a.txt"]->status == ArchiveDiff::Status::Unchanged);
+			BOOST_CHECK(entriesByPath["b.txt"]->status == ArchiveDiff::Status::Changed);
+			BOOST_CHECK(entriesByPath["c.txt"]->status == ArchiveDiff::Status::Removed);
+			BOOST_CHECK(!entriesByPath["c.txt"]->newFile.isValid());
+			BOOST_CHECK(entriesByPath["d.txt"]->status == ArchiveDiff::Status::Unchanged);
+			BOOST_CHECK(entriesByPath["e.txt"]->status == ArchiveDiff::Status::Added);
+			BOOST_CHECK(!entriesByPath["e.txt"]->oldFile.isValid());
+			BOOST_CHECK(entriesByPath["f.txt"]->status == ArchiveDiff::Status::Changed);
+			BOOST_CHECK(entriesByPath["f.txt"]->check == ArchiveDiff::Check::Size);
+			BOOST_CHECK(entriesByPath["units\\secret.txt"]->status == ArchiveDiff::Status::Unchanged);
+			BOOST_CHECK(entriesByPath["(listfile)"]->status == ArchiveDiff::Status::Changed);
+
+			if (useAttributes == 1)
+			{
+				// nothing has to be read
+				BOOST_CHECK(entriesByPath["a.txt"]->check == ArchiveDiff::Check::Md5);
+				BOOST_CHECK(entriesByPath["b.txt"]->check == ArchiveDiff::Check::Md5);
+				BOOST_CHECK(entriesByPath["d.txt"]->check == ArchiveDiff::Check::Md5);
+				BOOST_CHECK(entriesByPath["units\\secret.txt"]->check == ArchiveDiff::Check::Md5);
+			}
+			else
+			{
+				// the raw data of the first block is equal
+				BOOST_CHECK(entriesByPath["a.txt"]->check == ArchiveDiff::Check::RawData);
+				BOOST_CHECK(entriesByPath["b.txt"]->check == ArchiveDiff::Check::Content);
+				// the compression differs
+				BOOST_CHECK(entriesByPath["d.txt"]->check == ArchiveDiff::Check::Content);
+				// the encryption key depends on the offset of the block which differs
+				BOOST_CHECK(entriesByPath["units\\secret.txt"]->check == ArchiveDiff::Check::Content);
+			}
+
+			/*
+			 * The patch archive only contains the added and changed files.
+			 */
+			ArchiveBuilder patchBuilder;
+			ArchiveDiff::Entries skippedEntries;
+			BOOST_REQUIRE_EQUAL(ArchiveDiff::addPatchFiles(entries, patchBuilder, skippedEntries), 3);
+			BOOST_REQUIRE(skippedEntries.empty());
+			patchBuilder.write("diffpatch.mpq");
+
+			// files without paths cannot be added and are reported
+			ArchiveDiff::Entries unknownEntries = entries;
+
+			BOOST_FOREACH(ArchiveDiff::Entries::reference entry, unknownEntries)
+			{
+				if (entry.path == "e.txt")
+				{
+					entry.path.clear();
+				}
+			}
+
+			ArchiveBuilder unknownBuilder;
+			BOOST_CHECK_EQUAL(ArchiveDiff::addPatchFiles(unknownEntries, unknownBuilder, skippedEntries), 2);
+			BOOST_REQUIRE_EQUAL(skippedEntries.size(), 1);
+			BOOST_CHECK(skippedEntries.front().status == ArchiveDiff::Status::Added);
+
+			Archive patchArchive;
+			patchArchive.open("diffpatch.mpq");
+			BOOST_REQUIRE(!patchArchive.findFile("a.txt").isValid());
+			BOOST_REQUIRE(!patchArchive.findFile("c.txt").isValid());
+			const char *paths[] = { "b.txt", "e.txt", "f.txt" };
+
+			for (std::size_t i = 0; i < 3; ++i)
+			{
+				File file = patchArchive.findFile(paths[i]);
+				BOOST_REQUIRE(file.isValid());
+				BOOST_CHECK(file.isCompressed());
+				stringstream patchStream;
+				file.decompress(patchStream);
+				stringstream newStream;
+				newArchive.findFile(paths[i]).decompress(newStream);
+				BOOST_CHECK(patchStream.str() == newStream.str());
+			}
+
+			// a patch archive has no changes with the new archive
+			const ArchiveDiff::Entries patchEntries = diff.diff(newArchive, patchArchive);
+
+			BOOST_FOREACH(ArchiveDiff::Entries::const_reference entry, patchEntries)
+			{
+				if (entry.path == "b.txt" || entry.path == "e.txt" || entry.path == "f.txt")
+				{
+					BOOST_CHECK(entry.status == ArchiveDiff::Status::Unchanged);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Files of archives with higher priorities overlay the files of archives with lower priorities.
+ */
+BOOST_AUTO_TEST_CASE(ArchiveSetPriorities)
+{
+	const string data = testData(3 * 4096 + 100);
+
+	const char *archives[] = { "setwar3.mpq", "setwar3x.mpq", "setpatch.mpq" };
+
+	for (std::size_t i = 0; i < 3; ++i)
+	{
+		const string content = archives[i] + data;
+		ArchiveBuilder builder;
+		builder.addFile("units\\unit.txt", content.c_str(), content.size(), Sector::Compression::Deflated);
+		builder.addFile(archives[i], content.c_str(), content.size());
+
+		if (i == 1)
+		{
+			builder.addFile("units\\unit.txt", archives[i], strlen(archives[i]), Sector::Compression::Uncompressed, Block::Flags::None, File::Locale::German);
+		}
+
+		builder.write(archives[i]);
+	}
+
+	ArchiveSet set;
+	// the patch with the highest priority is added first
+	set.addArchive(archives[2], ArchiveSet::war3PatchPriority);
+	set.addArchive(archives[0], ArchiveSet::war3Priority, true);
+	set.addArchive(archives[1], ArchiveSet::war3XPriority);
+	BOOST_REQUIRE_EQUAL(set.sources().size(), 3);
+	BOOST_REQUIRE_EQUAL(set.sources().front().priority, ArchiveSet::war3Priority);
+
+	File file = set.findFile("units\\unit.txt");
+	BOOST_REQUIRE(file.isValid());
+	BOOST_CHECK_EQUAL(file.archive()->path().filename(), archives[2]);
+	BOOST_CHECK(set.findFile(HashData("units\\unit.txt")).archive() == file.archive());
+
+	// files which exist in one archive only
+	for (std::size_t i = 0; i < 3; ++i)
+	{
+		BOOST_CHECK_EQUAL(set.findFile(archives[i]).archive()->path().filename(), archives[i]);
+	}
+
+	BOOST_CHECK_EQUAL(set.findFile("units\\unit.txt", File::Locale::German).archive()->path().filename(), archives[1]);
+	BOOST_CHECK(!set.findFile("missing.txt").isValid());
+	BOOST_CHECK(set.openFile("missing.txt").get() == nullptr);
+
+	std::unique_ptr<FileInputStream> stream = set.openFile("units\\unit.txt");
+	BOOST_REQUIRE(stream.get() != nullptr);
+	const string content((std::istreambuf_iterator<char>(*stream)), std::istreambuf_iterator<char>());
+	BOOST_CHECK(content == archives[2] + data);
+
+	// the next archive is used after removing the patch
+	BOOST_REQUIRE(set.removeArchive(archives[2]));
+	BOOST_REQUIRE(!set.removeArchive(archives[2]));
+	BOOST_CHECK_EQUAL(set.findFile("units\\unit.txt").archive()->path().filename(), archives[1]);
+	BOOST_CHECK(!set.findFile(archives[2]).isValid());
+
+	// archives with equal priorities which are added later are preferred
+	set.addArchive(archives[2], ArchiveSet::war3XPriority);
+	BOOST_CHECK_EQUAL(set.findFile("units\\unit.txt").archive()->path().filename(), archives[2]);
+
+	set.clear();
+	BOOST_CHECK(!set.findFile("units\\unit.txt").isValid());
+	BOOST_CHECK_THROW(set.addArchive("missing.mpq"), Exception);
+	BOOST_CHECK(set.sources().empty());
+}
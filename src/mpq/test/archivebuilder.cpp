@@ -0,0 +1,325 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#define BOOST_TEST_MODULE ArchiveBuilderTest
+#include <boost/test/unit_test.hpp>
+#include <iostream>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "../archivebuilder.hpp"
+#include "../archive.hpp"
+#include "../attributes.hpp"
+#include "testdata.hpp"
+
+#ifndef BOOST_TEST_DYN_LINK
+#error Define BOOST_TEST_DYN_LINK for proper definition of main function.
+#endif
+
+using namespace wc3lib;
+using namespace wc3lib::mpq;
+using namespace wc3lib::mpq::test;
+
+namespace
+{
+
+struct TestFile
+{
+	string path;
+	string data;
+	Sector::Compression compression;
+	Block::Flags flags;
+};
+
+std::vector<TestFile> testFiles(uint32 sectorSize)
+{
+	static const Sector::Compression compressions[] =
+	{
+		Sector::Compression::Uncompressed,
+		Sector::Compression::Deflated,
+		Sector::Compression::Bzip2Compressed
+	};
+	static const Block::Flags flags[] =
+	{
+		Block::Flags::None,
+		Block::Flags::IsEncrypted,
+		Block::Flags::IsEncrypted | Block::Flags::UsesEncryptionKey
+	};
+
+	std::vector<TestFile> result;
+
+	for (std::size_t i = 0; i < 300; ++i)
+	{
+		TestFile file;
+		file.path = (boost::format("Units\\Directory%1%\\file%2%.txt") % (i % 10) % i).str();
+		// empty files, files with a single sector and files with many sectors
+		file.data = testData((i * 997) % (5 * sectorSize + 17), i);
+		file.compression = compressions[i % 3];
+		file.flags = flags[(i / 3) % 3];
+		result.push_back(file);
+	}
+
+	return result;
+}
+
+void requireFiles(Archive &archive, const std::vector<TestFile> &files)
+{
+	BOOST_FOREACH(const TestFile &testFile, files)
+	{
+		File file = archive.findFile(testFile.path);
+
+		BOOST_REQUIRE(file.isValid());
+		BOOST_REQUIRE_EQUAL(file.size(), testFile.data.size());
+
+		stringstream sstream;
+		file.decompress(sstream);
+		BOOST_REQUIRE(sstream.str() == testFile.data);
+	}
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(BuildArchive)
+{
+	ArchiveBuilder builder(Archive::Format::Mpq1, 4096);
+	const std::vector<TestFile> files = testFiles(builder.sectorSize());
+
+	BOOST_FOREACH(const TestFile &testFile, files)
+	{
+		builder.addFile(testFile.path, testFile.data.c_str(), testFile.data.size(), testFile.compression, testFile.flags);
+	}
+
+	const std::streamsize size = builder.write("builder.mpq");
+	BOOST_REQUIRE_EQUAL(size, boost::filesystem::file_size("builder.mpq"));
+
+	// read the archive from the file as well as from the memory mapped file
+	for (int mapped = 0; mapped < 2; ++mapped)
+	{
+		Archive archive;
+		archive.open("builder.mpq", mapped == 1);
+
+		BOOST_REQUIRE(archive.isOpen());
+		BOOST_REQUIRE_EQUAL(archive.sectorSize(), 4096);
+		BOOST_REQUIRE_EQUAL(archive.blocks().size(), files.size() + 2);
+		BOOST_REQUIRE_EQUAL(archive.hashTable().size(), ArchiveBuilder::hashTableEntries(files.size() + 2));
+
+		requireFiles(archive, files);
+
+		BOOST_REQUIRE(archive.containsListfileFile());
+		Listfile::Entries entries = archive.listfileFile().entries();
+		BOOST_REQUIRE_EQUAL(entries.size(), files.size());
+		BOOST_REQUIRE_EQUAL(entries.front(), files.front().path);
+
+		BOOST_REQUIRE(archive.containsAttributesFile());
+		int32 version = 0;
+		Attributes::ExtendedAttributes extendedAttributes = Attributes::ExtendedAttributes::None;
+		Attributes::Crc32s crcs;
+		Attributes::FileTimes fileTimes;
+		Attributes::Md5s md5s;
+		archive.attributesFile().attributes(version, extendedAttributes, crcs, fileTimes, md5s);
+		BOOST_REQUIRE_EQUAL(version, Attributes::latestVersion);
+		BOOST_REQUIRE(extendedAttributes & Attributes::ExtendedAttributes::FileCrc32s);
+		BOOST_REQUIRE(extendedAttributes & Attributes::ExtendedAttributes::FileMd5s);
+		BOOST_REQUIRE_EQUAL(crcs.size(), archive.blocks().size());
+
+		File file = archive.findFile(files[42].path);
+		BOOST_REQUIRE_EQUAL(crcs[file.block()->index()], Attributes::crc32(files[42].data.c_str(), files[42].data.size()));
+		BOOST_REQUIRE(md5s[file.block()->index()] == Attributes::md5(files[42].data.c_str(), files[42].data.size()));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(BuildArchiveDeterministic)
+{
+	const std::vector<TestFile> files = testFiles(4096);
+	std::vector<string> contents;
+
+	for (unsigned threads = 1; threads <= 4; threads += 3)
+	{
+		ArchiveBuilder builder;
+		builder.setThreads(threads);
+
+		BOOST_FOREACH(const TestFile &testFile, files)
+		{
+			builder.addFile(testFile.path, testFile.data.c_str(), testFile.data.size(), testFile.compression, testFile.flags);
+		}
+
+		builder.write("builderdeterministic.mpq");
+
+		ifstream in("builderdeterministic.mpq", std::ios::in | std::ios::binary);
+		contents.push_back(string((std::istreambuf_iterator<byte>(in)), std::istreambuf_iterator<byte>()));
+	}
+
+	BOOST_REQUIRE(!contents[0].empty());
+	BOOST_REQUIRE(contents[0] == contents[1]);
+}
+
+BOOST_AUTO_TEST_CASE(BuildArchiveWithFreeEntries)
+{
+	ArchiveBuilder builder;
+	builder.setHashTableEntries(64);
+	builder.setBlockTableEntries(32);
+	builder.setListfile(false);
+	builder.setAttributes(false);
+
+	const string data = testData(10000, 3);
+	builder.addFile("war3map.j", data.c_str(), data.size(), Sector::Compression::Deflated);
+	builder.write("builderfree.mpq");
+
+	Archive archive;
+	archive.open("builderfree.mpq");
+
+	BOOST_REQUIRE(archive.isOpen());
+	BOOST_REQUIRE_EQUAL(archive.hashTable().size(), 64);
+	BOOST_REQUIRE_EQUAL(archive.blocks().size(), 32);
+	BOOST_REQUIRE(!archive.containsListfileFile());
+
+	// the free entries can be used for adding further files
+	const string newData = "Added later";
+	BOOST_REQUIRE(archive.addFile("added.txt", newData.c_str(), newData.size()).isValid());
+
+	stringstream sstream;
+	archive.findFile("war3map.j").decompress(sstream);
+	BOOST_REQUIRE(sstream.str() == data);
+
+	sstream.str("");
+	archive.findFile("added.txt").decompress(sstream);
+	BOOST_REQUIRE(sstream.str() == newData);
+}
+
+BOOST_AUTO_TEST_CASE(BuildArchiveHashTablePowerOfTwo)
+{
+	ArchiveBuilder builder;
+	builder.setHashTableEntries(1000);
+
+	const string data = testData(1000, 4);
+	builder.addFile("war3map.j", data.c_str(), data.size(), Sector::Compression::Deflated);
+	builder.write("builderpoweroftwo.mpq");
+
+	Archive archive;
+	archive.open("builderpoweroftwo.mpq");
+
+	// the game masks the hash values with the size of the table
+	BOOST_REQUIRE_EQUAL(archive.hashTable().size(), 1024);
+	BOOST_REQUIRE(archive.findFile("war3map.j").isValid());
+}
+
+BOOST_AUTO_TEST_CASE(BuildArchiveFormat2)
+{
+	ArchiveBuilder builder(Archive::Format::Mpq2, 8192);
+	const std::vector<TestFile> files = testFiles(builder.sectorSize());
+
+	BOOST_FOREACH(const TestFile &testFile, files)
+	{
+		builder.addFile(testFile.path, testFile.data.c_str(), testFile.data.size(), testFile.compression, testFile.flags);
+	}
+
+	builder.write("builderformat2.mpq");
+
+	Archive archive;
+	archive.open("builderformat2.mpq");
+
+	BOOST_REQUIRE(archive.isOpen());
+	BOOST_REQUIRE(archive.format() == Archive::Format::Mpq2);
+	BOOST_REQUIRE_EQUAL(archive.sectorSize(), 8192);
+
+	requireFiles(archive, files);
+}
+
+BOOST_AUTO_TEST_CASE(BuildArchiveFormat3And4)
+{
+	const Archive::Format formats[] = { Archive::Format::Mpq3, Archive::Format::Mpq4 };
+
+	BOOST_FOREACH(Archive::Format format, formats)
+	{
+		ArchiveBuilder builder(format, 4096);
+		const std::vector<TestFile> files = testFiles(builder.sectorSize());
+
+		BOOST_FOREACH(const TestFile &testFile, files)
+		{
+			builder.addFile(testFile.path, testFile.data.c_str(), testFile.data.size(), testFile.compression, testFile.flags);
+		}
+
+		const std::streamsize size = builder.write("builderformat34.mpq");
+		BOOST_REQUIRE_EQUAL(size, boost::filesystem::file_size("builderformat34.mpq"));
+
+		Archive archive;
+		archive.open("builderformat34.mpq");
+
+		BOOST_REQUIRE(archive.isOpen());
+		BOOST_REQUIRE(archive.format() == format);
+		BOOST_REQUIRE(archive.hetTable() != 0);
+		BOOST_REQUIRE(archive.betTable() != 0);
+		BOOST_REQUIRE_EQUAL(archive.hetTable()->entryCount(), files.size() + 2);
+		BOOST_REQUIRE_EQUAL(archive.betTable()->entryCount(), archive.blocks().size());
+
+		requireFiles(archive, files);
+
+		// archives of these formats can only be read
+		BOOST_REQUIRE_THROW(archive.removeFile(archive.findFile(files.front().path)), Exception);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(ReadArchiveWithHetAndBetTableOnly)
+{
+	ArchiveBuilder builder(Archive::Format::Mpq3, 4096);
+	const std::vector<TestFile> files = testFiles(builder.sectorSize());
+
+	BOOST_FOREACH(const TestFile &testFile, files)
+	{
+		builder.addFile(testFile.path, testFile.data.c_str(), testFile.data.size(), testFile.compression, testFile.flags);
+	}
+
+	builder.write("builderhetbet.mpq");
+
+	/*
+	 * Clear the number of entries of the classic hash and block tables that only the HET and BET tables can be used.
+	 */
+	{
+		boost::filesystem::fstream fstream("builderhetbet.mpq", std::ios::in | std::ios::out | std::ios::binary);
+		const uint32 zero = 0;
+		fstream.seekp(24);
+		fstream.write(reinterpret_cast<const char*>(&zero), sizeof(zero));
+		fstream.write(reinterpret_cast<const char*>(&zero), sizeof(zero));
+	}
+
+	for (int mapped = 0; mapped < 2; ++mapped)
+	{
+		Archive archive;
+		archive.open("builderhetbet.mpq", mapped == 1);
+
+		BOOST_REQUIRE(archive.isOpen());
+		BOOST_REQUIRE_EQUAL(archive.blocks().size(), archive.betTable()->entryCount());
+		BOOST_REQUIRE_EQUAL(archive.hashes().size(), archive.hetTable()->totalCount());
+
+		requireFiles(archive, files);
+		BOOST_REQUIRE(!archive.findFile("missing.txt").isValid());
+	}
+}
+
+BOOST_AUTO_TEST_CASE(BuildArchiveDuplicate)
+{
+	ArchiveBuilder builder;
+	const string data = "Data";
+	builder.addFile("Units\\test.txt", data.c_str(), data.size());
+	builder.addFile("units/TEST.txt", data.c_str(), data.size());
+
+	BOOST_REQUIRE_THROW(builder.write("builderduplicate.mpq"), Exception);
+}
@@ -0,0 +1,507 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/*
+ * Self-contained benchmark of the MPQ module which does neither require StormLib nor an installation of Warcraft III.
+ *
+ * It generates a synthetic archive of a configurable size, number of files, sector size and mix of compressions using \ref wc3lib::mpq::ArchiveBuilder
+ * and measures the time of opening the archive, looking up files, extracting all files as well as adding and removing files.
+ * The results are written as JSON object that they can be compared automatically between different builds.
+ *
+ * Example:
+ * mpqbenchmark --files 10000 --size 268435456 --compression deflated,bzip2,uncompressed --output results.json
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/foreach.hpp>
+#include <boost/format.hpp>
+#include <boost/iostreams/device/null.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+
+#include "../archive.hpp"
+#include "../archivebuilder.hpp"
+
+using namespace wc3lib;
+using namespace wc3lib::mpq;
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds(const Clock::duration &duration)
+{
+	return std::chrono::duration_cast<std::chrono::duration<double> >(duration).count();
+}
+
+/*
+ * The result of one measurement with the number of operations, the processed bytes and the elapsed time.
+ */
+struct Measurement
+{
+	std::string name;
+	uint64 operations;
+	uint64 bytes;
+	double seconds;
+};
+
+typedef std::vector<Measurement> Measurements;
+
+void measure(Measurements &measurements, const std::string &name, uint64 operations, uint64 bytes, const Clock::duration &duration)
+{
+	Measurement measurement;
+	measurement.name = name;
+	measurement.operations = operations;
+	measurement.bytes = bytes;
+	measurement.seconds = seconds(duration);
+	measurements.push_back(measurement);
+}
+
+/*
+ * Writes the parameters and results as JSON object.
+ * All names are plain identifiers which do not have to be escaped.
+ */
+void writeJson(std::ostream &ostream, const std::vector<std::pair<std::string, std::string> > &parameters, const Measurements &measurements)
+{
+	ostream << "{\n\t\"parameters\": {";
+
+	for (std::size_t i = 0; i < parameters.size(); ++i)
+	{
+		ostream << (i > 0 ? "," : "") << boost::format("\n\t\t\"%1%\": %2%") % parameters[i].first % parameters[i].second;
+	}
+
+	ostream << "\n\t},\n\t\"results\": {";
+
+	for (std::size_t i = 0; i < measurements.size(); ++i)
+	{
+		const Measurement &measurement = measurements[i];
+		const double operationsPerSecond = measurement.seconds > 0.0 ? double(measurement.operations) / measurement.seconds : 0.0;
+		const double bytesPerSecond = measurement.seconds > 0.0 ? double(measurement.bytes) / measurement.seconds : 0.0;
+
+		ostream << (i > 0 ? "," : "")
+		<< boost::format("\n\t\t\"%1%\": { \"operations\": %2%, \"bytes\": %3%, \"seconds\": %4$.6f, \"operationsPerSecond\": %5$.1f, \"bytesPerSecond\": %6$.1f }")
+		% measurement.name % measurement.operations % measurement.bytes % measurement.seconds % operationsPerSecond % bytesPerSecond;
+	}
+
+	ostream << "\n\t}\n}" << std::endl;
+}
+
+Sector::Compression compressionFromString(const std::string &value)
+{
+	if (value == "uncompressed" || value == "none")
+	{
+		return Sector::Compression::Uncompressed;
+	}
+	else if (value == "deflated" || value == "zlib")
+	{
+		return Sector::Compression::Deflated;
+	}
+	else if (value == "bzip2")
+	{
+		return Sector::Compression::Bzip2Compressed;
+	}
+	else if (value == "imploded" || value == "pkware")
+	{
+		return Sector::Compression::Imploded;
+	}
+	else if (value == "huffman")
+	{
+		return Sector::Compression::Huffman;
+	}
+	else if (value == "sparse")
+	{
+		return Sector::Compression::Sparse;
+	}
+	else if (value == "lzma")
+	{
+		return Sector::Compression::Lzma;
+	}
+
+	throw std::invalid_argument((boost::format("Unknown compression \"%1%\".") % value).str());
+}
+
+Archive::Format formatFromNumber(unsigned value)
+{
+	switch (value)
+	{
+		case 1:
+			return Archive::Format::Mpq1;
+
+		case 2:
+			return Archive::Format::Mpq2;
+
+		case 3:
+			return Archive::Format::Mpq3;
+
+		case 4:
+			return Archive::Format::Mpq4;
+	}
+
+	throw std::invalid_argument((boost::format("Unknown format %1%.") % value).str());
+}
+
+/*
+ * Generates file data which consists of words like text files and of random bytes which cannot be compressed.
+ * \p randomRatio is the ratio of random bytes.
+ */
+void generateData(std::mt19937 &generator, std::size_t size, double randomRatio, std::vector<byte> &data)
+{
+	static const char *words[] =
+	{
+		"Footman", "Peasant", "Grunt", "Peon", "Acolyte", "Wisp", "Ghoul", "Archer", "Knight", "Tauren",
+		"Abilities", "Buffs", "Upgrades", "Units", "Doodads", "Destructables", "Art", "Sound", "ReplaceableTextures", "\r\n"
+	};
+	const std::size_t wordsCount = sizeof(words) / sizeof(const char*);
+	const std::size_t randomSize = static_cast<std::size_t>(double(size) * randomRatio);
+	std::uniform_int_distribution<std::size_t> wordDistribution(0, wordsCount - 1);
+	std::uniform_int_distribution<int> byteDistribution(0, 255);
+
+	data.clear();
+	data.reserve(size);
+
+	while (data.size() < size - randomSize)
+	{
+		const char *word = words[wordDistribution(generator)];
+
+		for (; *word != '\0' && data.size() < size - randomSize; ++word)
+		{
+			data.push_back(*word);
+		}
+
+		if (data.size() < size - randomSize)
+		{
+			data.push_back(' ');
+		}
+	}
+
+	while (data.size() < size)
+	{
+		data.push_back(static_cast<byte>(byteDistribution(generator)));
+	}
+}
+
+std::string filePath(std::size_t index)
+{
+	return (boost::format("Benchmark\\Directory%1%\\File%2%.txt") % (index % 64) % index).str();
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	std::size_t files = 0;
+	uint64 size = 0;
+	uint32 sectorSize = 0;
+	unsigned format = 0;
+	std::string compressions;
+	double randomRatio = 0.0;
+	unsigned seed = 0;
+	unsigned threads = 0;
+	std::size_t openRuns = 0;
+	std::size_t lookupRuns = 0;
+	std::size_t addFiles = 0;
+	boost::filesystem::path archivePath;
+	boost::filesystem::path outputPath;
+
+	boost::program_options::options_description desc("Allowed options");
+	desc.add_options()
+	("help,h", "Shows this text.")
+	("files", boost::program_options::value<std::size_t>(&files)->default_value(1000), "Number of files in the generated archive.")
+	("size", boost::program_options::value<uint64>(&size)->default_value(16 * 1024 * 1024), "Total uncompressed size of all files in bytes. The sizes of single files vary.")
+	("sectorsize", boost::program_options::value<uint32>(&sectorSize)->default_value(4096), "Sector size of the generated archive in bytes.")
+	("format", boost::program_options::value<unsigned>(&format)->default_value(1), "Format of the generated archive: <1|2|3|4>.")
+	("compression", boost::program_options::value<std::string>(&compressions)->default_value("deflated,bzip2,imploded,uncompressed"), "Comma separated list of compressions which are assigned to the files in turn: <uncompressed|deflated|bzip2|imploded|huffman|sparse|lzma>.")
+	("random", boost::program_options::value<double>(&randomRatio)->default_value(0.25), "Ratio of random bytes in the file data which cannot be compressed: <0-1>.")
+	("seed", boost::program_options::value<unsigned>(&seed)->default_value(0), "Seed of the generated data.")
+	("jobs,j", boost::program_options::value<unsigned>(&threads)->default_value(0), "Number of threads used for creating the archive. 0 uses all available cores.")
+	("open-runs", boost::program_options::value<std::size_t>(&openRuns)->default_value(20), "Number of times the archive is opened.")
+	("lookup-runs", boost::program_options::value<std::size_t>(&lookupRuns)->default_value(10), "Number of times all files are looked up.")
+	("add-files", boost::program_options::value<std::size_t>(&addFiles)->default_value(100), "Number of files which are added to and removed from the archive. Only archives of the formats 1 and 2 can be modified.")
+	("archive", boost::program_options::value<boost::filesystem::path>(&archivePath)->default_value("benchmark.mpq"), "Path of the generated archive which is overwritten.")
+	("output,o", boost::program_options::value<boost::filesystem::path>(&outputPath), "Path of the JSON file with the results. If not specified the results are written to the standard output.")
+	;
+
+	boost::program_options::variables_map vm;
+
+	try
+	{
+		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+		boost::program_options::notify(vm);
+
+		// more random bytes than the file size would underflow in generateData()
+		if (!(randomRatio >= 0.0 && randomRatio <= 1.0))
+		{
+			throw std::invalid_argument((boost::format("Ratio of random bytes %1% is not between 0 and 1.") % randomRatio).str());
+		}
+	}
+	catch (std::exception &exception)
+	{
+		std::cerr << boost::format("Error while parsing program options: \"%1%\"") % exception.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	if (vm.count("help"))
+	{
+		std::cout << desc << std::endl;
+
+		return EXIT_SUCCESS;
+	}
+
+	try
+	{
+		std::vector<std::string> compressionStrings;
+		boost::algorithm::split(compressionStrings, compressions, boost::algorithm::is_any_of(","), boost::algorithm::token_compress_on);
+		std::vector<Sector::Compression> compressionMix;
+		std::string compressionArray;
+
+		BOOST_FOREACH(const std::string &compression, compressionStrings)
+		{
+			compressionMix.push_back(compressionFromString(compression));
+			compressionArray += (compressionArray.empty() ? "\"" : ", \"") + compression + "\"";
+		}
+
+		if (files == 0 || compressionMix.empty())
+		{
+			throw std::invalid_argument("At least one file and one compression are required.");
+		}
+
+		/*
+		 * Generate the file sizes which vary between a half and one and a half times the average size.
+		 */
+		std::mt19937 generator(seed);
+		std::uniform_real_distribution<double> sizeDistribution(0.5, 1.5);
+		std::vector<uint64> sizes(files);
+		std::vector<double> factors(files);
+		double factorsSum = 0.0;
+
+		for (std::size_t i = 0; i < files; ++i)
+		{
+			factors[i] = sizeDistribution(generator);
+			factorsSum += factors[i];
+		}
+
+		for (std::size_t i = 0; i < files; ++i)
+		{
+			sizes[i] = std::max<uint64>(1, static_cast<uint64>(double(size) * factors[i] / factorsSum));
+		}
+
+		/*
+		 * Build the archive.
+		 * The hash and block tables leave space for the files which are added later.
+		 */
+		ArchiveBuilder builder(formatFromNumber(format), sectorSize);
+		builder.setThreads(threads);
+		builder.setHashTableEntries(ArchiveBuilder::hashTableEntries(boost::numeric_cast<uint32>(files + addFiles + 2)));
+		builder.setBlockTableEntries(boost::numeric_cast<uint32>(files + addFiles + 2));
+		std::vector<byte> data;
+		uint64 totalSize = 0;
+
+		for (std::size_t i = 0; i < files; ++i)
+		{
+			generateData(generator, sizes[i], randomRatio, data);
+			const Sector::Compression compression = compressionMix[i % compressionMix.size()];
+			builder.addFile(filePath(i), data.data(), data.size(), compression);
+			totalSize += data.size();
+		}
+
+		Clock::time_point now = Clock::now();
+		const std::streamsize archiveSize = builder.write(archivePath);
+		const Clock::duration buildDuration = Clock::now() - now;
+		builder.clear();
+
+		Measurements results;
+		measure(results, "build", files, totalSize, buildDuration);
+
+		/*
+		 * Open the archive several times. The tables are read and decrypted every time.
+		 */
+		now = Clock::now();
+
+		for (std::size_t i = 0; i < openRuns; ++i)
+		{
+			Archive archive;
+			archive.open(archivePath);
+		}
+
+		measure(results, "open", openRuns, uint64(archiveSize) * openRuns, Clock::now() - now);
+
+		Archive archive;
+		archive.open(archivePath);
+
+		/*
+		 * Look up all existing files and the same number of missing files.
+		 */
+		std::vector<std::string> paths(files);
+		std::vector<std::string> missingPaths(files);
+
+		for (std::size_t i = 0; i < files; ++i)
+		{
+			paths[i] = filePath(i);
+			missingPaths[i] = filePath(files + i);
+		}
+
+		std::size_t found = 0;
+		now = Clock::now();
+
+		for (std::size_t run = 0; run < lookupRuns; ++run)
+		{
+			BOOST_FOREACH(const std::string &path, paths)
+			{
+				if (archive.findHash(path) != 0)
+				{
+					++found;
+				}
+			}
+		}
+
+		measure(results, "lookup", lookupRuns * files, 0, Clock::now() - now);
+
+		if (found != lookupRuns * files)
+		{
+			throw std::runtime_error("Not all files have been found.");
+		}
+
+		now = Clock::now();
+
+		for (std::size_t run = 0; run < lookupRuns; ++run)
+		{
+			BOOST_FOREACH(const std::string &path, missingPaths)
+			{
+				if (archive.findHash(path) != 0)
+				{
+					++found;
+				}
+			}
+		}
+
+		measure(results, "lookupMissing", lookupRuns * files, 0, Clock::now() - now);
+
+		if (found != lookupRuns * files)
+		{
+			throw std::runtime_error("Missing files have been found.");
+		}
+
+		/*
+		 * Extract all files into a null device that only the reading and decompression is measured.
+		 */
+		boost::iostreams::stream<boost::iostreams::null_sink> nullStream((boost::iostreams::null_sink()));
+		uint64 extractedSize = 0;
+		now = Clock::now();
+
+		BOOST_FOREACH(const std::string &path, paths)
+		{
+			File file = archive.findFile(path);
+			file.decompress(nullStream);
+			extractedSize += file.size();
+		}
+
+		measure(results, "extract", files, extractedSize, Clock::now() - now);
+
+		{
+			Archive mappedArchive;
+			mappedArchive.open(archivePath, true);
+			extractedSize = 0;
+			now = Clock::now();
+
+			BOOST_FOREACH(const std::string &path, paths)
+			{
+				File file = mappedArchive.findFile(path);
+				file.decompress(nullStream);
+				extractedSize += file.size();
+			}
+
+			measure(results, "extractMapped", files, extractedSize, Clock::now() - now);
+		}
+
+		/*
+		 * Add and remove files of the average size.
+		 * Every call rewrites the tables of the archive.
+		 * Archives of the formats 3 and 4 cannot be modified.
+		 */
+		if (archive.format() == Archive::Format::Mpq1 || archive.format() == Archive::Format::Mpq2)
+		{
+			generateData(generator, boost::numeric_cast<std::size_t>(std::max<uint64>(1, totalSize / files)), randomRatio, data);
+			now = Clock::now();
+
+			for (std::size_t i = 0; i < addFiles; ++i)
+			{
+				archive.addFile(missingPaths[i % files] + boost::lexical_cast<std::string>(i), data.data(), data.size(), compressionMix[i % compressionMix.size()]);
+			}
+
+			measure(results, "add", addFiles, uint64(data.size()) * addFiles, Clock::now() - now);
+			now = Clock::now();
+
+			for (std::size_t i = 0; i < addFiles; ++i)
+			{
+				archive.removeFile(archive.findFile(missingPaths[i % files] + boost::lexical_cast<std::string>(i)));
+			}
+
+			measure(results, "remove", addFiles, 0, Clock::now() - now);
+		}
+
+		archive.close();
+
+		std::vector<std::pair<std::string, std::string> > parameters;
+		parameters.push_back(std::make_pair("files", boost::lexical_cast<std::string>(files)));
+		parameters.push_back(std::make_pair("size", boost::lexical_cast<std::string>(totalSize)));
+		parameters.push_back(std::make_pair("sectorSize", boost::lexical_cast<std::string>(sectorSize)));
+		parameters.push_back(std::make_pair("format", boost::lexical_cast<std::string>(format)));
+		parameters.push_back(std::make_pair("compression", "[" + compressionArray + "]"));
+		parameters.push_back(std::make_pair("random", boost::lexical_cast<std::string>(randomRatio)));
+		parameters.push_back(std::make_pair("seed", boost::lexical_cast<std::string>(seed)));
+		parameters.push_back(std::make_pair("archiveSize", boost::lexical_cast<std::string>(archiveSize)));
+
+		if (outputPath.empty())
+		{
+			writeJson(std::cout, parameters, results);
+		}
+		else
+		{
+			std::ofstream output(outputPath.string().c_str());
+			writeJson(output, parameters, results);
+
+			if (!output)
+			{
+				throw std::runtime_error((boost::format("Error on writing %1%.") % outputPath).str());
+			}
+		}
+	}
+	catch (std::exception &exception)
+	{
+		std::cerr << boost::format("Error while running the benchmark: \"%1%\"") % exception.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,1180 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#define BOOST_TEST_MODULE CompressionTest
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/format.hpp>
+
+#include "../algorithm.hpp"
+#include "../archive.hpp"
+#include "../archivebuilder.hpp"
+#include "../compressionselection.hpp"
+#include "../huffmandecoder.hpp"
+#include "../imaadpcm.hpp"
+#include "../pklibdecoder.hpp"
+#include "../sector.hpp"
+#include "testdata.hpp"
+
+#ifndef BOOST_TEST_DYN_LINK
+#error Define BOOST_TEST_DYN_LINK for proper definition of main function.
+#endif
+
+using namespace wc3lib;
+using namespace wc3lib::mpq;
+using namespace wc3lib::mpq::test;
+
+namespace
+{
+
+/*
+ * Compresses the data with the codec and decompresses it again.
+ */
+string roundTrip(const Codec *codec, const string &data)
+{
+	std::vector<byte> compressed(data.size() * 2 + 1024);
+	uint32 compressedSize = boost::numeric_cast<uint32>(compressed.size());
+	BOOST_REQUIRE(codec->compress(data.data(), boost::numeric_cast<uint32>(data.size()), compressed.data(), compressedSize, Sector::defaultWaveCompressionLevel));
+
+	std::vector<byte> decompressed(data.size());
+	uint32 decompressedSize = boost::numeric_cast<uint32>(decompressed.size());
+	BOOST_REQUIRE(codec->decompress(compressed.data(), compressedSize, decompressed.data(), decompressedSize));
+
+	return string(decompressed.data(), decompressedSize);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(CodecsRoundTrip)
+{
+	const string data = testData(4096);
+	const Sector::Compression compressions[] =
+	{
+		Sector::Compression::Deflated,
+		Sector::Compression::Bzip2Compressed,
+		Sector::Compression::Imploded,
+		Sector::Compression::Huffman
+	};
+
+	BOOST_FOREACH(Sector::Compression compression, compressions)
+	{
+		const Codec *codec = Sector::codec(compression);
+		BOOST_REQUIRE(codec != 0);
+		BOOST_REQUIRE(roundTrip(codec, data) == data);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(CodecsEqualStreams)
+{
+	const string data = testData(4096);
+	std::vector<byte> compressed(data.size() * 2 + 1024);
+
+	/*
+	 * The codecs have to produce the same data as the Boost streams that archives stay the same.
+	 */
+	uint32 compressedSize = boost::numeric_cast<uint32>(compressed.size());
+	BOOST_REQUIRE(Sector::codec(Sector::Compression::Deflated)->compress(data.data(), boost::numeric_cast<uint32>(data.size()), compressed.data(), compressedSize, Sector::defaultCompressionLevel));
+	iarraystream zlibInput(data.data(), data.size());
+	stringstream zlibOutput;
+	compressZlib(zlibInput, zlibOutput);
+	BOOST_REQUIRE(zlibOutput.str() == string(compressed.data(), compressedSize));
+
+	compressedSize = boost::numeric_cast<uint32>(compressed.size());
+	BOOST_REQUIRE(Sector::codec(Sector::Compression::Bzip2Compressed)->compress(data.data(), boost::numeric_cast<uint32>(data.size()), compressed.data(), compressedSize, Sector::defaultCompressionLevel));
+	iarraystream bzip2Input(data.data(), data.size());
+	stringstream bzip2Output;
+	compressBzip2(bzip2Input, bzip2Output);
+	BOOST_REQUIRE(bzip2Output.str() == string(compressed.data(), compressedSize));
+}
+
+BOOST_AUTO_TEST_CASE(CodecsOutputTooSmall)
+{
+	const string data = testData(4096);
+	const Sector::Compression compressions[] =
+	{
+		Sector::Compression::Deflated,
+		Sector::Compression::Bzip2Compressed
+	};
+
+	BOOST_FOREACH(Sector::Compression compression, compressions)
+	{
+		const Codec *codec = Sector::codec(compression);
+		std::vector<byte> compressed(data.size() * 2 + 1024);
+		uint32 compressedSize = 8;
+		BOOST_REQUIRE(!codec->compress(data.data(), boost::numeric_cast<uint32>(data.size()), compressed.data(), compressedSize, Sector::defaultCompressionLevel));
+
+		compressedSize = boost::numeric_cast<uint32>(compressed.size());
+		BOOST_REQUIRE(codec->compress(data.data(), boost::numeric_cast<uint32>(data.size()), compressed.data(), compressedSize, Sector::defaultCompressionLevel));
+		std::vector<byte> decompressed(data.size());
+		uint32 decompressedSize = boost::numeric_cast<uint32>(data.size() / 2);
+		BOOST_REQUIRE(!codec->decompress(compressed.data(), compressedSize, decompressed.data(), decompressedSize));
+
+		// corrupted header
+		compressed[0] = ~compressed[0];
+		decompressedSize = boost::numeric_cast<uint32>(decompressed.size());
+		BOOST_REQUIRE_THROW(codec->decompress(compressed.data(), compressedSize, decompressed.data(), decompressedSize), Exception);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(CodecsCompressionLevels)
+{
+	const string data = testData(4096 * 4);
+	std::vector<byte> compressed(data.size() * 2 + 1024);
+	const Sector::Compression compressions[] =
+	{
+		Sector::Compression::Deflated,
+		Sector::Compression::Bzip2Compressed
+	};
+
+	BOOST_FOREACH(Sector::Compression compression, compressions)
+	{
+		const Codec *codec = Sector::codec(compression);
+		uint32 fastSize = boost::numeric_cast<uint32>(compressed.size());
+		BOOST_REQUIRE(codec->compress(data.data(), boost::numeric_cast<uint32>(data.size()), compressed.data(), fastSize, 1));
+		uint32 bestSize = boost::numeric_cast<uint32>(compressed.size());
+		BOOST_REQUIRE(codec->compress(data.data(), boost::numeric_cast<uint32>(data.size()), compressed.data(), bestSize, 9));
+		BOOST_CHECK(bestSize <= fastSize);
+
+		std::vector<byte> decompressed(data.size());
+		uint32 decompressedSize = boost::numeric_cast<uint32>(decompressed.size());
+		BOOST_REQUIRE(codec->decompress(compressed.data(), bestSize, decompressed.data(), decompressedSize));
+		BOOST_CHECK(string(decompressed.data(), decompressedSize) == data);
+	}
+
+	// zlib stores the data with level 0
+	uint32 storedSize = boost::numeric_cast<uint32>(compressed.size());
+	BOOST_REQUIRE(Sector::codec(Sector::Compression::Deflated)->compress(data.data(), boost::numeric_cast<uint32>(data.size()), compressed.data(), storedSize, 0));
+	BOOST_CHECK(storedSize > data.size());
+
+	// changing the level of the stream of the thread does not change the output of the default level
+	uint32 defaultSize = boost::numeric_cast<uint32>(compressed.size());
+	BOOST_REQUIRE(Sector::codec(Sector::Compression::Deflated)->compress(data.data(), boost::numeric_cast<uint32>(data.size()), compressed.data(), defaultSize, Sector::defaultCompressionLevel));
+	iarraystream zlibInput(data.data(), data.size());
+	stringstream zlibOutput;
+	compressZlib(zlibInput, zlibOutput);
+	BOOST_CHECK(zlibOutput.str() == string(compressed.data(), defaultSize));
+}
+
+namespace
+{
+
+class ReverseCodec : public Codec
+{
+	public:
+		virtual const char* name() const override
+		{
+			return "Reverse";
+		}
+
+		virtual bool compress(const byte *in, uint32 inSize, byte *out, uint32 &outSize, int /* level */) const override
+		{
+			std::reverse_copy(in, in + inSize, out);
+			outSize = inSize;
+
+			return true;
+		}
+
+		virtual bool decompress(const byte *in, uint32 inSize, byte *out, uint32 &outSize) const override
+		{
+			return this->compress(in, inSize, out, outSize, 0);
+		}
+};
+
+}
+
+BOOST_AUTO_TEST_CASE(RegisterCodec)
+{
+	// this flag is not used by any algorithm
+	const uint8 compression = 0x04;
+	BOOST_REQUIRE(findCodec(compression) == 0);
+
+	registerCodec(compression, std::unique_ptr<Codec>(new ReverseCodec()));
+	const Codec *codec = findCodec(compression);
+	BOOST_REQUIRE(codec != 0);
+	BOOST_REQUIRE_EQUAL(string(codec->name()), "Reverse");
+
+	const string data = testData(100);
+	BOOST_REQUIRE(roundTrip(codec, data) == data);
+
+	registerCodec(compression, std::unique_ptr<Codec>());
+	BOOST_REQUIRE(findCodec(compression) == 0);
+}
+
+namespace
+{
+
+/*
+ * Data with runs of zero bytes of all lengths which are handled differently by the sparse compression.
+ */
+string sparseData()
+{
+	string result;
+	const std::size_t runs[] = { 1, 2, 3, 4, 129, 130, 131, 300 };
+
+	BOOST_FOREACH(std::size_t run, runs)
+	{
+		result += testData(run * 3);
+		result.append(run, '\0');
+	}
+
+	return result;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(SparseRoundTrip)
+{
+	const Codec *codec = Sector::codec(Sector::Compression::Sparse);
+	BOOST_REQUIRE(codec != 0);
+
+	const string data = sparseData();
+	BOOST_REQUIRE(roundTrip(codec, data) == data);
+	BOOST_REQUIRE(roundTrip(codec, string(4096, '\0')) == string(4096, '\0'));
+	BOOST_REQUIRE(roundTrip(codec, testData(1000)) == testData(1000));
+
+	std::vector<byte> compressed(data.size() * 2 + 1024);
+	uint32 compressedSize = boost::numeric_cast<uint32>(compressed.size());
+	BOOST_REQUIRE(codec->compress(data.data(), boost::numeric_cast<uint32>(data.size()), compressed.data(), compressedSize, 0));
+	BOOST_REQUIRE_LT(compressedSize, data.size());
+
+	/*
+	 * Three bytes of data followed by seven zero bytes and two implicit zero bytes at the end as StormLib stores them.
+	 */
+	const unsigned char stream[] = { 0x00, 0x00, 0x00, 0x0C, 0x82, 'a', 'b', 'c', 0x04 };
+	std::vector<byte> decompressed(12);
+	uint32 decompressedSize = boost::numeric_cast<uint32>(decompressed.size());
+	BOOST_REQUIRE(codec->decompress(reinterpret_cast<const byte*>(stream), sizeof(stream), decompressed.data(), decompressedSize));
+	BOOST_REQUIRE_EQUAL(decompressedSize, 12);
+	BOOST_REQUIRE(string(decompressed.data(), decompressedSize) == string("abc") + string(9, '\0'));
+
+	// the output buffer is too small
+	decompressedSize = 11;
+	BOOST_REQUIRE(!codec->decompress(reinterpret_cast<const byte*>(stream), sizeof(stream), decompressed.data(), decompressedSize));
+
+	// the data chunk exceeds the input
+	decompressedSize = boost::numeric_cast<uint32>(decompressed.size());
+	BOOST_REQUIRE_THROW(codec->decompress(reinterpret_cast<const byte*>(stream), sizeof(stream) - 2, decompressed.data(), decompressedSize), Exception);
+}
+
+#ifdef HAS_LZMA
+BOOST_AUTO_TEST_CASE(LzmaRoundTrip)
+{
+	const Codec *codec = Sector::codec(Sector::Compression::Lzma);
+	BOOST_REQUIRE(codec != 0);
+
+	const string data = testData(4096);
+	BOOST_REQUIRE(roundTrip(codec, data) == data);
+	BOOST_REQUIRE(roundTrip(codec, sparseData()) == sparseData());
+	BOOST_REQUIRE(roundTrip(codec, "a") == "a");
+
+	std::vector<byte> compressed(data.size() * 2 + 1024);
+	uint32 compressedSize = boost::numeric_cast<uint32>(compressed.size());
+	BOOST_REQUIRE(codec->compress(data.data(), boost::numeric_cast<uint32>(data.size()), compressed.data(), compressedSize, 0));
+	BOOST_REQUIRE_LT(compressedSize, data.size());
+	// no filter, the properties and the uncompressed size as StormLib stores them
+	BOOST_REQUIRE_EQUAL(compressed[0], 0);
+	BOOST_REQUIRE_EQUAL(static_cast<unsigned char>(compressed[6]), 0x00);
+	BOOST_REQUIRE_EQUAL(static_cast<unsigned char>(compressed[7]), 0x10);
+
+	// unsupported filter
+	compressed[0] = 1;
+	std::vector<byte> decompressed(data.size());
+	uint32 decompressedSize = boost::numeric_cast<uint32>(decompressed.size());
+	BOOST_REQUIRE_THROW(codec->decompress(compressed.data(), compressedSize, decompressed.data(), decompressedSize), Exception);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(ArchiveWithSparseAndLzmaSectors)
+{
+	std::vector<std::pair<string, Sector::Compression> > files;
+	files.push_back(std::make_pair("sparse.txt", Sector::Compression::Sparse));
+	files.push_back(std::make_pair("sparsedeflated.txt", Sector::Compression::Sparse | Sector::Compression::Deflated));
+	files.push_back(std::make_pair("sparsebzip2.txt", Sector::Compression::Sparse | Sector::Compression::Bzip2Compressed));
+#ifdef HAS_LZMA
+	files.push_back(std::make_pair("lzma.txt", Sector::Compression::Lzma));
+#endif
+
+	const string data = sparseData() + sparseData() + sparseData();
+	ArchiveBuilder builder(Archive::Format::Mpq1, 4096);
+
+	for (std::size_t i = 0; i < files.size(); ++i)
+	{
+		builder.addFile(files[i].first, data.c_str(), data.size(), files[i].second, i % 2 == 0 ? Block::Flags::None : Block::Flags::IsEncrypted);
+	}
+
+	builder.write("sparselzma.mpq");
+
+	Archive archive;
+	archive.open("sparselzma.mpq");
+
+	for (std::size_t i = 0; i < files.size(); ++i)
+	{
+		File file = archive.findFile(files[i].first);
+		BOOST_REQUIRE(file.isValid());
+		BOOST_REQUIRE(file.compressedSize() < data.size());
+
+		Sector::Sectors sectors;
+		file.sectors(sectors);
+		BOOST_REQUIRE(!sectors.empty());
+		// the compression flags are read from the first byte of the sector data on decompression
+		stringstream sectorStream;
+		sectors.front().decompress(sectorStream);
+		BOOST_REQUIRE(sectors.front().compression() == files[i].second);
+
+		stringstream sstream;
+		file.decompress(sstream);
+		BOOST_REQUIRE(sstream.str() == data);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(CompressionSelectionSmallest)
+{
+	CompressionSelection selection(4096);
+	// only the size counts without a decompression budget
+	selection.setDecompressionBudget(0.0);
+	selection.setSampleSectors(100);
+
+	const string data = testData(4096 * 5 + 100);
+	const CompressionSelection::Result result = selection.select("units\\unitdata.txt", data.c_str(), boost::numeric_cast<uint32>(data.size()));
+	BOOST_REQUIRE(!result.compressedFormat);
+	BOOST_REQUIRE_EQUAL(result.sampleSize, data.size());
+	BOOST_REQUIRE(result.compression != Sector::Compression::Uncompressed);
+	BOOST_REQUIRE(result.compressedSampleSize < result.sampleSize);
+
+	// all sectors are sampled, so no candidate compresses them better
+	BOOST_FOREACH(const CompressionSelection::Candidate &candidate, CompressionSelection::candidates())
+	{
+		uint32 size = 0;
+
+		for (std::size_t offset = 0; offset < data.size(); offset += 4096)
+		{
+			std::vector<byte> compressed;
+			Sector::compressData(data.c_str() + offset, boost::numeric_cast<uint32>(std::min<std::size_t>(4096, data.size() - offset)), Sector::fileFlags(Block::Flags::None, candidate.compression), candidate.compression, compressed, Sector::defaultWaveCompressionLevel, candidate.compressionLevel);
+			size += boost::numeric_cast<uint32>(compressed.size());
+		}
+
+		BOOST_CHECK(result.compressedSampleSize <= size);
+	}
+
+	// compressed formats are never sampled
+	const CompressionSelection::Result blp = selection.select("Textures\\Test.BLP", data.c_str(), boost::numeric_cast<uint32>(data.size()));
+	BOOST_CHECK(blp.compressedFormat);
+	BOOST_CHECK(blp.compression == Sector::Compression::Uncompressed);
+
+	// data which cannot be compressed is stored uncompressed
+	string random(4096 * 2, 0);
+	uint32 seed = 1;
+
+	for (std::size_t i = 0; i < random.size(); ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		random[i] = static_cast<byte>(seed >> 16);
+	}
+
+	const CompressionSelection::Result randomResult = selection.select("random.dat", random.c_str(), boost::numeric_cast<uint32>(random.size()));
+	BOOST_CHECK(randomResult.compression == Sector::Compression::Uncompressed);
+	BOOST_CHECK_EQUAL(randomResult.compressedSampleSize, randomResult.sampleSize);
+
+	// the decompression budget excludes expensive candidates without measuring any time
+	selection.setDecompressionBudget(3.0);
+	const CompressionSelection::Result budgetResult = selection.select("units\\unitdata.txt", data.c_str(), boost::numeric_cast<uint32>(data.size()));
+	BOOST_CHECK(CompressionSelection::decompressionCost(budgetResult.compression) <= 3.0 * CompressionSelection::decompressionCost(Sector::Compression::Deflated));
+	BOOST_CHECK(CompressionSelection::decompressionCost(Sector::Compression::Bzip2Compressed) > 3.0);
+	const CompressionSelection::Result sameResult = selection.select("units\\unitdata.txt", data.c_str(), boost::numeric_cast<uint32>(data.size()));
+	BOOST_CHECK(sameResult.compression == budgetResult.compression);
+	BOOST_CHECK_EQUAL(sameResult.compressionLevel, budgetResult.compressionLevel);
+	BOOST_CHECK_EQUAL(sameResult.compressedSampleSize, budgetResult.compressedSampleSize);
+}
+
+BOOST_AUTO_TEST_CASE(AddFilesAutoCompression)
+{
+	ArchiveBuilder builder(Archive::Format::Mpq1, 4096);
+	builder.setHashTableEntries(16);
+	builder.setBlockTableEntries(16);
+	builder.write("autocompression.mpq");
+
+	Archive archive;
+	archive.open("autocompression.mpq");
+
+	const string data = testData(4096 * 3);
+	Archive::NewFiles newFiles;
+	newFiles.push_back(Archive::NewFile("war3map.j", data.c_str(), data.size()));
+	newFiles.push_back(Archive::NewFile("war3mapPreview.blp", data.c_str(), data.size(), Sector::Compression::Deflated));
+
+	BOOST_FOREACH(Archive::NewFiles::reference newFile, newFiles)
+	{
+		newFile.autoCompression = true;
+	}
+
+	archive.addFiles(newFiles);
+
+	// the selected compressions are recorded
+	BOOST_CHECK(newFiles[0].compression != Sector::Compression::Uncompressed);
+	BOOST_CHECK(newFiles[1].compression == Sector::Compression::Uncompressed);
+
+	File compressed = archive.findFile("war3map.j");
+	BOOST_REQUIRE(compressed.isValid());
+	BOOST_CHECK(compressed.compressedSize() < data.size());
+	stringstream sstream;
+	compressed.decompress(sstream);
+	BOOST_CHECK(sstream.str() == data);
+
+	File uncompressed = archive.findFile("war3mapPreview.blp");
+	BOOST_REQUIRE(uncompressed.isValid());
+	BOOST_CHECK(!(uncompressed.block()->flags() & Block::Flags::IsCompressed));
+	BOOST_CHECK(!(uncompressed.block()->flags() & Block::Flags::IsImploded));
+}
+
+/*
+ * Warcraft III cannot decompress LZMA and sparse sectors. Therefore they are never selected for archives of format 1.
+ */
+BOOST_AUTO_TEST_CASE(AddFilesAutoCompressionWarcraft)
+{
+	BOOST_FOREACH(const CompressionSelection::Candidate &candidate, CompressionSelection::candidates())
+	{
+		BOOST_CHECK(candidate.compression != Sector::Compression::Lzma);
+		BOOST_CHECK(!(candidate.compression & Sector::Compression::Sparse));
+	}
+
+	bool extended = false;
+
+	BOOST_FOREACH(const CompressionSelection::Candidate &candidate, CompressionSelection::candidates(true))
+	{
+		extended = extended || (candidate.compression & Sector::Compression::Sparse);
+	}
+
+	BOOST_CHECK(extended);
+
+	ArchiveBuilder builder(Archive::Format::Mpq1, 4096);
+	builder.setHashTableEntries(16);
+	builder.setBlockTableEntries(16);
+	builder.write("autocompressionwarcraft.mpq");
+
+	Archive archive;
+	archive.open("autocompressionwarcraft.mpq");
+	// LZMA has the same cost as the budget
+	archive.compressionSelection().setDecompressionBudget(0.0);
+
+	const string text = testData(4096 * 8);
+	string zeros(4096 * 4, '\0');
+	zeros[100] = 'a';
+	zeros[5000] = 'b';
+	const string sparse = sparseData();
+	Archive::NewFiles newFiles;
+	newFiles.push_back(Archive::NewFile("war3map.j", text.c_str(), text.size()));
+	newFiles.push_back(Archive::NewFile("war3map.w3e", zeros.c_str(), zeros.size()));
+	newFiles.push_back(Archive::NewFile("war3map.wpm", sparse.c_str(), sparse.size()));
+
+	BOOST_FOREACH(Archive::NewFiles::reference newFile, newFiles)
+	{
+		newFile.autoCompression = true;
+	}
+
+	archive.addFiles(newFiles);
+
+	BOOST_FOREACH(Archive::NewFiles::const_reference newFile, newFiles)
+	{
+		BOOST_CHECK(newFile.compression != Sector::Compression::Uncompressed);
+		BOOST_CHECK(newFile.compression != Sector::Compression::Lzma);
+		BOOST_CHECK(!(newFile.compression & Sector::Compression::Sparse));
+	}
+}
+
+namespace
+{
+
+/*
+ * Generates data for all compression types of the Huffman codec: random bytes, text and small values like ADPCM samples.
+ */
+std::vector<string> huffmanTestData()
+{
+	std::vector<string> result;
+	uint32 seed = 7;
+	string random;
+	string samples;
+
+	for (std::size_t i = 0; i < 4096; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		random.push_back(static_cast<byte>(seed >> 16));
+		samples.push_back(static_cast<byte>(((seed >> 16) % 9) + (i % 3 == 0 ? 0xF8 : 0)));
+	}
+
+	result.push_back(random);
+	result.push_back(samples);
+	result.push_back(testData(4096));
+	result.push_back(testData(4095) + '\xFF');
+	result.push_back(string(1, 'a'));
+	result.push_back(string(4096, '\0'));
+
+	return result;
+}
+
+/*
+ * Decompresses Huffman data using "lib/huffman".
+ */
+string referenceHuffman(const std::vector<byte> &compressed, std::size_t size)
+{
+	std::vector<byte> output(size);
+	int outLength = boost::numeric_cast<int>(output.size());
+	BOOST_REQUIRE_EQUAL(decompressHuffman(output.data(), &outLength, const_cast<char*>(compressed.data()), boost::numeric_cast<int>(compressed.size())), 1);
+
+	return string(output.data(), outLength);
+}
+
+std::vector<byte> compressedHuffman(const string &data, int type)
+{
+	std::vector<byte> compressed(data.size() * 2 + 1024);
+	int length = boost::numeric_cast<int>(compressed.size());
+	compressHuffman(compressed.data(), &length, const_cast<char*>(data.data()), boost::numeric_cast<int>(data.size()), &type, 0);
+	compressed.resize(length);
+
+	return compressed;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(HuffmanDecoderEqualsReference)
+{
+	// the same decoder is used for all sectors
+	HuffmanDecoder decoder;
+	const std::vector<string> data = huffmanTestData();
+
+	for (int type = 0; type < 9; ++type)
+	{
+		BOOST_FOREACH(const string &sector, data)
+		{
+			const std::vector<byte> compressed = compressedHuffman(sector, type);
+
+			// the output might end before the end of the data
+			for (std::size_t size = sector.size(); size > 0; size /= 3)
+			{
+				const string reference = referenceHuffman(compressed, size);
+				BOOST_REQUIRE_EQUAL(reference.size(), size);
+				BOOST_REQUIRE(reference == sector.substr(0, size));
+
+				std::vector<byte> output(size);
+				const uint32 length = decoder.decompress(compressed.data(), boost::numeric_cast<uint32>(compressed.size()), output.data(), boost::numeric_cast<uint32>(output.size()));
+				BOOST_REQUIRE_EQUAL(length, size);
+				BOOST_REQUIRE(string(output.data(), length) == reference);
+			}
+		}
+	}
+
+	// unknown compression types
+	const std::vector<byte> invalid(16, '\x09');
+	std::vector<byte> output(16);
+	BOOST_CHECK_EQUAL(decoder.decompress(invalid.data(), boost::numeric_cast<uint32>(invalid.size()), output.data(), boost::numeric_cast<uint32>(output.size())), 0);
+}
+
+namespace
+{
+
+struct ImplodeBuffers
+{
+	const string *in;
+	std::size_t inPosition;
+	std::vector<byte> out;
+};
+
+unsigned int readImplodeBuffer(char *buf, unsigned int *size, void *param)
+{
+	ImplodeBuffers *buffers = reinterpret_cast<ImplodeBuffers*>(param);
+	const std::size_t count = std::min<std::size_t>(*size, buffers->in->size() - buffers->inPosition);
+	memcpy(buf, buffers->in->data() + buffers->inPosition, count);
+	buffers->inPosition += count;
+
+	return boost::numeric_cast<unsigned int>(count);
+}
+
+void writeImplodeBuffer(char *buf, unsigned int *size, void *param)
+{
+	ImplodeBuffers *buffers = reinterpret_cast<ImplodeBuffers*>(param);
+	buffers->out.insert(buffers->out.end(), buf, buf + *size);
+}
+
+/*
+ * Unlike compressPklib() the compression type and the dictionary size can be chosen.
+ */
+std::vector<byte> imploded(const string &data, unsigned int type, unsigned int dictionarySize)
+{
+	ImplodeBuffers buffers;
+	buffers.in = &data;
+	buffers.inPosition = 0;
+	std::vector<char> workBuffer(CMP_BUFFER_SIZE);
+	BOOST_REQUIRE_EQUAL(implode(readImplodeBuffer, writeImplodeBuffer, workBuffer.data(), &buffers, &type, &dictionarySize), static_cast<unsigned int>(CMP_NO_ERROR));
+
+	return buffers.out;
+}
+
+/*
+ * Returns the output of decompressPklib() or an empty string if it fails.
+ */
+string referencePklib(const std::vector<byte> &compressed, std::size_t size)
+{
+	std::vector<byte> output(size);
+	int outLength = boost::numeric_cast<int>(output.size());
+
+	try
+	{
+		decompressPklib(output.data(), outLength, const_cast<char*>(compressed.data()), boost::numeric_cast<int>(compressed.size()));
+	}
+	catch (const Exception &)
+	{
+		return string();
+	}
+
+	return string(output.data(), outLength);
+}
+
+string decodedPklib(const PklibDecoder &decoder, const std::vector<byte> &compressed, std::size_t size)
+{
+	std::vector<byte> output(size);
+	uint32 outSize = boost::numeric_cast<uint32>(output.size());
+	decoder.decompress(compressed.data(), boost::numeric_cast<uint32>(compressed.size()), output.data(), outSize);
+
+	return string(output.data(), outSize);
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(PklibDecoderEqualsReference)
+{
+	const PklibDecoder decoder;
+	std::vector<string> data = huffmanTestData();
+	// longer than the circular buffer of explode()
+	data.push_back(testData(0x5000));
+
+	for (unsigned int type = CMP_BINARY; type <= CMP_ASCII; ++type)
+	{
+		for (unsigned int dictionarySize = CMP_IMPLODE_DICT_SIZE1; dictionarySize <= CMP_IMPLODE_DICT_SIZE3; dictionarySize *= 2)
+		{
+			BOOST_FOREACH(const string &sector, data)
+			{
+				const std::vector<byte> compressed = imploded(sector, type, dictionarySize);
+
+				// the output might end before the end of the data
+				for (std::size_t size = sector.size(); size > 0; size /= 3)
+				{
+					const string reference = referencePklib(compressed, size);
+					BOOST_REQUIRE(reference == sector.substr(0, size));
+					BOOST_REQUIRE(decodedPklib(decoder, compressed, size) == reference);
+				}
+
+				// corrupted data results in the same partial output
+				std::vector<byte> corrupted = compressed;
+
+				for (std::size_t i = 3; i < corrupted.size(); i += 7)
+				{
+					corrupted[i] = static_cast<byte>(corrupted[i] ^ 0x5A);
+				}
+
+				BOOST_REQUIRE(decodedPklib(decoder, corrupted, sector.size()) == referencePklib(corrupted, sector.size()));
+				corrupted.resize(corrupted.size() / 2);
+				BOOST_REQUIRE(decodedPklib(decoder, corrupted, sector.size()) == referencePklib(corrupted, sector.size()));
+			}
+		}
+	}
+
+	// invalid dictionary size
+	std::vector<byte> invalid = imploded(testData(64), CMP_BINARY, CMP_IMPLODE_DICT_SIZE1);
+	invalid[1] = 7;
+	uint32 outSize = 64;
+	std::vector<byte> output(outSize);
+	BOOST_CHECK_EQUAL(decoder.decompress(invalid.data(), boost::numeric_cast<uint32>(invalid.size()), output.data(), outSize), static_cast<unsigned int>(CMP_INVALID_DICTSIZE));
+	BOOST_CHECK_EQUAL(outSize, 0);
+}
+
+namespace
+{
+
+/*
+ * Generates 16 bit samples of a sound with noise and some loud clicks which require large step sizes.
+ */
+string waveTestData(std::size_t samplesCount)
+{
+	string result;
+	uint32 seed = 11;
+
+	for (std::size_t i = 0; i < samplesCount; ++i)
+	{
+		seed = seed * 1103515245 + 12345;
+		int32 sample = int32(12000.0 * std::sin(i / 20.0) + 8000.0 * std::sin(i / 3.1)) + int32((seed >> 16) % 2000) - 1000;
+
+		if (i % 1000 < 20)
+		{
+			sample = i % 2 == 0 ? 32767 : -32768;
+		}
+
+		const int16 value = static_cast<int16>(std::min(std::max(sample, -32768), 32767));
+		result.append(reinterpret_cast<const byte*>(&value), sizeof(value));
+	}
+
+	return result;
+}
+
+/*
+ * The compression level of "lib/wave" for the wave compression level "level".
+ */
+int waveLevel(int level)
+{
+	return int(ImaAdpcm::bitShift(level)) + 1;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(ImaAdpcmEqualsReference)
+{
+	ImaAdpcm adpcm;
+	const string samples = waveTestData(0x4000);
+
+	for (uint32 channels = 1; channels <= 2; ++channels)
+	{
+		for (int level = 0; level <= 3; ++level)
+		{
+			for (std::size_t size = 8; size <= samples.size(); size *= 4)
+			{
+				const string sector = samples.substr(0, size);
+				// the size of the compressed data might be greater than the size of the samples
+				std::vector<byte> reference(size + 1024);
+				const int referenceSize = CompressADPCM(reinterpret_cast<unsigned char*>(reference.data()), boost::numeric_cast<int>(reference.size()), reinterpret_cast<short*>(const_cast<byte*>(sector.data())), boost::numeric_cast<int>(size), channels, waveLevel(level));
+
+				std::vector<byte> compressed(size + 1024);
+				uint32 compressedSize = boost::numeric_cast<uint32>(compressed.size());
+				BOOST_REQUIRE(ImaAdpcm::compress(sector.data(), boost::numeric_cast<uint32>(size), compressed.data(), compressedSize, channels, level));
+				BOOST_REQUIRE_EQUAL(compressedSize, uint32(referenceSize));
+				BOOST_REQUIRE(std::equal(compressed.begin(), compressed.begin() + compressedSize, reference.begin()));
+
+				// the reference decompression might write samples behind the output size
+				std::vector<byte> decompressed(size + 64);
+				const int decompressedSize = DecompressADPCM(reinterpret_cast<unsigned char*>(decompressed.data()), boost::numeric_cast<int>(size), reinterpret_cast<unsigned char*>(compressed.data()), boost::numeric_cast<int>(compressedSize), channels);
+				BOOST_REQUIRE_EQUAL(decompressedSize, int(size));
+
+				std::vector<byte> output(size);
+				BOOST_REQUIRE_EQUAL(adpcm.decompress(compressed.data(), compressedSize, output.data(), boost::numeric_cast<uint32>(output.size()), channels), size);
+				BOOST_REQUIRE(std::equal(output.begin(), output.end(), decompressed.begin()));
+			}
+		}
+
+		// random bytes contain all codes which change the step size
+		std::vector<byte> random(4096);
+		uint32 seed = 5;
+
+		for (std::size_t i = 0; i < random.size(); ++i)
+		{
+			seed = seed * 1103515245 + 12345;
+			random[i] = static_cast<byte>(seed >> 16);
+		}
+
+		random[1] = 4;
+		std::vector<byte> decompressed(random.size() * 2 + 64);
+		const int decompressedSize = DecompressADPCM(reinterpret_cast<unsigned char*>(decompressed.data()), boost::numeric_cast<int>(random.size() * 2), reinterpret_cast<unsigned char*>(random.data()), boost::numeric_cast<int>(random.size()), channels);
+		std::vector<byte> output(random.size() * 2);
+		const uint32 outputSize = adpcm.decompress(random.data(), boost::numeric_cast<uint32>(random.size()), output.data(), boost::numeric_cast<uint32>(output.size()), channels);
+		BOOST_REQUIRE_EQUAL(outputSize, uint32(decompressedSize));
+		BOOST_REQUIRE(std::equal(output.begin(), output.begin() + outputSize, decompressed.begin()));
+	}
+}
+
+/*
+ * Every other encoded sample decreases the step index by one in Warcraft III.
+ * "lib/wave" used to increase it to the maximum if "long" has 64 bits.
+ */
+BOOST_AUTO_TEST_CASE(ImaAdpcmGameCompatible)
+{
+	ImaAdpcm adpcm;
+	const byte compressed[] = { 0, 4, 0, 0, 0, 0 };
+	int16 samples[3] = { 1, 1, 1 };
+	BOOST_REQUIRE_EQUAL(adpcm.decompress(compressed, sizeof(compressed), reinterpret_cast<byte*>(samples), sizeof(samples), 1), sizeof(samples));
+	// step size 0x1EE shifted by 4, then 0x1C1 shifted by 4
+	BOOST_CHECK_EQUAL(samples[0], 0);
+	BOOST_CHECK_EQUAL(samples[1], 30);
+	BOOST_CHECK_EQUAL(samples[2], 58);
+}
+
+BOOST_AUTO_TEST_CASE(ImaAdpcmCompressBest)
+{
+	const string sector = waveTestData(2048);
+	std::vector<int> levels;
+	levels.push_back(1);
+	levels.push_back(2);
+	levels.push_back(3);
+	std::vector<byte> best(sector.size() + 1024);
+	uint32 bestSize = boost::numeric_cast<uint32>(best.size());
+	int bestLevel = 0;
+	BOOST_REQUIRE(ImaAdpcm::compressBest(sector.data(), boost::numeric_cast<uint32>(sector.size()), best.data(), bestSize, 2, levels, bestLevel));
+	BOOST_REQUIRE(std::find(levels.begin(), levels.end(), bestLevel) != levels.end());
+
+	const Codec *huffman = Sector::codec(Sector::Compression::Huffman);
+	std::vector<byte> huffmanOutput(sector.size() * 2 + 1024);
+	uint32 bestHuffmanSize = boost::numeric_cast<uint32>(huffmanOutput.size());
+	BOOST_REQUIRE(huffman->compress(best.data(), bestSize, huffmanOutput.data(), bestHuffmanSize, 0));
+
+	BOOST_FOREACH(int level, levels)
+	{
+		std::vector<byte> compressed(sector.size() + 1024);
+		uint32 compressedSize = boost::numeric_cast<uint32>(compressed.size());
+		BOOST_REQUIRE(ImaAdpcm::compress(sector.data(), boost::numeric_cast<uint32>(sector.size()), compressed.data(), compressedSize, 2, level));
+
+		if (level == bestLevel)
+		{
+			BOOST_REQUIRE_EQUAL(compressedSize, bestSize);
+			BOOST_REQUIRE(std::equal(compressed.begin(), compressed.begin() + compressedSize, best.begin()));
+		}
+
+		uint32 huffmanSize = boost::numeric_cast<uint32>(huffmanOutput.size());
+		BOOST_REQUIRE(huffman->compress(compressed.data(), compressedSize, huffmanOutput.data(), huffmanSize, 0));
+		BOOST_CHECK(bestHuffmanSize <= huffmanSize);
+	}
+
+	// the output of no level fits
+	uint32 tooSmall = 16;
+	BOOST_CHECK(!ImaAdpcm::compressBest(sector.data(), boost::numeric_cast<uint32>(sector.size()), best.data(), tooSmall, 2, levels, bestLevel));
+}
+
+BOOST_AUTO_TEST_CASE(CompressionSelectionWave)
+{
+	const string samples = waveTestData(4096 * 3 / 2);
+	string wave = "RIFF";
+	const uint32 riffSize = boost::numeric_cast<uint32>(36 + samples.size());
+	wave.append(reinterpret_cast<const byte*>(&riffSize), sizeof(riffSize));
+	wave += "WAVEfmt ";
+	// chunk size 16, PCM, stereo, 22050 Hz, 88200 bytes per second, block align 4, 16 bits per sample
+	const uint32 format[] = { 16, 1 | (2 << 16), 22050, 88200, 4 | (16 << 16) };
+	wave.append(reinterpret_cast<const byte*>(format), sizeof(format));
+	wave += "data";
+	const uint32 dataSize = boost::numeric_cast<uint32>(samples.size());
+	wave.append(reinterpret_cast<const byte*>(&dataSize), sizeof(dataSize));
+	wave += samples;
+
+	const Sector::Compression waveCompression = Sector::Compression::Huffman | Sector::Compression::ImaAdpcmStereo;
+	BOOST_REQUIRE(CompressionSelection::waveCompression("Sound\\Test.wav", wave.c_str(), boost::numeric_cast<uint32>(wave.size()), 4096) == waveCompression);
+	// without the extension or with data after the samples the file is not compressed lossy
+	BOOST_CHECK(CompressionSelection::waveCompression("Sound\\Test.dat", wave.c_str(), boost::numeric_cast<uint32>(wave.size()), 4096) == Sector::Compression::Uncompressed);
+	BOOST_CHECK(CompressionSelection::waveCompression("Sound\\Test.wav", (wave + "LIST").c_str(), boost::numeric_cast<uint32>(wave.size() + 4), 4096) == Sector::Compression::Uncompressed);
+
+	ArchiveBuilder builder(Archive::Format::Mpq1, 4096);
+	builder.setHashTableEntries(16);
+	builder.setBlockTableEntries(16);
+	builder.write("wavecompression.mpq");
+
+	Archive archive;
+	archive.open("wavecompression.mpq");
+	archive.compressionSelection().setDecompressionBudget(0.0);
+	Archive::NewFiles newFiles;
+	newFiles.push_back(Archive::NewFile("Sound\\Test.wav", wave.c_str(), wave.size()));
+	newFiles.back().autoCompression = true;
+	archive.addFiles(newFiles);
+	BOOST_REQUIRE(newFiles.front().compression == waveCompression);
+
+	File file = archive.findFile("Sound\\Test.wav");
+	BOOST_REQUIRE(file.isValid());
+	BOOST_CHECK(file.compressedSize() < wave.size() * 3 / 4);
+	stringstream sstream;
+	file.decompress(sstream);
+	const string decompressed = sstream.str();
+	BOOST_REQUIRE_EQUAL(decompressed.size(), wave.size());
+	// the first sector with the header is lossless
+	BOOST_CHECK(decompressed.substr(0, 4096) == wave.substr(0, 4096));
+
+	// the best wave compression level of the first sampled sector after the header is used for the whole file
+	CompressionSelection selection(4096);
+	selection.setDecompressionBudget(0.0);
+	std::vector<int> levels;
+	levels.push_back(1);
+	levels.push_back(3);
+	levels.push_back(4);
+	selection.setWaveCompressionLevels(levels);
+	const CompressionSelection::Result result = selection.select("Sound\\Test.wav", wave.c_str(), boost::numeric_cast<uint32>(wave.size()));
+	BOOST_REQUIRE(result.compression == waveCompression);
+	std::vector<byte> best(wave.size() - 4096);
+	uint32 bestSize = boost::numeric_cast<uint32>(best.size());
+	int bestLevel = 0;
+	BOOST_REQUIRE(ImaAdpcm::compressBest(wave.c_str() + 4096, boost::numeric_cast<uint32>(wave.size() - 4096), best.data(), bestSize, 2, levels, bestLevel));
+	BOOST_CHECK_EQUAL(result.waveCompressionLevel, bestLevel);
+}
+
+namespace
+{
+
+long long microseconds(const std::chrono::steady_clock::duration &duration)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+}
+
+}
+
+/*
+ * Compares the compression ratio and the decompression time of all codecs using the sectors of all files of the test archives.
+ */
+BOOST_AUTO_TEST_CASE(CompressionBenchmark)
+{
+	const char *archives[] =
+	{
+		"ladik_mpq1_all_extended_attributes.mpq",
+		"mpqmaster_mpq1_no_extended_attributes.mpq",
+		"testattributes.mpq"
+	};
+	std::vector<string> sectors;
+
+	BOOST_FOREACH(const char *path, archives)
+	{
+		Archive archive;
+		archive.open(path);
+		BOOST_REQUIRE(archive.isOpen());
+
+		Listfile::Entries entries;
+
+		if (archive.containsListfileFile())
+		{
+			entries = archive.listfileFile().entries();
+		}
+
+		entries.push_back("(listfile)");
+		entries.push_back("(attributes)");
+
+		BOOST_FOREACH(const string &entry, entries)
+		{
+			File file = archive.findFile(entry);
+
+			if (!file.isValid())
+			{
+				continue;
+			}
+
+			stringstream sstream;
+			file.decompress(sstream);
+			const string data = sstream.str();
+
+			for (std::size_t offset = 0; offset < data.size(); offset += archive.sectorSize())
+			{
+				sectors.push_back(data.substr(offset, archive.sectorSize()));
+			}
+		}
+	}
+
+	BOOST_REQUIRE(!sectors.empty());
+
+	const Sector::Compression compressions[] =
+	{
+		Sector::Compression::Deflated,
+		Sector::Compression::Bzip2Compressed,
+		Sector::Compression::Imploded,
+		Sector::Compression::Huffman,
+		Sector::Compression::Sparse,
+		Sector::Compression::Lzma
+	};
+	const int runs = 20;
+
+	BOOST_FOREACH(Sector::Compression compression, compressions)
+	{
+		const Codec *codec = Sector::codec(compression);
+
+		if (codec == 0)
+		{
+			continue;
+		}
+
+		std::vector<std::vector<byte> > compressedSectors;
+		std::size_t size = 0;
+		std::size_t compressedSize = 0;
+
+		BOOST_FOREACH(const string &sector, sectors)
+		{
+			std::vector<byte> compressed(sector.size() * 2 + 1024);
+			uint32 length = boost::numeric_cast<uint32>(compressed.size());
+			BOOST_REQUIRE(codec->compress(sector.data(), boost::numeric_cast<uint32>(sector.size()), compressed.data(), length, Sector::defaultWaveCompressionLevel));
+			compressed.resize(length);
+			compressedSectors.push_back(compressed);
+			size += sector.size();
+			compressedSize += length;
+		}
+
+		std::vector<byte> buffer(4096 * 4);
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		for (int run = 0; run < runs; ++run)
+		{
+			for (std::size_t i = 0; i < compressedSectors.size(); ++i)
+			{
+				uint32 length = boost::numeric_cast<uint32>(buffer.size());
+				BOOST_REQUIRE(codec->decompress(compressedSectors[i].data(), boost::numeric_cast<uint32>(compressedSectors[i].size()), buffer.data(), length));
+				BOOST_REQUIRE_EQUAL(length, sectors[i].size());
+			}
+		}
+
+		const std::chrono::steady_clock::duration duration = std::chrono::steady_clock::now() - now;
+		std::cerr << boost::format("%1%: %2% sectors, %3% bytes, ratio %4$.3f, decompressing %5% times: %6% us") % codec->name() % sectors.size() % size % (double(compressedSize) / double(size)) % runs % microseconds(duration) << std::endl;
+	}
+}
+
+/*
+ * Compares the table-driven Huffman decoder with "lib/huffman".
+ */
+BOOST_AUTO_TEST_CASE(HuffmanDecoderBenchmark)
+{
+	const int runs = 200;
+	const std::vector<string> data = huffmanTestData();
+	HuffmanDecoder decoder;
+
+	for (int type = 0; type < 9; type += 8)
+	{
+		std::vector<std::vector<byte> > compressedSectors;
+		std::size_t size = 0;
+
+		BOOST_FOREACH(const string &sector, data)
+		{
+			compressedSectors.push_back(compressedHuffman(sector, type));
+			size += sector.size();
+		}
+
+		std::vector<byte> buffer(4096);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		for (int run = 0; run < runs; ++run)
+		{
+			for (std::size_t i = 0; i < compressedSectors.size(); ++i)
+			{
+				int length = boost::numeric_cast<int>(data[i].size());
+				BOOST_REQUIRE_EQUAL(decompressHuffman(buffer.data(), &length, compressedSectors[i].data(), boost::numeric_cast<int>(compressedSectors[i].size())), 1);
+			}
+		}
+
+		const std::chrono::steady_clock::duration referenceDuration = std::chrono::steady_clock::now() - now;
+		now = std::chrono::steady_clock::now();
+
+		for (int run = 0; run < runs; ++run)
+		{
+			for (std::size_t i = 0; i < compressedSectors.size(); ++i)
+			{
+				BOOST_REQUIRE_EQUAL(decoder.decompress(compressedSectors[i].data(), boost::numeric_cast<uint32>(compressedSectors[i].size()), buffer.data(), boost::numeric_cast<uint32>(data[i].size())), data[i].size());
+			}
+		}
+
+		const std::chrono::steady_clock::duration duration = std::chrono::steady_clock::now() - now;
+		std::cerr << boost::format("Huffman type %1%: %2% bytes decompressed %3% times, lib/huffman: %4% us, HuffmanDecoder: %5% us") % type % size % runs % microseconds(referenceDuration) % microseconds(duration) << std::endl;
+	}
+}
+
+/*
+ * Compares the direct PKWare decoder with explode() of "lib/pklib".
+ */
+BOOST_AUTO_TEST_CASE(PklibDecoderBenchmark)
+{
+	const int runs = 200;
+	std::vector<string> data = huffmanTestData();
+	data.push_back(testData(0x5000));
+	const PklibDecoder decoder;
+
+	for (unsigned int type = CMP_BINARY; type <= CMP_ASCII; ++type)
+	{
+		std::vector<std::vector<byte> > compressedSectors;
+		std::size_t size = 0;
+
+		BOOST_FOREACH(const string &sector, data)
+		{
+			compressedSectors.push_back(imploded(sector, type, CMP_IMPLODE_DICT_SIZE3));
+			size += sector.size();
+		}
+
+		std::vector<byte> buffer(0x5000);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		for (int run = 0; run < runs; ++run)
+		{
+			for (std::size_t i = 0; i < compressedSectors.size(); ++i)
+			{
+				int length = boost::numeric_cast<int>(data[i].size());
+				decompressPklib(buffer.data(), length, compressedSectors[i].data(), boost::numeric_cast<int>(compressedSectors[i].size()));
+			}
+		}
+
+		const std::chrono::steady_clock::duration referenceDuration = std::chrono::steady_clock::now() - now;
+		now = std::chrono::steady_clock::now();
+
+		for (int run = 0; run < runs; ++run)
+		{
+			for (std::size_t i = 0; i < compressedSectors.size(); ++i)
+			{
+				uint32 length = boost::numeric_cast<uint32>(data[i].size());
+				BOOST_REQUIRE_EQUAL(decoder.decompress(compressedSectors[i].data(), boost::numeric_cast<uint32>(compressedSectors[i].size()), buffer.data(), length), static_cast<unsigned int>(CMP_NO_ERROR));
+			}
+		}
+
+		const std::chrono::steady_clock::duration duration = std::chrono::steady_clock::now() - now;
+		std::cerr << boost::format("Imploded %1%: %2% bytes decompressed %3% times, lib/pklib: %4% us, PklibDecoder: %5% us") % (type == CMP_BINARY ? "binary" : "ASCII") % size % runs % microseconds(referenceDuration) % microseconds(duration) << std::endl;
+	}
+}
+
+/*
+ * Compares the IMA ADPCM codec with "lib/wave".
+ */
+BOOST_AUTO_TEST_CASE(ImaAdpcmBenchmark)
+{
+	const int runs = 200;
+	const string samples = waveTestData(0x8000);
+	const uint32 sectorSize = 4096;
+	ImaAdpcm adpcm;
+
+	for (uint32 channels = 1; channels <= 2; ++channels)
+	{
+		std::vector<std::vector<byte> > compressedSectors;
+
+		for (uint32 offset = 0; offset < samples.size(); offset += sectorSize)
+		{
+			std::vector<byte> compressed(sectorSize + 1024);
+			uint32 compressedSize = boost::numeric_cast<uint32>(compressed.size());
+			BOOST_REQUIRE(ImaAdpcm::compress(samples.data() + offset, sectorSize, compressed.data(), compressedSize, channels, Sector::defaultWaveCompressionLevel));
+			compressed.resize(compressedSize);
+			compressedSectors.push_back(compressed);
+		}
+
+		std::vector<byte> buffer(sectorSize + 64);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+		for (int run = 0; run < runs; ++run)
+		{
+			for (std::size_t i = 0; i < compressedSectors.size(); ++i)
+			{
+				DecompressADPCM(reinterpret_cast<unsigned char*>(buffer.data()), sectorSize, reinterpret_cast<unsigned char*>(compressedSectors[i].data()), boost::numeric_cast<int>(compressedSectors[i].size()), channels);
+			}
+		}
+
+		const std::chrono::steady_clock::duration referenceDuration = std::chrono::steady_clock::now() - now;
+		now = std::chrono::steady_clock::now();
+
+		for (int run = 0; run < runs; ++run)
+		{
+			for (std::size_t i = 0; i < compressedSectors.size(); ++i)
+			{
+				BOOST_REQUIRE_EQUAL(adpcm.decompress(compressedSectors[i].data(), boost::numeric_cast<uint32>(compressedSectors[i].size()), buffer.data(), sectorSize, channels), sectorSize);
+			}
+		}
+
+		const std::chrono::steady_clock::duration duration = std::chrono::steady_clock::now() - now;
+		std::cerr << boost::format("IMA ADPCM %1%: %2% bytes decompressed %3% times, lib/wave: %4% us, ImaAdpcm: %5% us") % (channels == 1 ? "mono" : "stereo") % samples.size() % runs % microseconds(referenceDuration) % microseconds(duration) << std::endl;
+	}
+}
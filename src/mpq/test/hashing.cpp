@@ -0,0 +1,394 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#define BOOST_TEST_MODULE HashingTest
+#include <boost/test/unit_test.hpp>
+#include <iostream>
+#include <chrono>
+#include <vector>
+
+#include <boost/format.hpp>
+
+#include "../archive.hpp"
+#include "../algorithm.hpp"
+
+#ifndef BOOST_TEST_DYN_LINK
+#error Define BOOST_TEST_DYN_LINK for proper definition of main function.
+#endif
+
+using namespace wc3lib;
+using namespace wc3lib::mpq;
+
+namespace
+{
+
+/*
+ * The original scalar implementations which are used as reference for the results and the durations.
+ */
+void referenceDecryptData(const uint32 dwCryptTable[cryptTableSize], void *lpbyBuffer, uint32 dwLength, uint32 dwKey)
+{
+	uint32 *lpdwBuffer = (uint32 *)lpbyBuffer;
+	uint32 seed = 0xEEEEEEEEL;
+	uint32 ch;
+
+	dwLength /= sizeof(uint32);
+
+	while (dwLength-- > 0)
+	{
+		seed += dwCryptTable[0x400 + (dwKey & 0xFF)];
+		ch = *lpdwBuffer ^ (dwKey + seed);
+
+		dwKey = ((~dwKey << 0x15) + 0x11111111L) | (dwKey >> 0x0B);
+		seed = ch + seed + (seed << 5) + 3;
+
+		*lpdwBuffer++ = ch;
+	}
+}
+
+uint32 referenceHashString(const uint32 dwCryptTable[cryptTableSize], const char *lpszString, HashType hashType)
+{
+	uint32 dwHashType = uint32(hashType);
+	uint32 seed1 = 0x7FED7FEDL;
+	uint32 seed2 = 0xEEEEEEEEL;
+	int ch;
+
+	while (*lpszString != 0)
+	{
+		ch = toupper(*lpszString++);
+
+		seed1 = dwCryptTable[dwHashType + ch] ^ (seed1 + seed2);
+		seed2 = ch + seed1 + seed2 + (seed2 << 5) + 3;
+	}
+
+	return seed1;
+}
+
+/**
+ * Generates \p count file paths which look like the entries of a listfile.
+ */
+std::vector<string> listfileEntries(std::size_t count)
+{
+	static const char *directories[] = { "Units\\Human\\Footman\\", "Abilities\\Spells\\Orc\\", "ReplaceableTextures\\CommandButtons\\", "war3mapImported\\", "UI\\Widgets\\Console\\" };
+	static const char *extensions[] = { ".mdx", ".blp", ".wav", ".txt", ".slk" };
+	std::vector<string> result;
+	result.reserve(count);
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		result.push_back((boost::format("%1%File%2%Name%3%") % directories[i % 5] % i % extensions[(i / 5) % 5]).str());
+	}
+
+	return result;
+}
+
+long long milliseconds(const std::chrono::steady_clock::duration &duration)
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(HashStringsEqualsHashString)
+{
+	const std::vector<string> entries = listfileEntries(1000);
+	std::vector<const char*> strings;
+
+	BOOST_FOREACH(const string &entry, entries)
+	{
+		strings.push_back(entry.c_str());
+	}
+
+	std::vector<HashValues> values(strings.size());
+	HashStrings(Archive::cryptTable(), strings.data(), strings.size(), values.data());
+
+	for (std::size_t i = 0; i < strings.size(); ++i)
+	{
+		BOOST_REQUIRE_EQUAL(values[i].tableOffset, referenceHashString(Archive::cryptTable(), strings[i], HashType::TableOffset));
+		BOOST_REQUIRE_EQUAL(values[i].nameA, referenceHashString(Archive::cryptTable(), strings[i], HashType::NameA));
+		BOOST_REQUIRE_EQUAL(values[i].nameB, referenceHashString(Archive::cryptTable(), strings[i], HashType::NameB));
+		BOOST_REQUIRE_EQUAL(HashString(Archive::cryptTable(), strings[i], HashType::FileKey), referenceHashString(Archive::cryptTable(), strings[i], HashType::FileKey));
+	}
+
+	// case insensitive
+	const HashValues lower = HashStrings(Archive::cryptTable(), "units\\human\\footman\\footman.mdx");
+	const HashValues upper = HashStrings(Archive::cryptTable(), "UNITS\\HUMAN\\FOOTMAN\\FOOTMAN.MDX");
+	BOOST_REQUIRE_EQUAL(lower.tableOffset, upper.tableOffset);
+	BOOST_REQUIRE_EQUAL(lower.nameA, upper.nameA);
+	BOOST_REQUIRE_EQUAL(lower.nameB, upper.nameB);
+}
+
+BOOST_AUTO_TEST_CASE(DecryptDataEqualsReference)
+{
+	const uint32 key = HashString(Archive::cryptTable(), "(hash table)", HashType::FileKey);
+
+	// check all remainders of the batches and unaligned buffers
+	for (uint32 size = 0; size < 64; size += sizeof(uint32))
+	{
+		std::vector<byte> data(size + 1);
+
+		for (uint32 i = 0; i < data.size(); ++i)
+		{
+			data[i] = static_cast<byte>(i * 31 + size);
+		}
+
+		std::vector<byte> expected(data.begin() + 1, data.end());
+		referenceDecryptData(Archive::cryptTable(), expected.data(), size, key);
+
+		std::vector<byte> decrypted(data);
+		DecryptData(Archive::cryptTable(), decrypted.data() + 1, size, key);
+		BOOST_REQUIRE(std::equal(expected.begin(), expected.end(), decrypted.begin() + 1));
+
+		// encrypting the decrypted data restores the original data
+		EncryptData(Archive::cryptTable(), decrypted.data() + 1, size, key);
+		BOOST_REQUIRE(decrypted == data);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(HashLittle2ReferenceValues)
+{
+	// reference values from the driver of lookup3.c
+	uint32 primary = 0;
+	uint32 secondary = 0;
+	HashLittle2("", 0, primary, secondary);
+	BOOST_REQUIRE_EQUAL(primary, 0xdeadbeef);
+	BOOST_REQUIRE_EQUAL(secondary, 0xdeadbeef);
+
+	const char *text = "Four score and seven years ago";
+	primary = 0;
+	secondary = 0;
+	HashLittle2(text, 30, primary, secondary);
+	BOOST_REQUIRE_EQUAL(primary, 0x17770551);
+	BOOST_REQUIRE_EQUAL(secondary, 0xce7226e6);
+
+	primary = 0;
+	secondary = 1;
+	HashLittle2(text, 30, primary, secondary);
+	BOOST_REQUIRE_EQUAL(primary, 0xe3607cae);
+	BOOST_REQUIRE_EQUAL(secondary, 0xbd371de4);
+
+	primary = 1;
+	secondary = 0;
+	HashLittle2(text, 30, primary, secondary);
+	BOOST_REQUIRE_EQUAL(primary, 0xcd628161);
+	BOOST_REQUIRE_EQUAL(secondary, 0x6cbea4b3);
+
+	// file names are normalized
+	BOOST_REQUIRE_EQUAL(HashStringJenkins("Units\\Human\\Footman.mdx"), HashStringJenkins("units/human/FOOTMAN.mdx"));
+	BOOST_REQUIRE_NE(HashStringJenkins("units\\human\\footman.mdx"), HashStringJenkins("units\\human\\knight.mdx"));
+}
+
+BOOST_AUTO_TEST_CASE(ReadWriteBits)
+{
+	std::vector<byte> data(64, 0);
+	uint64 bitIndex = 0;
+
+	// values of all widths which are not aligned to bytes
+	for (uint32 bits = 1; bits <= 64; bits += 7)
+	{
+		const uint64 value = (bits == 64 ? 0xfedcba9876543210ULL : (0xfedcba9876543210ULL & ((1ULL << bits) - 1)));
+		writeBits(data.data(), bitIndex, bits, value);
+		BOOST_REQUIRE_EQUAL(readBits(data.data(), bitIndex, bits), value);
+		bitIndex += bits;
+	}
+
+	bitIndex = 0;
+
+	for (uint32 bits = 1; bits <= 64; bits += 7)
+	{
+		const uint64 value = (bits == 64 ? 0xfedcba9876543210ULL : (0xfedcba9876543210ULL & ((1ULL << bits) - 1)));
+		BOOST_REQUIRE_EQUAL(readBits(data.data(), bitIndex, bits), value);
+		bitIndex += bits;
+	}
+
+	BOOST_REQUIRE_EQUAL(bitCount(0), 0);
+	BOOST_REQUIRE_EQUAL(bitCount(1), 1);
+	BOOST_REQUIRE_EQUAL(bitCount(255), 8);
+	BOOST_REQUIRE_EQUAL(bitCount(256), 9);
+}
+
+/*
+ * Resolves a listfile with 30000 entries against an archive with a hash table of 32768 entries.
+ * The durations of the original hashing and decryption are printed next to the new ones.
+ */
+BOOST_AUTO_TEST_CASE(ResolveListfileBenchmark)
+{
+	const uint32 hashTableEntries = 32768;
+	const std::vector<string> entries = listfileEntries(30000);
+
+	/*
+	 * Place all entries into the hash table like the MPQ format does it.
+	 * All of them use the one and only block of the archive.
+	 */
+	std::vector<HashTableEntry> hashTable(hashTableEntries);
+
+	BOOST_FOREACH(HashTableEntry &entry, hashTable)
+	{
+		entry.filePathHashA = 0;
+		entry.filePathHashB = 0;
+		entry.locale = 0;
+		entry.platform = 0;
+		entry.fileBlockIndex = Hash::blockIndexEmpty;
+	}
+
+	BOOST_FOREACH(const string &entry, entries)
+	{
+		uint32 index = referenceHashString(Archive::cryptTable(), entry.c_str(), HashType::TableOffset) % hashTableEntries;
+
+		while (hashTable[index].fileBlockIndex != Hash::blockIndexEmpty)
+		{
+			index = (index + 1) % hashTableEntries;
+		}
+
+		hashTable[index].filePathHashA = referenceHashString(Archive::cryptTable(), entry.c_str(), HashType::NameA);
+		hashTable[index].filePathHashB = referenceHashString(Archive::cryptTable(), entry.c_str(), HashType::NameB);
+		hashTable[index].fileBlockIndex = 0;
+	}
+
+	Header header;
+	memcpy(header.magic, Archive::identifier, 4);
+	header.headerSize = sizeof(header);
+	header.archiveSize = sizeof(header) + sizeof(BlockTableEntry) + hashTableEntries * sizeof(HashTableEntry);
+	header.formatVersion = static_cast<uint16>(Archive::Format::Mpq1);
+	header.sectorSizeShift = 3;
+	header.blockTableOffset = sizeof(header);
+	header.hashTableOffset = sizeof(header) + sizeof(BlockTableEntry);
+	header.hashTableEntries = hashTableEntries;
+	header.blockTableEntries = 1;
+
+	BlockTableEntry blockTableEntry;
+	blockTableEntry.blockOffset = header.archiveSize;
+	blockTableEntry.blockSize = 0;
+	blockTableEntry.fileSize = 0;
+	blockTableEntry.flags = static_cast<uint32>(Block::Flags::IsFile);
+
+	EncryptData(Archive::cryptTable(), &blockTableEntry, sizeof(blockTableEntry), HashString(Archive::cryptTable(), "(block table)", HashType::FileKey));
+	std::vector<HashTableEntry> encryptedHashTable(hashTable);
+	EncryptData(Archive::cryptTable(), encryptedHashTable.data(), hashTableEntries * sizeof(HashTableEntry), HashString(Archive::cryptTable(), "(hash table)", HashType::FileKey));
+
+	{
+		ofstream out("resolvelistfile.mpq", std::ios::out | std::ios::binary);
+		out.write(reinterpret_cast<const byte*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const byte*>(&blockTableEntry), sizeof(blockTableEntry));
+		out.write(reinterpret_cast<const byte*>(encryptedHashTable.data()), hashTableEntries * sizeof(HashTableEntry));
+	}
+
+	/*
+	 * Decryption of the whole hash table.
+	 */
+	const uint32 hashTableKey = HashString(Archive::cryptTable(), "(hash table)", HashType::FileKey);
+	const int decryptionRuns = 50;
+	std::vector<HashTableEntry> buffer(encryptedHashTable);
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < decryptionRuns; ++i)
+	{
+		buffer = encryptedHashTable;
+		referenceDecryptData(Archive::cryptTable(), buffer.data(), hashTableEntries * sizeof(HashTableEntry), hashTableKey);
+	}
+
+	std::chrono::steady_clock::duration duration = std::chrono::steady_clock::now() - now;
+	std::cerr << "Decrypting the hash table " << decryptionRuns << " times with the reference implementation: " << milliseconds(duration) << " ms" << std::endl;
+
+	now = std::chrono::steady_clock::now();
+
+	for (int i = 0; i < decryptionRuns; ++i)
+	{
+		buffer = encryptedHashTable;
+		DecryptData(Archive::cryptTable(), buffer.data(), hashTableEntries * sizeof(HashTableEntry), hashTableKey);
+	}
+
+	duration = std::chrono::steady_clock::now() - now;
+	std::cerr << "Decrypting the hash table " << decryptionRuns << " times: " << milliseconds(duration) << " ms" << std::endl;
+	BOOST_REQUIRE(memcmp(buffer.data(), hashTable.data(), hashTableEntries * sizeof(HashTableEntry)) == 0);
+
+	Archive archive;
+	BOOST_REQUIRE(archive.open("resolvelistfile.mpq") > 0);
+	BOOST_REQUIRE_EQUAL(archive.hashTable().size(), hashTableEntries);
+
+	/*
+	 * Resolving all listfile entries by calculating the three hash values separately.
+	 */
+	std::size_t found = 0;
+	now = std::chrono::steady_clock::now();
+
+	BOOST_FOREACH(const string &entry, entries)
+	{
+		const uint32 tableOffset = referenceHashString(Archive::cryptTable(), entry.c_str(), HashType::TableOffset);
+		const uint32 nameA = referenceHashString(Archive::cryptTable(), entry.c_str(), HashType::NameA);
+		const uint32 nameB = referenceHashString(Archive::cryptTable(), entry.c_str(), HashType::NameB);
+
+		if (archive.hashTable().find(tableOffset, nameA, nameB, 0, 0) != 0)
+		{
+			++found;
+		}
+	}
+
+	duration = std::chrono::steady_clock::now() - now;
+	std::cerr << "Resolving " << entries.size() << " listfile entries with separate hash values: " << milliseconds(duration) << " ms" << std::endl;
+	BOOST_REQUIRE_EQUAL(found, entries.size());
+
+	/*
+	 * Resolving all listfile entries by their paths.
+	 */
+	found = 0;
+	now = std::chrono::steady_clock::now();
+
+	BOOST_FOREACH(const string &entry, entries)
+	{
+		if (archive.findHash(entry) != 0)
+		{
+			++found;
+		}
+	}
+
+	duration = std::chrono::steady_clock::now() - now;
+	std::cerr << "Resolving " << entries.size() << " listfile entries with Archive::findHash(): " << milliseconds(duration) << " ms" << std::endl;
+	BOOST_REQUIRE_EQUAL(found, entries.size());
+
+	/*
+	 * Resolving all listfile entries as batch.
+	 */
+	found = 0;
+	now = std::chrono::steady_clock::now();
+	std::vector<const char*> strings;
+	strings.reserve(entries.size());
+
+	BOOST_FOREACH(const string &entry, entries)
+	{
+		strings.push_back(entry.c_str());
+	}
+
+	std::vector<HashValues> values(strings.size());
+	HashStrings(Archive::cryptTable(), strings.data(), strings.size(), values.data());
+
+	BOOST_FOREACH(const HashValues &value, values)
+	{
+		if (archive.hashTable().find(value.tableOffset, value.nameA, value.nameB, 0, 0) != 0)
+		{
+			++found;
+		}
+	}
+
+	duration = std::chrono::steady_clock::now() - now;
+	std::cerr << "Resolving " << entries.size() << " listfile entries as batch: " << milliseconds(duration) << " ms" << std::endl;
+	BOOST_REQUIRE_EQUAL(found, entries.size());
+
+	BOOST_REQUIRE(archive.findHash("missing.txt") == 0);
+}
@@ -26,7 +26,10 @@
 #include <boost/foreach.hpp>
 
 #include "../listfile.hpp"
+#include "../listfileindex.hpp"
+#include "../listfilerecovery.hpp"
 #include "../archive.hpp"
+#include "../archivebuilder.hpp"
 
 #ifndef BOOST_TEST_DYN_LINK
 #error Define BOOST_TEST_DYN_LINK for proper definition of main function.
@@ -84,6 +87,27 @@ BOOST_AUTO_TEST_CASE(ListfileEntriesTest)
 	BOOST_REQUIRE(entries.back() == "end");
 }
 
+/*
+ * Repeated separator characters result in empty entries.
+ * A separator at the end results in an empty last entry.
+ */
+BOOST_AUTO_TEST_CASE(ListfileEntriesEmpty)
+{
+	mpq::Listfile::Entries entries = mpq::Listfile::entries("");
+	BOOST_REQUIRE(entries.size() == 1);
+	BOOST_REQUIRE(entries[0].empty());
+
+	entries = mpq::Listfile::entries("bla1;;bla2\n\nbla3;\r\nbla4\r\n");
+	BOOST_REQUIRE(entries.size() == 7);
+	BOOST_REQUIRE(entries[0] == "bla1");
+	BOOST_REQUIRE(entries[1].empty());
+	BOOST_REQUIRE(entries[2] == "bla2");
+	BOOST_REQUIRE(entries[3].empty());
+	BOOST_REQUIRE(entries[4] == "bla3");
+	BOOST_REQUIRE(entries[5] == "bla4");
+	BOOST_REQUIRE(entries[6].empty());
+}
+
 BOOST_AUTO_TEST_CASE(ListfileContentTest)
 {
 	mpq::Listfile::Entries entries;
@@ -331,6 +355,64 @@ BOOST_AUTO_TEST_CASE(CaseSensitiveDirEntriesWithEmptyPrefix)
 	BOOST_REQUIRE(uniqueEntries[1] == "test");
 }
 
+BOOST_AUTO_TEST_CASE(ListfileIndexEntries)
+{
+	stringstream sstream;
+	sstream <<
+	"Abilities\\Hans\\bla"
+	";abilities\\Peter\\blu"
+	";abilities\\PeTeR\\bli"
+	";abILIties\\UI\\test"
+	";abilities\\ui\\test2"
+	";abilities\\ui\\testDir\\test"
+	";ABILITIES\\HANS\\BLA"
+	";test\\ui\\test3.txt"
+	";war3map.j"
+	";"
+	;
+
+	const mpq::Listfile::Entries entries = mpq::Listfile::entries(sstream.str());
+	const mpq::ListfileIndex index(entries);
+
+	BOOST_REQUIRE(index.files() == 8);
+	BOOST_REQUIRE(index.directories() == 7);
+	BOOST_REQUIRE(index.containsFile("abilities\\hans\\BLA"));
+	BOOST_REQUIRE(!index.containsFile("abilities\\hans"));
+	BOOST_REQUIRE(index.containsDirectory("ABILITIES\\UI\\"));
+	BOOST_REQUIRE(!index.containsDirectory("war3map.j"));
+	BOOST_REQUIRE(index.containsDirectory(""));
+
+	mpq::Listfile::Entries result = index.dirEntries("Abilities\\", false);
+	BOOST_REQUIRE(result.size() == 3);
+	BOOST_REQUIRE(result[0] == "Abilities\\Hans");
+	BOOST_REQUIRE(result[1] == "Abilities\\Peter");
+	BOOST_REQUIRE(result[2] == "Abilities\\UI");
+
+	result = index.dirEntries("", true);
+	BOOST_REQUIRE(result.size() == 7);
+	BOOST_REQUIRE(result[0] == "Abilities");
+	BOOST_REQUIRE(result[4] == "Abilities\\UI\\testDir");
+	BOOST_REQUIRE(result[5] == "test");
+	// names are interned globally like in mpq::Listfile::caseSensitiveEntries()
+	BOOST_REQUIRE(result[6] == "test\\UI");
+
+	result = index.fileEntries("", false);
+	BOOST_REQUIRE(result.size() == 1);
+	BOOST_REQUIRE(result[0] == "war3map.j");
+
+	result = index.fileEntries("abilities\\ui", true);
+	BOOST_REQUIRE(result.size() == 3);
+	BOOST_REQUIRE(result[0] == "Abilities\\UI\\test");
+	BOOST_REQUIRE(result[1] == "Abilities\\UI\\test2");
+	BOOST_REQUIRE(result[2] == "Abilities\\UI\\testDir\\test");
+
+	result = index.fileEntries("abilities\\ui", false);
+	BOOST_REQUIRE(result.size() == 2);
+
+	BOOST_REQUIRE(index.fileEntries("Abilities\\Unknown").empty());
+	BOOST_REQUIRE(index.fileEntries("war3map.j").empty());
+}
+
 BOOST_AUTO_TEST_CASE(ExistingEntriesWithPrefix)
 {
 	mpq::Archive archive;
@@ -390,3 +472,74 @@ BOOST_AUTO_TEST_CASE(FileName)
 	const string filePath2 = "UI\\peter\\";
 	BOOST_CHECK_EQUAL(mpq::Listfile::fileName(filePath2), "");
 }
+
+BOOST_AUTO_TEST_CASE(RecoverListfile)
+{
+	const string data = "recover me";
+	const char *paths[] =
+	{
+		"war3map.j",
+		"war3map.w3e",
+		"Units\\UnitData.slk",
+		"ReplaceableTextures\\CommandButtons\\BTNFootman.blp",
+		"Abilities\\Footman\\Peasant.txt",
+		"unknown.txt"
+	};
+
+	mpq::ArchiveBuilder builder;
+	builder.setListfile(false);
+	builder.setAttributes(false);
+
+	BOOST_FOREACH(const char *path, paths)
+	{
+		builder.addFile(path, data.c_str(), data.size(), mpq::Sector::Compression::Deflated, mpq::Block::Flags::IsEncrypted);
+	}
+
+	builder.write("recover.mpq");
+
+	mpq::Archive archive;
+	archive.open("recover.mpq");
+	BOOST_REQUIRE(!archive.containsListfileFile());
+
+	mpq::ListfileRecovery recovery;
+	recovery.addPatterns(mpq::ListfileRecovery::defaultPatterns());
+	recovery.addPattern("Abilities\\*\\*.txt");
+	recovery.addWord("UnitData");
+	recovery.addWord("UnitUI");
+	recovery.addWord("Peasant");
+	recovery.addWord("Footman");
+
+	// two words for every '*' of the two patterns with wildcards
+	BOOST_REQUIRE_GT(recovery.candidates(), 16u);
+
+	for (unsigned threads = 1; threads < 3; ++threads)
+	{
+		recovery.setThreads(threads);
+		const mpq::Listfile::Entries entries = recovery.recover(archive);
+
+		BOOST_REQUIRE_EQUAL(entries.size(), 5);
+		BOOST_REQUIRE_EQUAL(entries[0], "Abilities\\Footman\\Peasant.txt");
+		BOOST_REQUIRE_EQUAL(entries[1], "ReplaceableTextures\\CommandButtons\\BTNFootman.blp");
+		BOOST_REQUIRE_EQUAL(entries[2], "Units\\UnitData.slk");
+		BOOST_REQUIRE_EQUAL(entries[3], "war3map.j");
+		BOOST_REQUIRE_EQUAL(entries[4], "war3map.w3e");
+
+		// the recovered paths can be used to decrypt the files
+		BOOST_FOREACH(mpq::Listfile::Entries::const_reference entry, entries)
+		{
+			mpq::File file = archive.findFile(entry);
+			BOOST_REQUIRE(file.isValid());
+
+			stringstream sstream;
+			file.decompress(sstream);
+			BOOST_REQUIRE(sstream.str() == data);
+		}
+	}
+
+	// hashing is case insensitive but only the first candidate is returned
+	mpq::ListfileRecovery caseRecovery;
+	caseRecovery.addPattern("WAR3MAP.J");
+	caseRecovery.addPattern("war3map.j");
+	BOOST_REQUIRE_EQUAL(caseRecovery.recover(archive).size(), 1);
+	BOOST_REQUIRE_EQUAL(caseRecovery.recover(archive)[0], "WAR3MAP.J");
+}
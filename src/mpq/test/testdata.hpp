@@ -0,0 +1,58 @@
+/***************************************************************************
+ *   Copyright (C) 2014 by Tamino Dauth                                    *
+ *   tamino@cdauth.eu                                                      *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef WC3LIB_MPQ_TEST_TESTDATA_HPP
+#define WC3LIB_MPQ_TEST_TESTDATA_HPP
+
+#include "../../platform.hpp"
+
+namespace wc3lib
+{
+
+namespace mpq
+{
+
+namespace test
+{
+
+/**
+ * Generates compressible data like the text files of an archive.
+ * \p seed shifts the letters that several files get different data.
+ */
+inline string testData(std::size_t size, std::size_t seed = 0)
+{
+	string result;
+	result.reserve(size);
+
+	for (std::size_t i = 0; i < size; ++i)
+	{
+		result.push_back(static_cast<byte>('a' + (i / 7 + i % 5 + seed) % 26));
+	}
+
+	return result;
+}
+
+}
+
+}
+
+}
+
+#endif